@@ -41,9 +41,6 @@ sim::Ship::~Ship()
 
 void sim::Ship::update()
 {
-    if (_timer.elapsed() < 0.01f) 
-        return;
-
     ClearForce();
     ClearSpin();
 
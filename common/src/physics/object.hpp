@@ -68,7 +68,6 @@ class Ship : public MovableObject {
 
     private:
         ControlState _control;
-        Timer _timer;
 
         ObjectID _id;
 
@@ -270,7 +270,8 @@ RigidBody::State::State() :
 ////////// Physics //////////
 
 Physics::Physics(const vol::AABB& worldBounds, const char* collisionGeomFile) :
-    _quadTree(worldBounds), _collisionGeom(collisionGeomFile), _accumulator(0.0f)
+    _quadTree(worldBounds), _collisionGeom(collisionGeomFile), _accumulator(0.0f),
+    _bodiesChanged(false), _runner(0)
 {
 
 }
@@ -298,17 +299,25 @@ struct CollisionVisitor {
 
 void Physics::accumulateAndIntegrate()
 {
-    _accumulator += _timer.elapsed();
+    uint64_t elapsed = _timer.elapsed();
     _timer.reset();
 
+    accumulateAndIntegrate(elapsed);
+}
+
+void Physics::accumulateAndIntegrate(uint64_t elapsed)
+{
+    _accumulator += elapsed;
+
     while (_accumulator >= TIMESTEP_USEC) {
         integrateTimeDelta(TIMESTEP_SEC);
         _accumulator -= TIMESTEP_USEC;
     }
 
     float blend = float(_accumulator) / TIMESTEP_USEC;
-    for (auto body : _registered)
-        body->blendStates(blend);
+    forEachBody([blend](RigidBody& body) {
+        body.blendStates(blend);
+    });
 }
 
 void Physics::registerBody(RigidBody& body)
@@ -317,6 +326,7 @@ void Physics::registerBody(RigidBody& body)
         body._system->deregisterBody(body);
 
     _registered.insert(&body);
+    _bodiesChanged = true;
     body._system = this;
 }
 
@@ -325,9 +335,15 @@ void Physics::deregisterBody(RigidBody& body)
     assert(body._system == this);
 
     _registered.erase(&body);
+    _bodiesChanged = true;
     body._system = 0;
 }
 
+void Physics::setParallelRunner(ParallelRunner* runner)
+{
+    _runner = runner;
+}
+
 const CollisionGeometry& Physics::getCollisionGeom() const
 {
     return _collisionGeom;
@@ -335,13 +351,37 @@ const CollisionGeometry& Physics::getCollisionGeom() const
 
 void Physics::integrateTimeDelta(float dt)
 {
-    for (auto body : _registered) {
-        body->integrate(dt);
+    // Every body is moved before any collisions are tested, so that bodies 
+    // can be handled in parallel without seeing each other half updated.
+    forEachBody([dt](RigidBody& body) {
+        body.integrate(dt);
+    });
 
-        CollisionVisitor visitor(*body);
+    forEachBody([this](RigidBody& body) {
+        CollisionVisitor visitor(body);
         _quadTree.process(visitor, vol::Circle(
-            body->getPosition(), body->getRadius()));
+            body.getPosition(), body.getRadius()));
+    });
+}
+
+void Physics::forEachBody(const std::function<void(RigidBody&)>& func)
+{
+    if (_bodiesChanged) {
+        _bodies.assign(_registered.begin(), _registered.end());
+        _bodiesChanged = false;
     }
+
+    if (_runner == 0) {
+        for (auto body : _bodies)
+            func(*body);
+        return;
+    }
+
+    _runner->parallelFor(0, _bodies.size(), BODY_GRAIN, 
+        [this, &func](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+                func(*_bodies[i]);
+        });
 }
 
 const float Physics::TIMESTEP_SEC = convUSecToSec(float(Physics::TIMESTEP_USEC));
@@ -13,6 +13,8 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <vector>
+#include <functional>
 #include <core/timer.hpp>
 #include <math/vecmath.hpp>
 #include <tr1/unordered_set>
@@ -94,6 +96,17 @@ class RigidBody {
 };
 
 
+class ParallelRunner {
+    public:
+        typedef std::function<void(size_t, size_t)> RangeFunc;
+
+        virtual ~ParallelRunner() {}
+
+        virtual void parallelFor(size_t begin, size_t end, size_t grain, 
+            const RangeFunc& func) = 0;
+};
+
+
 class Physics {
     public:
         Physics(const vol::AABB& worldBounds, 
@@ -101,22 +114,28 @@ class Physics {
         ~Physics();
 
         void accumulateAndIntegrate();
+        void accumulateAndIntegrate(uint64_t elapsed);
 
         void registerBody(RigidBody& body);
         void deregisterBody(RigidBody& body);
+
+        void setParallelRunner(ParallelRunner* runner);
         
         const CollisionGeometry& getCollisionGeom() const;
 
     private:
         static const int TIMESTEP_USEC = 10000;
         static const float TIMESTEP_SEC;
+        static const int BODY_GRAIN = 64;
 
         Physics(const Physics&);
         Physics& operator=(const Physics&);
 
         void integrateTimeDelta(float dt);
+        void forEachBody(const std::function<void(RigidBody&)>& func);
 
         typedef std::tr1::unordered_set<RigidBody*> RigidBodySet;
+        typedef std::vector<RigidBody*> RigidBodyVector;
 
         RigidBodySet _registered;
         QuadTree<RigidBody> _quadTree;
@@ -124,6 +143,10 @@ class Physics {
 
         uint64_t _accumulator;
         Timer _timer;
+
+        RigidBodyVector _bodies;
+        bool _bodiesChanged;
+        ParallelRunner* _runner;
 };
 
 
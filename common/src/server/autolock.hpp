@@ -6,6 +6,7 @@
 /// Copyright (c) 2007 Ben Radford.
 ///
 /// Modifications (most recent first):
+/// - 17/10/26 Pass construction site of lockable containers to their locks.
 /// - 17/05/08 Refactored code into seperate read and write locks.
 
 
@@ -81,7 +82,8 @@ struct Lockable {
     template<typename S>
     class Template {
         public:
-            Template();
+            Template(const char* file = __builtin_FILE(), 
+                int line = __builtin_LINE());
 
             struct LockForRead : public AutoReadLock<S> {
                 LockForRead(const Template& obj);
@@ -190,8 +192,8 @@ inline void AutoWriteLock<T>::resetLock()
 
 template<typename T>
 template<typename S>
-inline Lockable<T>::Template<S>::Template()
-    : _lock(_struct)
+inline Lockable<T>::Template<S>::Template(const char* file, int line)
+    : _lock(_struct, file, line)
 {
     
 }
@@ -0,0 +1,489 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <new>
+#include <core/core.hpp>
+#include "bridge.hpp"
+
+
+/// Fill in the address of a Unix domain socket.
+/// \param path Path of the socket.
+/// \return The address.
+static sockaddr_un socketAddress(const std::string& path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(address.sun_path))
+        throw InputException("SocketLink: socket path is too long");
+
+    memcpy(address.sun_path, path.data(), path.size());
+
+    return address;
+}
+
+
+////////// BridgeLink //////////
+
+BridgeLink::~BridgeLink()
+{
+
+}
+
+
+////////// SocketLink //////////
+
+/// Wait for another process to connect to a socket.
+/// Any file already at the path is replaced, and the socket is removed from
+/// the path once connected so that none is left behind.
+/// \param path Path of the socket.
+/// \return A link to the process that connected.
+std::unique_ptr<SocketLink> SocketLink::listen(const std::string& path)
+{
+    sockaddr_un address = socketAddress(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        throw ErrNoException("socket failed");
+
+    unlink(path.c_str());
+
+    if ((bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) ||
+        (::listen(fd, 1) == -1)) {
+        close(fd);
+        throw ErrNoException("bind failed");
+    }
+
+    int peer = accept4(fd, 0, 0, SOCK_CLOEXEC);
+    int error = errno;
+
+    close(fd);
+    unlink(path.c_str());
+
+    if (peer == -1) {
+        errno = error;
+        throw ErrNoException("accept failed");
+    }
+
+    return std::make_unique<SocketLink>(peer);
+}
+
+/// Connect to a process waiting in listen().
+/// \param path Path of the socket.
+/// \return A link to the process.
+std::unique_ptr<SocketLink> SocketLink::connect(const std::string& path)
+{
+    sockaddr_un address = socketAddress(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        throw ErrNoException("socket failed");
+
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        throw ErrNoException("connect failed");
+    }
+
+    return std::make_unique<SocketLink>(fd);
+}
+
+/// Make two links connected to each other, such as for a process that is
+/// about to fork.
+/// \param first Set to one end.
+/// \param second Set to the other end.
+void SocketLink::pair(std::unique_ptr<SocketLink>& first, std::unique_ptr<SocketLink>& second)
+{
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+        throw ErrNoException("socketpair failed");
+
+    first = std::make_unique<SocketLink>(fds[0]);
+    second = std::make_unique<SocketLink>(fds[1]);
+}
+
+/// Construct a SocketLink.
+/// \param fd A connected socket, which the link closes when destroyed.
+SocketLink::SocketLink(int fd) :
+    _fd(fd), _closed(false)
+{
+    int flags = fcntl(_fd, F_GETFL);
+
+    if ((flags == -1) || (fcntl(_fd, F_SETFL, flags | O_NONBLOCK) == -1)) {
+        close(_fd);
+        throw ErrNoException("fcntl failed");
+    }
+}
+
+SocketLink::~SocketLink()
+{
+    close(_fd);
+}
+
+/// Send as many bytes as the socket has room for.
+/// \param data The bytes.
+/// \param size Number of bytes.
+/// \return Number of bytes sent.
+size_t SocketLink::send(const char* data, size_t size)
+{
+    ssize_t sent = ::send(_fd, data, size, MSG_NOSIGNAL);
+
+    if (sent >= 0)
+        return sent;
+
+    if ((errno == EPIPE) || (errno == ECONNRESET)) {
+        _closed = true;
+    } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        throw ErrNoException("send failed");
+    }
+
+    return 0;
+}
+
+/// Receive as many bytes as are waiting.
+/// \param data Where to put the bytes.
+/// \param size Most bytes to receive.
+/// \return Number of bytes received.
+size_t SocketLink::receive(char* data, size_t size)
+{
+    ssize_t received = recv(_fd, data, size, 0);
+
+    if (received > 0)
+        return received;
+
+    if ((received == 0) || (errno == ECONNRESET)) {
+        _closed = true;
+    } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        throw ErrNoException("recv failed");
+    }
+
+    return 0;
+}
+
+/// \return Whether the other end has closed the socket.
+bool SocketLink::closed() const
+{
+    return _closed;
+}
+
+
+////////// ShmLink //////////
+
+/// Construct a ShmLink.
+/// The side that creates the memory replaces any left by an earlier run and
+/// removes it again when destroyed. The other side must open it after that.
+/// \param name Name of the shared memory, starting with a slash.
+/// \param create Whether to create the memory or open it.
+/// \param capacity Bytes in each ring if creating the memory.
+ShmLink::ShmLink(const std::string& name, bool create, size_t capacity) :
+    _name(name), _created(create), _side(create ? 0 : 1), _size(0), _shared(0)
+{
+    int fd;
+
+    if (create) {
+        shm_unlink(_name.c_str());
+
+        fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        _size = sizeof(Shared) + 2 * capacity;
+
+        if ((fd != -1) && (ftruncate(fd, _size) == -1)) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        fd = shm_open(_name.c_str(), O_RDWR, 0);
+        struct stat info;
+
+        if ((fd != -1) && (fstat(fd, &info) == -1)) {
+            close(fd);
+            fd = -1;
+        }
+
+        _size = (fd != -1 ? info.st_size : 0);
+    }
+
+    if (fd == -1)
+        throw ErrNoException("shm_open failed");
+
+    if (_size < sizeof(Shared)) {
+        close(fd);
+        throw InputException("ShmLink: shared memory is too small");
+    }
+
+    void* memory = mmap(0, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (memory == MAP_FAILED)
+        throw ErrNoException("mmap failed");
+
+    if (create) {
+        _shared = new (memory) Shared();
+        _shared->capacity = capacity;
+    } else {
+        _shared = static_cast<Shared*>(memory);
+
+        if ((_shared->capacity == 0) || (_size != sizeof(Shared) + 2 * _shared->capacity)) {
+            munmap(memory, _size);
+            throw InputException("ShmLink: shared memory does not match its capacity");
+        }
+    }
+}
+
+ShmLink::~ShmLink()
+{
+    _shared->gone[_side].store(true, std::memory_order_release);
+    munmap(_shared, _size);
+
+    if (_created)
+        shm_unlink(_name.c_str());
+}
+
+/// Copy as many bytes as there is room for into the ring this side writes.
+/// \param data The bytes.
+/// \param size Number of bytes.
+/// \return Number of bytes sent.
+size_t ShmLink::send(const char* data, size_t size)
+{
+    Ring& ring = _shared->rings[_side];
+    uint64_t capacity = _shared->capacity;
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    uint64_t tail = ring.tail.load(std::memory_order_acquire);
+
+    size = std::min<uint64_t>(size, capacity - (head - tail));
+
+    size_t offset = head % capacity;
+    size_t first = std::min<size_t>(size, capacity - offset);
+
+    memcpy(this->data(_side) + offset, data, first);
+    memcpy(this->data(_side), data + first, size - first);
+
+    ring.head.store(head + size, std::memory_order_release);
+
+    return size;
+}
+
+/// Copy as many bytes as are waiting out of the ring the other side writes.
+/// \param data Where to put the bytes.
+/// \param size Most bytes to receive.
+/// \return Number of bytes received.
+size_t ShmLink::receive(char* data, size_t size)
+{
+    int side = 1 - _side;
+    Ring& ring = _shared->rings[side];
+    uint64_t capacity = _shared->capacity;
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+
+    size = std::min<uint64_t>(size, head - tail);
+
+    size_t offset = tail % capacity;
+    size_t first = std::min<size_t>(size, capacity - offset);
+
+    memcpy(data, this->data(side) + offset, first);
+    memcpy(data + first, this->data(side), size - first);
+
+    ring.tail.store(tail + size, std::memory_order_release);
+
+    return size;
+}
+
+/// \return Whether the other side has closed the link.
+bool ShmLink::closed() const
+{
+    return _shared->gone[1 - _side].load(std::memory_order_acquire);
+}
+
+/// \param side Side that writes the ring.
+/// \return The bytes of the ring.
+char* ShmLink::data(int side)
+{
+    return reinterpret_cast<char*>(_shared + 1) + side * _shared->capacity;
+}
+
+
+////////// openLink //////////
+
+/// Open a link to another process.
+/// \param address Path of a Unix domain socket, or "shm:" followed by the
+/// name of shared memory.
+/// \param serve Whether this is the side that waits for a socket connection
+/// or creates the shared memory.
+/// \return The link.
+std::unique_ptr<BridgeLink> openLink(const std::string& address, bool serve)
+{
+    if (address.compare(0, 4, "shm:") == 0) {
+        std::string name = address.substr(4);
+
+        if (name.empty() || (name[0] != '/'))
+            name = "/" + name;
+
+        return std::make_unique<ShmLink>(name, serve);
+    }
+
+    if (serve)
+        return SocketLink::listen(address);
+
+    return SocketLink::connect(address);
+}
+
+
+////////// PostBridge //////////
+
+/// Construct a PostBridge.
+/// \param po The post office to carry messages to and from.
+/// \param clock Wakes the bridge each tick to poll the link.
+/// \param link Link to the bridge in the other process.
+/// \param subscription Types of message to send to the other process.
+PostBridge::PostBridge(PostOffice& po, TickClock& clock, std::unique_ptr<BridgeLink> link,
+        int subscription) :
+    MessagableJob(po, subscription), _clock(clock), _link(std::move(link)),
+    _sent(0), _arrived(0), _unsent(0)
+{
+    registerKey(subscription, PostShard::ANY_KEY);
+    _clock.subscribe(this);
+}
+
+PostBridge::~PostBridge()
+{
+    _clock.unsubscribe(this);
+}
+
+Job::RetType PostBridge::main()
+{
+    // Woken each tick to poll the link, or when messages arrive to send.
+    if (_link) {
+        try {
+            flush();
+            receive();
+        } catch (const InputException& e) {
+            fail(e.what());
+        }
+    }
+
+    return BLOCK;
+}
+
+/// \return Number of messages sent to the other process.
+uint64_t PostBridge::sentMessages() const
+{
+    return _sent.load(std::memory_order_relaxed);
+}
+
+/// \return Number of messages received from the other process.
+uint64_t PostBridge::receivedMessages() const
+{
+    return _arrived.load(std::memory_order_relaxed);
+}
+
+/// \return Number of messages dropped because the link had failed or the
+/// other process was too far behind.
+uint64_t PostBridge::unsentMessages() const
+{
+    return _unsent.load(std::memory_order_relaxed);
+}
+
+/// Encode a message as a frame to send.
+/// \param message The message.
+void PostBridge::deliver(std::unique_ptr<msg::Message> message)
+{
+    if (!_link || (_sending.size() >= BACKLOG)) {
+        _unsent.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    size_t start = _sending.size();
+    msg::Writer writer(_sending);
+    writer.write(uint32_t(message->id()));
+    writer.write(uint32_t(0));
+
+    message->encode(writer);
+
+    uint32_t size = _sending.size() - start - HEADER;
+    memcpy(_sending.data() + start + sizeof(uint32_t), &size, sizeof(size));
+
+    _sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+/// Send as much of the waiting frames as the link has room for.
+void PostBridge::flush()
+{
+    size_t flushed = 0;
+
+    while (flushed < _sending.size()) {
+        size_t sent = _link->send(_sending.data() + flushed, _sending.size() - flushed);
+        if (sent == 0)
+            break;
+
+        flushed += sent;
+    }
+
+    _sending.consume(flushed);
+
+    if (_link->closed())
+        fail("link closed by other process");
+}
+
+/// Receive whatever has arrived over the link and send on each whole frame.
+/// A frame that cannot be decoded means the link can no longer be trusted,
+/// so InputException is thrown.
+void PostBridge::receive()
+{
+    if (!_link)
+        return;
+
+    char chunk[CHUNK];
+    size_t size;
+
+    while ((size = _link->receive(chunk, sizeof(chunk))) != 0)
+        _received.append(chunk, size);
+
+    size_t used = 0;
+
+    while (_received.size() - used >= HEADER) {
+        const char* frame = _received.data() + used;
+        msg::Reader header(frame, HEADER, true);
+        msg::MsgId id = msg::MsgId(header.read<uint32_t>());
+        uint32_t length = header.read<uint32_t>();
+
+        if (length > MAX_FRAME)
+            throw InputException("PostBridge: frame is too large");
+
+        if (_received.size() - used - HEADER < length)
+            break;
+
+        msg::Reader reader(frame + HEADER, length);
+        std::unique_ptr<msg::Message> message = msg::decode(id, reader);
+
+        if (!reader.done())
+            throw InputException("PostBridge: frame is too long");
+
+        sendMessage(std::move(message));
+        used += HEADER + length;
+
+        _arrived.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    _received.consume(used);
+
+    if (_link->closed())
+        fail("link closed by other process");
+}
+
+/// Give up on the link and drop messages for the other process from now on.
+/// \param reason Why the link failed.
+void PostBridge::fail(const std::string& reason)
+{
+    Log::log->warn("PostBridge: " + reason + ", messages for the other process are dropped");
+
+    _link.reset();
+    _sending.clear();
+    _received.clear();
+}
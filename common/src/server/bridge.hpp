@@ -0,0 +1,151 @@
+/// \file bridge.hpp
+/// \brief Links the post offices of processes on the same host.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef BRIDGE_HPP
+#define BRIDGE_HPP
+
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include "msgjob.hpp"
+#include "msgcodec.hpp"
+#include "tickclock.hpp"
+
+
+/// A stream of bytes to another process.
+/// Neither sending nor receiving ever waits, so a link can be polled by a job
+/// without holding up the worker running it.
+class BridgeLink {
+    public:
+        virtual ~BridgeLink();
+
+        virtual size_t send(const char* data, size_t size) = 0;
+        virtual size_t receive(char* data, size_t size) = 0;
+        virtual bool closed() const = 0;
+};
+
+
+/// A link over a Unix domain socket.
+class SocketLink : public BridgeLink {
+    public:
+        static std::unique_ptr<SocketLink> listen(const std::string& path);
+        static std::unique_ptr<SocketLink> connect(const std::string& path);
+        static void pair(std::unique_ptr<SocketLink>& first, std::unique_ptr<SocketLink>& second);
+
+        SocketLink(int fd);
+        virtual ~SocketLink();
+
+        virtual size_t send(const char* data, size_t size);
+        virtual size_t receive(char* data, size_t size);
+        virtual bool closed() const;
+
+    private:
+        SocketLink(const SocketLink&);             ///< This method is undefined.
+        SocketLink& operator=(const SocketLink&);  ///< This method is undefined.
+
+        int _fd;       ///< The connected socket.
+        bool _closed;  ///< Whether the other end has gone.
+};
+
+
+/// A link over a pair of rings in shared memory.
+/// Each ring has a single writer and a single reader, so bytes pass between
+/// the processes with no system calls at all. The process that creates the
+/// memory writes to the first ring and the one that opens it to the second.
+/// Unlike a socket, a process that dies without closing its link is not
+/// noticed by the other side.
+class ShmLink : public BridgeLink {
+    public:
+        static const size_t CAPACITY = 1 << 20;  ///< Default bytes per ring.
+
+        ShmLink(const std::string& name, bool create, size_t capacity = CAPACITY);
+        virtual ~ShmLink();
+
+        virtual size_t send(const char* data, size_t size);
+        virtual size_t receive(char* data, size_t size);
+        virtual bool closed() const;
+
+    private:
+        struct Ring {
+            alignas(64) std::atomic<uint64_t> head;  ///< Bytes ever written.
+            alignas(64) std::atomic<uint64_t> tail;  ///< Bytes ever read.
+        };
+
+        struct Shared {
+            uint64_t capacity;          ///< Bytes in each ring.
+            std::atomic<bool> gone[2];  ///< Whether each side has closed.
+            Ring rings[2];              ///< Written by each side.
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "rings need lock free atomics");
+
+        ShmLink(const ShmLink&);             ///< This method is undefined.
+        ShmLink& operator=(const ShmLink&);  ///< This method is undefined.
+
+        char* data(int side);
+
+        std::string _name;  ///< Name of the shared memory.
+        bool _created;      ///< Whether this side created it.
+        int _side;          ///< Ring this side writes to.
+        size_t _size;       ///< Bytes mapped.
+        Shared* _shared;    ///< The mapped memory.
+};
+
+
+std::unique_ptr<BridgeLink> openLink(const std::string& address, bool serve);
+
+
+/// Carries messages between a PostOffice and one in another process.
+/// Messages the bridge subscribes to are encoded and sent over its link, and
+/// those that arrive over the link are decoded and sent to its post office as
+/// if a local job had sent them. Keyed messages are taken whatever their key,
+/// since it is the far post office that knows which keys its jobs hold. The
+/// bridges at each end must not subscribe to types the other sends, or those
+/// messages would come straight back. Each message is sent as a frame of its
+/// id and size followed by its encoded fields, the same layout as a record of
+/// a batch. The link is polled each tick, so a message waits up to a tick to
+/// be picked up at the far end. If the other process goes away or falls too
+/// far behind, messages for it are dropped but the rest of this process
+/// carries on.
+class PostBridge : public MessagableJob {
+    public:
+        PostBridge(PostOffice& po, TickClock& clock, std::unique_ptr<BridgeLink> link,
+            int subscription);
+        virtual ~PostBridge();
+
+        virtual RetType main();
+
+        uint64_t sentMessages() const;
+        uint64_t receivedMessages() const;
+        uint64_t unsentMessages() const;
+
+    private:
+        static const size_t HEADER = 2 * sizeof(uint32_t);  ///< Id and size of a frame.
+        static const size_t CHUNK = 64 * 1024;              ///< Bytes received at once.
+        static const size_t BACKLOG = 16 << 20;             ///< Most bytes waiting to be sent.
+        static const uint32_t MAX_FRAME = 64 << 20;         ///< Largest message accepted.
+
+        virtual void deliver(std::unique_ptr<msg::Message> message);
+
+        void flush();
+        void receive();
+        void fail(const std::string& reason);
+
+        TickClock& _clock;
+        std::unique_ptr<BridgeLink> _link;  ///< Null once the link has failed.
+        msg::Buffer _sending;               ///< Frames not yet sent.
+        msg::Buffer _received;              ///< Frames not yet decoded.
+        std::atomic<uint64_t> _sent;        ///< Messages encoded for sending.
+        std::atomic<uint64_t> _arrived;     ///< Messages decoded from the link.
+        std::atomic<uint64_t> _unsent;      ///< Messages dropped unsent.
+};
+
+
+#endif  // BRIDGE_HPP
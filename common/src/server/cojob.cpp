@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <core/core.hpp>
+#include "cojob.hpp"
+
+
+////////// CoroutineJob //////////
+
+/// Construct a CoroutineJob.
+/// \param po Post office to send and receive messages through.
+/// \param subscription Types of message to receive.
+/// \param clock Clock for nextTick() or null if ticks are not needed.
+CoroutineJob::CoroutineJob(PostOffice& po, int subscription, TickClock* clock)
+    : MessagableJob(po, subscription), _clock(clock), _subscribed(false)
+{
+
+}
+
+/// Destroy the job and any coroutines that are still suspended.
+CoroutineJob::~CoroutineJob()
+{
+    if (_subscribed)
+        _clock->unsubscribe(this);
+
+    _waiters.clear();
+
+    for (auto handle : _tasks)
+        handle.destroy();
+}
+
+/// Resume coroutines whose timeouts have expired or whose tick has started.
+/// Resumed coroutines may wait again, so the search restarts after each one.
+/// \return Always Job::BLOCK since coroutines are resumed by wakes.
+Job::RetType CoroutineJob::main()
+{
+    uint64_t time = JobPool::now();
+    TickClock::Tick tick = (_clock != 0 ? _clock->tick() : 0);
+    bool resumed = true;
+
+    while (resumed) {
+        resumed = false;
+
+        for (auto waiter : _waiters) {
+            if (((waiter->wakeTime != 0) && (waiter->wakeTime <= time)) ||
+                (waiter->tick && (tick > waiter->lastTick))) {
+                resume(*waiter);
+                resumed = true;
+                break;
+            }
+        }
+    }
+
+    reap();
+    schedule();
+
+    return BLOCK;
+}
+
+/// Start running a coroutine.
+/// The coroutine runs until it first awaits something, then this returns.
+/// \param task The coroutine to run.
+void CoroutineJob::spawn(Task task)
+{
+    Task::Handle handle = task._handle;
+    task._handle = 0;
+
+    _tasks.push_back(handle);
+    handle.resume();
+}
+
+/// Wait for a delay.
+/// \param usec Delay in microseconds.
+/// \return Awaitable that resumes after the delay.
+CoroutineJob::Sleep CoroutineJob::sleepFor(uint64_t usec)
+{
+    return Sleep(*this, usec);
+}
+
+/// Wait for the start of the next tick.
+/// The job must have been given a TickClock.
+/// \return Awaitable giving the number of the tick that started.
+CoroutineJob::NextTick CoroutineJob::nextTick()
+{
+    if (_clock == 0)
+        throw InputException("CoroutineJob: nextTick needs a clock");
+
+    return NextTick(*this, *_clock);
+}
+
+/// Give a message to the first coroutine waiting for it.
+/// While a coroutine is waiting for a message a batch is split into its
+/// records, which are offered in turn as if they had been sent alone.
+/// \param message The message.
+void CoroutineJob::deliver(std::unique_ptr<msg::Message> message)
+{
+    if ((message->id() == msg::ID_BATCH) && receiving()) {
+        std::vector<std::unique_ptr<msg::Message> > records;
+        static_cast<const msg::Batch&>(*message).split(records);
+
+        for (auto& record : records)
+            offer(std::move(record));
+
+        return;
+    }
+
+    offer(std::move(message));
+}
+
+/// Give a message to the first coroutine waiting for it.
+/// If no coroutine wants the message it is dispatched to the handle methods.
+/// \param message The message.
+void CoroutineJob::offer(std::unique_ptr<msg::Message> message)
+{
+    for (auto waiter : _waiters) {
+        if (waiter->accepts && waiter->accepts(*message)) {
+            waiter->message = std::move(message);
+            resume(*waiter);
+            reap();
+            return;
+        }
+    }
+
+    MessagableJob::deliver(std::move(message));
+    reap();
+}
+
+/// \return Whether any coroutine is waiting for a message.
+bool CoroutineJob::receiving() const
+{
+    for (auto waiter : _waiters) {
+        if (waiter->accepts)
+            return true;
+    }
+
+    return false;
+}
+
+/// Record that a coroutine is suspended.
+/// \param waiter What the coroutine is waiting for.
+/// \param handle The coroutine.
+void CoroutineJob::wait(Waiter& waiter, std::coroutine_handle<> handle)
+{
+    waiter.handle = handle;
+    _waiters.push_back(&waiter);
+}
+
+/// Stop a coroutine waiting and resume it.
+/// The waiter belongs to the coroutine, so it must not be used afterwards.
+/// \param waiter What the coroutine was waiting for.
+void CoroutineJob::resume(Waiter& waiter)
+{
+    _waiters.erase(std::find(_waiters.begin(), _waiters.end(), &waiter));
+    waiter.handle.resume();
+}
+
+/// Destroy coroutines that have returned.
+/// If one of them threw then the exception is rethrown, ending the job.
+void CoroutineJob::reap()
+{
+    for (HandleVector::iterator iter = _tasks.begin(); iter != _tasks.end(); ) {
+        if (!iter->done()) {
+            ++iter;
+            continue;
+        }
+
+        std::exception_ptr error = iter->promise().error;
+        iter->destroy();
+        iter = _tasks.erase(iter);
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+}
+
+/// Arrange for the job to be woken when a coroutine is next due.
+/// The job only subscribes to the clock while a coroutine waits for a tick.
+/// A tick that started before the subscription would be missed, so the job
+/// wakes itself in that case.
+void CoroutineJob::schedule()
+{
+    uint64_t next = 0;
+    bool ticks = false;
+    bool missed = false;
+
+    for (auto waiter : _waiters) {
+        if ((waiter->wakeTime != 0) && ((next == 0) || (waiter->wakeTime < next)))
+            next = waiter->wakeTime;
+
+        if (waiter->tick) {
+            ticks = true;
+            missed = missed || (_clock->tick() > waiter->lastTick);
+        }
+    }
+
+    if (next != 0) {
+        uint64_t time = JobPool::now();
+        wakeAfter(next > time ? next - time : 0);
+    }
+
+    if (ticks != _subscribed) {
+        if (ticks) {
+            _clock->subscribe(this);
+        } else {
+            _clock->unsubscribe(this);
+        }
+
+        _subscribed = ticks;
+    }
+
+    if (missed)
+        wake();
+}
+
+
+////////// CoroutineJob::Task //////////
+
+/// Take over a coroutine from another Task.
+/// \param other The task to take the coroutine from.
+CoroutineJob::Task::Task(Task&& other)
+    : _handle(other._handle)
+{
+    other._handle = 0;
+}
+
+/// Wrap a coroutine.
+/// \param handle The coroutine.
+CoroutineJob::Task::Task(Handle handle)
+    : _handle(handle)
+{
+
+}
+
+/// Destroy the coroutine if it was never spawned.
+CoroutineJob::Task::~Task()
+{
+    if (_handle)
+        _handle.destroy();
+}
+
+
+////////// CoroutineJob::Task::promise_type //////////
+
+/// \return Task wrapping the new coroutine.
+CoroutineJob::Task CoroutineJob::Task::promise_type::get_return_object()
+{
+    return Task(Handle::from_promise(*this));
+}
+
+/// Coroutines do not run until spawned.
+/// \return Awaitable that always suspends.
+std::suspend_always CoroutineJob::Task::promise_type::initial_suspend() noexcept
+{
+    return std::suspend_always();
+}
+
+/// Coroutines stay suspended when they return so the job can destroy them.
+/// \return Awaitable that always suspends.
+std::suspend_always CoroutineJob::Task::promise_type::final_suspend() noexcept
+{
+    return std::suspend_always();
+}
+
+/// Called when the coroutine returns.
+void CoroutineJob::Task::promise_type::return_void()
+{
+
+}
+
+/// Keep an exception thrown by the coroutine for the job to rethrow.
+void CoroutineJob::Task::promise_type::unhandled_exception()
+{
+    error = std::current_exception();
+}
+
+
+////////// CoroutineJob::Waiter //////////
+
+/// Construct a Waiter that waits for nothing.
+CoroutineJob::Waiter::Waiter()
+    : wakeTime(0), tick(false), lastTick(0)
+{
+
+}
+
+
+////////// CoroutineJob::Sleep //////////
+
+/// Construct an awaitable for a delay.
+/// \param job Job running the coroutine.
+/// \param usec Delay in microseconds.
+CoroutineJob::Sleep::Sleep(CoroutineJob& job, uint64_t usec)
+    : _job(job)
+{
+    _waiter.wakeTime = JobPool::now() + std::max<uint64_t>(usec, 1);
+}
+
+/// \return Always false since the delay has only just begun.
+bool CoroutineJob::Sleep::await_ready() const
+{
+    return false;
+}
+
+/// Start waiting for the delay.
+/// \param handle The coroutine being suspended.
+void CoroutineJob::Sleep::await_suspend(std::coroutine_handle<> handle)
+{
+    _job.wait(_waiter, handle);
+}
+
+/// Called when the delay has expired.
+void CoroutineJob::Sleep::await_resume()
+{
+
+}
+
+
+////////// CoroutineJob::NextTick //////////
+
+/// Construct an awaitable for the next tick.
+/// \param job Job running the coroutine.
+/// \param clock Clock that drives ticks.
+CoroutineJob::NextTick::NextTick(CoroutineJob& job, TickClock& clock)
+    : _job(job), _clock(clock)
+{
+    _waiter.tick = true;
+    _waiter.lastTick = clock.tick();
+}
+
+/// \return Whether a tick has already started since this was constructed.
+bool CoroutineJob::NextTick::await_ready() const
+{
+    return (_clock.tick() > _waiter.lastTick);
+}
+
+/// Start waiting for the tick.
+/// \param handle The coroutine being suspended.
+void CoroutineJob::NextTick::await_suspend(std::coroutine_handle<> handle)
+{
+    _job.wait(_waiter, handle);
+}
+
+/// \return Number of the tick that started.
+TickClock::Tick CoroutineJob::NextTick::await_resume()
+{
+    return _clock.tick();
+}
@@ -0,0 +1,243 @@
+/// \file cojob.hpp
+/// \brief Jobs written as coroutines that await messages and timers.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef COJOB_HPP
+#define COJOB_HPP
+
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include "msgjob.hpp"
+#include "tickclock.hpp"
+
+
+/// Messagable job whose behaviour is written as coroutines.
+/// A member function returning Task is a coroutine. It is started with
+/// spawn() and runs until it awaits something. It may co_await receive() for
+/// the next message of a given type, nextTick() for the start of the next
+/// simulation tick or sleepFor() for a delay. While every coroutine is
+/// suspended the job is blocked, so it uses no worker time until a message
+/// arrives, a tick starts or a timeout expires. A multi-step flow can
+/// therefore be written as straight line code rather than as a state machine
+/// polled from main().
+///
+/// Each message is offered to the waiting coroutines in the order they began
+/// waiting and goes to the first that wants it. Messages no coroutine wants
+/// are passed to the usual handle methods, so both styles can be mixed. While
+/// a coroutine is waiting for a message, batches are split so that each of
+/// their records is offered like a message sent alone. Only messages
+/// matching the subscription of the job are received. A coroutine
+/// that throws ends the whole job, just as a job that throws from run() does.
+/// Coroutines must only be spawned by the job itself and derived classes must
+/// not override main(). Coroutines still suspended when the job is destroyed
+/// are destroyed with it, after the derived class has been destroyed.
+class CoroutineJob : public MessagableJob {
+    public:
+        /// Coroutine that can be run by a %CoroutineJob.
+        class Task {
+            public:
+                friend class CoroutineJob;
+
+                struct promise_type {
+                    Task get_return_object();
+                    std::suspend_always initial_suspend() noexcept;
+                    std::suspend_always final_suspend() noexcept;
+                    void return_void();
+                    void unhandled_exception();
+
+                    std::exception_ptr error;  ///< Exception thrown by coroutine.
+                };
+
+                typedef std::coroutine_handle<promise_type> Handle;
+
+                Task(Task&& other);
+                ~Task();
+
+            private:
+                Task(Handle handle);
+                Task(const Task&);             ///< This method is undefined.
+                Task& operator=(const Task&);  ///< This method is undefined.
+
+                Handle _handle;  ///< Coroutine until it is spawned.
+        };
+
+        CoroutineJob(PostOffice& po, int subscription, TickClock* clock = 0);
+        virtual ~CoroutineJob();
+
+        virtual RetType main();
+
+    protected:
+        /// What a suspended coroutine is waiting for.
+        struct Waiter {
+            Waiter();
+
+            std::coroutine_handle<> handle;  ///< The suspended coroutine.
+            std::function<bool(const msg::Message&)> accepts;  ///< Wanted messages.
+            std::unique_ptr<msg::Message> message;  ///< Message received.
+            uint64_t wakeTime;          ///< Time to stop waiting or zero.
+            bool tick;                  ///< Whether waiting for a tick.
+            TickClock::Tick lastTick;   ///< Tick when waiting began.
+        };
+
+        template<typename T> class Receive;
+        class Sleep;
+        class NextTick;
+
+        void spawn(Task task);
+
+        template<typename T>
+        Receive<T> receive(uint64_t timeout = 0);
+        template<typename T>
+        Receive<T> receive(std::function<bool(const T&)> filter, uint64_t timeout = 0);
+        Sleep sleepFor(uint64_t usec);
+        NextTick nextTick();
+
+        virtual void deliver(std::unique_ptr<msg::Message> message);
+
+    private:
+        typedef std::vector<Waiter*> WaiterVector;
+        typedef std::vector<Task::Handle> HandleVector;
+
+        void offer(std::unique_ptr<msg::Message> message);
+        bool receiving() const;
+        void wait(Waiter& waiter, std::coroutine_handle<> handle);
+        void resume(Waiter& waiter);
+        void reap();
+        void schedule();
+
+        TickClock* _clock;      ///< Clock for ticks or null if there is none.
+        bool _subscribed;       ///< Whether the job is woken every tick.
+        WaiterVector _waiters;  ///< Suspended coroutines in the order they waited.
+        HandleVector _tasks;    ///< Coroutines that have been spawned.
+};
+
+
+/// Awaitable for the next message of type \em T.
+/// Awaiting it gives the message, or null if the timeout expired first. The
+/// message may be shared with other jobs, so it cannot be modified.
+template<typename T>
+class CoroutineJob::Receive {
+    public:
+        Receive(CoroutineJob& job, std::function<bool(const T&)> filter, uint64_t timeout);
+
+        bool await_ready() const;
+        void await_suspend(std::coroutine_handle<> handle);
+        std::unique_ptr<const T> await_resume();
+
+    private:
+        CoroutineJob& _job;  ///< Job running the coroutine.
+        Waiter _waiter;      ///< Registered with the job while suspended.
+};
+
+
+/// Awaitable for a delay.
+class CoroutineJob::Sleep {
+    public:
+        Sleep(CoroutineJob& job, uint64_t usec);
+
+        bool await_ready() const;
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume();
+
+    private:
+        CoroutineJob& _job;  ///< Job running the coroutine.
+        Waiter _waiter;      ///< Registered with the job while suspended.
+};
+
+
+/// Awaitable for the start of the next tick.
+/// Awaiting it gives the number of the tick that started. If the coroutine
+/// was slow to resume this may be more than one tick later.
+class CoroutineJob::NextTick {
+    public:
+        NextTick(CoroutineJob& job, TickClock& clock);
+
+        bool await_ready() const;
+        void await_suspend(std::coroutine_handle<> handle);
+        TickClock::Tick await_resume();
+
+    private:
+        CoroutineJob& _job;  ///< Job running the coroutine.
+        TickClock& _clock;   ///< Clock that drives ticks.
+        Waiter _waiter;      ///< Registered with the job while suspended.
+};
+
+
+////////// CoroutineJob //////////
+
+/// Wait for the next message of type \em T.
+/// \param timeout Microseconds to wait or zero to wait forever.
+/// \return Awaitable giving the message or null on timeout.
+template<typename T>
+CoroutineJob::Receive<T> CoroutineJob::receive(uint64_t timeout)
+{
+    return Receive<T>(*this, std::function<bool(const T&)>(), timeout);
+}
+
+/// Wait for the next message of type \em T accepted by a filter.
+/// Messages the filter rejects are offered to other coroutines instead.
+/// \param filter Function that returns whether a message is wanted.
+/// \param timeout Microseconds to wait or zero to wait forever.
+/// \return Awaitable giving the message or null on timeout.
+template<typename T>
+CoroutineJob::Receive<T> CoroutineJob::receive(std::function<bool(const T&)> filter,
+    uint64_t timeout)
+{
+    return Receive<T>(*this, filter, timeout);
+}
+
+
+////////// CoroutineJob::Receive //////////
+
+/// Construct an awaitable for a message.
+/// \param job Job running the coroutine.
+/// \param filter Function that returns whether a message is wanted or null.
+/// \param timeout Microseconds to wait or zero to wait forever.
+template<typename T>
+CoroutineJob::Receive<T>::Receive(CoroutineJob& job, std::function<bool(const T&)> filter,
+    uint64_t timeout)
+    : _job(job)
+{
+    _waiter.accepts = [filter](const msg::Message& message) {
+        const T* typed = dynamic_cast<const T*>(&message);
+        return ((typed != 0) && (!filter || filter(*typed)));
+    };
+
+    if (timeout != 0)
+        _waiter.wakeTime = JobPool::now() + timeout;
+}
+
+/// \return Always false since messages are only received by waiting.
+template<typename T>
+bool CoroutineJob::Receive<T>::await_ready() const
+{
+    return false;
+}
+
+/// Start waiting for the message.
+/// \param handle The coroutine being suspended.
+template<typename T>
+void CoroutineJob::Receive<T>::await_suspend(std::coroutine_handle<> handle)
+{
+    _job.wait(_waiter, handle);
+}
+
+/// \return The message or null if the timeout expired.
+template<typename T>
+std::unique_ptr<const T> CoroutineJob::Receive<T>::await_resume()
+{
+    return std::unique_ptr<const T>(static_cast<const T*>(_waiter.message.release()));
+}
+
+
+#endif  // COJOB_HPP
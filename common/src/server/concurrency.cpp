@@ -1,12 +1,91 @@
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sstream>
+#include <exception>
+#include <algorithm>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <core/core.hpp>
+#include "demangle.hpp"
+#include "topology.hpp"
 #include "concurrency.hpp"
 
 
+static const uint64_t NEVER = UINT64_MAX;  ///< Time used when no timer is set.
+
+static thread_local JobPool* currentPool = 0;  ///< Pool of the running worker.
+static thread_local int currentSlot = -1;      ///< Slot of the running worker.
+
+
+/// Sleep until the value of a futex word changes.
+/// \param word The futex word.
+/// \param expected Value the word is expected to have.
+/// \param timeout Maximum time to sleep in microseconds or zero for no limit.
+static void futexWait(std::atomic<int>& word, int expected, uint64_t timeout)
+{
+    timespec ts = {time_t(timeout / 1000000), long(timeout % 1000000) * 1000};
+    
+    syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT_PRIVATE, 
+        expected, (timeout != 0 ? &ts : 0), 0, 0);
+}
+
+/// Wake threads sleeping on a futex word.
+/// \param word The futex word.
+/// \param count Maximum number of threads to wake.
+static void futexWake(std::atomic<int>& word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE_PRIVATE, 
+        count, 0, 0, 0);
+}
+
+
+/// State shared by a job running a parallel loop and the jobs helping it.
+/// The range is split into chunks of at most \em grain iterations which are
+/// claimed in order by whichever thread gets to them first. The function is
+/// held by reference, which is safe because it is only called for claimed
+/// chunks and the owning job does not return until every chunk is complete.
+struct ForkState {
+    ForkState(size_t begin, size_t end, size_t grain, const Job::RangeFunc& func);
+
+    bool runChunk();
+    void wait();
+
+    const size_t begin;          ///< First iteration.
+    const size_t end;            ///< One past the last iteration.
+    const size_t grain;          ///< Iterations per chunk.
+    const size_t chunks;         ///< Number of chunks.
+    const Job::RangeFunc& func;  ///< Function run for each chunk.
+
+    std::atomic<size_t> next;       ///< Next chunk to claim.
+    std::atomic<size_t> completed;  ///< Number of chunks completed.
+    std::atomic<bool> failed;       ///< Whether a chunk threw.
+    std::exception_ptr error;       ///< First exception thrown by a chunk.
+};
+
+/// Job that helps run the chunks of a parallel loop.
+class ForkJob : public Job {
+    public:
+        ForkJob(std::shared_ptr<ForkState> fork, Priority priority);
+
+        virtual RetType run();
+
+    private:
+        virtual Priority priority();
+
+        std::shared_ptr<ForkState> _fork;  ///< Loop being helped with.
+        Priority _priority;                ///< Class of the job being helped.
+};
+
+
 ////////// Job //////////
 
 /// Construct a Job.
 Job::Job()
-    : _runLock(*this), _nodeLock(*this), _next(0), _prev(0)
+    : _state(QUEUED), _pool(0), _wakeTime(0), _timer(0), _readyTime(0), _stats(0)
 {
     
 }
@@ -17,11 +96,96 @@ Job::~Job()
     
 }
 
+/// Make a blocked job runnable again.
+/// This may be called from any thread at any time. If the job is blocked it is
+/// put back in its JobPool to be run. If it is running then it will be run 
+/// again rather than block when it returns. Otherwise nothing happens.
+void Job::wake()
+{
+    int state = _state.load();
+    
+    while (true) {
+        if (state == BLOCKED) {
+            if (_state.compare_exchange_weak(state, QUEUED)) {
+                _pool->requeue(this);
+                return;
+            }
+        } else if (state == RUNNING) {
+            if (_state.compare_exchange_weak(state, WOKEN))
+                return;
+        } else {
+            return;
+        }
+    }
+}
+
+/// Arrange for the job to be woken after a delay.
+/// This should be called from run() before returning BLOCK. The job will be
+/// woken when the delay expires unless something else wakes it first.
+/// \param usec Delay in microseconds.
+void Job::wakeAfter(uint64_t usec)
+{
+    _wakeTime = JobPool::now() + usec;
+}
+
+/// Used to find out which pool the job belongs to.
+/// \return The pool or null if the job has not been added to one yet.
+JobPool* Job::pool()
+{
+    return _pool;
+}
+
+/// Run the iterations of a loop on several workers at once.
+/// The range is split into chunks and helper jobs are added to the pool to 
+/// run them. The calling job runs chunks too rather than waiting, so the loop
+/// completes even if no other worker is free to help, and the call cannot 
+/// deadlock. Once every chunk has been claimed the caller waits for those 
+/// still running on other workers. Helpers that start after that find no work
+/// and finish straight away. If any chunk throws then the first exception is
+/// rethrown here once all chunks are done. When there is nobody to help the
+/// chunks are simply run in turn.
+/// \param begin First iteration.
+/// \param end One past the last iteration.
+/// \param grain Maximum number of iterations to run as one chunk.
+/// \param func Function to call with the bounds of each chunk.
+void Job::parallelFor(size_t begin, size_t end, size_t grain, const RangeFunc& func)
+{
+    if (begin >= end)
+        return;
+    
+    grain = std::max<size_t>(grain, 1);
+    size_t chunks = (end - begin + grain - 1) / grain;
+    int workers = (_pool != 0) ? _pool->workers() : 0;
+    size_t helpers = 0;
+
+    // With one worker or none (all parked) the chunks are run here in turn.
+    if (workers > 1)
+        helpers = std::min<size_t>(chunks, workers) - 1;
+    
+    if ((chunks == 1) || (helpers == 0)) {
+        for (size_t first = begin; first < end; first += grain)
+            func(first, std::min(first + grain, end));
+        return;
+    }
+    
+    std::shared_ptr<ForkState> fork = 
+        std::make_shared<ForkState>(begin, end, grain, func);
+    
+    for (size_t i = 0; i < helpers; i++)
+        _pool->add(Job::Ptr(new ForkJob(fork, priority())));
+    
+    while (fork->runChunk());
+    fork->wait();
+    
+    if (fork->failed)
+        std::rethrow_exception(fork->error);
+}
+
 /// Exception safe wrapper for run().
 /// Allowing exceptions to propagate further up the call chain than this would
-/// leave the locks in the JobPool in an inconsistent state and cause the entire
-/// system to fail. Instead we catch exceptions here when they occur and simply
-/// terminate the %Job.
+/// leave the JobPool in an inconsistent state and cause the entire system to 
+/// fail. Instead we catch exceptions here when they occur and simply terminate
+/// the %Job.
 Job::RetType Job::safeRun()
 {
     try {
@@ -42,13 +206,123 @@ bool Job::readOnly()
     return false;
 }
 
+/// Indicates which scheduling class the job belongs to.
+/// Jobs are interactive unless they override this method. It is called each 
+/// time the job is queued so it should be cheap.
+/// \return Scheduling class of the job.
+Job::Priority Job::priority()
+{
+    return INTERACTIVE;
+}
 
-////////// EmptyJob //////////
+/// Indicates how soon the job should be run once it becomes runnable.
+/// This is only used for realtime jobs. A job still waiting when its deadline
+/// passes is run ahead of everything else and counted as a deadline miss.
+/// \return Deadline in microseconds or zero for no deadline.
+uint64_t Job::deadline()
+{
+    return 0;
+}
+
+/// Indicates which NUMA node the job would like to be run on.
+/// A job that works on memory placed on one node should override this so that
+/// it is run by workers on that node. It is called each time the job is 
+/// queued so it should be cheap.
+/// \return Node number or -1 to run anywhere.
+int Job::node()
+{
+    return -1;
+}
+
+
+////////// JobQueue //////////
+
+/// Construct an empty JobQueue.
+JobQueue::JobQueue()
+    : _size(0)
+{
+    
+}
 
-/// Immediately returns Job::YIELD.
-Job::RetType EmptyJob::run()
+/// Add a job to the end of the queue.
+/// \param job The job to add.
+void JobQueue::push(Job* job)
 {
-    return YIELD;
+    Deque::LockForWrite deque(_deque);
+    
+    deque->push_back(job);
+    _size.store(deque->size(), std::memory_order_relaxed);
+}
+
+/// Take the job from the front of the queue.
+/// \return The job or zero if the queue is empty.
+Job* JobQueue::pop()
+{
+    if (size() == 0)
+        return 0;
+    
+    Deque::LockForWrite deque(_deque);
+    
+    if (deque->empty())
+        return 0;
+    
+    Job* job = deque->front();
+    deque->pop_front();
+    _size.store(deque->size(), std::memory_order_relaxed);
+    
+    return job;
+}
+
+/// Take the job from the front of the queue if it has missed its deadline.
+/// \param time The current time.
+/// \return The job or zero if the front job is not overdue.
+Job* JobQueue::popOverdue(uint64_t time)
+{
+    if (size() == 0)
+        return 0;
+    
+    Deque::LockForWrite deque(_deque);
+    
+    if (deque->empty())
+        return 0;
+    
+    Job* job = deque->front();
+    uint64_t deadline = job->deadline();
+    
+    if ((deadline == 0) || (time < job->_readyTime + deadline))
+        return 0;
+    
+    deque->pop_front();
+    _size.store(deque->size(), std::memory_order_relaxed);
+    
+    return job;
+}
+
+/// Take the job from the end of the queue.
+/// This is used by workers stealing from the queue of another worker.
+/// \return The job or zero if the queue is empty.
+Job* JobQueue::steal()
+{
+    if (size() == 0)
+        return 0;
+    
+    Deque::LockForWrite deque(_deque);
+    
+    if (deque->empty())
+        return 0;
+    
+    Job* job = deque->back();
+    deque->pop_back();
+    _size.store(deque->size(), std::memory_order_relaxed);
+    
+    return job;
+}
+
+/// Used to find out the approximate size of the queue.
+/// \return Number of jobs in the queue.
+int JobQueue::size() const
+{
+    return _size.load(std::memory_order_relaxed);
 }
 
 
@@ -56,10 +330,12 @@ Job::RetType EmptyJob::run()
 
 /// Construct a JobPool.
 JobPool::JobPool()
-    : _head(&_empty1), _tail(&_empty2), _count(0)
+    : _slotCount(0), _allLock(_all), _readOnlyLock(_readOnly), 
+      _timers(now(), TIMER_RESOLUTION), _timersLock(_timers), 
+      _nextTimer(NEVER), _epoch(0), _sleeping(0), _workerLimit(MAX_WORKERS), 
+      _limitEpoch(0), _jobStatsLock(_jobStats), _count(0), _deadlineMisses(0)
 {
-    _empty1._next = &_empty2;
-    _empty2._prev = &_empty1;
+    
 }
 
 /// Destroy %JobPool and all its jobs.
@@ -68,80 +344,145 @@ JobPool::JobPool()
 /// \pre There are no Worker objects using this %JobPool.
 JobPool::~JobPool()
 {
-    while (_tail != &_empty2) {
-        _tail = _tail->_prev;
-        Job::Ptr tempPtr(_tail->_next);
-    }
+    for (auto job : _all)
+        Job::Ptr tempPtr(job);
+    
+    for (auto& pair : _jobStats)
+        delete pair.second;
 }
 
 /// Add a job to the pool.
 /// \param job The job to add.
 void JobPool::add(Job::Ptr job)
 {
-    // Get rw lock on the tail node.
-    while (_tail->_nodeLock.rwTryLock() == 0);
-    
-    // Tag job onto end of list.
-    _tail->_next = job.release();
-    _tail->_next->_prev = _tail;
-    _tail = _tail->_next;
     _count++;
+    job->_pool = this;
+    job->_stats = statsFor(*job);
+    AutoWriteLock<JobSet>(_allLock)->insert(job.get());
+    
+    if (job->readOnly()) {
+        AutoWriteLock<JobVector>(_readOnlyLock)->push_back(job.release());
+        return;
+    }
     
-    // Unlock old tail node.
-    _tail->_prev->_nodeLock.rwUnlock();
+    enqueueFrom(-1, job.release());
+    notify();
 }
 
-/// Finds a Job that needs running and runs it.
-/// This method searches the pool for a %Job that needs to be done. It does this
-/// by attempting to acquire the run lock on successive jobs. When it manages to
-/// get this lock it can safely run that job. Depending on the return value of
-/// the Job::run() method it will either release the run lock and return or
-/// remove the job from the pool then return.
-/// \param last The last job run by the calling thread.
-/// \return The job that was run this time.
-Job* JobPool::runNextJob(Job* last)
-{
-    Job* curr = 0;
-    
-    if (last == 0) {
-        last = _head;
-        last->_nodeLock.roWaitLock();
-    }
-    
-    do {
-        curr = (last->_next != 0 ? last->_next : _head);
-        curr->_nodeLock.roWaitLock();
-        last->_nodeLock.roUnlock();
-        last = curr;
-    } while (!acquireRunLock(curr));
-    
-    if (curr->safeRun() == Job::YIELD) {
-        releaseRunLock(curr);
-    } else {
-        curr->_nodeLock.roUnlock();
-        removeJobFromList(curr);
-        releaseRunLock(curr);
-        Job::Ptr tempPtr(curr);
-        curr = _head;
-        _count--;
+/// Run a callback after a delay.
+/// The callback is run by a worker with the timers locked. It must be short
+/// and must not schedule or cancel timers. Anything it uses must outlive it,
+/// or be protected by cancelling the callback before it is destroyed.
+/// \param usec Delay in microseconds.
+/// \param callback Function to call.
+/// \return Id that can be used to cancel the callback.
+JobPool::TimerId JobPool::schedule(uint64_t usec, TimerCallback callback)
+{
+    uint64_t time = now() + usec;
+    TimerId id = AutoWriteLock<TimerWheel>(_timersLock)->schedule(time, 
+        std::move(callback));
+    
+    timerAdded(time);
+    
+    return id;
+}
+
+/// Cancel a callback before it runs.
+/// Once this returns the callback is not running and never will, even if it
+/// was too late to cancel it.
+/// \param id Id returned when the callback was scheduled.
+/// \return Whether the callback was cancelled before it ran.
+bool JobPool::cancel(TimerId id)
+{
+    return AutoWriteLock<TimerWheel>(_timersLock)->cancel(id);
+}
+
+/// Summarise the statistics for every type of job.
+/// Run rates are measured since the previous call to this method or report().
+/// \param summaries Vector to fill with one summary per job type.
+void JobPool::summarise(std::vector<JobStats::Summary>& summaries)
+{
+    AutoWriteLock<JobStatsMap> stats(_jobStatsLock);
+    uint64_t time = now();
+    
+    for (auto& pair : *stats)
+        summaries.push_back(pair.second->summarise(time));
+}
+
+/// Produce a report on the statistics for every type of job.
+/// Job types are listed with the slowest 99th percentile run time first.
+/// \return The report with one line per job type.
+std::string JobPool::report()
+{
+    std::vector<JobStats::Summary> summaries;
+    summarise(summaries);
+    
+    std::sort(summaries.begin(), summaries.end(), 
+        [](const JobStats::Summary& a, const JobStats::Summary& b) {
+            return (a.runP99 > b.runP99);
+        });
+    
+    std::ostringstream report;
+    report << "job stats: " << _count << " jobs, " << _deadlineMisses 
+           << " deadline misses";
+    
+    for (auto& summary : summaries) {
+        report << "\n  " << summary.name << " runs=" << summary.runs 
+               << " (" << uint64_t(summary.runsPerSecond) << "/s)"
+               << " run(us) p50=" << summary.runP50 << " p99=" << summary.runP99 
+               << " max=" << summary.runMax
+               << " wait(us) p50=" << summary.waitP50 << " p99=" << summary.waitP99
+               << " max=" << summary.waitMax
+               << " runaways=" << summary.runaways;
     }
     
-    return curr;
+    return report.str();
 }
 
-/// Releases a node read-only lock on the specified job.
-/// The %JobPool implementation has workers move around the job list rather than
-/// manipulating the list to give jobs to workers. As such a Worker holds a lock
-/// on the last Job it ran. When it gains a lock on its next job this lock will
-/// be removed. This method is provided so that the lock a Worker holds on its
-/// last job can be removed before that %Worker terminates. Failure by a %Worker
-/// to call this method before terminating may result in deadlock if jobs are
-/// removed later.
-/// \param job The job to release.
-void JobPool::releaseJob(Job* job)
+/// Sample the running totals of work done by the pool.
+/// The difference between two samples shows how busy the pool was between 
+/// them.
+/// \return The totals.
+JobPool::Load JobPool::load()
 {
-    if (job != 0)
-        job->_nodeLock.roUnlock();
+    Load load = {0, 0, 0, _deadlineMisses.load()};
+    int count = _slotCount.load();
+    
+    for (int i = 0; i < count; i++) {
+        load.busy += _slots[i].busyTime.load(std::memory_order_relaxed);
+        load.wait += _slots[i].waitTime.load(std::memory_order_relaxed);
+        load.runs += _slots[i].runCount.load(std::memory_order_relaxed);
+    }
+    
+    return load;
+}
+
+/// Set how many workers may run jobs.
+/// Workers in slots at or beyond the limit park until it is raised again. 
+/// \param limit Number of workers allowed to run jobs, at least one.
+void JobPool::setWorkerLimit(int limit)
+{
+    _workerLimit = std::max(std::min(limit, int(MAX_WORKERS)), 1);
+    
+    _limitEpoch++;
+    futexWake(_limitEpoch, INT_MAX);
+}
+
+/// Used to find out how many workers may run jobs.
+/// \return The worker limit.
+int JobPool::workerLimit()
+{
+    return _workerLimit;
+}
+
+/// Get the current time from a monotonic clock.
+/// \return Time in microseconds.
+uint64_t JobPool::now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
 }
 
 /// Used to find out the job count.
@@ -151,69 +492,734 @@ int JobPool::count()
     return _count;
 }
 
-/// Attempt to lock the job so that other workers do not run it.
-/// This method tries to get the run lock for the specified job. If the job is
-/// read-only (as determined by the Job::readOnly() method) it does nothing. It
-/// could acquire an ro lock but this is not necessary because the job's state
-/// will never change anyway.
-/// \param job The job to lock.
-/// \return Success of locking operation.
-bool JobPool::acquireRunLock(Job* job)
+/// Used to find out how many workers are running jobs.
+/// Workers parked because of the worker limit are not counted.
+/// \return Number of workers.
+int JobPool::workers()
+{
+    int count = std::min(_slotCount.load(), _workerLimit.load());
+    int active = 0;
+    
+    for (int i = 0; i < count; i++) {
+        if (_slots[i].active.load())
+            active++;
+    }
+    
+    return active;
+}
+
+/// Used to find out how often realtime jobs have been run late.
+/// \return Number of deadline misses since the pool was created.
+unsigned int JobPool::deadlineMisses()
+{
+    return _deadlineMisses;
+}
+
+/// Give a new Worker a slot in the pool.
+/// This is called by the Worker constructor before its thread is started, so
+/// that a pool with no free slot fails the construction rather than the
+/// thread.
+/// \param node NUMA node the worker runs on.
+/// \return Index of the slot now owned by the worker.
+int JobPool::attachWorker(int node)
+{
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        bool expected = false;
+        
+        if (!_slots[i].active.compare_exchange_strong(expected, true))
+            continue;
+        
+        int count = _slotCount.load();
+        while ((count <= i) && !_slotCount.compare_exchange_weak(count, i + 1));
+        
+        _slots[i].node = std::max(node, 0) % MAX_NODES;
+        _slots[i].seed = 2463534242u + 7919u * i;
+        _slots[i].round = 0;
+        
+        return i;
+    }
+    
+    throw MemoryException("worker limit exceeded");
+}
+
+/// Release the slot owned by a Worker.
+/// Any jobs left in the queue of the worker are returned to the shared queue
+/// so that other workers may run them.
+/// \param slot Index of the slot owned by the worker.
+void JobPool::detachWorker(int slot)
+{
+    releaseJobs(slot);
+    
+    _slots[slot].active = false;
+    
+    notify();
+}
+
+/// Finds a Job that needs running and runs it.
+/// This method first runs the read-only jobs if the worker has completed a
+/// round of its own queue. It then takes a job from its own queue (or from
+/// elsewhere, see acquireJob()) and runs it. Depending on the return value of
+/// the Job::run() method it will either put the job back on the end of the
+/// worker's queue, leave it blocked or destroy it. Any timers that are due
+/// are fired first.
+/// \param slot Index of the slot owned by the calling worker.
+/// \return Whether a job other than a read-only job was run.
+bool JobPool::runNextJob(int slot)
+{
+    Slot& self = _slots[slot];
+    
+    if (_nextTimer.load() <= now())
+        fireTimers();
+    
+    if (self.round <= 0) {
+        runReadOnlyJobs();
+        self.round = self.size() + 1;
+    }
+    
+    Job* job = acquireJob(slot);
+    
+    if (job == 0) {
+        self.round = 0;
+        return false;
+    }
+    
+    self.round--;
+    self.runs++;
+    
+    if (job->_timer != 0)
+        cancelTimer(job);
+    
+    job->_wakeTime = 0;
+    job->_state = Job::RUNNING;
+    
+    uint64_t start = now();
+    checkDeadline(job, start);
+    
+    Job::RetType ret = job->safeRun();
+    
+    uint64_t duration = now() - start;
+    job->_stats->recordRun(start - job->_readyTime, duration);
+    
+    // Only this worker writes to its slot so no atomic increment is needed.
+    self.busyTime.store(self.busyTime.load(std::memory_order_relaxed) + duration, 
+        std::memory_order_relaxed);
+    self.waitTime.store(self.waitTime.load(std::memory_order_relaxed) + 
+        (start - job->_readyTime), std::memory_order_relaxed);
+    self.runCount.store(self.runCount.load(std::memory_order_relaxed) + 1, 
+        std::memory_order_relaxed);
+    
+    switch (ret) {
+        case Job::YIELD:
+            job->_state = Job::QUEUED;
+            enqueueFrom(slot, job);
+            break;
+        case Job::BLOCK:
+            blockJob(job, slot);
+            break;
+        case Job::FINISH:
+            destroyJob(job);
+            break;
+    }
+    
+    return true;
+}
+
+/// Put the calling worker to sleep until there may be work to do.
+/// The worker sleeps until a job is added or woken, or until the next timer is
+/// due. It may also wake spuriously so the caller should simply try to run a
+/// job again afterwards. The stop flag is checked after the futex word is 
+/// read, so a worker told to stop by unparkAll() cannot go to sleep.
+/// \param stop Flag set when the worker should stop.
+void JobPool::park(const std::atomic<bool>& stop)
+{
+    int epoch = _epoch.load();
+    _sleeping++;
+    
+    if (!stop && !hasWork()) {
+        uint64_t next = _nextTimer.load();
+        uint64_t time = now();
+        
+        if (next == NEVER) {
+            futexWait(_epoch, epoch, 0);
+        } else if (next > time) {
+            futexWait(_epoch, epoch, next - time);
+        }
+    }
+    
+    _sleeping--;
+}
+
+/// Wake all parked workers.
+/// This is used when workers are being terminated.
+void JobPool::unparkAll()
+{
+    _epoch++;
+    futexWake(_epoch, INT_MAX);
+    
+    _limitEpoch++;
+    futexWake(_limitEpoch, INT_MAX);
+}
+
+/// Check whether a worker is beyond the worker limit.
+/// \param slot Index of the slot owned by the worker.
+/// \return Whether the worker should park rather than run jobs.
+bool JobPool::excess(int slot) const
+{
+    return (slot >= _workerLimit.load(std::memory_order_relaxed));
+}
+
+/// Park a worker that is beyond the worker limit.
+/// Its jobs are given back to the shared queue first so that the remaining
+/// workers run them. The worker sleeps until the limit changes or the pool
+/// is told to unpark all workers, so the caller should check again after.
+/// \param slot Index of the slot owned by the worker.
+/// \param stop Flag set when the worker should stop.
+void JobPool::parkExcess(int slot, const std::atomic<bool>& stop)
+{
+    releaseJobs(slot);
+    notify();
+    
+    int epoch = _limitEpoch.load();
+    
+    if (!stop && excess(slot))
+        futexWait(_limitEpoch, epoch, 0);
+}
+
+/// Move the jobs queued on a slot to the shared queue.
+/// \param slot Index of the slot.
+void JobPool::releaseJobs(int slot)
+{
+    Job* job = 0;
+    
+    for (int i = 0; i < Job::PRIORITIES; i++) {
+        while ((job = _slots[slot].queues[i].pop()) != 0)
+            _shared[i].push(job);
+    }
+}
+
+/// Put a job back in a queue after it has been woken.
+/// If the caller is a worker of this pool the job is queued as though that
+/// worker had run it, otherwise it is queued as though it were new. A parked
+/// worker is then woken.
+/// \param job The job to put back.
+void JobPool::requeue(Job* job)
+{
+    enqueueFrom((currentPool == this ? currentSlot : -1), job);
+    notify();
+}
+
+/// Queue a job that is ready to run.
+/// A job with a node hint goes on the queue of its node unless the worker 
+/// queuing it is on that node, in which case a parked worker is woken so the
+/// job is not left waiting for this one. Otherwise the job goes on the queue
+/// of the worker or on the shared queue if there is no worker.
+/// \param slot Index of the slot owned by the calling worker or -1 if none.
+/// \param job The job to queue.
+void JobPool::enqueueFrom(int slot, Job* job)
+{
+    int node = job->node();
+    
+    if ((node >= 0) && ((slot < 0) || (_slots[slot].node != node % MAX_NODES))) {
+        enqueue(_nodeShared[node % MAX_NODES], job);
+        
+        if (slot >= 0)
+            notify();
+    } else if (slot < 0) {
+        enqueue(_shared, job);
+    } else {
+        enqueue(_slots[slot].queues, job);
+    }
+}
+
+/// Put a job on the queue for its scheduling class.
+/// The time is recorded so that deadline misses can be detected.
+/// \param queues The set of queues to use.
+/// \param job The job to put on a queue.
+void JobPool::enqueue(Queues& queues, Job* job)
+{
+    job->_readyTime = now();
+    queues[job->priority()].push(job);
+}
+
+/// Wake one parked worker, if there are any.
+void JobPool::notify()
 {
-    return (job->readOnly() || job->_runLock.rwTryLock() != 0);
+    _epoch++;
+    
+    if (_sleeping.load() > 0)
+        futexWake(_epoch, 1);
 }
 
-/// Release the lock on a job so other workers may run it.
-/// \param job The job to unlock.
-/// \pre The job must have been lock previously with JobPool::acquireRunLock().
-void JobPool::releaseRunLock(Job* job)
+/// Check whether any job is ready to run.
+/// \return Whether there is a queued job or a timer is due.
+bool JobPool::hasWork() const
 {
-    if (!job->readOnly())
-        job->_runLock.rwUnlock();
+    for (int i = 0; i < Job::PRIORITIES; i++) {
+        if (_shared[i].size() > 0)
+            return true;
+        
+        for (int j = 0; j < MAX_NODES; j++) {
+            if (_nodeShared[j][i].size() > 0)
+                return true;
+        }
+    }
+    
+    int count = _slotCount.load();
+    for (int i = 0; i < count; i++) {
+        if (_slots[i].size() > 0)
+            return true;
+    }
+    
+    return (_nextTimer.load() <= now());
 }
 
-/// Removes the specified job from the pool's linked list.
-/// This method will first acquire node read-write locks on the previous, 
-/// specified and next job, in that order. Therefore the current thread must not
-/// be holding node locks on any of those jobs or dead-lock will occur. Once the
-/// locks are held it is able to safely remove the specified job from the list.
-/// Finally it releases all held locks in the order they were acquired.
-/// \param job The job to remove from the linked list.
-/// \pre The calling thread holds no node locks on the previous, specified and
-///      next jobs.
-void JobPool::removeJobFromList(Job* job)
+/// Handle a job that returned Job::BLOCK.
+/// If the job asked to be woken after a delay its timer is set before it is
+/// marked as blocked, so the timer cannot be missed. If the job was woken while
+/// it was running it is queued again instead of blocking. Once the job is 
+/// marked as blocked another thread may wake it, so it must not be touched.
+/// \param job The job to block.
+/// \param slot Index of the slot owned by the calling worker.
+void JobPool::blockJob(Job* job, int slot)
 {
-    // Lock previous job node.
-    if (job->_prev != 0)  // Should this be in the while guard too?
-        while (job->_prev->_nodeLock.rwTryLock() == 0);
+    if (job->readOnly())
+        return;
+    
+    if (job->_wakeTime != 0)
+        setTimer(job);
     
-    // Lock current job node.
-    job->_nodeLock.rwWaitLock();
+    int expected = Job::RUNNING;
+    if (job->_state.compare_exchange_strong(expected, Job::BLOCKED))
+        return;
     
-    // Lock next job node.
-    if (job->_next != 0)
-        job->_next->_nodeLock.rwWaitLock();
+    job->_state = Job::QUEUED;
+    enqueueFrom(slot, job);
+}
+
+/// Set a timer to wake a job at its requested wake time.
+/// \param job The job to set the timer for.
+void JobPool::setTimer(Job* job)
+{
+    {
+        AutoWriteLock<TimerWheel> timers(_timersLock);
+        
+        job->_timer = timers->schedule(job->_wakeTime, [job]() {
+            job->_timer = 0;
+            job->wake();
+        });
+    }
     
-    // Remove current job node from list.
-    if (job->_prev != 0)
-        job->_prev->_next = job->_next;
-    if (job->_next != 0)
-        job->_next->_prev = job->_prev;
+    timerAdded(job->_wakeTime);
+}
+
+/// Cancel the timer of a job that is about to be run.
+/// \param job The job to cancel the timer for.
+void JobPool::cancelTimer(Job* job)
+{
+    AutoWriteLock<TimerWheel> timers(_timersLock);
     
-    // Set new tail if necessary.
-    if (job == _tail)
-        _tail = job->_prev;
+    if (job->_timer == 0)
+        return;
     
-    // Unlock previous job node.
-    if (job->_prev != 0)
-        job->_prev->_nodeLock.rwUnlock();
+    timers->cancel(job->_timer);
+    job->_timer = 0;
+}
+
+/// Run all timers that are due.
+/// Timers are fired while the timer lock is held. This guarantees that a job
+/// is not destroyed between its timer being removed and it being woken, 
+/// because a job must cancel its timer before it is run, and likewise that a
+/// callback is not running once cancel() returns. If another worker is 
+/// already firing timers then this method returns immediately.
+void JobPool::fireTimers()
+{
+    if (_timersLock.rwTryLock() == 0)
+        return;
     
-    // Unlock current job node.
-    job->_nodeLock.rwUnlock();
+    _timers.advance(now());
+    _nextTimer = _timers.nextExpiry();
     
-    // Unlock next job node.
-    if (job->_next != 0)
-        job->_next->_nodeLock.rwUnlock();
+    _timersLock.rwUnlock();
+}
+
+/// Make sure a newly added timer is noticed.
+/// A parked worker may need to shorten its sleep if the timer is due before
+/// any other.
+/// \param time Time at which the timer is due.
+void JobPool::timerAdded(uint64_t time)
+{
+    uint64_t next = _nextTimer.load();
+    
+    while (time < next) {
+        if (_nextTimer.compare_exchange_weak(next, time)) {
+            notify();
+            return;
+        }
+    }
+}
+
+/// Find the next job for a worker to run.
+/// Overdue realtime jobs are always taken first, wherever they are queued,
+/// followed by realtime jobs on the shared queue and the queue of the 
+/// worker's node. Otherwise the worker normally takes a job from its own 
+/// queues. The node and shared queues are checked every SHARED_INTERVAL runs
+/// so new jobs are not left waiting, and if a randomly chosen victim on the
+/// same node has noticeably more jobs than the worker then one is stolen from
+/// it. This keeps the jobs spread evenly over the workers of each node. 
+/// Realtime jobs are preferred but every INTERACTIVE_INTERVAL and 
+/// BACKGROUND_INTERVAL runs the other classes are given a turn. If the worker
+/// has no jobs of its own then the node and shared queues are checked 
+/// followed by the queues of every other worker.
+/// \param slot Index of the slot owned by the calling worker.
+/// \return The job to run or zero if no job was found.
+Job* JobPool::acquireJob(int slot)
+{
+    Slot& self = _slots[slot];
+    Job* job = 0;
+    
+    if ((job = takeOverdueJob(slot)) != 0)
+        return job;
+    
+    // Realtime jobs woken from outside the pool, such as by a clock, should
+    // not wait for the periodic check of the shared queues.
+    Queues& local = _nodeShared[self.node];
+    
+    if ((job = _shared[Job::REALTIME].pop()) != 0)
+        return job;
+    
+    if ((job = local[Job::REALTIME].pop()) != 0)
+        return job;
+    
+    if (self.runs % SHARED_INTERVAL == 0) {
+        for (int i = 0; i < Job::PRIORITIES; i++) {
+            if ((job = local[i].pop()) != 0)
+                return job;
+            
+            if ((job = _shared[i].pop()) != 0)
+                return job;
+        }
+    }
+    
+    int victim = randomVictim(slot);
+    if ((victim != slot) && (_slots[victim].node == self.node) && 
+        (_slots[victim].size() > self.size() + 1)) {
+        if ((job = stealFrom(victim)) != 0)
+            return job;
+    }
+    
+    int first = Job::REALTIME;
+    if (self.runs % BACKGROUND_INTERVAL == 0) {
+        first = Job::BACKGROUND;
+    } else if (self.runs % INTERACTIVE_INTERVAL == 0) {
+        first = Job::INTERACTIVE;
+    }
+    
+    if ((job = self.queues[first].pop()) != 0)
+        return job;
+    
+    for (int i = 0; i < Job::PRIORITIES; i++) {
+        if ((i != first) && (job = self.queues[i].pop()) != 0)
+            return job;
+    }
+    
+    for (int i = 0; i < Job::PRIORITIES; i++) {
+        if ((job = local[i].pop()) != 0)
+            return job;
+        
+        if ((job = _shared[i].pop()) != 0)
+            return job;
+    }
+    
+    return stealJob(slot);
+}
+
+/// Take a realtime job that has missed its deadline.
+/// The worker's own queue is checked first, followed by the queues of the 
+/// other workers, the node queues and finally the shared queue. A realtime 
+/// job stuck behind a long running job on another worker, or waiting for a
+/// busy node, is therefore picked up by this one.
+/// \param slot Index of the slot owned by the calling worker.
+/// \return The overdue job or zero if there is none.
+Job* JobPool::takeOverdueJob(int slot)
+{
+    int count = _slotCount.load();
+    uint64_t time = 0;
+    
+    for (int i = 0; i <= count + MAX_NODES; i++) {
+        JobQueue& queue = (i < count ? 
+            _slots[(slot + i) % count].queues[Job::REALTIME] : 
+            (i < count + MAX_NODES ? _nodeShared[i - count][Job::REALTIME] :
+            _shared[Job::REALTIME]));
+        
+        if (queue.size() == 0)
+            continue;
+        
+        if (time == 0)
+            time = now();
+        
+        Job* job = queue.popOverdue(time);
+        if (job != 0)
+            return job;
+    }
+    
+    return 0;
+}
+
+/// Steal a job from any other worker.
+/// Victims are tried in turn starting from a random one. Workers on the same
+/// node are tried first, then workers on other nodes and finally the queues
+/// of other nodes, so a node with no running workers is not starved.
+/// \param slot Index of the slot owned by the calling worker.
+/// \return The stolen job or zero if there are no jobs to steal.
+Job* JobPool::stealJob(int slot)
+{
+    int count = _slotCount.load();
+    int start = randomVictim(slot);
+    int node = _slots[slot].node;
+    
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < count; i++) {
+            int victim = (start + i) % count;
+            
+            if ((victim == slot) || ((_slots[victim].node == node) != (pass == 0)))
+                continue;
+            
+            Job* job = stealFrom(victim);
+            if (job != 0)
+                return job;
+        }
+    }
+    
+    for (int i = 0; i < Job::PRIORITIES; i++) {
+        for (int j = 1; j < MAX_NODES; j++) {
+            Job* job = _nodeShared[(node + j) % MAX_NODES][i].pop();
+            if (job != 0)
+                return job;
+        }
+    }
+    
+    return 0;
+}
+
+/// Steal a job from a worker, favouring the most urgent scheduling class.
+/// \param victim Index of the slot to steal from.
+/// \return The stolen job or zero if the worker has no jobs.
+Job* JobPool::stealFrom(int victim)
+{
+    for (int i = 0; i < Job::PRIORITIES; i++) {
+        Job* job = _slots[victim].queues[i].steal();
+        if (job != 0)
+            return job;
+    }
+    
+    return 0;
+}
+
+/// Choose a random slot to steal from.
+/// \param slot Index of the slot owned by the calling worker.
+/// \return Index of the victim slot. This may be the calling worker's own.
+int JobPool::randomVictim(int slot)
+{
+    uint32_t& x = _slots[slot].seed;
+    
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    
+    return x % _slotCount.load();
+}
+
+/// Count and report a realtime job that is being run after its deadline.
+/// A warning is logged each time the number of misses doubles, so that an
+/// overloaded server does not flood the log.
+/// \param job The job about to be run.
+/// \param time The current time.
+void JobPool::checkDeadline(Job* job, uint64_t time)
+{
+    if (job->priority() != Job::REALTIME)
+        return;
+    
+    uint64_t deadline = job->deadline();
+    uint64_t waited = time - job->_readyTime;
+    
+    if ((deadline == 0) || (waited <= deadline))
+        return;
+    
+    unsigned int misses = ++_deadlineMisses;
+    
+    if ((misses & (misses - 1)) == 0) {
+        std::ostringstream message;
+        message << "JobPool: realtime job ran " << (waited - deadline) 
+                << "us past its deadline (" << misses << " misses so far)";
+        Log::log->warn(message.str());
+    }
+}
+
+/// Find the statistics for the type of a job, creating them if necessary.
+/// Jobs such as the helpers of parallelFor() are added every tick, so the
+/// statistics are looked up by type under a read lock. The name is only
+/// demangled, and the write lock only taken, the first time a type is seen.
+/// \param job The job.
+/// \return Statistics shared by jobs of the same type.
+JobStats* JobPool::statsFor(const Job& job)
+{
+    std::type_index type(typeid(job));
+    
+    {
+        AutoReadLock<JobStatsMap> stats(_jobStatsLock);
+        
+        JobStatsMap::const_iterator iter = stats->find(type);
+        if (iter != stats->end())
+            return iter->second;
+    }
+    
+    std::string name = demangle(typeid(job));
+    AutoWriteLock<JobStatsMap> stats(_jobStatsLock);
+    
+    JobStats*& entry = (*stats)[type];
+    if (entry == 0)
+        entry = new JobStats(name, now());
+    
+    return entry;
+}
+
+/// Run every read-only job once.
+/// Read-only jobs may be run by several workers at once so the list is only
+/// locked for reading while they run. Any that finish are removed afterwards.
+void JobPool::runReadOnlyJobs()
+{
+    JobVector finished;
+    
+    {
+        AutoReadLock<JobVector> jobs(_readOnlyLock);
+        
+        for (auto job : *jobs) {
+            if (job->safeRun() == Job::FINISH)
+                finished.push_back(job);
+        }
+    }
+    
+    if (finished.empty())
+        return;
+    
+    AutoWriteLock<JobVector> jobs(_readOnlyLock);
+    
+    for (auto job : finished) {
+        JobVector::iterator iter = std::find(jobs->begin(), jobs->end(), job);
+        
+        if (iter == jobs->end())
+            continue;
+        
+        jobs->erase(iter);
+        destroyJob(job);
+    }
+}
+
+/// Destroy a job that has finished.
+/// \param job The job to destroy.
+void JobPool::destroyJob(Job* job)
+{
+    AutoWriteLock<JobSet>(_allLock)->erase(job);
+    Job::Ptr tempPtr(job);
+    _count--;
+}
+
+
+////////// JobPool::Slot //////////
+
+/// Construct an unused Slot.
+JobPool::Slot::Slot()
+    : active(false), node(0), seed(1), runs(0), round(0), busyTime(0), waitTime(0), 
+      runCount(0)
+{
+    
+}
+
+/// Used to find out the approximate number of jobs queued on the slot.
+/// \return Number of jobs in all queues of the slot.
+int JobPool::Slot::size() const
+{
+    int total = 0;
+    
+    for (int i = 0; i < Job::PRIORITIES; i++)
+        total += queues[i].size();
+    
+    return total;
+}
+
+
+////////// ForkState //////////
+
+/// Construct ForkState for a loop.
+/// \param begin First iteration.
+/// \param end One past the last iteration.
+/// \param grain Iterations per chunk.
+/// \param func Function to call for each chunk.
+ForkState::ForkState(size_t begin, size_t end, size_t grain, const Job::RangeFunc& func)
+    : begin(begin), end(end), grain(grain), chunks((end - begin + grain - 1) / grain),
+      func(func), next(0), completed(0), failed(false)
+{
+    
+}
+
+/// Claim the next chunk and run it.
+/// \return Whether there was a chunk left to run.
+bool ForkState::runChunk()
+{
+    size_t chunk = next++;
+    
+    if (chunk >= chunks)
+        return false;
+    
+    size_t first = begin + chunk * grain;
+    
+    try {
+        func(first, std::min(first + grain, end));
+    } catch (...) {
+        if (!failed.exchange(true))
+            error = std::current_exception();
+    }
+    
+    completed++;
+    
+    return true;
+}
+
+/// Wait for chunks claimed by other threads to complete.
+/// Each chunk is short so the wait is spent spinning. The thread yields while
+/// it spins in case the worker it is waiting for is not running.
+void ForkState::wait()
+{
+    while (completed.load() < chunks)
+        sched_yield();
+}
+
+
+////////// ForkJob //////////
+
+/// Construct a ForkJob.
+/// \param fork State of the loop to help with.
+/// \param priority Scheduling class of the job running the loop.
+ForkJob::ForkJob(std::shared_ptr<ForkState> fork, Priority priority)
+    : _fork(fork), _priority(priority)
+{
+    
+}
+
+/// Run chunks until there are none left.
+/// \return Always Job::FINISH.
+Job::RetType ForkJob::run()
+{
+    while (_fork->runChunk());
+    
+    return FINISH;
+}
+
+/// Helpers share the scheduling class of the job they help.
+/// \return Scheduling class of the job running the loop.
+Job::Priority ForkJob::priority()
+{
+    return _priority;
 }
 
 
@@ -221,10 +1227,18 @@ void JobPool::removeJobFromList(Job* job)
 
 /// Create a %Worker to do jobs in the specified JobPool.
 /// \param jobs The JobPool from which to do jobs.
-Worker::Worker(JobPool& jobs)
-    : _jobs(jobs), _terminate(false)
+/// \param node NUMA node the worker will run on.
+Worker::Worker(JobPool& jobs, int node)
+    : _jobs(jobs), _node(node), _terminate(false)
 {
-    pthread_create(&_thread, 0, &threadMain, this);
+    _slot = _jobs.attachWorker(_node);
+    
+    int error = pthread_create(&_thread, 0, &threadMain, this);
+    if (error != 0) {
+        _jobs.detachWorker(_slot);
+        errno = error;
+        throw ErrNoException("pthread_create failed");
+    }
 }
 
 /// Destroy %Worker object.
@@ -237,6 +1251,13 @@ Worker::~Worker()
     pthread_join(_thread, 0);
 }
 
+/// Restrict the worker thread to a set of CPUs.
+/// \param cpus The CPUs the thread may run on.
+void Worker::pin(const std::vector<int>& cpus)
+{
+    Topology::pinThread(_thread, cpus);
+}
+
 /// Manually terminate %Worker thread.
 /// This method causes the thread to terminate after the current job yields. It
 /// returns immediately, so the caller should not expect the thread to be
@@ -246,6 +1267,7 @@ Worker::~Worker()
 void Worker::terminate()
 {
     _terminate = true;
+    _jobs.unparkAll();
 }
 
 /// Get identity of running worker.
@@ -258,17 +1280,34 @@ Worker::Identifier Worker::self()
 }
 
 /// Main function executed by thread.
+/// Signals are blocked so that they are delivered to the main thread, which 
+/// waits for them.
 /// \param args Pointer to %Worker object.
 /// \return Always zero.
 void* Worker::threadMain(void* args)
 {
-    Job* job = 0;
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+    
     Worker* worker = reinterpret_cast<Worker*>(args);
+    int slot = worker->_slot;
+    
+    currentPool = &worker->_jobs;
+    currentSlot = slot;
+    
+    while (!worker->_terminate) {
+        if (worker->_jobs.excess(slot)) {
+            worker->_jobs.parkExcess(slot, worker->_terminate);
+        } else if (!worker->_jobs.runNextJob(slot)) {
+            worker->_jobs.park(worker->_terminate);
+        }
+    }
     
-    while (!worker->_terminate)
-        job = worker->_jobs.runNextJob(job);
+    worker->_jobs.detachWorker(slot);
     
-    worker->_jobs.releaseJob(job);
+    currentPool = 0;
+    currentSlot = -1;
     
     return 0;
 }
@@ -6,6 +6,14 @@
 /// Copyright (c) 2007 Ben Radford.
 ///
 /// Modifications (most recent first):
+/// - 17/10/26 Replaced timer map with a timer wheel and added timer callbacks.
+/// - 17/10/26 Added NUMA node hints for jobs and pinning of workers.
+/// - 17/10/26 Added a limit on active workers so the pool can grow and shrink.
+/// - 17/10/26 Added per job type runtime statistics.
+/// - 17/10/26 Added fork-join parallel loops.
+/// - 17/10/26 Added scheduling classes and realtime deadlines.
+/// - 17/10/26 Added blocking jobs and parking of idle workers.
+/// - 17/10/26 Replaced shared job list with per-worker work stealing queues.
 /// - 27/10/07 Implemented read-only run jobs and added thread local storage.
 /// - 08/10/07 Added the Worker::self() method.
 
@@ -14,10 +22,19 @@
 #define CONCURRENCY_HPP
 
 
-#include <list>
+#include <map>
+#include <atomic>
 #include <memory>
+#include <functional>
+#include <typeindex>
+#include <vector>
+#include <stdint.h>
 #include <pthread.h>
+#include <tr1/unordered_set>
 #include "lock.hpp"
+#include "autolock.hpp"
+#include "jobstats.hpp"
+#include "timerwheel.hpp"
 
 
 /// Represents a job that needs to be run.
@@ -27,68 +44,269 @@
 /// serving clients will likely return YIELD most of the time. This causes the
 /// job to be suspended so that other jobs have a chance to run but the job will
 /// be run again later. A job should return FINISH to indicate that it has
-/// completed its task.
+/// completed its task. A job that has nothing to do until some event occurs
+/// should return BLOCK. It will then not be run again until wake() is called,
+/// for example by a FIFO pipe it reads from or by a timer set with wakeAfter().
+/// Each job belongs to a scheduling class given by priority(). Realtime jobs
+/// may also give a deadline() by which they should be run once runnable.
+/// A running job may spread a loop over the other workers with parallelFor().
+/// A job whose data lives on one NUMA node may ask to be run there by node().
 class Job {
     public:
         friend class JobPool;
+        friend class JobQueue;
         typedef std::unique_ptr<Job> Ptr;
+        typedef std::function<void(size_t, size_t)> RangeFunc;
         
         enum RetType {
             YIELD,  ///< The job is temporarily yielding.
-            FINISH  ///< The job has been completed.
+            FINISH, ///< The job has been completed.
+            BLOCK   ///< The job is waiting to be woken.
+        };
+        
+        /// Scheduling class of a job.
+        enum Priority {
+            REALTIME,     ///< Latency critical work such as simulation ticks.
+            INTERACTIVE,  ///< Work that clients are waiting on.
+            BACKGROUND,   ///< Work that can be put off when busy.
+            PRIORITIES    ///< Number of scheduling classes.
         };
         
         Job();
         virtual ~Job();
         virtual RetType run() = 0;
+
+        void wake();
         
+    protected:
+        void wakeAfter(uint64_t usec);
+        class JobPool* pool();
+        void parallelFor(size_t begin, size_t end, size_t grain, 
+            const RangeFunc& func);
+
     private:
+        /// Scheduling state of the job.
+        enum State {
+            QUEUED,   ///< Waiting in a queue to be run.
+            RUNNING,  ///< Being run by a worker.
+            BLOCKED,  ///< Waiting to be woken.
+            WOKEN     ///< Woken while running so must not block.
+        };
+
         RetType safeRun();
         virtual bool readOnly();
-        
-        Lock<Job> _runLock;   ///< Lock for running the job.
-        Lock<Job> _nodeLock;  ///< Lock for accessing the linked list node.
-        
-        Job* _next;  ///< Next job in the JobPool linked list.
-        Job* _prev;  ///< Previous job in the JobPool linked list.
+        virtual Priority priority();
+        virtual uint64_t deadline();
+        virtual int node();
+
+        std::atomic<int> _state;       ///< Current scheduling state.
+        class JobPool* _pool;          ///< Pool the job belongs to.
+        uint64_t _wakeTime;            ///< Time at which to wake if blocked.
+        std::atomic<uint64_t> _timer;  ///< Pending wake timer or zero.
+        uint64_t _readyTime;           ///< Time the job was last queued.
+        JobStats* _stats;              ///< Statistics for jobs of this type.
 };
 
 
-/// Special Job which does nothing.
-/// %EmptyJob is required internally by JobPool. When run it immediately returns
-/// YIELD.
-class EmptyJob : public Job {
+/// Queue of jobs waiting to be run by a particular Worker.
+/// Each Worker owns a %JobQueue for each scheduling class. The owner takes 
+/// jobs from the front and puts jobs that yield back on the end, so its jobs
+/// are run in round robin order.
+/// Other workers that are short of jobs steal from the end of the queue, which
+/// holds the job that would otherwise wait longest to be run again. The size 
+/// is tracked separately so that it can be checked without taking the lock.
+class JobQueue {
     public:
-        virtual RetType run();
+        JobQueue();
+
+        void push(Job* job);
+        Job* pop();
+        Job* popOverdue(uint64_t time);
+        Job* steal();
+
+        int size() const;
+
+    private:
+        JobQueue(const JobQueue&);
+        JobQueue& operator=(const JobQueue&);
+
+        typedef Lockable<Job*>::Deque Deque;
+
+        Deque _deque;             ///< Jobs waiting to be run.
+        std::atomic<int> _size;   ///< Number of jobs in the deque.
 };
 
 
 /// A %JobPool holds Job objects so that Worker objects may run them.
 /// After a %Job has been added it is owned by the %JobPool and will be 
 /// destroyed when the %Job returns Job::FINISH from its Job::run() method. 
+/// Each Worker attached to the pool is given a JobQueue of its own. New jobs
+/// are placed on a shared queue which workers check periodically, and a 
+/// worker whose queue runs short steals jobs from the queue of a randomly 
+/// chosen victim. Read-only jobs are not queued at all. Instead every worker
+/// runs each of them once per round, where a round is one pass through the
+/// worker's own queue. Workers that find nothing to run park themselves on a
+/// futex until a job is added or woken, or until the next timer is due.
+///
+/// Every queue is split by Job::Priority. Realtime jobs that have waited past
+/// their deadline are run before anything else, taken from whichever worker
+/// holds them. Otherwise workers favour realtime jobs but give interactive 
+/// and background jobs regular turns, so no class can be starved. Deadline
+/// misses are counted and logged.
+///
+/// Timers are kept in a TimerWheel so that setting and cancelling them is 
+/// cheap however many are pending. Besides waking blocked jobs the pool runs
+/// callbacks given to schedule() once their delay expires. Callbacks are run
+/// by a worker with the timers locked, so they must be short and must not 
+/// schedule or cancel timers themselves. In return a callback is never still
+/// running once cancel() has returned.
+///
+/// The pool keeps JobStats for each type of job it runs, recording how long
+/// runs take and how long jobs wait to be run. These can be read at any time
+/// with summarise() or report().
+///
+/// Only as many workers as the worker limit run jobs. Workers beyond the 
+/// limit give their jobs back to the shared queue and park until the limit
+/// is raised again, so a PoolManager can adjust the number of active workers
+/// to the load without creating and destroying threads.
+///
+/// Each worker belongs to a NUMA node. Jobs that give a node hint are queued
+/// on a queue of that node when they are added or yield on a worker of some
+/// other node, and workers check the queue of their own node before the 
+/// shared queue. Workers balance load by stealing from workers on the same
+/// node and only steal from other nodes when there is nothing else to run,
+/// so jobs and their memory stay together unless a node runs out of workers.
 class JobPool {
     public:
+        friend class Job;
+        friend class Worker;
+
+        /// Running totals used to measure how busy the pool is.
+        struct Load {
+            uint64_t busy;                ///< Microseconds spent running jobs.
+            uint64_t wait;                ///< Microseconds jobs waited to run.
+            uint64_t runs;                ///< Number of jobs run.
+            unsigned int deadlineMisses;  ///< Realtime jobs run late.
+        };
+
+        typedef TimerWheel::Id TimerId;
+        typedef TimerWheel::Callback TimerCallback;
+
+        static const int MAX_WORKERS = 64;  ///< Limit on attached workers.
+
         JobPool();
         ~JobPool();
         
         void add(Job::Ptr job);
-        Job* runNextJob(Job* last = 0);
-        void releaseJob(Job* job);
+
+        TimerId schedule(uint64_t usec, TimerCallback callback);
+        bool cancel(TimerId id);
         
         int count();
+        int workers();
+        unsigned int deadlineMisses();
+
+        void summarise(std::vector<JobStats::Summary>& summaries);
+        std::string report();
+
+        Load load();
+        void setWorkerLimit(int limit);
+        int workerLimit();
+
+        static uint64_t now();
         
     private:
-        bool acquireRunLock(Job* job);
-        void releaseRunLock(Job* job);
-        void removeJobFromList(Job* job);
-        
-        Job* _head;  ///< First job in linked list.
-        Job* _tail;  ///< Last job in linked list.
-        
-        EmptyJob _empty1;  ///< Used for internal implementation.
-        EmptyJob _empty2;  ///< Used for internal implementation.
+        JobPool(const JobPool&);             ///< This method is undefined.
+        JobPool& operator=(const JobPool&);  ///< This method is undefined.
+
+        static const int SHARED_INTERVAL = 31;  ///< Runs between shared checks.
+        static const int INTERACTIVE_INTERVAL = 2;  ///< Runs between interactive turns.
+        static const int BACKGROUND_INTERVAL = 8;   ///< Runs between background turns.
+        static const int MAX_NODES = 8;             ///< Limit on distinct nodes.
+        static const uint64_t TIMER_RESOLUTION = 1000;  ///< Microseconds.
+
+        typedef JobQueue Queues[Job::PRIORITIES];
+
+        /// Per worker scheduling state.
+        struct Slot {
+            Slot();
+
+            int size() const;
+
+            Queues queues;             ///< Jobs owned by this worker.
+            std::atomic<bool> active;  ///< Whether a worker owns the slot.
+            int node;                  ///< Node the worker runs on.
+            uint32_t seed;             ///< State for victim selection.
+            unsigned int runs;         ///< Jobs run by this worker.
+            int round;                 ///< Jobs left to run this round.
+
+            std::atomic<uint64_t> busyTime;  ///< Time spent running jobs.
+            std::atomic<uint64_t> waitTime;  ///< Time its jobs waited to run.
+            std::atomic<uint64_t> runCount;  ///< Jobs run, for load sampling.
+        };
+
+        typedef std::vector<Job*> JobVector;
+        typedef std::tr1::unordered_set<Job*> JobSet;
+        typedef std::map<std::type_index, JobStats*> JobStatsMap;
+
+        int attachWorker(int node);
+        void detachWorker(int slot);
+        bool runNextJob(int slot);
+        void park(const std::atomic<bool>& stop);
+        void unparkAll();
+
+        bool excess(int slot) const;
+        void parkExcess(int slot, const std::atomic<bool>& stop);
+        void releaseJobs(int slot);
+
+        void requeue(Job* job);
+        void enqueueFrom(int slot, Job* job);
+        void enqueue(Queues& queues, Job* job);
+        void notify();
+        bool hasWork() const;
+
+        void blockJob(Job* job, int slot);
+        void setTimer(Job* job);
+        void cancelTimer(Job* job);
+        void fireTimers();
+        void timerAdded(uint64_t time);
+
+        Job* acquireJob(int slot);
+        Job* takeOverdueJob(int slot);
+        Job* stealJob(int slot);
+        Job* stealFrom(int victim);
+        int randomVictim(int slot);
+        void checkDeadline(Job* job, uint64_t time);
+        JobStats* statsFor(const Job& job);
+        void runReadOnlyJobs();
+        void destroyJob(Job* job);
         
-        int _count;  ///< Number of jobs in pool.
+        Slot _slots[MAX_WORKERS];     ///< Scheduling state for each worker.
+        std::atomic<int> _slotCount;  ///< Highest attached slot plus one.
+        Queues _shared;               ///< Jobs not yet taken by a worker.
+        Queues _nodeShared[MAX_NODES];  ///< Jobs waiting for a worker on a node.
+
+        JobSet _all;             ///< Every job owned by the pool.
+        Lock<JobSet> _allLock;   ///< Lock for set of all jobs.
+
+        JobVector _readOnly;           ///< Jobs run by every worker.
+        Lock<JobVector> _readOnlyLock; ///< Lock for read-only jobs.
+
+        TimerWheel _timers;               ///< Wake timers and callbacks.
+        Lock<TimerWheel> _timersLock;     ///< Lock for timers.
+        std::atomic<uint64_t> _nextTimer; ///< Time the next timer is due.
+
+        std::atomic<int> _epoch;     ///< Futex word changed when work arrives.
+        std::atomic<int> _sleeping;  ///< Number of parked workers.
+
+        std::atomic<int> _workerLimit;  ///< Number of workers allowed to run.
+        std::atomic<int> _limitEpoch;   ///< Futex word changed with the limit.
+
+        JobStatsMap _jobStats;             ///< Statistics for each job type.
+        Lock<JobStatsMap> _jobStatsLock;   ///< Lock for job statistics.
+
+        std::atomic<int> _count;  ///< Number of jobs in pool.
+        std::atomic<unsigned int> _deadlineMisses;  ///< Realtime jobs run late.
 };
 
 
@@ -103,16 +321,19 @@ class JobPool {
 /// not own jobs themselves so the user is free to add and remove workers as 
 /// they wish. One heuristic for the number of workers to have is the number of
 /// processor cores available. Be aware that adding more workers than there are
-/// jobs will lead to wasted CPU time because some workers will just spend time
-/// fruitlessly looking for a job to do.
+/// jobs will not make things faster, but spare workers sleep rather than 
+/// spending CPU time looking for jobs. Constructing more than
+/// JobPool::MAX_WORKERS workers for a pool throws MemoryException. A worker may be pinned to a set of CPUs with pin(),
+/// in which case it should be given the NUMA node of those CPUs.
 class Worker {
     public:
         typedef pthread_t Identifier;      ///< Unique to each worker.
         typedef pthread_key_t StorageKey;  ///< Key for local storage.
         
-        Worker(JobPool& jobs);
+        Worker(JobPool& jobs, int node = 0);
         ~Worker();
         
+        void pin(const std::vector<int>& cpus);
         void terminate();
         
         static Identifier self();
@@ -124,8 +345,10 @@ class Worker {
         static void* threadMain(void* args);
         pthread_t _thread;  ///< Thread identifier.
         
-        JobPool& _jobs;   ///< JobPool object from which to do jobs.
-        bool _terminate;  ///< Indicates whether to stop worker thread.
+        JobPool& _jobs;                 ///< JobPool object from which to do jobs.
+        int _node;                      ///< NUMA node the worker runs on.
+        int _slot;                      ///< Slot of the worker in the pool.
+        std::atomic<bool> _terminate;   ///< Indicates whether to stop worker thread.
 };
 
 
@@ -0,0 +1,38 @@
+/// \file demangle.hpp
+/// \brief Readable names for types.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef DEMANGLE_HPP
+#define DEMANGLE_HPP
+
+
+#include <string>
+#include <typeinfo>
+#include <stdlib.h>
+#include <cxxabi.h>
+
+
+/// Get the name of a type as it would appear in source code.
+/// \param type The type.
+/// \return Demangled name, or the mangled one if it cannot be demangled.
+inline std::string demangle(const std::type_info& type)
+{
+    int status = 0;
+    char* readable = abi::__cxa_demangle(type.name(), 0, 0, &status);
+
+    if (readable == 0)
+        return type.name();
+
+    std::string result(readable);
+    free(readable);
+
+    return result;
+}
+
+
+#endif  // DEMANGLE_HPP
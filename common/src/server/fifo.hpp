@@ -15,6 +15,7 @@
 #include <assert.h>
 #include <core/core.hpp>
 #include "autolock.hpp"
+#include "concurrency.hpp"
 
 
 namespace fifo {
@@ -33,7 +34,8 @@ static const int FIFOSIZE = 10;  ///< Space to reserve on each end of FIFO.
 /// connecting a fifo::Put and a fifo::Get together (see Put::connectTo). When 
 /// one end of an established FIFO pipe is destroyed the pipe is automatically 
 /// broken and all objects in transit are deleted. The remaining end may be 
-/// reused as part of another FIFO pipe.
+/// reused as part of another FIFO pipe. Putting an object into the pipe wakes
+/// the job reading from the other end (see Get::setReader).
 template<typename T>
 class Put {
     public:
@@ -45,12 +47,14 @@ class Put {
         void clear();
         void transfer();
         void put(const T& object);
+        void put(std::unique_ptr<T> object);
         void connectTo(Get<T>& get);
         bool closed() const;
         bool empty() const;
 
     private:
         void disconnect();
+        void wakeReader();
 
         typedef AutoWriteLock<Put> HalfLockFIFO;
         typedef typename Lockable<T*>::Vector Vector;
@@ -83,6 +87,7 @@ class Get {
         void transfer();
         std::unique_ptr<T> get();
         void connectTo(Put<T>& put);
+        void setReader(Job* job);
         bool closed() const;
         bool empty() const;
 
@@ -99,6 +104,7 @@ class Get {
         Put<T>* _put;     ///< Pointer to other end of pipe.
         Vector _vec;      ///< Holds objects to be read from pipe.
         size_t _index;    ///< Index of next object to be read.
+        Job* _reader;     ///< Job to wake when objects arrive.
 
         class LockFIFO {
             public:
@@ -169,9 +175,23 @@ void fifo::Put<T>::put(const T& object)
     if (closed()) 
         return;
 
-    auto p = object.clone();
-    WriteLock(_vec)->push_back(p.get());
-    p.release();
+    put(object.clone());
+}
+
+/// Puts an object into the FIFO pipe without copying it.
+/// The pipe takes ownership of the object. If the pipe is not connected the
+/// object is deleted.
+/// \param object The object to put into the pipe.
+template<typename T>
+void fifo::Put<T>::put(std::unique_ptr<T> object)
+{
+    if (closed()) 
+        return;
+
+    WriteLock(_vec)->push_back(object.get());
+    object.release();
+
+    wakeReader();
 }
 
 /// Form a FIFO pipe between two ends.
@@ -210,12 +230,24 @@ void fifo::Put<T>::disconnect()
 }
 
 
+/// Wake the job reading from the other end of the FIFO pipe.
+/// This end is locked while the job is woken so that the other end cannot be
+/// disconnected and destroyed in the meantime.
+template<typename T>
+void fifo::Put<T>::wakeReader()
+{
+    HalfLockFIFO lock(_lock);
+    if ((_get != 0) && (_get->_reader != 0)) 
+        _get->_reader->wake();
+}
+
+
 ////////// fifo::Get //////////
 
 /// Create the readable end of a FIFO pipe.
 template<typename T>
 fifo::Get<T>::Get() :
-    _lock(*this), _put(0), _index(0)
+    _lock(*this), _put(0), _index(0), _reader(0)
 {
     WriteLock(_vec)->reserve(FIFOSIZE);
 }
@@ -286,6 +318,17 @@ void fifo::Get<T>::connectTo(Put<T>& put)
     put._get = this;
 }
 
+/// Set the job that reads from this end of the FIFO pipe.
+/// The job is woken whenever objects are put into the pipe or transferred to
+/// this end from the other, so it may block while the pipe is empty. This 
+/// should be called before the pipe is connected.
+/// \param job The reading job.
+template<typename T>
+void fifo::Get<T>::setReader(Job* job)
+{
+    _reader = job;
+}
+
 /// \return Whether this end is part of a FIFO pipe.
 template<typename T>
 inline bool fifo::Get<T>::closed() const
@@ -319,6 +362,9 @@ void fifo::Get<T>::transfer(bool referred)
     clear();
 
     WriteLock(_put->_vec)->swap(*WriteLock(_vec));
+
+    if (referred && (_reader != 0) && !empty()) 
+        _reader->wake();
 }
 
 /// Disconnect FIFO pipe and free any objects that are in transit.
@@ -0,0 +1,91 @@
+#include "histogram.hpp"
+
+
+////////// Histogram //////////
+
+/// Construct an empty Histogram.
+Histogram::Histogram()
+    : _count(0), _total(0), _max(0)
+{
+    for (int i = 0; i < BUCKETS; i++)
+        _buckets[i] = 0;
+}
+
+/// Add a value.
+/// \param value The value to add.
+void Histogram::add(uint64_t value)
+{
+    int bucket = (value == 0 ? 0 : 64 - __builtin_clzll(value));
+
+    _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _total.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t max = _max.load(std::memory_order_relaxed);
+    while ((value > max) && !_max.compare_exchange_weak(max, value, 
+        std::memory_order_relaxed));
+}
+
+/// Remove all values.
+/// Values added by other threads while this runs may be partly kept.
+void Histogram::reset()
+{
+    for (int i = 0; i < BUCKETS; i++)
+        _buckets[i] = 0;
+
+    _count = 0;
+    _total = 0;
+    _max = 0;
+}
+
+/// Used to find out how many values have been added.
+/// \return Number of values.
+uint64_t Histogram::count() const
+{
+    return _count.load(std::memory_order_relaxed);
+}
+
+/// Used to find out the sum of all values added.
+/// \return Sum of values.
+uint64_t Histogram::total() const
+{
+    return _total.load(std::memory_order_relaxed);
+}
+
+/// Used to find out the largest value added.
+/// \return Largest value or zero if there are none.
+uint64_t Histogram::max() const
+{
+    return _max.load(std::memory_order_relaxed);
+}
+
+/// Used to find out the mean of the values added.
+/// \return Mean value or zero if there are none.
+uint64_t Histogram::mean() const
+{
+    uint64_t count = this->count();
+
+    return (count > 0 ? total() / count : 0);
+}
+
+/// Estimate a percentile.
+/// \param fraction Fraction of values that should be at or below the result,
+///                 for example 0.99 for the 99th percentile.
+/// \return Upper bound of the bucket holding the percentile, capped at the
+///         largest value added.
+uint64_t Histogram::percentile(double fraction) const
+{
+    uint64_t target = uint64_t(fraction * count());
+    uint64_t seen = 0;
+
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += _buckets[i].load(std::memory_order_relaxed);
+
+        if ((seen > target) || (i == BUCKETS - 1)) {
+            uint64_t bound = (i == 0 ? 0 : (i >= 64 ? UINT64_MAX : (uint64_t(1) << i) - 1));
+            return (bound < max() ? bound : max());
+        }
+    }
+
+    return max();
+}
@@ -0,0 +1,50 @@
+/// \file histogram.hpp
+/// \brief Lock free histogram for latency statistics.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+
+#include <atomic>
+#include <stdint.h>
+
+
+/// Counts values in buckets whose bounds are powers of two.
+/// Values may be added from any number of threads at once without locking.
+/// Bucket \em n holds values below 2^n that do not fit in a lower bucket, so
+/// percentiles are only accurate to within a factor of two. That is plenty
+/// for spotting which of several things is slow, and adding a value costs
+/// only a few atomic increments.
+class Histogram {
+    public:
+        Histogram();
+
+        void add(uint64_t value);
+        void reset();
+
+        uint64_t count() const;
+        uint64_t total() const;
+        uint64_t max() const;
+        uint64_t mean() const;
+        uint64_t percentile(double fraction) const;
+
+    private:
+        Histogram(const Histogram&);             ///< This method is undefined.
+        Histogram& operator=(const Histogram&);  ///< This method is undefined.
+
+        static const int BUCKETS = 65;  ///< One per bit plus one for zero.
+
+        std::atomic<uint64_t> _buckets[BUCKETS];  ///< Values in each bucket.
+        std::atomic<uint64_t> _count;             ///< Number of values added.
+        std::atomic<uint64_t> _total;             ///< Sum of values added.
+        std::atomic<uint64_t> _max;               ///< Largest value added.
+};
+
+
+#endif  // HISTOGRAM_HPP
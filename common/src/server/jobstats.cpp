@@ -0,0 +1,75 @@
+#include <sstream>
+#include <core/core.hpp>
+#include "jobstats.hpp"
+
+
+////////// JobStats //////////
+
+/// Construct JobStats with no runs recorded.
+/// \param name Type name of the jobs.
+/// \param time The current time in microseconds.
+JobStats::JobStats(const std::string& name, uint64_t time)
+    : _name(name), _runs(0), _runaways(0), _lastRuns(0), _lastTime(time)
+{
+
+}
+
+/// Record a run of a job.
+/// This may be called by several workers at once.
+/// \param wait Microseconds between the job becoming runnable and running.
+/// \param duration Microseconds the run took.
+void JobStats::recordRun(uint64_t wait, uint64_t duration)
+{
+    _runs.fetch_add(1, std::memory_order_relaxed);
+    _runTime.add(duration);
+    _waitTime.add(wait);
+
+    if (duration <= RUNAWAY_LIMIT)
+        return;
+
+    // Log each time the count doubles so a job stuck in a loop does not flood
+    // the log.
+    uint64_t runaways = ++_runaways;
+
+    if ((runaways & (runaways - 1)) == 0) {
+        std::ostringstream message;
+        message << "JobPool: " << _name << " ran for " << duration 
+                << "us (" << runaways << " long runs so far)";
+        Log::log->warn(message.str());
+    }
+}
+
+/// Summarise the statistics.
+/// The run rate is measured since the previous summary, so this should only
+/// be called by one thread at a time.
+/// \param time The current time in microseconds.
+/// \return The summary.
+JobStats::Summary JobStats::summarise(uint64_t time)
+{
+    Summary summary;
+    summary.name = _name;
+    summary.runs = _runs.load();
+    summary.runsPerSecond = 0.0;
+    summary.runP50 = _runTime.percentile(0.5);
+    summary.runP99 = _runTime.percentile(0.99);
+    summary.runMax = _runTime.max();
+    summary.waitP50 = _waitTime.percentile(0.5);
+    summary.waitP99 = _waitTime.percentile(0.99);
+    summary.waitMax = _waitTime.max();
+    summary.runaways = _runaways.load();
+
+    if (time > _lastTime)
+        summary.runsPerSecond = (summary.runs - _lastRuns) * 1e6 / (time - _lastTime);
+
+    _lastRuns = summary.runs;
+    _lastTime = time;
+
+    return summary;
+}
+
+/// Used to find out which jobs the statistics are for.
+/// \return Type name of the jobs.
+const std::string& JobStats::name() const
+{
+    return _name;
+}
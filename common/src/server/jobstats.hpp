@@ -0,0 +1,65 @@
+/// \file jobstats.hpp
+/// \brief Runtime statistics for jobs.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef JOBSTATS_HPP
+#define JOBSTATS_HPP
+
+
+#include <string>
+#include <atomic>
+#include <stdint.h>
+#include "histogram.hpp"
+
+
+/// Runtime statistics shared by every Job of one type.
+/// The JobPool records how long each run of a job took and how long the job
+/// waited between becoming runnable and being run. Times are in microseconds.
+/// A run taking longer than RUNAWAY_LIMIT is counted as a runaway and logged,
+/// since it holds up a worker for long enough that players may notice.
+class JobStats {
+    public:
+        /// Statistics at one moment in time.
+        struct Summary {
+            std::string name;      ///< Type name of the jobs.
+            uint64_t runs;         ///< Runs since the pool was created.
+            double runsPerSecond;  ///< Rate of runs since the last summary.
+            uint64_t runP50;       ///< Median run time.
+            uint64_t runP99;       ///< 99th percentile run time.
+            uint64_t runMax;       ///< Longest run time.
+            uint64_t waitP50;      ///< Median wait to be run.
+            uint64_t waitP99;      ///< 99th percentile wait to be run.
+            uint64_t waitMax;      ///< Longest wait to be run.
+            uint64_t runaways;     ///< Runs longer than RUNAWAY_LIMIT.
+        };
+
+        JobStats(const std::string& name, uint64_t time);
+
+        void recordRun(uint64_t wait, uint64_t duration);
+        Summary summarise(uint64_t time);
+
+        const std::string& name() const;
+
+    private:
+        JobStats(const JobStats&);             ///< This method is undefined.
+        JobStats& operator=(const JobStats&);  ///< This method is undefined.
+
+        static const uint64_t RUNAWAY_LIMIT = 50000;  ///< Microseconds.
+
+        const std::string _name;          ///< Type name of the jobs.
+        std::atomic<uint64_t> _runs;      ///< Number of runs.
+        std::atomic<uint64_t> _runaways;  ///< Number of runaway runs.
+        Histogram _runTime;               ///< Duration of each run.
+        Histogram _waitTime;              ///< Wait before each run.
+
+        uint64_t _lastRuns;  ///< Runs at the last summary.
+        uint64_t _lastTime;  ///< Time of the last summary.
+};
+
+
+#endif  // JOBSTATS_HPP
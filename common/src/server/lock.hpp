@@ -6,6 +6,9 @@
 /// Copyright (c) 2007 Ben Radford.
 ///
 /// Modifications (most recent first):
+/// - 17/10/26 Added optional contention profiling.
+/// - 17/10/26 Reimplemented on std::atomic with writer preference and backoff.
+/// - 17/10/26 Added pause instruction to spin loops.
 /// - 08/10/07 Made the try locks fully atomic using the assembly lock prefix.
 
 
@@ -13,6 +16,48 @@
 #define LOCK_HPP
 
 
+#include <sched.h>
+#include <atomic>
+#include <stdint.h>
+
+#ifdef LOCK_PROFILING
+#include "lockprofile.hpp"
+#endif
+
+
+/// Tell the processor the calling thread is spinning.
+/// This eases pressure on the memory bus and lets a sibling hyperthread run.
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile ("yield" ::: "memory");
+#endif
+}
+
+
+/// Exponential backoff for spin loops.
+/// Each call to pause() spins for twice as long as the one before. Once the 
+/// spins would exceed MAX_SPINS the thread yields the processor instead, so
+/// a thread waiting on a lock whose holder has been descheduled does not burn
+/// the rest of its time slice.
+class Backoff {
+    public:
+        Backoff();
+        
+        void pause();
+        
+        unsigned int pauses() const;
+        
+    private:
+        static const unsigned int MAX_SPINS = 1024;  ///< Spins before yielding.
+        
+        unsigned int _spins;   ///< Spins on the next pause.
+        unsigned int _pauses;  ///< Number of calls to pause().
+};
+
+
 /// Safely manages access to an object in a multi-threaded environment.
 /// The %Lock is constructed by with a reference to the object it is to manage.
 /// All access to this object must then be done via the lock to guarantee thread
@@ -22,10 +67,22 @@
 /// no read-only locks may be held at the same time as it. Multiple read-only 
 /// locks may be held at once. This ensures data is in a consistent state when 
 /// it is read. 
+///
+/// The lock state is a single atomic word holding a writer bit, a pending bit
+/// and a count of readers. A writer that has to wait sets the pending bit, 
+/// which stops new readers from taking the lock so that writers are not 
+/// starved by a steady stream of readers. A consequence is that a thread must
+/// not wait for a read-only lock it already holds, since a writer may arrive
+/// in between. Waiting uses exponential Backoff.
+///
+/// When built with LOCK_PROFILING defined each lock records its statistics in
+/// the LockSite for the file and line it was constructed on, which default to
+/// those of the caller.
 template<typename T>
 class Lock {
     public:
-        Lock(T& object);
+        Lock(T& object, const char* file = __builtin_FILE(), 
+            int line = __builtin_LINE());
         
         T* rwTryLock();
         T& rwWaitLock();
@@ -47,21 +104,74 @@ class Lock {
         Lock(const Lock&);
         Lock& operator=(const Lock&);
 
-        unsigned char _rw;  ///< Read-write lock flag.
-        unsigned char _ro;  ///< Read-only lock count.
-        T& _object;         ///< Object to manage locks for.
+        void profileAcquired(bool write, const Backoff* backoff);
+        void profileFailed();
+        void profileReleased();
+
+        static const uint32_t WRITER = 1u << 31;        ///< Read-write lock held.
+        static const uint32_t PENDING = 1u << 30;       ///< Writer is waiting.
+        static const uint32_t READERS = PENDING - 1;    ///< Read-only lock count.
+
+        std::atomic<uint32_t> _state;  ///< Writer, pending and reader count.
+        T& _object;                    ///< Object to manage locks for.
+
+#ifdef LOCK_PROFILING
+        LockSite* _site;       ///< Statistics for where the lock was made.
+        uint64_t _acquiredAt;  ///< Time the read-write lock was taken.
+#endif
 };
 
 
+////////// Backoff //////////
+
+/// Construct a Backoff for a new spin loop.
+inline Backoff::Backoff()
+    : _spins(1), _pauses(0)
+{
+    
+}
+
+/// Wait a little before trying again.
+inline void Backoff::pause()
+{
+    _pauses++;
+    
+    if (_spins > MAX_SPINS) {
+        sched_yield();
+        return;
+    }
+    
+    for (unsigned int i = 0; i < _spins; i++)
+        cpuRelax();
+    
+    _spins *= 2;
+}
+
+/// Used to find out how long the spin loop has waited.
+/// \return Number of calls to pause().
+inline unsigned int Backoff::pauses() const
+{
+    return _pauses;
+}
+
+
 ////////// Lock //////////
 
 /// Create a lock for \em object.
 /// \param object The object to create the lock for.
+/// \param file Source file the lock is constructed in, for profiling.
+/// \param line Line the lock is constructed on, for profiling.
 template<typename T>
-inline Lock<T>::Lock(T& object)
-    : _rw(0), _ro(0), _object(object)
+inline Lock<T>::Lock(T& object, const char* file, int line)
+    : _state(0), _object(object)
 {
-    
+#ifdef LOCK_PROFILING
+    _site = LockProfile::site(typeid(T), file, line);
+    _acquiredAt = 0;
+#else
+    (void)file;
+    (void)line;
+#endif
 }
 
 /// Attempt to lock the object for read-write access.
@@ -73,53 +183,47 @@ inline Lock<T>::Lock(T& object)
 template<typename T>
 T* Lock<T>::rwTryLock()
 {
-    unsigned char lock = 0;
-    
-    // Try and get lock.
-    asm volatile (
-        "              lock cmpxchgb %%dl, %1;"
-        "              cmpb $0, %%al;         "
-        "              jne rwtry_done%=;      "
-        "              orb %2, %%al;          "
-        "              cmpb $0, %%al;         "
-        "              je rwtry_done%=;       "
-        "              lock andb $0, %1;      "
-        "rwtry_done%=:                        "
-        : "=a"(lock)
-        : "m"(_rw), "m"(_ro), "a"(0), "d"(1)
-    );
+    uint32_t state = _state.load(std::memory_order_relaxed);
     
-    // Did we get the lock?
-    if (lock != 0)
-        return 0;
+    while ((state & ~PENDING) == 0) {
+        if (_state.compare_exchange_weak(state, WRITER, 
+                std::memory_order_acquire, std::memory_order_relaxed)) {
+            profileAcquired(true, 0);
+            return &_object;
+        }
+    }
     
-    return &_object;
+    profileFailed();
+    return 0;
 }
 
 /// Lock the object for read-write access.
 /// If no read-write or read-only locks are held then this method sets the 
-/// read-write lock and returns. Otherwise it spins until the stated condition
-/// is true.
+/// read-write lock and returns. Otherwise it marks a writer as pending and 
+/// waits, backing off between attempts, until the stated condition is true.
 /// \return The locked object.
 template<typename T>
 inline T& Lock<T>::rwWaitLock()
 {
-    // Spin until we get rw lock and ro == 0.
-    asm volatile (
-        "rwwait_spin%=: xorb %%al, %%al;       "
-        "               lock cmpxchgb %%dl, %0;"
-        "               cmpb $0, %%al;         "
-        "               jne rwwait_spin%=;     "
-        "               orb %1, %%al;          "
-        "               cmpb $0, %%al;         "
-        "               je rwwait_done%=;      "
-        "               lock andb $0, %0;      "
-        "               jmp rwwait_spin%=;     "
-        "rwwait_done%=:                        "
-        : : "m"(_rw), "m"(_ro), "a"(0), "d"(1)
-    );
+    Backoff backoff;
+    uint32_t state = _state.load(std::memory_order_relaxed);
     
-    return _object;
+    while (true) {
+        if ((state & ~PENDING) == 0) {
+            if (_state.compare_exchange_weak(state, WRITER, 
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                profileAcquired(true, &backoff);
+                return _object;
+            }
+            continue;
+        }
+        
+        if ((state & PENDING) == 0)
+            _state.fetch_or(PENDING, std::memory_order_relaxed);
+        
+        backoff.pause();
+        state = _state.load(std::memory_order_relaxed);
+    }
 }
 
 /// Release a read-write lock.
@@ -130,61 +234,60 @@ inline T& Lock<T>::rwWaitLock()
 template<typename T>
 inline void Lock<T>::rwUnlock()
 {
-    asm volatile ("lock andb $0, %0" : : "m"(_rw));
+    profileReleased();
+    _state.fetch_and(~WRITER, std::memory_order_release);
 }
 
 /// Attempt to lock the object for read-only access.
-/// If the read-write lock is not held then this method locks the object for 
-/// read-only access and returns a pointer to the object. Otherwise it returns
-/// zero. The caller is allowed to read the object but must not write to it. As
-/// long as the object is const correct the compiler will enforce this 
-/// condition.
+/// If the read-write lock is not held and no writer is waiting for it then
+/// this method locks the object for read-only access and returns a pointer to
+/// the object. Otherwise it returns zero. The caller is allowed to read the
+/// object but must not write to it. As long as the object is const correct 
+/// the compiler will enforce this condition.
 /// \return A pointer to the locked object or zero.
 template<typename T>
 const T* Lock<T>::roTryLock()
 {
-    unsigned char lock = 0;
-    
-    // Try and get lock.
-    asm volatile (
-        "              lock cmpxchgb %%dl, %1;"
-        "              cmpb $0, %%al;         "
-        "              jne rotry_done%=;      "
-        "              lock incb %2;          "
-        "              lock andb $0, %1;      "
-        "rotry_done%=:                        "
-        : "=a"(lock)
-        : "m"(_rw), "m"(_ro), "a"(0), "d"(1)
-    );
+    uint32_t state = _state.load(std::memory_order_relaxed);
     
-    // Did we get the lock?
-    if (lock != 0)
-        return 0;
+    while ((state & (WRITER | PENDING)) == 0) {
+        if (_state.compare_exchange_weak(state, state + 1, 
+                std::memory_order_acquire, std::memory_order_relaxed)) {
+            profileAcquired(false, 0);
+            return &_object;
+        }
+    }
     
-    return &_object;
+    profileFailed();
+    return 0;
 }
 
 /// Lock the object for read-only access.
-/// If the read-write lock is not held then this method locks the object for 
-/// read-only access and returns. Otherwise it spins until the stated condition
-/// is true. The caller is allowed to read the object but must not write to it. 
-/// As long as the object is const correct the compiler will enforce this 
-/// condition.
+/// If the read-write lock is not held and no writer is waiting for it then 
+/// this method locks the object for read-only access and returns. Otherwise it
+/// waits, backing off between attempts, until the stated condition is true.
+/// The caller is allowed to read the object but must not write to it. As long
+/// as the object is const correct the compiler will enforce this condition.
 /// \return The locked object.
 template<typename T>
 inline const T& Lock<T>::roWaitLock()
 {
-    asm volatile (
-        "rowait_spin%=: xorb %%al, %%al;       "
-        "               lock cmpxchgb %%dl, %0;"
-        "               cmpb $0, %%al;         "
-        "               jne rowait_spin%=;     "
-        "               lock incb %1;          "
-        "               lock andb $0, %0;      "
-        : : "m"(_rw), "m"(_ro), "a"(0), "d"(1)
-    );
+    Backoff backoff;
+    uint32_t state = _state.load(std::memory_order_relaxed);
     
-    return _object;
+    while (true) {
+        if ((state & (WRITER | PENDING)) == 0) {
+            if (_state.compare_exchange_weak(state, state + 1, 
+                    std::memory_order_acquire, std::memory_order_relaxed)) {
+                profileAcquired(false, &backoff);
+                return _object;
+            }
+            continue;
+        }
+        
+        backoff.pause();
+        state = _state.load(std::memory_order_relaxed);
+    }
 }
 
 /// Release a read-only lock.
@@ -195,7 +298,7 @@ inline const T& Lock<T>::roWaitLock()
 template<typename T>
 inline void Lock<T>::roUnlock()
 {
-    asm volatile ("lock decb %0;" : : "m"(_ro));
+    _state.fetch_sub(1, std::memory_order_release);
 }
 
 /// Indicates whether the read-write lock is held.
@@ -203,7 +306,7 @@ inline void Lock<T>::roUnlock()
 template<typename T>
 inline bool Lock<T>::rwLocked() const
 {
-    return (_rw != 0);
+    return ((_state.load(std::memory_order_relaxed) & WRITER) != 0);
 }
 
 /// Indicates whether any read-only locks are held.
@@ -211,7 +314,7 @@ inline bool Lock<T>::rwLocked() const
 template<typename T>
 inline bool Lock<T>::roLocked() const
 {
-    return (_ro != 0);
+    return ((_state.load(std::memory_order_relaxed) & READERS) != 0);
 }
 
 /// Used to access the object guarded by this lock.
@@ -233,5 +336,48 @@ inline const T& Lock<T>::getObject() const
     return _object;
 }
 
+/// Record that the lock has been taken.
+/// This does nothing unless LOCK_PROFILING is defined.
+/// \param write Whether the read-write lock was taken.
+/// \param backoff Backoff used while waiting or zero for a try lock.
+template<typename T>
+inline void Lock<T>::profileAcquired(bool write, const Backoff* backoff)
+{
+#ifdef LOCK_PROFILING
+    if (backoff != 0)
+        _site->spins.fetch_add(backoff->pauses(), std::memory_order_relaxed);
+    
+    if (write) {
+        _site->rwAcquires.fetch_add(1, std::memory_order_relaxed);
+        _acquiredAt = LockProfile::now();
+    } else {
+        _site->roAcquires.fetch_add(1, std::memory_order_relaxed);
+    }
+#else
+    (void)write;
+    (void)backoff;
+#endif
+}
+
+/// Record that a try lock failed.
+/// This does nothing unless LOCK_PROFILING is defined.
+template<typename T>
+inline void Lock<T>::profileFailed()
+{
+#ifdef LOCK_PROFILING
+    _site->failedTries.fetch_add(1, std::memory_order_relaxed);
+#endif
+}
+
+/// Record how long the read-write lock was held.
+/// This does nothing unless LOCK_PROFILING is defined.
+template<typename T>
+inline void Lock<T>::profileReleased()
+{
+#ifdef LOCK_PROFILING
+    _site->held.add(LockProfile::now() - _acquiredAt);
+#endif
+}
+
 
 #endif  // LOCK_HPP
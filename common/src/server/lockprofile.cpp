@@ -0,0 +1,124 @@
+#include <map>
+#include <time.h>
+#include <vector>
+#include <sstream>
+#include <utility>
+#include <pthread.h>
+#include <algorithm>
+#include "demangle.hpp"
+#include "lockprofile.hpp"
+
+
+/// Sites keyed by type, file and line.
+typedef std::map<std::pair<std::string, std::pair<std::string, int> >, LockSite*> SiteMap;
+
+static SiteMap sites;  ///< Every site created so far.
+
+/// Guards the site map. This cannot be a Lock since locks use the map.
+static pthread_mutex_t sitesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/// Order sites with the most contended first.
+static bool moreContended(const LockSite* a, const LockSite* b)
+{
+    if (a->contention() != b->contention())
+        return (a->contention() > b->contention());
+
+    return (a->held.total() > b->held.total());
+}
+
+
+////////// LockSite //////////
+
+/// Construct a LockSite with no statistics.
+/// \param type Readable name of the locked type.
+/// \param file Source file the lock was constructed in.
+/// \param line Line the lock was constructed on.
+LockSite::LockSite(const std::string& type, const char* file, int line)
+    : type(type), file(file), line(line), rwAcquires(0), roAcquires(0), 
+      failedTries(0), spins(0)
+{
+
+}
+
+/// Measure how contended locks made at this site have been.
+/// \return Sum of failed try locks and backoff pauses.
+uint64_t LockSite::contention() const
+{
+    return failedTries.load() + spins.load();
+}
+
+
+////////// LockProfile //////////
+
+/// Find the site for a lock, creating it if necessary.
+/// \param type Type of the locked object.
+/// \param file Source file the lock is being constructed in.
+/// \param line Line the lock is being constructed on.
+/// \return The site.
+LockSite* LockProfile::site(const std::type_info& type, const char* file, int line)
+{
+    std::string name = demangle(type);
+    SiteMap::key_type key(name, std::make_pair(std::string(file), line));
+
+    pthread_mutex_lock(&sitesMutex);
+
+    LockSite*& site = sites[key];
+    if (site == 0)
+        site = new LockSite(name, file, line);
+
+    LockSite* result = site;
+
+    pthread_mutex_unlock(&sitesMutex);
+
+    return result;
+}
+
+/// Produce a report on the most contended lock sites.
+/// \return The report with one line per site.
+std::string LockProfile::report()
+{
+    std::vector<LockSite*> ranked;
+
+    pthread_mutex_lock(&sitesMutex);
+    for (auto& pair : sites)
+        ranked.push_back(pair.second);
+    pthread_mutex_unlock(&sitesMutex);
+
+    std::ostringstream report;
+
+    if (ranked.empty()) {
+        report << "lock profile: no locks recorded";
+#ifndef LOCK_PROFILING
+        report << " (build with LOCK_PROFILING defined)";
+#endif
+        return report.str();
+    }
+
+    std::sort(ranked.begin(), ranked.end(), moreContended);
+
+    report << "lock profile: " << ranked.size() << " sites, most contended first";
+
+    for (unsigned int i = 0; (i < ranked.size()) && (i < REPORT_SITES); i++) {
+        const LockSite* site = ranked[i];
+
+        report << "\n  " << site->file << ":" << site->line << " " << site->type
+               << " rw=" << site->rwAcquires << " ro=" << site->roAcquires
+               << " failed=" << site->failedTries << " spins=" << site->spins
+               << " held(ns) mean=" << site->held.mean() 
+               << " p99=" << site->held.percentile(0.99) 
+               << " max=" << site->held.max();
+    }
+
+    return report.str();
+}
+
+/// Get the time from a monotonic clock.
+/// \return Time in nanoseconds.
+uint64_t LockProfile::now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,58 @@
+/// \file lockprofile.hpp
+/// \brief Contention statistics for locks.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef LOCKPROFILE_HPP
+#define LOCKPROFILE_HPP
+
+
+#include <string>
+#include <atomic>
+#include <typeinfo>
+#include <stdint.h>
+#include "histogram.hpp"
+
+
+/// Statistics for every Lock constructed at one place in the code.
+/// Locks made by the same line of code, such as the lock in each instance of
+/// a class, share a %LockSite. Sites are never destroyed.
+struct LockSite {
+    LockSite(const std::string& type, const char* file, int line);
+
+    uint64_t contention() const;
+
+    const std::string type;  ///< Type of the locked object.
+    const char* const file;  ///< Source file the lock was constructed in.
+    const int line;          ///< Line the lock was constructed on.
+
+    std::atomic<uint64_t> rwAcquires;   ///< Read-write locks taken.
+    std::atomic<uint64_t> roAcquires;   ///< Read-only locks taken.
+    std::atomic<uint64_t> failedTries;  ///< Try locks that failed.
+    std::atomic<uint64_t> spins;        ///< Backoff pauses while waiting.
+    Histogram held;                     ///< Nanoseconds read-write lock held.
+};
+
+
+/// Registry of LockSite objects.
+/// Locks only record statistics when the server is built with LOCK_PROFILING
+/// defined, for example by passing \em --copt=-DLOCK_PROFILING to bazel. The
+/// extra bookkeeping makes every lock operation slower so it is off by 
+/// default. The report is empty in normal builds.
+class LockProfile {
+    public:
+        static LockSite* site(const std::type_info& type, const char* file, int line);
+        static std::string report();
+
+        static uint64_t now();
+
+    private:
+        static const unsigned int REPORT_SITES = 20;  ///< Sites in report.
+};
+
+
+#endif  // LOCKPROFILE_HPP
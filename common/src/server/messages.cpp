@@ -9,539 +9,1381 @@
 
 #include "messages.hpp"
 #include "msghandler.hpp"
+#include "msgpool.hpp"
+#include "msgtrace.hpp"
 
 
 ////////// msg::Message //////////
 
-msg::Message::~Message()
+void* msg::Message::operator new(size_t size)
 {
+    return MessagePool::allocate(size);
+}
 
+void msg::Message::operator delete(void* p, size_t size)
+{
+    MessagePool::release(p, size);
 }
 
+void msg::Message::operator delete(Message* p, std::destroying_delete_t, size_t size)
+{
+    if (p->_owners.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
 
-////////// msg::ZoneTellObjectPos //////////
+    p->~Message();
+    MessagePool::release(p, size);
+}
 
-msg::ZoneTellObjectPos::ZoneTellObjectPos(PlayerID player, ObjectID object, Vector3 pos) :
-    _player(player), _object(object), _pos(pos)
+msg::Message::Message()
+    : _owners(1), _trace(0)
 {
 
 }
 
-msg::ZoneTellObjectPos::~ZoneTellObjectPos()
+msg::Message::Message(const Message& other)
+    : _owners(1), _trace(0)
 {
 
 }
 
-std::unique_ptr<msg::Message> msg::ZoneTellObjectPos::clone() const
+msg::Message& msg::Message::operator=(const Message& other)
 {
-    return std::unique_ptr<Message>(new ZoneTellObjectPos(*this));
+    return *this;
 }
 
-void msg::ZoneTellObjectPos::dispatch(MessageHandler& handler)
+msg::Message::~Message()
 {
-    handler.handleZoneTellObjectPos(_player, _object, _pos);
+    delete _trace;
 }
 
-bool msg::ZoneTellObjectPos::matches(int subscription)
+void msg::Message::share(unsigned int readers) const
 {
-    return ((subscription & MSG_ZONETELL) != 0);
+    _owners.fetch_add(readers, std::memory_order_relaxed);
+}
+
+msg::Trace* msg::Message::trace() const
+{
+    return _trace;
 }
 
+void msg::Message::setTrace(Trace* trace) const
+{
+    _trace = trace;
+}
 
-////////// msg::ZoneTellObjectAll //////////
 
-msg::ZoneTellObjectAll::ZoneTellObjectAll(PlayerID player, ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state) :
-    _player(player), _object(object), _pos(pos), _vel(vel), _rot(rot), _state(state)
+////////// msg::ZoneTellObjectPos //////////
+
+msg::ZoneTellObjectPos::ZoneTellObjectPos(PlayerID player, ObjectID object, Vector3 pos) :
+    _player(player), _object(object), _pos(pos)
 {
 
 }
 
-msg::ZoneTellObjectAll::~ZoneTellObjectAll()
+msg::ZoneTellObjectPos::~ZoneTellObjectPos()
 {
 
 }
 
-std::unique_ptr<msg::Message> msg::ZoneTellObjectAll::clone() const
+std::unique_ptr<msg::Message> msg::ZoneTellObjectPos::clone() const
 {
-    return std::unique_ptr<Message>(new ZoneTellObjectAll(*this));
+    return std::unique_ptr<Message>(new ZoneTellObjectPos(*this));
 }
 
-void msg::ZoneTellObjectAll::dispatch(MessageHandler& handler)
+void msg::ZoneTellObjectPos::dispatch(MessageHandler& handler) const
 {
-    handler.handleZoneTellObjectAll(_player, _object, _pos, _vel, _rot, _state);
+    handler.handleZoneTellObjectPos(_player, _object, _pos);
 }
 
-bool msg::ZoneTellObjectAll::matches(int subscription)
+bool msg::ZoneTellObjectPos::matches(int subscription) const
 {
     return ((subscription & MSG_ZONETELL) != 0);
 }
 
-
-////////// msg::ZoneSaysObjectEnter //////////
-
-msg::ZoneSaysObjectEnter::ZoneSaysObjectEnter(ObjectID object) :
-    _object(object)
+int msg::ZoneTellObjectPos::type() const
 {
-
+    return MSG_ZONETELL;
 }
 
-msg::ZoneSaysObjectEnter::~ZoneSaysObjectEnter()
+msg::MsgId msg::ZoneTellObjectPos::id() const
 {
-
+    return ID_ZONETELLOBJECTPOS;
 }
 
-std::unique_ptr<msg::Message> msg::ZoneSaysObjectEnter::clone() const
+void msg::ZoneTellObjectPos::encode(Writer& writer) const
 {
-    return std::unique_ptr<Message>(new ZoneSaysObjectEnter(*this));
+    writer.write(_player);
+    writer.write(_object);
+    writer.write(_pos);
 }
 
-void msg::ZoneSaysObjectEnter::dispatch(MessageHandler& handler)
+bool msg::ZoneTellObjectPos::keyed() const
 {
-    handler.handleZoneSaysObjectEnter(_object);
+    return true;
 }
 
-bool msg::ZoneSaysObjectEnter::matches(int subscription)
+uint64_t msg::ZoneTellObjectPos::key() const
 {
-    return ((subscription & MSG_ZONESAYS) != 0);
+    return _player;
 }
 
-
-////////// msg::ZoneSaysObjectLeave //////////
-
-msg::ZoneSaysObjectLeave::ZoneSaysObjectLeave(ObjectID object) :
-    _object(object)
+bool msg::ZoneTellObjectPos::coalesces() const
 {
-
+    return false;
 }
 
-msg::ZoneSaysObjectLeave::~ZoneSaysObjectLeave()
+uint64_t msg::ZoneTellObjectPos::stateKey() const
 {
-
+    return 0;
 }
 
-std::unique_ptr<msg::Message> msg::ZoneSaysObjectLeave::clone() const
+const PlayerID& msg::ZoneTellObjectPos::player() const
 {
-    return std::unique_ptr<Message>(new ZoneSaysObjectLeave(*this));
+    return _player;
 }
 
-void msg::ZoneSaysObjectLeave::dispatch(MessageHandler& handler)
+const ObjectID& msg::ZoneTellObjectPos::object() const
 {
-    handler.handleZoneSaysObjectLeave(_object);
+    return _object;
 }
 
-bool msg::ZoneSaysObjectLeave::matches(int subscription)
+const Vector3& msg::ZoneTellObjectPos::pos() const
 {
-    return ((subscription & MSG_ZONESAYS) != 0);
+    return _pos;
 }
 
 
-////////// msg::ZoneSaysObjectClearClose //////////
+////////// msg::ZoneTellObjectAll //////////
 
-msg::ZoneSaysObjectClearClose::ZoneSaysObjectClearClose(ObjectID object) :
-    _object(object)
+msg::ZoneTellObjectAll::ZoneTellObjectAll(PlayerID player, ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state) :
+    _player(player), _object(object), _pos(pos), _vel(vel), _rot(rot), _state(state)
 {
 
 }
 
-msg::ZoneSaysObjectClearClose::~ZoneSaysObjectClearClose()
+msg::ZoneTellObjectAll::~ZoneTellObjectAll()
 {
 
 }
 
-std::unique_ptr<msg::Message> msg::ZoneSaysObjectClearClose::clone() const
+std::unique_ptr<msg::Message> msg::ZoneTellObjectAll::clone() const
 {
-    return std::unique_ptr<Message>(new ZoneSaysObjectClearClose(*this));
+    return std::unique_ptr<Message>(new ZoneTellObjectAll(*this));
 }
 
-void msg::ZoneSaysObjectClearClose::dispatch(MessageHandler& handler)
+void msg::ZoneTellObjectAll::dispatch(MessageHandler& handler) const
 {
-    handler.handleZoneSaysObjectClearClose(_object);
+    handler.handleZoneTellObjectAll(_player, _object, _pos, _vel, _rot, _state);
 }
 
-bool msg::ZoneSaysObjectClearClose::matches(int subscription)
+bool msg::ZoneTellObjectAll::matches(int subscription) const
 {
-    return ((subscription & MSG_ZONESAYS) != 0);
+    return ((subscription & MSG_ZONETELL) != 0);
 }
 
-
-////////// msg::ZoneSaysObjectsClose //////////
-
-msg::ZoneSaysObjectsClose::ZoneSaysObjectsClose(ObjectID a, ObjectID b) :
-    _a(a), _b(b)
+int msg::ZoneTellObjectAll::type() const
 {
-
+    return MSG_ZONETELL;
 }
 
-msg::ZoneSaysObjectsClose::~ZoneSaysObjectsClose()
+msg::MsgId msg::ZoneTellObjectAll::id() const
 {
-
+    return ID_ZONETELLOBJECTALL;
 }
 
-std::unique_ptr<msg::Message> msg::ZoneSaysObjectsClose::clone() const
+void msg::ZoneTellObjectAll::encode(Writer& writer) const
 {
-    return std::unique_ptr<Message>(new ZoneSaysObjectsClose(*this));
+    writer.write(_player);
+    writer.write(_object);
+    writer.write(_pos);
+    writer.write(_vel);
+    writer.write(_rot);
+    writer.write(_state);
 }
 
-void msg::ZoneSaysObjectsClose::dispatch(MessageHandler& handler)
+bool msg::ZoneTellObjectAll::keyed() const
 {
-    handler.handleZoneSaysObjectsClose(_a, _b);
+    return true;
 }
 
-bool msg::ZoneSaysObjectsClose::matches(int subscription)
+uint64_t msg::ZoneTellObjectAll::key() const
 {
-    return ((subscription & MSG_ZONESAYS) != 0);
+    return _player;
 }
 
+bool msg::ZoneTellObjectAll::coalesces() const
+{
+    return false;
+}
 
-////////// msg::ZoneSaysObjectAttach //////////
-
-msg::ZoneSaysObjectAttach::ZoneSaysObjectAttach(ObjectID object, PlayerID player) :
-    _object(object), _player(player)
+uint64_t msg::ZoneTellObjectAll::stateKey() const
 {
+    return 0;
+}
 
+const PlayerID& msg::ZoneTellObjectAll::player() const
+{
+    return _player;
 }
 
-msg::ZoneSaysObjectAttach::~ZoneSaysObjectAttach()
+const ObjectID& msg::ZoneTellObjectAll::object() const
 {
+    return _object;
+}
 
+const Vector3& msg::ZoneTellObjectAll::pos() const
+{
+    return _pos;
 }
 
-std::unique_ptr<msg::Message> msg::ZoneSaysObjectAttach::clone() const
+const Vector3& msg::ZoneTellObjectAll::vel() const
 {
-    return std::unique_ptr<Message>(new ZoneSaysObjectAttach(*this));
+    return _vel;
 }
 
-void msg::ZoneSaysObjectAttach::dispatch(MessageHandler& handler)
+const float& msg::ZoneTellObjectAll::rot() const
 {
-    handler.handleZoneSaysObjectAttach(_object, _player);
+    return _rot;
 }
 
-bool msg::ZoneSaysObjectAttach::matches(int subscription)
+const ControlState& msg::ZoneTellObjectAll::state() const
 {
-    return ((subscription & MSG_ZONESAYS) != 0);
+    return _state;
 }
 
 
-////////// msg::ZoneSaysObjectName //////////
+////////// msg::ZoneSaysObjectEnter //////////
 
-msg::ZoneSaysObjectName::ZoneSaysObjectName(ObjectID object, const std::string& name) :
-    _object(object), _name(name)
+msg::ZoneSaysObjectEnter::ZoneSaysObjectEnter(ObjectID object) :
+    _object(object)
 {
 
 }
 
-msg::ZoneSaysObjectName::~ZoneSaysObjectName()
+msg::ZoneSaysObjectEnter::~ZoneSaysObjectEnter()
 {
 
 }
 
-std::unique_ptr<msg::Message> msg::ZoneSaysObjectName::clone() const
+std::unique_ptr<msg::Message> msg::ZoneSaysObjectEnter::clone() const
 {
-    return std::unique_ptr<Message>(new ZoneSaysObjectName(*this));
+    return std::unique_ptr<Message>(new ZoneSaysObjectEnter(*this));
 }
 
-void msg::ZoneSaysObjectName::dispatch(MessageHandler& handler)
+void msg::ZoneSaysObjectEnter::dispatch(MessageHandler& handler) const
 {
-    handler.handleZoneSaysObjectName(_object, _name);
+    handler.handleZoneSaysObjectEnter(_object);
 }
 
-bool msg::ZoneSaysObjectName::matches(int subscription)
+bool msg::ZoneSaysObjectEnter::matches(int subscription) const
 {
     return ((subscription & MSG_ZONESAYS) != 0);
 }
 
+int msg::ZoneSaysObjectEnter::type() const
+{
+    return MSG_ZONESAYS;
+}
 
-////////// msg::ZoneSaysObjectPos //////////
-
-msg::ZoneSaysObjectPos::ZoneSaysObjectPos(ObjectID object, Vector3 pos) :
-    _object(object), _pos(pos)
+msg::MsgId msg::ZoneSaysObjectEnter::id() const
 {
+    return ID_ZONESAYSOBJECTENTER;
+}
 
+void msg::ZoneSaysObjectEnter::encode(Writer& writer) const
+{
+    writer.write(_object);
 }
 
-msg::ZoneSaysObjectPos::~ZoneSaysObjectPos()
+bool msg::ZoneSaysObjectEnter::keyed() const
 {
+    return false;
+}
 
+uint64_t msg::ZoneSaysObjectEnter::key() const
+{
+    return 0;
 }
 
-std::unique_ptr<msg::Message> msg::ZoneSaysObjectPos::clone() const
+bool msg::ZoneSaysObjectEnter::coalesces() const
 {
-    return std::unique_ptr<Message>(new ZoneSaysObjectPos(*this));
+    return false;
 }
 
-void msg::ZoneSaysObjectPos::dispatch(MessageHandler& handler)
+uint64_t msg::ZoneSaysObjectEnter::stateKey() const
 {
-    handler.handleZoneSaysObjectPos(_object, _pos);
+    return 0;
 }
 
-bool msg::ZoneSaysObjectPos::matches(int subscription)
+const ObjectID& msg::ZoneSaysObjectEnter::object() const
 {
-    return ((subscription & MSG_ZONESAYS) != 0);
+    return _object;
 }
 
 
-////////// msg::ZoneSaysObjectAll //////////
+////////// msg::ZoneSaysObjectLeave //////////
 
-msg::ZoneSaysObjectAll::ZoneSaysObjectAll(ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state) :
-    _object(object), _pos(pos), _vel(vel), _rot(rot), _state(state)
+msg::ZoneSaysObjectLeave::ZoneSaysObjectLeave(ObjectID object) :
+    _object(object)
 {
 
 }
 
-msg::ZoneSaysObjectAll::~ZoneSaysObjectAll()
+msg::ZoneSaysObjectLeave::~ZoneSaysObjectLeave()
 {
 
 }
 
-std::unique_ptr<msg::Message> msg::ZoneSaysObjectAll::clone() const
+std::unique_ptr<msg::Message> msg::ZoneSaysObjectLeave::clone() const
 {
-    return std::unique_ptr<Message>(new ZoneSaysObjectAll(*this));
+    return std::unique_ptr<Message>(new ZoneSaysObjectLeave(*this));
 }
 
-void msg::ZoneSaysObjectAll::dispatch(MessageHandler& handler)
+void msg::ZoneSaysObjectLeave::dispatch(MessageHandler& handler) const
 {
-    handler.handleZoneSaysObjectAll(_object, _pos, _vel, _rot, _state);
+    handler.handleZoneSaysObjectLeave(_object);
 }
 
-bool msg::ZoneSaysObjectAll::matches(int subscription)
+bool msg::ZoneSaysObjectLeave::matches(int subscription) const
 {
     return ((subscription & MSG_ZONESAYS) != 0);
 }
 
+int msg::ZoneSaysObjectLeave::type() const
+{
+    return MSG_ZONESAYS;
+}
 
-////////// msg::PlayerRequestZoneSwitch //////////
-
-msg::PlayerRequestZoneSwitch::PlayerRequestZoneSwitch(PlayerID player, ZoneID zone) :
-    _player(player), _zone(zone)
+msg::MsgId msg::ZoneSaysObjectLeave::id() const
 {
+    return ID_ZONESAYSOBJECTLEAVE;
+}
 
+void msg::ZoneSaysObjectLeave::encode(Writer& writer) const
+{
+    writer.write(_object);
 }
 
-msg::PlayerRequestZoneSwitch::~PlayerRequestZoneSwitch()
+bool msg::ZoneSaysObjectLeave::keyed() const
 {
+    return false;
+}
 
+uint64_t msg::ZoneSaysObjectLeave::key() const
+{
+    return 0;
 }
 
-std::unique_ptr<msg::Message> msg::PlayerRequestZoneSwitch::clone() const
+bool msg::ZoneSaysObjectLeave::coalesces() const
 {
-    return std::unique_ptr<Message>(new PlayerRequestZoneSwitch(*this));
+    return false;
 }
 
-void msg::PlayerRequestZoneSwitch::dispatch(MessageHandler& handler)
+uint64_t msg::ZoneSaysObjectLeave::stateKey() const
 {
-    handler.handlePlayerRequestZoneSwitch(_player, _zone);
+    return 0;
 }
 
-bool msg::PlayerRequestZoneSwitch::matches(int subscription)
+const ObjectID& msg::ZoneSaysObjectLeave::object() const
 {
-    return ((subscription & MSG_PLAYER) != 0);
+    return _object;
 }
 
 
-////////// msg::PlayerEnterZone //////////
+////////// msg::ZoneSaysObjectNeighbours //////////
 
-msg::PlayerEnterZone::PlayerEnterZone(PlayerID player, ZoneID zone) :
-    _player(player), _zone(zone)
+msg::ZoneSaysObjectNeighbours::ZoneSaysObjectNeighbours(ObjectID object, const ObjectList& neighbours) :
+    _object(object), _neighbours(neighbours)
 {
 
 }
 
-msg::PlayerEnterZone::~PlayerEnterZone()
+msg::ZoneSaysObjectNeighbours::~ZoneSaysObjectNeighbours()
 {
 
 }
 
-std::unique_ptr<msg::Message> msg::PlayerEnterZone::clone() const
+std::unique_ptr<msg::Message> msg::ZoneSaysObjectNeighbours::clone() const
 {
-    return std::unique_ptr<Message>(new PlayerEnterZone(*this));
+    return std::unique_ptr<Message>(new ZoneSaysObjectNeighbours(*this));
 }
 
-void msg::PlayerEnterZone::dispatch(MessageHandler& handler)
+void msg::ZoneSaysObjectNeighbours::dispatch(MessageHandler& handler) const
 {
-    handler.handlePlayerEnterZone(_player, _zone);
+    handler.handleZoneSaysObjectNeighbours(_object, _neighbours);
 }
 
-bool msg::PlayerEnterZone::matches(int subscription)
+bool msg::ZoneSaysObjectNeighbours::matches(int subscription) const
 {
-    return ((subscription & MSG_PLAYER) != 0);
+    return ((subscription & MSG_ZONESAYS) != 0);
 }
 
+int msg::ZoneSaysObjectNeighbours::type() const
+{
+    return MSG_ZONESAYS;
+}
 
-////////// msg::PlayerLeaveZone //////////
+msg::MsgId msg::ZoneSaysObjectNeighbours::id() const
+{
+    return ID_ZONESAYSOBJECTNEIGHBOURS;
+}
 
-msg::PlayerLeaveZone::PlayerLeaveZone(PlayerID player, ZoneID zone) :
-    _player(player), _zone(zone)
+void msg::ZoneSaysObjectNeighbours::encode(Writer& writer) const
 {
+    writer.write(_object);
+    writer.write(_neighbours);
+}
 
+bool msg::ZoneSaysObjectNeighbours::keyed() const
+{
+    return false;
 }
 
-msg::PlayerLeaveZone::~PlayerLeaveZone()
+uint64_t msg::ZoneSaysObjectNeighbours::key() const
 {
+    return 0;
+}
 
+bool msg::ZoneSaysObjectNeighbours::coalesces() const
+{
+    return true;
 }
 
-std::unique_ptr<msg::Message> msg::PlayerLeaveZone::clone() const
+uint64_t msg::ZoneSaysObjectNeighbours::stateKey() const
 {
-    return std::unique_ptr<Message>(new PlayerLeaveZone(*this));
+    return _object;
 }
 
-void msg::PlayerLeaveZone::dispatch(MessageHandler& handler)
+const ObjectID& msg::ZoneSaysObjectNeighbours::object() const
 {
-    handler.handlePlayerLeaveZone(_player, _zone);
+    return _object;
 }
 
-bool msg::PlayerLeaveZone::matches(int subscription)
+const ObjectList& msg::ZoneSaysObjectNeighbours::neighbours() const
 {
-    return ((subscription & MSG_PLAYER) != 0);
+    return _neighbours;
 }
 
 
-////////// msg::PlayerName //////////
+////////// msg::ZoneSaysObjectAttach //////////
 
-msg::PlayerName::PlayerName(PlayerID player, const std::string& username) :
-    _player(player), _username(username)
+msg::ZoneSaysObjectAttach::ZoneSaysObjectAttach(ObjectID object, PlayerID player) :
+    _object(object), _player(player)
 {
 
 }
 
-msg::PlayerName::~PlayerName()
+msg::ZoneSaysObjectAttach::~ZoneSaysObjectAttach()
 {
 
 }
 
-std::unique_ptr<msg::Message> msg::PlayerName::clone() const
+std::unique_ptr<msg::Message> msg::ZoneSaysObjectAttach::clone() const
 {
-    return std::unique_ptr<Message>(new PlayerName(*this));
+    return std::unique_ptr<Message>(new ZoneSaysObjectAttach(*this));
 }
 
-void msg::PlayerName::dispatch(MessageHandler& handler)
+void msg::ZoneSaysObjectAttach::dispatch(MessageHandler& handler) const
 {
-    handler.handlePlayerName(_player, _username);
+    handler.handleZoneSaysObjectAttach(_object, _player);
 }
 
-bool msg::PlayerName::matches(int subscription)
+bool msg::ZoneSaysObjectAttach::matches(int subscription) const
 {
-    return ((subscription & MSG_PLAYER) != 0);
+    return ((subscription & MSG_ZONESAYS) != 0);
 }
 
+int msg::ZoneSaysObjectAttach::type() const
+{
+    return MSG_ZONESAYS;
+}
 
-////////// msg::PeerRequestLogin //////////
+msg::MsgId msg::ZoneSaysObjectAttach::id() const
+{
+    return ID_ZONESAYSOBJECTATTACH;
+}
 
-msg::PeerRequestLogin::PeerRequestLogin(PeerID peer, const std::string& username, const MD5Hash& password) :
-    _peer(peer), _username(username), _password(password)
+void msg::ZoneSaysObjectAttach::encode(Writer& writer) const
 {
+    writer.write(_object);
+    writer.write(_player);
+}
 
+bool msg::ZoneSaysObjectAttach::keyed() const
+{
+    return false;
 }
 
-msg::PeerRequestLogin::~PeerRequestLogin()
+uint64_t msg::ZoneSaysObjectAttach::key() const
 {
+    return 0;
+}
 
+bool msg::ZoneSaysObjectAttach::coalesces() const
+{
+    return false;
 }
 
-std::unique_ptr<msg::Message> msg::PeerRequestLogin::clone() const
+uint64_t msg::ZoneSaysObjectAttach::stateKey() const
 {
-    return std::unique_ptr<Message>(new PeerRequestLogin(*this));
+    return 0;
 }
 
-void msg::PeerRequestLogin::dispatch(MessageHandler& handler)
+const ObjectID& msg::ZoneSaysObjectAttach::object() const
 {
-    handler.handlePeerRequestLogin(_peer, _username, _password);
+    return _object;
 }
 
-bool msg::PeerRequestLogin::matches(int subscription)
+const PlayerID& msg::ZoneSaysObjectAttach::player() const
 {
-    return ((subscription & MSG_PEER) != 0);
+    return _player;
 }
 
 
-////////// msg::PeerRequestLogout //////////
+////////// msg::ZoneSaysObjectName //////////
 
-msg::PeerRequestLogout::PeerRequestLogout(PeerID peer, PlayerID player) :
-    _peer(peer), _player(player)
+msg::ZoneSaysObjectName::ZoneSaysObjectName(ObjectID object, const std::string& name) :
+    _object(object), _name(name)
 {
 
 }
 
-msg::PeerRequestLogout::~PeerRequestLogout()
+msg::ZoneSaysObjectName::~ZoneSaysObjectName()
 {
 
 }
 
-std::unique_ptr<msg::Message> msg::PeerRequestLogout::clone() const
+std::unique_ptr<msg::Message> msg::ZoneSaysObjectName::clone() const
 {
-    return std::unique_ptr<Message>(new PeerRequestLogout(*this));
+    return std::unique_ptr<Message>(new ZoneSaysObjectName(*this));
 }
 
-void msg::PeerRequestLogout::dispatch(MessageHandler& handler)
+void msg::ZoneSaysObjectName::dispatch(MessageHandler& handler) const
 {
-    handler.handlePeerRequestLogout(_peer, _player);
+    handler.handleZoneSaysObjectName(_object, _name);
 }
 
-bool msg::PeerRequestLogout::matches(int subscription)
+bool msg::ZoneSaysObjectName::matches(int subscription) const
 {
-    return ((subscription & MSG_PEER) != 0);
+    return ((subscription & MSG_ZONESAYS) != 0);
 }
 
+int msg::ZoneSaysObjectName::type() const
+{
+    return MSG_ZONESAYS;
+}
 
-////////// msg::PeerLoginGranted //////////
+msg::MsgId msg::ZoneSaysObjectName::id() const
+{
+    return ID_ZONESAYSOBJECTNAME;
+}
 
-msg::PeerLoginGranted::PeerLoginGranted(PeerID peer, PlayerID player) :
-    _peer(peer), _player(player)
+void msg::ZoneSaysObjectName::encode(Writer& writer) const
 {
+    writer.write(_object);
+    writer.write(_name);
+}
 
+bool msg::ZoneSaysObjectName::keyed() const
+{
+    return false;
 }
 
-msg::PeerLoginGranted::~PeerLoginGranted()
+uint64_t msg::ZoneSaysObjectName::key() const
 {
+    return 0;
+}
 
+bool msg::ZoneSaysObjectName::coalesces() const
+{
+    return false;
 }
 
-std::unique_ptr<msg::Message> msg::PeerLoginGranted::clone() const
+uint64_t msg::ZoneSaysObjectName::stateKey() const
 {
-    return std::unique_ptr<Message>(new PeerLoginGranted(*this));
+    return 0;
 }
 
-void msg::PeerLoginGranted::dispatch(MessageHandler& handler)
+const ObjectID& msg::ZoneSaysObjectName::object() const
 {
-    handler.handlePeerLoginGranted(_peer, _player);
+    return _object;
 }
 
-bool msg::PeerLoginGranted::matches(int subscription)
+const std::string& msg::ZoneSaysObjectName::name() const
 {
-    return ((subscription & MSG_PEER) != 0);
+    return _name;
 }
 
 
-////////// msg::PeerLoginDenied //////////
+////////// msg::ZoneSaysObjectPos //////////
 
-msg::PeerLoginDenied::PeerLoginDenied(PeerID peer) :
-    _peer(peer)
+msg::ZoneSaysObjectPos::ZoneSaysObjectPos(ObjectID object, Vector3 pos) :
+    _object(object), _pos(pos)
 {
 
 }
 
-msg::PeerLoginDenied::~PeerLoginDenied()
+msg::ZoneSaysObjectPos::~ZoneSaysObjectPos()
 {
 
 }
 
-std::unique_ptr<msg::Message> msg::PeerLoginDenied::clone() const
+std::unique_ptr<msg::Message> msg::ZoneSaysObjectPos::clone() const
 {
-    return std::unique_ptr<Message>(new PeerLoginDenied(*this));
+    return std::unique_ptr<Message>(new ZoneSaysObjectPos(*this));
 }
 
-void msg::PeerLoginDenied::dispatch(MessageHandler& handler)
+void msg::ZoneSaysObjectPos::dispatch(MessageHandler& handler) const
 {
-    handler.handlePeerLoginDenied(_peer);
+    handler.handleZoneSaysObjectPos(_object, _pos);
 }
 
-bool msg::PeerLoginDenied::matches(int subscription)
+bool msg::ZoneSaysObjectPos::matches(int subscription) const
 {
-    return ((subscription & MSG_PEER) != 0);
+    return ((subscription & MSG_ZONESAYS) != 0);
 }
 
+int msg::ZoneSaysObjectPos::type() const
+{
+    return MSG_ZONESAYS;
+}
 
-////////// msg::ChatSayPublic //////////
+msg::MsgId msg::ZoneSaysObjectPos::id() const
+{
+    return ID_ZONESAYSOBJECTPOS;
+}
+
+void msg::ZoneSaysObjectPos::encode(Writer& writer) const
+{
+    writer.write(_object);
+    writer.write(_pos);
+}
+
+bool msg::ZoneSaysObjectPos::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::ZoneSaysObjectPos::key() const
+{
+    return 0;
+}
+
+bool msg::ZoneSaysObjectPos::coalesces() const
+{
+    return true;
+}
+
+uint64_t msg::ZoneSaysObjectPos::stateKey() const
+{
+    return _object;
+}
+
+const ObjectID& msg::ZoneSaysObjectPos::object() const
+{
+    return _object;
+}
+
+const Vector3& msg::ZoneSaysObjectPos::pos() const
+{
+    return _pos;
+}
+
+
+////////// msg::ZoneSaysObjectAll //////////
+
+msg::ZoneSaysObjectAll::ZoneSaysObjectAll(ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state) :
+    _object(object), _pos(pos), _vel(vel), _rot(rot), _state(state)
+{
+
+}
+
+msg::ZoneSaysObjectAll::~ZoneSaysObjectAll()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::ZoneSaysObjectAll::clone() const
+{
+    return std::unique_ptr<Message>(new ZoneSaysObjectAll(*this));
+}
+
+void msg::ZoneSaysObjectAll::dispatch(MessageHandler& handler) const
+{
+    handler.handleZoneSaysObjectAll(_object, _pos, _vel, _rot, _state);
+}
+
+bool msg::ZoneSaysObjectAll::matches(int subscription) const
+{
+    return ((subscription & MSG_ZONESAYS) != 0);
+}
+
+int msg::ZoneSaysObjectAll::type() const
+{
+    return MSG_ZONESAYS;
+}
+
+msg::MsgId msg::ZoneSaysObjectAll::id() const
+{
+    return ID_ZONESAYSOBJECTALL;
+}
+
+void msg::ZoneSaysObjectAll::encode(Writer& writer) const
+{
+    writer.write(_object);
+    writer.write(_pos);
+    writer.write(_vel);
+    writer.write(_rot);
+    writer.write(_state);
+}
+
+bool msg::ZoneSaysObjectAll::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::ZoneSaysObjectAll::key() const
+{
+    return 0;
+}
+
+bool msg::ZoneSaysObjectAll::coalesces() const
+{
+    return true;
+}
+
+uint64_t msg::ZoneSaysObjectAll::stateKey() const
+{
+    return _object;
+}
+
+const ObjectID& msg::ZoneSaysObjectAll::object() const
+{
+    return _object;
+}
+
+const Vector3& msg::ZoneSaysObjectAll::pos() const
+{
+    return _pos;
+}
+
+const Vector3& msg::ZoneSaysObjectAll::vel() const
+{
+    return _vel;
+}
+
+const float& msg::ZoneSaysObjectAll::rot() const
+{
+    return _rot;
+}
+
+const ControlState& msg::ZoneSaysObjectAll::state() const
+{
+    return _state;
+}
+
+
+////////// msg::PlayerRequestZoneSwitch //////////
+
+msg::PlayerRequestZoneSwitch::PlayerRequestZoneSwitch(PlayerID player, ZoneID zone) :
+    _player(player), _zone(zone)
+{
+
+}
+
+msg::PlayerRequestZoneSwitch::~PlayerRequestZoneSwitch()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::PlayerRequestZoneSwitch::clone() const
+{
+    return std::unique_ptr<Message>(new PlayerRequestZoneSwitch(*this));
+}
+
+void msg::PlayerRequestZoneSwitch::dispatch(MessageHandler& handler) const
+{
+    handler.handlePlayerRequestZoneSwitch(_player, _zone);
+}
+
+bool msg::PlayerRequestZoneSwitch::matches(int subscription) const
+{
+    return ((subscription & MSG_PLAYER) != 0);
+}
+
+int msg::PlayerRequestZoneSwitch::type() const
+{
+    return MSG_PLAYER;
+}
+
+msg::MsgId msg::PlayerRequestZoneSwitch::id() const
+{
+    return ID_PLAYERREQUESTZONESWITCH;
+}
+
+void msg::PlayerRequestZoneSwitch::encode(Writer& writer) const
+{
+    writer.write(_player);
+    writer.write(_zone);
+}
+
+bool msg::PlayerRequestZoneSwitch::keyed() const
+{
+    return true;
+}
+
+uint64_t msg::PlayerRequestZoneSwitch::key() const
+{
+    return _zone;
+}
+
+bool msg::PlayerRequestZoneSwitch::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::PlayerRequestZoneSwitch::stateKey() const
+{
+    return 0;
+}
+
+const PlayerID& msg::PlayerRequestZoneSwitch::player() const
+{
+    return _player;
+}
+
+const ZoneID& msg::PlayerRequestZoneSwitch::zone() const
+{
+    return _zone;
+}
+
+
+////////// msg::PlayerEnterZone //////////
+
+msg::PlayerEnterZone::PlayerEnterZone(PlayerID player, ZoneID zone) :
+    _player(player), _zone(zone)
+{
+
+}
+
+msg::PlayerEnterZone::~PlayerEnterZone()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::PlayerEnterZone::clone() const
+{
+    return std::unique_ptr<Message>(new PlayerEnterZone(*this));
+}
+
+void msg::PlayerEnterZone::dispatch(MessageHandler& handler) const
+{
+    handler.handlePlayerEnterZone(_player, _zone);
+}
+
+bool msg::PlayerEnterZone::matches(int subscription) const
+{
+    return ((subscription & MSG_PLAYER) != 0);
+}
+
+int msg::PlayerEnterZone::type() const
+{
+    return MSG_PLAYER;
+}
+
+msg::MsgId msg::PlayerEnterZone::id() const
+{
+    return ID_PLAYERENTERZONE;
+}
+
+void msg::PlayerEnterZone::encode(Writer& writer) const
+{
+    writer.write(_player);
+    writer.write(_zone);
+}
+
+bool msg::PlayerEnterZone::keyed() const
+{
+    return true;
+}
+
+uint64_t msg::PlayerEnterZone::key() const
+{
+    return _zone;
+}
+
+bool msg::PlayerEnterZone::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::PlayerEnterZone::stateKey() const
+{
+    return 0;
+}
+
+const PlayerID& msg::PlayerEnterZone::player() const
+{
+    return _player;
+}
+
+const ZoneID& msg::PlayerEnterZone::zone() const
+{
+    return _zone;
+}
+
+
+////////// msg::PlayerLeaveZone //////////
+
+msg::PlayerLeaveZone::PlayerLeaveZone(PlayerID player, ZoneID zone) :
+    _player(player), _zone(zone)
+{
+
+}
+
+msg::PlayerLeaveZone::~PlayerLeaveZone()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::PlayerLeaveZone::clone() const
+{
+    return std::unique_ptr<Message>(new PlayerLeaveZone(*this));
+}
+
+void msg::PlayerLeaveZone::dispatch(MessageHandler& handler) const
+{
+    handler.handlePlayerLeaveZone(_player, _zone);
+}
+
+bool msg::PlayerLeaveZone::matches(int subscription) const
+{
+    return ((subscription & MSG_PLAYER) != 0);
+}
+
+int msg::PlayerLeaveZone::type() const
+{
+    return MSG_PLAYER;
+}
+
+msg::MsgId msg::PlayerLeaveZone::id() const
+{
+    return ID_PLAYERLEAVEZONE;
+}
+
+void msg::PlayerLeaveZone::encode(Writer& writer) const
+{
+    writer.write(_player);
+    writer.write(_zone);
+}
+
+bool msg::PlayerLeaveZone::keyed() const
+{
+    return true;
+}
+
+uint64_t msg::PlayerLeaveZone::key() const
+{
+    return _zone;
+}
+
+bool msg::PlayerLeaveZone::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::PlayerLeaveZone::stateKey() const
+{
+    return 0;
+}
+
+const PlayerID& msg::PlayerLeaveZone::player() const
+{
+    return _player;
+}
+
+const ZoneID& msg::PlayerLeaveZone::zone() const
+{
+    return _zone;
+}
+
+
+////////// msg::PlayerName //////////
+
+msg::PlayerName::PlayerName(PlayerID player, const std::string& username) :
+    _player(player), _username(username)
+{
+
+}
+
+msg::PlayerName::~PlayerName()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::PlayerName::clone() const
+{
+    return std::unique_ptr<Message>(new PlayerName(*this));
+}
+
+void msg::PlayerName::dispatch(MessageHandler& handler) const
+{
+    handler.handlePlayerName(_player, _username);
+}
+
+bool msg::PlayerName::matches(int subscription) const
+{
+    return ((subscription & MSG_PLAYER) != 0);
+}
+
+int msg::PlayerName::type() const
+{
+    return MSG_PLAYER;
+}
+
+msg::MsgId msg::PlayerName::id() const
+{
+    return ID_PLAYERNAME;
+}
+
+void msg::PlayerName::encode(Writer& writer) const
+{
+    writer.write(_player);
+    writer.write(_username);
+}
+
+bool msg::PlayerName::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::PlayerName::key() const
+{
+    return 0;
+}
+
+bool msg::PlayerName::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::PlayerName::stateKey() const
+{
+    return 0;
+}
+
+const PlayerID& msg::PlayerName::player() const
+{
+    return _player;
+}
+
+const std::string& msg::PlayerName::username() const
+{
+    return _username;
+}
+
+
+////////// msg::PeerRequestLogin //////////
+
+msg::PeerRequestLogin::PeerRequestLogin(PeerID peer, const std::string& username, const MD5Hash& password) :
+    _peer(peer), _username(username), _password(password)
+{
+
+}
+
+msg::PeerRequestLogin::~PeerRequestLogin()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::PeerRequestLogin::clone() const
+{
+    return std::unique_ptr<Message>(new PeerRequestLogin(*this));
+}
+
+void msg::PeerRequestLogin::dispatch(MessageHandler& handler) const
+{
+    handler.handlePeerRequestLogin(_peer, _username, _password);
+}
+
+bool msg::PeerRequestLogin::matches(int subscription) const
+{
+    return ((subscription & MSG_PEER) != 0);
+}
+
+int msg::PeerRequestLogin::type() const
+{
+    return MSG_PEER;
+}
+
+msg::MsgId msg::PeerRequestLogin::id() const
+{
+    return ID_PEERREQUESTLOGIN;
+}
+
+void msg::PeerRequestLogin::encode(Writer& writer) const
+{
+    writer.write(_peer);
+    writer.write(_username);
+    writer.write(_password);
+}
+
+bool msg::PeerRequestLogin::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::PeerRequestLogin::key() const
+{
+    return 0;
+}
+
+bool msg::PeerRequestLogin::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::PeerRequestLogin::stateKey() const
+{
+    return 0;
+}
+
+const PeerID& msg::PeerRequestLogin::peer() const
+{
+    return _peer;
+}
+
+const std::string& msg::PeerRequestLogin::username() const
+{
+    return _username;
+}
+
+const MD5Hash& msg::PeerRequestLogin::password() const
+{
+    return _password;
+}
+
+
+////////// msg::PeerRequestLogout //////////
+
+msg::PeerRequestLogout::PeerRequestLogout(PeerID peer, PlayerID player) :
+    _peer(peer), _player(player)
+{
+
+}
+
+msg::PeerRequestLogout::~PeerRequestLogout()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::PeerRequestLogout::clone() const
+{
+    return std::unique_ptr<Message>(new PeerRequestLogout(*this));
+}
+
+void msg::PeerRequestLogout::dispatch(MessageHandler& handler) const
+{
+    handler.handlePeerRequestLogout(_peer, _player);
+}
+
+bool msg::PeerRequestLogout::matches(int subscription) const
+{
+    return ((subscription & MSG_PEER) != 0);
+}
+
+int msg::PeerRequestLogout::type() const
+{
+    return MSG_PEER;
+}
+
+msg::MsgId msg::PeerRequestLogout::id() const
+{
+    return ID_PEERREQUESTLOGOUT;
+}
+
+void msg::PeerRequestLogout::encode(Writer& writer) const
+{
+    writer.write(_peer);
+    writer.write(_player);
+}
+
+bool msg::PeerRequestLogout::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::PeerRequestLogout::key() const
+{
+    return 0;
+}
+
+bool msg::PeerRequestLogout::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::PeerRequestLogout::stateKey() const
+{
+    return 0;
+}
+
+const PeerID& msg::PeerRequestLogout::peer() const
+{
+    return _peer;
+}
+
+const PlayerID& msg::PeerRequestLogout::player() const
+{
+    return _player;
+}
+
+
+////////// msg::PeerLoginGranted //////////
+
+msg::PeerLoginGranted::PeerLoginGranted(PeerID peer, PlayerID player) :
+    _peer(peer), _player(player)
+{
+
+}
+
+msg::PeerLoginGranted::~PeerLoginGranted()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::PeerLoginGranted::clone() const
+{
+    return std::unique_ptr<Message>(new PeerLoginGranted(*this));
+}
+
+void msg::PeerLoginGranted::dispatch(MessageHandler& handler) const
+{
+    handler.handlePeerLoginGranted(_peer, _player);
+}
+
+bool msg::PeerLoginGranted::matches(int subscription) const
+{
+    return ((subscription & MSG_PEER) != 0);
+}
+
+int msg::PeerLoginGranted::type() const
+{
+    return MSG_PEER;
+}
+
+msg::MsgId msg::PeerLoginGranted::id() const
+{
+    return ID_PEERLOGINGRANTED;
+}
+
+void msg::PeerLoginGranted::encode(Writer& writer) const
+{
+    writer.write(_peer);
+    writer.write(_player);
+}
+
+bool msg::PeerLoginGranted::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::PeerLoginGranted::key() const
+{
+    return 0;
+}
+
+bool msg::PeerLoginGranted::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::PeerLoginGranted::stateKey() const
+{
+    return 0;
+}
+
+const PeerID& msg::PeerLoginGranted::peer() const
+{
+    return _peer;
+}
+
+const PlayerID& msg::PeerLoginGranted::player() const
+{
+    return _player;
+}
+
+
+////////// msg::PeerLoginDenied //////////
+
+msg::PeerLoginDenied::PeerLoginDenied(PeerID peer) :
+    _peer(peer)
+{
+
+}
+
+msg::PeerLoginDenied::~PeerLoginDenied()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::PeerLoginDenied::clone() const
+{
+    return std::unique_ptr<Message>(new PeerLoginDenied(*this));
+}
+
+void msg::PeerLoginDenied::dispatch(MessageHandler& handler) const
+{
+    handler.handlePeerLoginDenied(_peer);
+}
+
+bool msg::PeerLoginDenied::matches(int subscription) const
+{
+    return ((subscription & MSG_PEER) != 0);
+}
+
+int msg::PeerLoginDenied::type() const
+{
+    return MSG_PEER;
+}
+
+msg::MsgId msg::PeerLoginDenied::id() const
+{
+    return ID_PEERLOGINDENIED;
+}
+
+void msg::PeerLoginDenied::encode(Writer& writer) const
+{
+    writer.write(_peer);
+}
+
+bool msg::PeerLoginDenied::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::PeerLoginDenied::key() const
+{
+    return 0;
+}
+
+bool msg::PeerLoginDenied::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::PeerLoginDenied::stateKey() const
+{
+    return 0;
+}
+
+const PeerID& msg::PeerLoginDenied::peer() const
+{
+    return _peer;
+}
+
+
+////////// msg::ChatSayPublic //////////
 
 msg::ChatSayPublic::ChatSayPublic(PlayerID player, const std::string& text) :
     _player(player), _text(text)
@@ -559,16 +1401,62 @@ std::unique_ptr<msg::Message> msg::ChatSayPublic::clone() const
     return std::unique_ptr<Message>(new ChatSayPublic(*this));
 }
 
-void msg::ChatSayPublic::dispatch(MessageHandler& handler)
+void msg::ChatSayPublic::dispatch(MessageHandler& handler) const
 {
     handler.handleChatSayPublic(_player, _text);
 }
 
-bool msg::ChatSayPublic::matches(int subscription)
+bool msg::ChatSayPublic::matches(int subscription) const
 {
     return ((subscription & MSG_CHAT) != 0);
 }
 
+int msg::ChatSayPublic::type() const
+{
+    return MSG_CHAT;
+}
+
+msg::MsgId msg::ChatSayPublic::id() const
+{
+    return ID_CHATSAYPUBLIC;
+}
+
+void msg::ChatSayPublic::encode(Writer& writer) const
+{
+    writer.write(_player);
+    writer.write(_text);
+}
+
+bool msg::ChatSayPublic::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::ChatSayPublic::key() const
+{
+    return 0;
+}
+
+bool msg::ChatSayPublic::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::ChatSayPublic::stateKey() const
+{
+    return 0;
+}
+
+const PlayerID& msg::ChatSayPublic::player() const
+{
+    return _player;
+}
+
+const std::string& msg::ChatSayPublic::text() const
+{
+    return _text;
+}
+
 
 ////////// msg::ChatBroadcast //////////
 
@@ -588,14 +1476,729 @@ std::unique_ptr<msg::Message> msg::ChatBroadcast::clone() const
     return std::unique_ptr<Message>(new ChatBroadcast(*this));
 }
 
-void msg::ChatBroadcast::dispatch(MessageHandler& handler)
+void msg::ChatBroadcast::dispatch(MessageHandler& handler) const
 {
     handler.handleChatBroadcast(_text);
 }
 
-bool msg::ChatBroadcast::matches(int subscription)
+bool msg::ChatBroadcast::matches(int subscription) const
 {
     return ((subscription & MSG_CHAT) != 0);
 }
 
+int msg::ChatBroadcast::type() const
+{
+    return MSG_CHAT;
+}
+
+msg::MsgId msg::ChatBroadcast::id() const
+{
+    return ID_CHATBROADCAST;
+}
+
+void msg::ChatBroadcast::encode(Writer& writer) const
+{
+    writer.write(_text);
+}
+
+bool msg::ChatBroadcast::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::ChatBroadcast::key() const
+{
+    return 0;
+}
+
+bool msg::ChatBroadcast::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::ChatBroadcast::stateKey() const
+{
+    return 0;
+}
+
+const std::string& msg::ChatBroadcast::text() const
+{
+    return _text;
+}
+
+
+////////// msg::Batch //////////
+
+msg::Batch::Batch() :
+    _types(0), _count(0), _states(0)
+{
+
+}
+
+msg::Batch::~Batch()
+{
+
+}
+
+std::unique_ptr<msg::Message> msg::Batch::clone() const
+{
+    return std::unique_ptr<Message>(new Batch(*this));
+}
+
+void msg::Batch::dispatch(MessageHandler& handler) const
+{
+    // The buffer is only written by this class so it need not be checked.
+    Reader reader(_buffer.data(), _buffer.size(), true);
+
+    while (!reader.done()) {
+        uint32_t id = reader.read<uint32_t>();
+        uint32_t size = reader.read<uint32_t>();
+
+        switch (id) {
+            case ID_ZONETELLOBJECTPOS: {
+                PlayerID player = reader.read<PlayerID>();
+                ObjectID object = reader.read<ObjectID>();
+                Vector3 pos = reader.read<Vector3>();
+                handler.handleZoneTellObjectPos(player, object, pos);
+                break;
+            }
+            case ID_ZONETELLOBJECTALL: {
+                PlayerID player = reader.read<PlayerID>();
+                ObjectID object = reader.read<ObjectID>();
+                Vector3 pos = reader.read<Vector3>();
+                Vector3 vel = reader.read<Vector3>();
+                float rot = reader.read<float>();
+                ControlState state = reader.read<ControlState>();
+                handler.handleZoneTellObjectAll(player, object, pos, vel, rot, state);
+                break;
+            }
+            case ID_ZONESAYSOBJECTENTER: {
+                ObjectID object = reader.read<ObjectID>();
+                handler.handleZoneSaysObjectEnter(object);
+                break;
+            }
+            case ID_ZONESAYSOBJECTLEAVE: {
+                ObjectID object = reader.read<ObjectID>();
+                handler.handleZoneSaysObjectLeave(object);
+                break;
+            }
+            case ID_ZONESAYSOBJECTNEIGHBOURS: {
+                ObjectID object = reader.read<ObjectID>();
+                ObjectList neighbours = reader.read<ObjectList>();
+                handler.handleZoneSaysObjectNeighbours(object, neighbours);
+                break;
+            }
+            case ID_ZONESAYSOBJECTATTACH: {
+                ObjectID object = reader.read<ObjectID>();
+                PlayerID player = reader.read<PlayerID>();
+                handler.handleZoneSaysObjectAttach(object, player);
+                break;
+            }
+            case ID_ZONESAYSOBJECTNAME: {
+                ObjectID object = reader.read<ObjectID>();
+                std::string name = reader.read<std::string>();
+                handler.handleZoneSaysObjectName(object, name);
+                break;
+            }
+            case ID_ZONESAYSOBJECTPOS: {
+                ObjectID object = reader.read<ObjectID>();
+                Vector3 pos = reader.read<Vector3>();
+                handler.handleZoneSaysObjectPos(object, pos);
+                break;
+            }
+            case ID_ZONESAYSOBJECTALL: {
+                ObjectID object = reader.read<ObjectID>();
+                Vector3 pos = reader.read<Vector3>();
+                Vector3 vel = reader.read<Vector3>();
+                float rot = reader.read<float>();
+                ControlState state = reader.read<ControlState>();
+                handler.handleZoneSaysObjectAll(object, pos, vel, rot, state);
+                break;
+            }
+            case ID_PLAYERREQUESTZONESWITCH: {
+                PlayerID player = reader.read<PlayerID>();
+                ZoneID zone = reader.read<ZoneID>();
+                handler.handlePlayerRequestZoneSwitch(player, zone);
+                break;
+            }
+            case ID_PLAYERENTERZONE: {
+                PlayerID player = reader.read<PlayerID>();
+                ZoneID zone = reader.read<ZoneID>();
+                handler.handlePlayerEnterZone(player, zone);
+                break;
+            }
+            case ID_PLAYERLEAVEZONE: {
+                PlayerID player = reader.read<PlayerID>();
+                ZoneID zone = reader.read<ZoneID>();
+                handler.handlePlayerLeaveZone(player, zone);
+                break;
+            }
+            case ID_PLAYERNAME: {
+                PlayerID player = reader.read<PlayerID>();
+                std::string username = reader.read<std::string>();
+                handler.handlePlayerName(player, username);
+                break;
+            }
+            case ID_PEERREQUESTLOGIN: {
+                PeerID peer = reader.read<PeerID>();
+                std::string username = reader.read<std::string>();
+                MD5Hash password = reader.read<MD5Hash>();
+                handler.handlePeerRequestLogin(peer, username, password);
+                break;
+            }
+            case ID_PEERREQUESTLOGOUT: {
+                PeerID peer = reader.read<PeerID>();
+                PlayerID player = reader.read<PlayerID>();
+                handler.handlePeerRequestLogout(peer, player);
+                break;
+            }
+            case ID_PEERLOGINGRANTED: {
+                PeerID peer = reader.read<PeerID>();
+                PlayerID player = reader.read<PlayerID>();
+                handler.handlePeerLoginGranted(peer, player);
+                break;
+            }
+            case ID_PEERLOGINDENIED: {
+                PeerID peer = reader.read<PeerID>();
+                handler.handlePeerLoginDenied(peer);
+                break;
+            }
+            case ID_CHATSAYPUBLIC: {
+                PlayerID player = reader.read<PlayerID>();
+                std::string text = reader.read<std::string>();
+                handler.handleChatSayPublic(player, text);
+                break;
+            }
+            case ID_CHATBROADCAST: {
+                std::string text = reader.read<std::string>();
+                handler.handleChatBroadcast(text);
+                break;
+            }
+            default:
+                reader.skip(size);
+                break;
+        }
+    }
+}
+
+bool msg::Batch::matches(int subscription) const
+{
+    return ((subscription & _types) != 0);
+}
+
+int msg::Batch::type() const
+{
+    return _types;
+}
+
+msg::MsgId msg::Batch::id() const
+{
+    return ID_BATCH;
+}
+
+void msg::Batch::encode(Writer& writer) const
+{
+    writer.write(_buffer);
+}
+
+bool msg::Batch::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::Batch::key() const
+{
+    return 0;
+}
+
+bool msg::Batch::coalesces() const
+{
+    return ((_count != 0) && (_states == _count));
+}
+
+uint64_t msg::Batch::stateKey() const
+{
+    return 0;
+}
+
+std::unique_ptr<msg::Batch> msg::Batch::decode(Reader& reader)
+{
+    std::unique_ptr<Batch> batch(new Batch());
+    batch->_buffer = reader.read<Buffer>();
+
+    // The buffer came from outside so each record is decoded to check it.
+    Reader records(batch->_buffer.data(), batch->_buffer.size());
+
+    while (!records.done()) {
+        MsgId id = MsgId(records.read<uint32_t>());
+        uint32_t size = records.read<uint32_t>();
+        int type = typeOf(id);
+
+        if (type == 0)
+            throw InputException("msg::Batch: record has no type");
+
+        Reader record = records.record(size);
+        bool state = msg::decode(id, record)->coalesces();
+
+        if (!record.done())
+            throw InputException("msg::Batch: record is too long");
+
+        batch->_types |= type;
+        batch->_count++;
+        batch->_states += (state ? 1 : 0);
+    }
+
+    return batch;
+}
+
+void msg::Batch::add(const Message& msg)
+{
+    if (msg.id() == ID_BATCH) {
+        const Batch& batch = static_cast<const Batch&>(msg);
+        _buffer.append(batch._buffer.data(), batch._buffer.size());
+        _types |= batch._types;
+        _count += batch._count;
+        _states += batch._states;
+        return;
+    }
+
+    size_t start = begin(msg.id(), typeOf(msg.id()), msg.coalesces());
+    Writer writer(_buffer);
+    msg.encode(writer);
+    end(start);
+}
+
+void msg::Batch::addZoneTellObjectPos(PlayerID player, ObjectID object, Vector3 pos)
+{
+    size_t start = begin(ID_ZONETELLOBJECTPOS, MSG_ZONETELL, false);
+    Writer writer(_buffer);
+    writer.write(player);
+    writer.write(object);
+    writer.write(pos);
+    end(start);
+}
+
+void msg::Batch::addZoneTellObjectAll(PlayerID player, ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state)
+{
+    size_t start = begin(ID_ZONETELLOBJECTALL, MSG_ZONETELL, false);
+    Writer writer(_buffer);
+    writer.write(player);
+    writer.write(object);
+    writer.write(pos);
+    writer.write(vel);
+    writer.write(rot);
+    writer.write(state);
+    end(start);
+}
+
+void msg::Batch::addZoneSaysObjectEnter(ObjectID object)
+{
+    size_t start = begin(ID_ZONESAYSOBJECTENTER, MSG_ZONESAYS, false);
+    Writer writer(_buffer);
+    writer.write(object);
+    end(start);
+}
+
+void msg::Batch::addZoneSaysObjectLeave(ObjectID object)
+{
+    size_t start = begin(ID_ZONESAYSOBJECTLEAVE, MSG_ZONESAYS, false);
+    Writer writer(_buffer);
+    writer.write(object);
+    end(start);
+}
+
+void msg::Batch::addZoneSaysObjectNeighbours(ObjectID object, const ObjectList& neighbours)
+{
+    size_t start = begin(ID_ZONESAYSOBJECTNEIGHBOURS, MSG_ZONESAYS, true);
+    Writer writer(_buffer);
+    writer.write(object);
+    writer.write(neighbours);
+    end(start);
+}
+
+void msg::Batch::addZoneSaysObjectAttach(ObjectID object, PlayerID player)
+{
+    size_t start = begin(ID_ZONESAYSOBJECTATTACH, MSG_ZONESAYS, false);
+    Writer writer(_buffer);
+    writer.write(object);
+    writer.write(player);
+    end(start);
+}
+
+void msg::Batch::addZoneSaysObjectName(ObjectID object, const std::string& name)
+{
+    size_t start = begin(ID_ZONESAYSOBJECTNAME, MSG_ZONESAYS, false);
+    Writer writer(_buffer);
+    writer.write(object);
+    writer.write(name);
+    end(start);
+}
+
+void msg::Batch::addZoneSaysObjectPos(ObjectID object, Vector3 pos)
+{
+    size_t start = begin(ID_ZONESAYSOBJECTPOS, MSG_ZONESAYS, true);
+    Writer writer(_buffer);
+    writer.write(object);
+    writer.write(pos);
+    end(start);
+}
+
+void msg::Batch::addZoneSaysObjectAll(ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state)
+{
+    size_t start = begin(ID_ZONESAYSOBJECTALL, MSG_ZONESAYS, true);
+    Writer writer(_buffer);
+    writer.write(object);
+    writer.write(pos);
+    writer.write(vel);
+    writer.write(rot);
+    writer.write(state);
+    end(start);
+}
+
+void msg::Batch::addPlayerRequestZoneSwitch(PlayerID player, ZoneID zone)
+{
+    size_t start = begin(ID_PLAYERREQUESTZONESWITCH, MSG_PLAYER, false);
+    Writer writer(_buffer);
+    writer.write(player);
+    writer.write(zone);
+    end(start);
+}
+
+void msg::Batch::addPlayerEnterZone(PlayerID player, ZoneID zone)
+{
+    size_t start = begin(ID_PLAYERENTERZONE, MSG_PLAYER, false);
+    Writer writer(_buffer);
+    writer.write(player);
+    writer.write(zone);
+    end(start);
+}
+
+void msg::Batch::addPlayerLeaveZone(PlayerID player, ZoneID zone)
+{
+    size_t start = begin(ID_PLAYERLEAVEZONE, MSG_PLAYER, false);
+    Writer writer(_buffer);
+    writer.write(player);
+    writer.write(zone);
+    end(start);
+}
+
+void msg::Batch::addPlayerName(PlayerID player, const std::string& username)
+{
+    size_t start = begin(ID_PLAYERNAME, MSG_PLAYER, false);
+    Writer writer(_buffer);
+    writer.write(player);
+    writer.write(username);
+    end(start);
+}
+
+void msg::Batch::addPeerRequestLogin(PeerID peer, const std::string& username, const MD5Hash& password)
+{
+    size_t start = begin(ID_PEERREQUESTLOGIN, MSG_PEER, false);
+    Writer writer(_buffer);
+    writer.write(peer);
+    writer.write(username);
+    writer.write(password);
+    end(start);
+}
+
+void msg::Batch::addPeerRequestLogout(PeerID peer, PlayerID player)
+{
+    size_t start = begin(ID_PEERREQUESTLOGOUT, MSG_PEER, false);
+    Writer writer(_buffer);
+    writer.write(peer);
+    writer.write(player);
+    end(start);
+}
+
+void msg::Batch::addPeerLoginGranted(PeerID peer, PlayerID player)
+{
+    size_t start = begin(ID_PEERLOGINGRANTED, MSG_PEER, false);
+    Writer writer(_buffer);
+    writer.write(peer);
+    writer.write(player);
+    end(start);
+}
+
+void msg::Batch::addPeerLoginDenied(PeerID peer)
+{
+    size_t start = begin(ID_PEERLOGINDENIED, MSG_PEER, false);
+    Writer writer(_buffer);
+    writer.write(peer);
+    end(start);
+}
+
+void msg::Batch::addChatSayPublic(PlayerID player, const std::string& text)
+{
+    size_t start = begin(ID_CHATSAYPUBLIC, MSG_CHAT, false);
+    Writer writer(_buffer);
+    writer.write(player);
+    writer.write(text);
+    end(start);
+}
+
+void msg::Batch::addChatBroadcast(const std::string& text)
+{
+    size_t start = begin(ID_CHATBROADCAST, MSG_CHAT, false);
+    Writer writer(_buffer);
+    writer.write(text);
+    end(start);
+}
+
+void msg::Batch::clear()
+{
+    _buffer.clear();
+    _types = 0;
+    _count = 0;
+    _states = 0;
+}
+
+bool msg::Batch::empty() const
+{
+    return (_count == 0);
+}
+
+size_t msg::Batch::count() const
+{
+    return _count;
+}
+
+void msg::Batch::split(std::vector<std::unique_ptr<Message> >& records) const
+{
+    // The buffer is only written by this class so it need not be checked.
+    Reader reader(_buffer.data(), _buffer.size(), true);
+
+    while (!reader.done()) {
+        MsgId id = MsgId(reader.read<uint32_t>());
+        Reader record = reader.record(reader.read<uint32_t>());
+        records.push_back(msg::decode(id, record));
+    }
+}
+
+int msg::Batch::typeOf(MsgId id)
+{
+    switch (id) {
+        case ID_ZONETELLOBJECTPOS:
+            return MSG_ZONETELL;
+        case ID_ZONETELLOBJECTALL:
+            return MSG_ZONETELL;
+        case ID_ZONESAYSOBJECTENTER:
+            return MSG_ZONESAYS;
+        case ID_ZONESAYSOBJECTLEAVE:
+            return MSG_ZONESAYS;
+        case ID_ZONESAYSOBJECTNEIGHBOURS:
+            return MSG_ZONESAYS;
+        case ID_ZONESAYSOBJECTATTACH:
+            return MSG_ZONESAYS;
+        case ID_ZONESAYSOBJECTNAME:
+            return MSG_ZONESAYS;
+        case ID_ZONESAYSOBJECTPOS:
+            return MSG_ZONESAYS;
+        case ID_ZONESAYSOBJECTALL:
+            return MSG_ZONESAYS;
+        case ID_PLAYERREQUESTZONESWITCH:
+            return MSG_PLAYER;
+        case ID_PLAYERENTERZONE:
+            return MSG_PLAYER;
+        case ID_PLAYERLEAVEZONE:
+            return MSG_PLAYER;
+        case ID_PLAYERNAME:
+            return MSG_PLAYER;
+        case ID_PEERREQUESTLOGIN:
+            return MSG_PEER;
+        case ID_PEERREQUESTLOGOUT:
+            return MSG_PEER;
+        case ID_PEERLOGINGRANTED:
+            return MSG_PEER;
+        case ID_PEERLOGINDENIED:
+            return MSG_PEER;
+        case ID_CHATSAYPUBLIC:
+            return MSG_CHAT;
+        case ID_CHATBROADCAST:
+            return MSG_CHAT;
+        default:
+            return 0;
+    }
+}
+
+size_t msg::Batch::begin(MsgId id, int type, bool state)
+{
+    size_t start = _buffer.size();
+    Writer writer(_buffer);
+    writer.write(uint32_t(id));
+    writer.write(uint32_t(0));
+
+    _types |= type;
+    _count++;
+    _states += (state ? 1 : 0);
+
+    return start;
+}
+
+void msg::Batch::end(size_t start)
+{
+    uint32_t size = _buffer.size() - start - 2 * sizeof(uint32_t);
+    memcpy(_buffer.data() + start + sizeof(uint32_t), &size, sizeof(size));
+}
+
+////////// msg //////////
+
+const char* msg::idName(MsgId id)
+{
+    switch (id) {
+        case ID_BATCH:
+            return "Batch";
+        case ID_LATEST:
+            return "Latest";
+        case ID_ZONETELLOBJECTPOS:
+            return "ZoneTellObjectPos";
+        case ID_ZONETELLOBJECTALL:
+            return "ZoneTellObjectAll";
+        case ID_ZONESAYSOBJECTENTER:
+            return "ZoneSaysObjectEnter";
+        case ID_ZONESAYSOBJECTLEAVE:
+            return "ZoneSaysObjectLeave";
+        case ID_ZONESAYSOBJECTNEIGHBOURS:
+            return "ZoneSaysObjectNeighbours";
+        case ID_ZONESAYSOBJECTATTACH:
+            return "ZoneSaysObjectAttach";
+        case ID_ZONESAYSOBJECTNAME:
+            return "ZoneSaysObjectName";
+        case ID_ZONESAYSOBJECTPOS:
+            return "ZoneSaysObjectPos";
+        case ID_ZONESAYSOBJECTALL:
+            return "ZoneSaysObjectAll";
+        case ID_PLAYERREQUESTZONESWITCH:
+            return "PlayerRequestZoneSwitch";
+        case ID_PLAYERENTERZONE:
+            return "PlayerEnterZone";
+        case ID_PLAYERLEAVEZONE:
+            return "PlayerLeaveZone";
+        case ID_PLAYERNAME:
+            return "PlayerName";
+        case ID_PEERREQUESTLOGIN:
+            return "PeerRequestLogin";
+        case ID_PEERREQUESTLOGOUT:
+            return "PeerRequestLogout";
+        case ID_PEERLOGINGRANTED:
+            return "PeerLoginGranted";
+        case ID_PEERLOGINDENIED:
+            return "PeerLoginDenied";
+        case ID_CHATSAYPUBLIC:
+            return "ChatSayPublic";
+        case ID_CHATBROADCAST:
+            return "ChatBroadcast";
+        default:
+            return "Unknown";
+    }
+}
+
+std::unique_ptr<msg::Message> msg::decode(MsgId id, Reader& reader)
+{
+    switch (id) {
+        case ID_BATCH:
+            return Batch::decode(reader);
+        case ID_ZONETELLOBJECTPOS: {
+            PlayerID player = reader.read<PlayerID>();
+            ObjectID object = reader.read<ObjectID>();
+            Vector3 pos = reader.read<Vector3>();
+            return std::unique_ptr<Message>(new ZoneTellObjectPos(player, object, pos));
+        }
+        case ID_ZONETELLOBJECTALL: {
+            PlayerID player = reader.read<PlayerID>();
+            ObjectID object = reader.read<ObjectID>();
+            Vector3 pos = reader.read<Vector3>();
+            Vector3 vel = reader.read<Vector3>();
+            float rot = reader.read<float>();
+            ControlState state = reader.read<ControlState>();
+            return std::unique_ptr<Message>(new ZoneTellObjectAll(player, object, pos, vel, rot, state));
+        }
+        case ID_ZONESAYSOBJECTENTER: {
+            ObjectID object = reader.read<ObjectID>();
+            return std::unique_ptr<Message>(new ZoneSaysObjectEnter(object));
+        }
+        case ID_ZONESAYSOBJECTLEAVE: {
+            ObjectID object = reader.read<ObjectID>();
+            return std::unique_ptr<Message>(new ZoneSaysObjectLeave(object));
+        }
+        case ID_ZONESAYSOBJECTNEIGHBOURS: {
+            ObjectID object = reader.read<ObjectID>();
+            ObjectList neighbours = reader.read<ObjectList>();
+            return std::unique_ptr<Message>(new ZoneSaysObjectNeighbours(object, neighbours));
+        }
+        case ID_ZONESAYSOBJECTATTACH: {
+            ObjectID object = reader.read<ObjectID>();
+            PlayerID player = reader.read<PlayerID>();
+            return std::unique_ptr<Message>(new ZoneSaysObjectAttach(object, player));
+        }
+        case ID_ZONESAYSOBJECTNAME: {
+            ObjectID object = reader.read<ObjectID>();
+            std::string name = reader.read<std::string>();
+            return std::unique_ptr<Message>(new ZoneSaysObjectName(object, name));
+        }
+        case ID_ZONESAYSOBJECTPOS: {
+            ObjectID object = reader.read<ObjectID>();
+            Vector3 pos = reader.read<Vector3>();
+            return std::unique_ptr<Message>(new ZoneSaysObjectPos(object, pos));
+        }
+        case ID_ZONESAYSOBJECTALL: {
+            ObjectID object = reader.read<ObjectID>();
+            Vector3 pos = reader.read<Vector3>();
+            Vector3 vel = reader.read<Vector3>();
+            float rot = reader.read<float>();
+            ControlState state = reader.read<ControlState>();
+            return std::unique_ptr<Message>(new ZoneSaysObjectAll(object, pos, vel, rot, state));
+        }
+        case ID_PLAYERREQUESTZONESWITCH: {
+            PlayerID player = reader.read<PlayerID>();
+            ZoneID zone = reader.read<ZoneID>();
+            return std::unique_ptr<Message>(new PlayerRequestZoneSwitch(player, zone));
+        }
+        case ID_PLAYERENTERZONE: {
+            PlayerID player = reader.read<PlayerID>();
+            ZoneID zone = reader.read<ZoneID>();
+            return std::unique_ptr<Message>(new PlayerEnterZone(player, zone));
+        }
+        case ID_PLAYERLEAVEZONE: {
+            PlayerID player = reader.read<PlayerID>();
+            ZoneID zone = reader.read<ZoneID>();
+            return std::unique_ptr<Message>(new PlayerLeaveZone(player, zone));
+        }
+        case ID_PLAYERNAME: {
+            PlayerID player = reader.read<PlayerID>();
+            std::string username = reader.read<std::string>();
+            return std::unique_ptr<Message>(new PlayerName(player, username));
+        }
+        case ID_PEERREQUESTLOGIN: {
+            PeerID peer = reader.read<PeerID>();
+            std::string username = reader.read<std::string>();
+            MD5Hash password = reader.read<MD5Hash>();
+            return std::unique_ptr<Message>(new PeerRequestLogin(peer, username, password));
+        }
+        case ID_PEERREQUESTLOGOUT: {
+            PeerID peer = reader.read<PeerID>();
+            PlayerID player = reader.read<PlayerID>();
+            return std::unique_ptr<Message>(new PeerRequestLogout(peer, player));
+        }
+        case ID_PEERLOGINGRANTED: {
+            PeerID peer = reader.read<PeerID>();
+            PlayerID player = reader.read<PlayerID>();
+            return std::unique_ptr<Message>(new PeerLoginGranted(peer, player));
+        }
+        case ID_PEERLOGINDENIED: {
+            PeerID peer = reader.read<PeerID>();
+            return std::unique_ptr<Message>(new PeerLoginDenied(peer));
+        }
+        case ID_CHATSAYPUBLIC: {
+            PlayerID player = reader.read<PlayerID>();
+            std::string text = reader.read<std::string>();
+            return std::unique_ptr<Message>(new ChatSayPublic(player, text));
+        }
+        case ID_CHATBROADCAST: {
+            std::string text = reader.read<std::string>();
+            return std::unique_ptr<Message>(new ChatBroadcast(text));
+        }
+        default:
+            throw InputException("msg::decode: unknown message id");
+    }
+}
 
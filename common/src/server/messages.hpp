@@ -11,8 +11,11 @@
 #define MESSAGES_HPP
 
 
+#include <new>
+#include <atomic>
 #include <memory>
 #include "typedefs.hpp"
+#include "msgcodec.hpp"
 
 
 namespace msg {
@@ -27,18 +30,68 @@ enum MsgType {
     MSG_PLAYER   = 0x0004,
     MSG_ZONESAYS = 0x0008,
     MSG_ZONETELL = 0x0010,
+    MSG_ALL      = 0x001f,
 };
 
 
+enum MsgId {
+    ID_BATCH                    = 0,
+    ID_LATEST                   = 1,
+    ID_ZONETELLOBJECTPOS        = 2,
+    ID_ZONETELLOBJECTALL        = 3,
+    ID_ZONESAYSOBJECTENTER      = 4,
+    ID_ZONESAYSOBJECTLEAVE      = 5,
+    ID_ZONESAYSOBJECTNEIGHBOURS = 6,
+    ID_ZONESAYSOBJECTATTACH     = 7,
+    ID_ZONESAYSOBJECTNAME       = 8,
+    ID_ZONESAYSOBJECTPOS        = 9,
+    ID_ZONESAYSOBJECTALL        = 10,
+    ID_PLAYERREQUESTZONESWITCH  = 11,
+    ID_PLAYERENTERZONE          = 12,
+    ID_PLAYERLEAVEZONE          = 13,
+    ID_PLAYERNAME               = 14,
+    ID_PEERREQUESTLOGIN         = 15,
+    ID_PEERREQUESTLOGOUT        = 16,
+    ID_PEERLOGINGRANTED         = 17,
+    ID_PEERLOGINDENIED          = 18,
+    ID_CHATSAYPUBLIC            = 19,
+    ID_CHATBROADCAST            = 20,
+};
+
+
+struct Trace;
+
+const char* idName(MsgId id);
+
+
 class Message {
     public:
+        static void* operator new(size_t size);
+        static void operator delete(void* p, size_t size);
+        static void operator delete(Message* p, std::destroying_delete_t, size_t size);
+
+        Message();
+        Message(const Message& other);
+        Message& operator=(const Message& other);
         virtual ~Message();
         virtual std::unique_ptr<Message> clone() const = 0;
-        virtual void dispatch(MessageHandler& handler) = 0;
-        virtual bool matches(int subscription) = 0;
+        virtual void dispatch(MessageHandler& handler) const = 0;
+        virtual bool matches(int subscription) const = 0;
+        virtual int type() const = 0;
+        virtual MsgId id() const = 0;
+        virtual void encode(Writer& writer) const = 0;
+        virtual bool keyed() const = 0;
+        virtual uint64_t key() const = 0;
+        virtual bool coalesces() const = 0;
+        virtual uint64_t stateKey() const = 0;
+
+        void share(unsigned int readers) const;
+        Trace* trace() const;
+        void setTrace(Trace* trace) const;
 
     private:
-
+        mutable std::atomic<unsigned int> _owners;
+        mutable Trace* _trace;
 };
 
 
@@ -47,8 +100,19 @@ class ZoneTellObjectPos : public Message {
         ZoneTellObjectPos(PlayerID player, ObjectID object, Vector3 pos);
         virtual ~ZoneTellObjectPos();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PlayerID& player() const;
+        const ObjectID& object() const;
+        const Vector3& pos() const;
 
     private:
         PlayerID _player;
@@ -62,8 +126,22 @@ class ZoneTellObjectAll : public Message {
         ZoneTellObjectAll(PlayerID player, ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state);
         virtual ~ZoneTellObjectAll();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PlayerID& player() const;
+        const ObjectID& object() const;
+        const Vector3& pos() const;
+        const Vector3& vel() const;
+        const float& rot() const;
+        const ControlState& state() const;
 
     private:
         PlayerID _player;
@@ -80,8 +158,17 @@ class ZoneSaysObjectEnter : public Message {
         ZoneSaysObjectEnter(ObjectID object);
         virtual ~ZoneSaysObjectEnter();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const ObjectID& object() const;
 
     private:
         ObjectID _object;
@@ -93,38 +180,44 @@ class ZoneSaysObjectLeave : public Message {
         ZoneSaysObjectLeave(ObjectID object);
         virtual ~ZoneSaysObjectLeave();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const ObjectID& object() const;
 
     private:
         ObjectID _object;
 };
 
 
-class ZoneSaysObjectClearClose : public Message {
+class ZoneSaysObjectNeighbours : public Message {
     public:
-        ZoneSaysObjectClearClose(ObjectID object);
-        virtual ~ZoneSaysObjectClearClose();
+        ZoneSaysObjectNeighbours(ObjectID object, const ObjectList& neighbours);
+        virtual ~ZoneSaysObjectNeighbours();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const ObjectID& object() const;
+        const ObjectList& neighbours() const;
 
     private:
         ObjectID _object;
-};
-
-
-class ZoneSaysObjectsClose : public Message {
-    public:
-        ZoneSaysObjectsClose(ObjectID a, ObjectID b);
-        virtual ~ZoneSaysObjectsClose();
-        virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
-
-    private:
-        ObjectID _a;
-        ObjectID _b;
+        const ObjectList _neighbours;
 };
 
 
@@ -133,8 +226,18 @@ class ZoneSaysObjectAttach : public Message {
         ZoneSaysObjectAttach(ObjectID object, PlayerID player);
         virtual ~ZoneSaysObjectAttach();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const ObjectID& object() const;
+        const PlayerID& player() const;
 
     private:
         ObjectID _object;
@@ -147,8 +250,18 @@ class ZoneSaysObjectName : public Message {
         ZoneSaysObjectName(ObjectID object, const std::string& name);
         virtual ~ZoneSaysObjectName();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const ObjectID& object() const;
+        const std::string& name() const;
 
     private:
         ObjectID _object;
@@ -161,8 +274,18 @@ class ZoneSaysObjectPos : public Message {
         ZoneSaysObjectPos(ObjectID object, Vector3 pos);
         virtual ~ZoneSaysObjectPos();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const ObjectID& object() const;
+        const Vector3& pos() const;
 
     private:
         ObjectID _object;
@@ -175,8 +298,21 @@ class ZoneSaysObjectAll : public Message {
         ZoneSaysObjectAll(ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state);
         virtual ~ZoneSaysObjectAll();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const ObjectID& object() const;
+        const Vector3& pos() const;
+        const Vector3& vel() const;
+        const float& rot() const;
+        const ControlState& state() const;
 
     private:
         ObjectID _object;
@@ -192,8 +328,18 @@ class PlayerRequestZoneSwitch : public Message {
         PlayerRequestZoneSwitch(PlayerID player, ZoneID zone);
         virtual ~PlayerRequestZoneSwitch();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PlayerID& player() const;
+        const ZoneID& zone() const;
 
     private:
         PlayerID _player;
@@ -206,8 +352,18 @@ class PlayerEnterZone : public Message {
         PlayerEnterZone(PlayerID player, ZoneID zone);
         virtual ~PlayerEnterZone();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PlayerID& player() const;
+        const ZoneID& zone() const;
 
     private:
         PlayerID _player;
@@ -220,8 +376,18 @@ class PlayerLeaveZone : public Message {
         PlayerLeaveZone(PlayerID player, ZoneID zone);
         virtual ~PlayerLeaveZone();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PlayerID& player() const;
+        const ZoneID& zone() const;
 
     private:
         PlayerID _player;
@@ -234,8 +400,18 @@ class PlayerName : public Message {
         PlayerName(PlayerID player, const std::string& username);
         virtual ~PlayerName();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PlayerID& player() const;
+        const std::string& username() const;
 
     private:
         PlayerID _player;
@@ -248,8 +424,19 @@ class PeerRequestLogin : public Message {
         PeerRequestLogin(PeerID peer, const std::string& username, const MD5Hash& password);
         virtual ~PeerRequestLogin();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PeerID& peer() const;
+        const std::string& username() const;
+        const MD5Hash& password() const;
 
     private:
         PeerID _peer;
@@ -263,8 +450,18 @@ class PeerRequestLogout : public Message {
         PeerRequestLogout(PeerID peer, PlayerID player);
         virtual ~PeerRequestLogout();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PeerID& peer() const;
+        const PlayerID& player() const;
 
     private:
         PeerID _peer;
@@ -277,8 +474,18 @@ class PeerLoginGranted : public Message {
         PeerLoginGranted(PeerID peer, PlayerID player);
         virtual ~PeerLoginGranted();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PeerID& peer() const;
+        const PlayerID& player() const;
 
     private:
         PeerID _peer;
@@ -291,8 +498,17 @@ class PeerLoginDenied : public Message {
         PeerLoginDenied(PeerID peer);
         virtual ~PeerLoginDenied();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PeerID& peer() const;
 
     private:
         PeerID _peer;
@@ -304,8 +520,18 @@ class ChatSayPublic : public Message {
         ChatSayPublic(PlayerID player, const std::string& text);
         virtual ~ChatSayPublic();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const PlayerID& player() const;
+        const std::string& text() const;
 
     private:
         PlayerID _player;
@@ -318,14 +544,82 @@ class ChatBroadcast : public Message {
         ChatBroadcast(const std::string& text);
         virtual ~ChatBroadcast();
         virtual std::unique_ptr<Message> clone() const;
-        virtual void dispatch(MessageHandler& handler);
-        virtual bool matches(int subscription);
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        const std::string& text() const;
 
     private:
         const std::string _text;
 };
 
 
+class Batch : public Message {
+    public:
+        Batch();
+        virtual ~Batch();
+        virtual std::unique_ptr<Message> clone() const;
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        static std::unique_ptr<Batch> decode(Reader& reader);
+
+        void add(const Message& msg);
+        void addZoneTellObjectPos(PlayerID player, ObjectID object, Vector3 pos);
+        void addZoneTellObjectAll(PlayerID player, ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state);
+        void addZoneSaysObjectEnter(ObjectID object);
+        void addZoneSaysObjectLeave(ObjectID object);
+        void addZoneSaysObjectNeighbours(ObjectID object, const ObjectList& neighbours);
+        void addZoneSaysObjectAttach(ObjectID object, PlayerID player);
+        void addZoneSaysObjectName(ObjectID object, const std::string& name);
+        void addZoneSaysObjectPos(ObjectID object, Vector3 pos);
+        void addZoneSaysObjectAll(ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state);
+        void addPlayerRequestZoneSwitch(PlayerID player, ZoneID zone);
+        void addPlayerEnterZone(PlayerID player, ZoneID zone);
+        void addPlayerLeaveZone(PlayerID player, ZoneID zone);
+        void addPlayerName(PlayerID player, const std::string& username);
+        void addPeerRequestLogin(PeerID peer, const std::string& username, const MD5Hash& password);
+        void addPeerRequestLogout(PeerID peer, PlayerID player);
+        void addPeerLoginGranted(PeerID peer, PlayerID player);
+        void addPeerLoginDenied(PeerID peer);
+        void addChatSayPublic(PlayerID player, const std::string& text);
+        void addChatBroadcast(const std::string& text);
+
+        void clear();
+        bool empty() const;
+        size_t count() const;
+        void split(std::vector<std::unique_ptr<Message> >& records) const;
+
+    private:
+        static int typeOf(MsgId id);
+
+        size_t begin(MsgId id, int type, bool state);
+        void end(size_t start);
+
+        Buffer _buffer;
+        int _types;
+        size_t _count;
+        size_t _states;
+};
+
+
+std::unique_ptr<Message> decode(MsgId id, Reader& reader);
+
+
 }  // namespace msg
 
 
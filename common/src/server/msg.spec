@@ -1,16 +1,15 @@
-ZoneTell_ObjectPos(PlayerID player, ObjectID object, Vector3 pos)
-ZoneTell_ObjectAll(PlayerID player, ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state)
+ZoneTell_ObjectPos(PlayerID player, ObjectID object, Vector3 pos) [route=player]
+ZoneTell_ObjectAll(PlayerID player, ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state) [route=player]
 ZoneSays_ObjectEnter(ObjectID object)
 ZoneSays_ObjectLeave(ObjectID object)
-ZoneSays_ObjectClearClose(ObjectID object)
-ZoneSays_ObjectsClose(ObjectID a, ObjectID b)
+ZoneSays_ObjectNeighbours(ObjectID object, const ObjectList& neighbours) [state=object]
 ZoneSays_ObjectAttach(ObjectID object, PlayerID player)
 ZoneSays_ObjectName(ObjectID object, const std::string& name)
-ZoneSays_ObjectPos(ObjectID object, Vector3 pos)
-ZoneSays_ObjectAll(ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state)
-Player_RequestZoneSwitch(PlayerID player, ZoneID zone)
-Player_EnterZone(PlayerID player, ZoneID zone)
-Player_LeaveZone(PlayerID player, ZoneID zone)
+ZoneSays_ObjectPos(ObjectID object, Vector3 pos) [state=object]
+ZoneSays_ObjectAll(ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state) [state=object]
+Player_RequestZoneSwitch(PlayerID player, ZoneID zone) [route=zone]
+Player_EnterZone(PlayerID player, ZoneID zone) [route=zone]
+Player_LeaveZone(PlayerID player, ZoneID zone) [route=zone]
 Player_Name(PlayerID player, const std::string& username)
 Peer_RequestLogin(PeerID peer, const std::string& username, const MD5Hash& password)
 Peer_RequestLogout(PeerID peer, PlayerID player)
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+#include <algorithm>
+#include "msgcodec.hpp"
+
+
+////////// msg::Buffer //////////
+
+/// Construct an empty Buffer.
+msg::Buffer::Buffer()
+    : _data(0), _size(0), _capacity(0)
+{
+
+}
+
+/// Construct a copy of a Buffer.
+/// \param other The buffer to copy.
+msg::Buffer::Buffer(const Buffer& other)
+    : _data(0), _size(0), _capacity(0)
+{
+    append(other._data, other._size);
+}
+
+/// Replace the bytes with a copy of those in another Buffer.
+/// \param other The buffer to copy.
+/// \return This buffer.
+msg::Buffer& msg::Buffer::operator=(const Buffer& other)
+{
+    if (this != &other) {
+        clear();
+        append(other._data, other._size);
+    }
+
+    return *this;
+}
+
+/// Free the bytes.
+msg::Buffer::~Buffer()
+{
+    free(_data);
+}
+
+/// Remove bytes from the front, moving the rest down.
+/// \param size Number of bytes, which must be no more than size().
+void msg::Buffer::consume(size_t size)
+{
+    if (size != 0)
+        memmove(_data, _data + size, _size - size);
+
+    _size -= size;
+}
+
+/// Make room for bytes without appending them.
+/// \param capacity Number of bytes to make room for in total.
+void msg::Buffer::reserve(size_t capacity)
+{
+    if (capacity > _capacity)
+        grow(capacity);
+}
+
+/// Allocate more memory.
+/// The capacity at least doubles so that appending is amortised O(1).
+/// \param size Number of bytes that must fit.
+void msg::Buffer::grow(size_t size)
+{
+    size_t capacity = std::max<size_t>(std::max<size_t>(size, 2 * _capacity), 64);
+    char* data = static_cast<char*>(realloc(_data, capacity));
+
+    if (data == 0)
+        throw MemoryException("msg::Buffer: out of memory");
+
+    _data = data;
+    _capacity = capacity;
+}
+
+
+////////// msg::Reader //////////
+
+/// Report that the bytes ended part way through a field.
+/// This is kept out of line so that reading fields stays small enough to be
+/// inlined.
+void msg::Reader::truncated()
+{
+    throw InputException("msg::Reader: record is truncated");
+}
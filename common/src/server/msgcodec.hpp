@@ -0,0 +1,308 @@
+/// \file msgcodec.hpp
+/// \brief Reads and writes message fields as bytes.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef MSGCODEC_HPP
+#define MSGCODEC_HPP
+
+
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+#include <type_traits>
+#include <core/core.hpp>
+
+
+namespace msg {
+
+
+/// Growable array of bytes.
+/// Unlike std::vector<char> appending is a bounds check and a memcpy, with
+/// no zero filling, so it is cheap enough to be done field by field.
+class Buffer {
+    public:
+        Buffer();
+        Buffer(const Buffer& other);
+        Buffer& operator=(const Buffer& other);
+        ~Buffer();
+
+        void append(const void* data, size_t size);
+        void consume(size_t size);
+        void reserve(size_t capacity);
+        void clear();
+
+        char* data();
+        const char* data() const;
+        size_t size() const;
+
+    private:
+        void grow(size_t size);
+
+        char* _data;       ///< The bytes or null if none are allocated.
+        size_t _size;      ///< Bytes in use.
+        size_t _capacity;  ///< Bytes allocated.
+};
+
+
+/// Appends message fields to a Buffer.
+/// Fields of trivially copyable type are copied as they are, so the bytes are
+/// only meaningful to a process built for the same architecture. Strings,
+/// buffers and vectors are written as a 32 bit length followed by their
+/// contents.
+class Writer {
+    public:
+        Writer(Buffer& buffer);
+
+        template<typename T>
+        void write(const T& value);
+        void write(const std::string& value);
+        void write(const Buffer& value);
+        template<typename T>
+        void write(const std::vector<T>& value);
+
+    private:
+        Buffer& _buffer;  ///< Buffer to append to.
+};
+
+
+/// Reads message fields from bytes written by a Writer.
+/// Fields are returned by value so that types without a default constructor
+/// can be read. Reading past the end of the bytes throws InputException,
+/// unless they are trusted to be well formed, in which case they are not
+/// checked at all.
+class Reader {
+    public:
+        Reader(const char* data, size_t size, bool trusted = false);
+
+        template<typename T>
+        T read();
+
+        Reader record(size_t size);
+        void skip(size_t size);
+        bool done() const;
+
+    private:
+        template<typename T>
+        T read(T*);
+        std::string read(std::string*);
+        Buffer read(Buffer*);
+        template<typename T>
+        std::vector<T> read(std::vector<T>*);
+
+        const char* take(size_t size);
+        [[noreturn]] static void truncated();
+
+        const char* _data;  ///< Next byte to read.
+        const char* _end;   ///< End of the bytes.
+        bool _trusted;      ///< Whether reads are not checked.
+};
+
+
+}  // namespace msg
+
+
+////////// msg::Buffer //////////
+
+/// Append bytes.
+/// \param data The bytes.
+/// \param size Number of bytes.
+inline void msg::Buffer::append(const void* data, size_t size)
+{
+    if (__builtin_expect(_capacity - _size < size, 0))
+        grow(_size + size);
+
+    if (size != 0)
+        memcpy(_data + _size, data, size);
+
+    _size += size;
+}
+
+/// Remove all bytes, keeping the memory for reuse.
+inline void msg::Buffer::clear()
+{
+    _size = 0;
+}
+
+/// \return The bytes.
+inline char* msg::Buffer::data()
+{
+    return _data;
+}
+
+/// \return The bytes.
+inline const char* msg::Buffer::data() const
+{
+    return _data;
+}
+
+/// \return Number of bytes.
+inline size_t msg::Buffer::size() const
+{
+    return _size;
+}
+
+
+////////// msg::Writer //////////
+
+/// Construct a Writer.
+/// \param buffer Buffer to append to.
+inline msg::Writer::Writer(Buffer& buffer)
+    : _buffer(buffer)
+{
+
+}
+
+/// Append a field of trivially copyable type.
+/// \param value The field.
+template<typename T>
+inline void msg::Writer::write(const T& value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "field must be trivially copyable");
+    _buffer.append(&value, sizeof(T));
+}
+
+/// Append a string field.
+/// \param value The field.
+inline void msg::Writer::write(const std::string& value)
+{
+    write(uint32_t(value.size()));
+    _buffer.append(value.data(), value.size());
+}
+
+/// Append a field holding raw bytes.
+/// \param value The field.
+inline void msg::Writer::write(const Buffer& value)
+{
+    write(uint32_t(value.size()));
+    _buffer.append(value.data(), value.size());
+}
+
+/// Append a vector field whose elements are trivially copyable.
+/// \param value The field.
+template<typename T>
+inline void msg::Writer::write(const std::vector<T>& value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "elements must be trivially copyable");
+    write(uint32_t(value.size()));
+    _buffer.append(value.data(), value.size() * sizeof(T));
+}
+
+
+////////// msg::Reader //////////
+
+/// Construct a Reader.
+/// \param data Start of the bytes.
+/// \param size Number of bytes.
+/// \param trusted Whether the bytes are known to be well formed.
+inline msg::Reader::Reader(const char* data, size_t size, bool trusted)
+    : _data(data), _end(data + size), _trusted(trusted)
+{
+
+}
+
+/// Read a field.
+/// \return The field.
+template<typename T>
+inline T msg::Reader::read()
+{
+    return read(static_cast<T*>(0));
+}
+
+/// Read a field of trivially copyable type.
+/// \return The field.
+template<typename T>
+inline T msg::Reader::read(T*)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "field must be trivially copyable");
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    memcpy(&storage, take(sizeof(T)), sizeof(T));
+
+    return *reinterpret_cast<T*>(&storage);
+}
+
+/// Read a string field.
+/// \return The field.
+inline std::string msg::Reader::read(std::string*)
+{
+    uint32_t size = read<uint32_t>();
+    const char* data = take(size);
+
+    return std::string(data, size);
+}
+
+/// Read a field holding raw bytes.
+/// \return The field.
+inline msg::Buffer msg::Reader::read(Buffer*)
+{
+    uint32_t size = read<uint32_t>();
+    Buffer buffer;
+    buffer.append(take(size), size);
+
+    return buffer;
+}
+
+/// Read a vector field whose elements are trivially copyable.
+/// \return The field.
+template<typename T>
+inline std::vector<T> msg::Reader::read(std::vector<T>*)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "elements must be trivially copyable");
+
+    uint32_t count = read<uint32_t>();
+
+    if (!_trusted && __builtin_expect(size_t(_end - _data) / sizeof(T) < count, 0))
+        truncated();
+
+    std::vector<T> value(count);
+    const char* data = take(count * sizeof(T));
+
+    if (count != 0)
+        memcpy(value.data(), data, count * sizeof(T));
+
+    return value;
+}
+
+/// Read a record nested in the bytes, such as one message of a batch.
+/// \param size Number of bytes in the record.
+/// \return A Reader of the record, which is trusted if this one is.
+inline msg::Reader msg::Reader::record(size_t size)
+{
+    return Reader(take(size), size, _trusted);
+}
+
+/// Skip over bytes.
+/// \param size Number of bytes.
+inline void msg::Reader::skip(size_t size)
+{
+    take(size);
+}
+
+/// \return Whether all the bytes have been read.
+inline bool msg::Reader::done() const
+{
+    return (_data == _end);
+}
+
+/// Move past bytes.
+/// \param size Number of bytes.
+/// \return The first of the bytes.
+inline const char* msg::Reader::take(size_t size)
+{
+    if (!_trusted && __builtin_expect(size_t(_end - _data) < size, 0))
+        truncated();
+
+    const char* data = _data;
+    _data += size;
+
+    return data;
+}
+
+
+#endif  // MSGCODEC_HPP
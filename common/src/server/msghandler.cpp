@@ -37,12 +37,7 @@ void msg::MessageHandler::handleZoneSaysObjectLeave(ObjectID object)
 
 }
 
-void msg::MessageHandler::handleZoneSaysObjectClearClose(ObjectID object)
-{
-
-}
-
-void msg::MessageHandler::handleZoneSaysObjectsClose(ObjectID a, ObjectID b)
+void msg::MessageHandler::handleZoneSaysObjectNeighbours(ObjectID object, const ObjectList& neighbours)
 {
 
 }
@@ -24,8 +24,7 @@ class MessageHandler {
         virtual void handleZoneTellObjectAll(PlayerID player, ObjectID object, Vector3 pos, Vector3 vel, float rot, ControlState state);
         virtual void handleZoneSaysObjectEnter(ObjectID object);
         virtual void handleZoneSaysObjectLeave(ObjectID object);
-        virtual void handleZoneSaysObjectClearClose(ObjectID object);
-        virtual void handleZoneSaysObjectsClose(ObjectID a, ObjectID b);
+        virtual void handleZoneSaysObjectNeighbours(ObjectID object, const ObjectList& neighbours);
         virtual void handleZoneSaysObjectAttach(ObjectID object, PlayerID player);
         virtual void handleZoneSaysObjectName(ObjectID object, const std::string& name);
         virtual void handleZoneSaysObjectPos(ObjectID object, Vector3 pos);
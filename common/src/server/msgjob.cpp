@@ -8,12 +8,15 @@
 
 
 #include "msgjob.hpp"
+#include "msgtrace.hpp"
 
 
 ////////// MessagableJob //////////
 
-MessagableJob::MessagableJob(PostOffice& po, int subscription)
+MessagableJob::MessagableJob(PostOffice& po, int subscription) :
+    _po(po), _drainBudget(0)
 {
+    _inbox.setReader(this);
     po.registerInbox(_inbox, subscription);
     po.registerOutbox(_outbox);
 }
@@ -25,15 +28,111 @@ MessagableJob::~MessagableJob()
 
 Job::RetType MessagableJob::run()
 {
-    while (!_inbox.empty()) 
-        _inbox.get()->dispatch(*this);
+    _inbox.transfer();
 
-    return main();
+    for (size_t count = 0; !_inbox.empty(); count++) {
+        if ((_drainBudget != 0) && (count == _drainBudget))
+            break;
+
+        std::unique_ptr<msg::Message> message = msg::Latest::open(_inbox.get());
+
+        if (message->trace() != 0) {
+            deliverTraced(std::move(message));
+        } else {
+            deliver(std::move(message));
+        }
+
+        if (_inbox.empty()) 
+            _inbox.transfer();
+    }
+
+    RetType result = main();
+
+    // Nothing will wake the job for messages left over by the budget.
+    if ((result == BLOCK) && !_inbox.empty())
+        return YIELD;
+
+    return result;
+}
+
+/// Limit how many messages of some types may wait in the inbox.
+/// \param types Bitwise OR of the types of message to limit.
+/// \param capacity Most messages of the types that may wait.
+/// \param policy What the post office does with messages once there are
+/// that many.
+void MessagableJob::setInboxLimit(int types, size_t capacity, Overload policy)
+{
+    _inbox.setLimit(types, capacity, policy);
+}
+
+/// Limit how many messages are handled each time the job runs.
+/// Messages left over are handled on the next run, after main() has been
+/// called, so a backlog is worked through a piece at a time rather than
+/// holding up main() until it is all gone.
+/// \param messages Most messages to handle per run or zero for no limit.
+void MessagableJob::setDrainBudget(size_t messages)
+{
+    _drainBudget = messages;
+}
+
+/// \return Number of messages for this job dropped by inbox limits.
+uint64_t MessagableJob::droppedMessages() const
+{
+    return _inbox.dropped();
+}
+
+/// \return Number of messages for this job left with their sender by inbox
+/// limits.
+uint64_t MessagableJob::deferredMessages() const
+{
+    return _inbox.deferred();
 }
 
 void MessagableJob::sendMessage(const msg::Message& msg)
 {
-    _outbox.put(msg);
+    std::unique_ptr<msg::Message> message = msg.clone();
+    msg::Tracer::sent(*message);
+
+    _outbox.put(std::move(message));
+}
+
+/// Send a message without copying it.
+/// Messages are allocated from a MessagePool, so a message built with
+/// std::make_unique and sent this way costs no calls to the system allocator
+/// once messaging has reached a steady state.
+/// \param msg The message to send.
+void MessagableJob::sendMessage(std::unique_ptr<msg::Message> msg)
+{
+    msg::Tracer::sent(*msg);
+
+    _outbox.put(std::move(msg));
+}
+
+/// Send a message once a delay has passed.
+/// The message is sent by the post office even if this job is blocked or has
+/// been destroyed by then. It does not go through the outbox of this job,
+/// since that may only have one writer.
+/// \param msg The message to send.
+/// \param usec Delay in microseconds.
+void MessagableJob::sendMessageAfter(const msg::Message& msg, uint64_t usec)
+{
+    _po.sendAfter(msg, usec);
+}
+
+/// Receive keyed messages of a type that have a key.
+/// \param type Bitwise OR of the types of message the key is for.
+/// \param key The key.
+void MessagableJob::registerKey(int type, uint64_t key)
+{
+    _po.registerKey(_inbox, type, key);
+}
+
+/// Stop receiving keyed messages with a key.
+/// \param type Types passed to registerKey().
+/// \param key Key passed to registerKey().
+void MessagableJob::deregisterKey(int type, uint64_t key)
+{
+    _po.deregisterKey(_inbox, type, key);
 }
 
 MessageSender MessagableJob::newMessageSender()
@@ -41,6 +140,24 @@ MessageSender MessagableJob::newMessageSender()
     return MessageSender(*this);
 }
 
+void MessagableJob::deliver(std::unique_ptr<msg::Message> message)
+{
+    message->dispatch(*this);
+}
+
+/// Deliver a message that is being traced and record how long it took.
+/// The trace is copied first since delivering the message may free it.
+/// \param message The message.
+void MessagableJob::deliverTraced(std::unique_ptr<msg::Message> message)
+{
+    msg::Trace trace = msg::Tracer::read(*message);
+    msg::MsgId id = message->id();
+
+    deliver(std::move(message));
+
+    msg::Tracer::handled(id, trace);
+}
+
 
 ////////// MessageSender //////////
 
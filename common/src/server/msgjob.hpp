@@ -40,13 +40,28 @@ class MessagableJob : public Job, public virtual msg::MessageHandler {
         virtual RetType run();
         virtual RetType main() = 0;
 
+        void setInboxLimit(int types, size_t capacity, Overload policy);
+        void setDrainBudget(size_t messages);
+        uint64_t droppedMessages() const;
+        uint64_t deferredMessages() const;
+
     protected:
         void sendMessage(const msg::Message& msg);
+        void sendMessage(std::unique_ptr<msg::Message> msg);
+        void sendMessageAfter(const msg::Message& msg, uint64_t usec);
+        void registerKey(int type, uint64_t key);
+        void deregisterKey(int type, uint64_t key);
         MessageSender newMessageSender();
 
+        virtual void deliver(std::unique_ptr<msg::Message> message);
+
     private:
+        void deliverTraced(std::unique_ptr<msg::Message> message);
+
+        PostOffice& _po;
         Inbox _inbox;
         Outbox _outbox;
+        size_t _drainBudget;  ///< Most messages handled per run or zero.
 };
 
 
@@ -0,0 +1,120 @@
+#include "msglatest.hpp"
+
+
+////////// msg::Latest //////////
+
+/// Construct a Latest holding a state message.
+/// \param message The message.
+msg::Latest::Latest(std::unique_ptr<Message> message)
+    : _message(message.get()), _type(message->type())
+{
+    message.release();
+}
+
+msg::Latest::~Latest()
+{
+    delete _message.load();
+}
+
+/// A Latest cannot be copied.
+/// \return Never returns normally.
+std::unique_ptr<msg::Message> msg::Latest::clone() const
+{
+    throw InputException("msg::Latest: cannot be copied");
+}
+
+/// Dispatch the newest message, if it has not already been read.
+/// \param handler The handler to dispatch to.
+void msg::Latest::dispatch(MessageHandler& handler) const
+{
+    std::unique_ptr<Message> message = take();
+
+    if (message)
+        message->dispatch(handler);
+}
+
+bool msg::Latest::matches(int subscription) const
+{
+    return ((subscription & _type) != 0);
+}
+
+int msg::Latest::type() const
+{
+    return _type;
+}
+
+msg::MsgId msg::Latest::id() const
+{
+    return ID_LATEST;
+}
+
+/// A Latest cannot be encoded.
+/// \param writer Unused.
+void msg::Latest::encode(Writer& writer) const
+{
+    throw InputException("msg::Latest: cannot be encoded");
+}
+
+bool msg::Latest::keyed() const
+{
+    return false;
+}
+
+uint64_t msg::Latest::key() const
+{
+    return 0;
+}
+
+bool msg::Latest::coalesces() const
+{
+    return false;
+}
+
+uint64_t msg::Latest::stateKey() const
+{
+    return 0;
+}
+
+/// Swap a newer message in for the one held.
+/// This is called by the writer. It fails once the reader has taken the
+/// message, in which case the newer message must be queued.
+/// \param message The newer message, which is moved from on success.
+/// \return Whether the message was swapped in.
+bool msg::Latest::replace(std::unique_ptr<Message>& message)
+{
+    Message* old = _message.load(std::memory_order_acquire);
+
+    while (old != 0) {
+        if (_message.compare_exchange_weak(old, message.get(), std::memory_order_acq_rel)) {
+            message.release();
+            delete old;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// Take the newest message. This is called by the reader.
+/// \return The message or null if it has already been taken.
+std::unique_ptr<msg::Message> msg::Latest::take() const
+{
+    return std::unique_ptr<Message>(_message.exchange(0, std::memory_order_acq_rel));
+}
+
+/// \return Whether the reader has taken the message.
+bool msg::Latest::taken() const
+{
+    return (_message.load(std::memory_order_acquire) == 0);
+}
+
+/// Replace a Latest read from an inbox with the message it holds.
+/// \param message A message read from an inbox.
+/// \return The message held if it is a Latest, otherwise the message given.
+std::unique_ptr<msg::Message> msg::Latest::open(std::unique_ptr<Message> message)
+{
+    if (message->id() != ID_LATEST)
+        return message;
+
+    return static_cast<const Latest&>(*message).take();
+}
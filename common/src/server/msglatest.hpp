@@ -0,0 +1,62 @@
+/// \file msglatest.hpp
+/// \brief Holds the newest of a run of state messages.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef MSGLATEST_HPP
+#define MSGLATEST_HPP
+
+
+#include <atomic>
+#include <memory>
+#include "messages.hpp"
+
+
+namespace msg {
+
+
+/// Stands in an inbox for the newest state message with some id and key.
+/// State messages, marked in msg.spec, each describe the whole state of
+/// something so only the newest one matters. The post office puts a Latest
+/// into an inbox in place of a state message, and while the Latest is still
+/// waiting to be read it swaps newer messages with the same id and key into
+/// it instead of queueing them. So however far behind its reader falls, an
+/// inbox holds at most three state messages for each key: one in the batch
+/// last queued whole, and one queued alone on either side of that. The reader swaps the message out when it reads the Latest,
+/// after which the post office queues a new one. A Latest is only ever read from the inbox it was
+/// put in, so it cannot be copied or encoded.
+class Latest : public Message {
+    public:
+        Latest(std::unique_ptr<Message> message);
+        virtual ~Latest();
+        virtual std::unique_ptr<Message> clone() const;
+        virtual void dispatch(MessageHandler& handler) const;
+        virtual bool matches(int subscription) const;
+        virtual int type() const;
+        virtual MsgId id() const;
+        virtual void encode(Writer& writer) const;
+        virtual bool keyed() const;
+        virtual uint64_t key() const;
+        virtual bool coalesces() const;
+        virtual uint64_t stateKey() const;
+
+        bool replace(std::unique_ptr<Message>& message);
+        std::unique_ptr<Message> take() const;
+        bool taken() const;
+
+        static std::unique_ptr<Message> open(std::unique_ptr<Message> message);
+
+    private:
+        mutable std::atomic<Message*> _message;  ///< Newest message or null once read.
+        int _type;                               ///< Type of the messages held.
+};
+
+
+}  // namespace msg
+
+
+#endif  // MSGLATEST_HPP
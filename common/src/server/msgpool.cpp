@@ -0,0 +1,210 @@
+#include <new>
+#include <atomic>
+#include "autolock.hpp"
+#include "msgpool.hpp"
+
+
+/// A free block.
+struct msg::MessagePool::Block {
+    Block* next;       ///< Next block in the same list or batch.
+    Block* nextBatch;  ///< Next batch in the depot if first in a batch.
+};
+
+/// Free blocks held by a thread.
+/// This is zero initialised and trivially destructible, so it can be used
+/// without any setup and even after the thread has begun exiting.
+struct msg::MessagePool::Cache {
+    bool started;             ///< Whether the Reaper has been created.
+    bool dead;                ///< Whether the Reaper has run.
+    Block* heads[CLASSES];    ///< First free block of each size.
+    size_t counts[CLASSES];   ///< Free blocks of each size.
+};
+
+/// Gives the blocks cached by a thread to the depot when the thread exits.
+struct msg::MessagePool::Reaper {
+    ~Reaper();
+};
+
+/// Batches of free blocks shared between threads.
+struct msg::MessagePool::Depot {
+    Depot();
+
+    Block* batches;      ///< First block of first batch.
+    Lock<Block*> lock;   ///< Lock for batches.
+};
+
+
+thread_local msg::MessagePool::Cache msg::MessagePool::_cache;
+
+static std::atomic<uint64_t> systemAllocs(0);
+
+
+////////// msg::MessagePool //////////
+
+/// Allocate memory for a message.
+/// \param size Size of the message in bytes.
+/// \return Memory at least size bytes long.
+void* msg::MessagePool::allocate(size_t size)
+{
+    if ((size == 0) || (size > MAX_SIZE))
+        return ::operator new(size);
+
+    size_t sizeClass = (size - 1) / GRANULE;
+    Cache& cache = _cache;
+
+    if (cache.heads[sizeClass] == 0)
+        refill(sizeClass, cache);
+
+    Block* block = cache.heads[sizeClass];
+    cache.heads[sizeClass] = block->next;
+    cache.counts[sizeClass]--;
+
+    return block;
+}
+
+/// Free memory from allocate().
+/// \param p The memory.
+/// \param size Size passed to allocate().
+void msg::MessagePool::release(void* p, size_t size)
+{
+    if ((size == 0) || (size > MAX_SIZE)) {
+        ::operator delete(p);
+        return;
+    }
+
+    size_t sizeClass = (size - 1) / GRANULE;
+    Cache& cache = _cache;
+    Block* block = static_cast<Block*>(p);
+
+    if (!cache.started)
+        start(cache);
+
+    block->next = cache.heads[sizeClass];
+    cache.heads[sizeClass] = block;
+    cache.counts[sizeClass]++;
+
+    // Once the thread is exiting blocks go straight to the depot.
+    if (cache.dead) {
+        flush(sizeClass, cache, cache.counts[sizeClass]);
+    } else if (cache.counts[sizeClass] > 2 * BATCH) {
+        flush(sizeClass, cache, BATCH);
+    }
+}
+
+/// Used to check that messaging has reached a steady state.
+/// \return Number of times the pool has asked the system for memory.
+uint64_t msg::MessagePool::systemAllocations()
+{
+    return systemAllocs;
+}
+
+/// Arrange for the cache of the calling thread to be emptied when it exits.
+/// \param cache Cache of the calling thread.
+void msg::MessagePool::start(Cache& cache)
+{
+    static thread_local Reaper reaper;
+    (void)reaper;
+
+    cache.started = true;
+}
+
+/// Fill an empty list in a cache.
+/// A batch is taken from the depot if it has one. Otherwise memory for a
+/// batch of blocks is asked for from the system.
+/// \param sizeClass Size of block wanted.
+/// \param cache Cache of the calling thread.
+void msg::MessagePool::refill(size_t sizeClass, Cache& cache)
+{
+    if (!cache.started)
+        start(cache);
+
+    Block* batch = 0;
+
+    {
+        Depot& depot = depots()[sizeClass];
+        AutoWriteLock<Block*> batches(depot.lock);
+
+        batch = *batches;
+        if (batch != 0)
+            *batches = batch->nextBatch;
+    }
+
+    size_t count = 0;
+
+    if (batch != 0) {
+        for (Block* block = batch; block != 0; block = block->next)
+            count++;
+    } else {
+        size_t blockSize = (sizeClass + 1) * GRANULE;
+        char* memory = static_cast<char*>(::operator new(BATCH * blockSize));
+        systemAllocs++;
+
+        for (size_t i = BATCH; i > 0; i--) {
+            Block* block = reinterpret_cast<Block*>(memory + (i - 1) * blockSize);
+            block->next = batch;
+            batch = block;
+        }
+
+        count = BATCH;
+    }
+
+    cache.heads[sizeClass] = batch;
+    cache.counts[sizeClass] = count;
+}
+
+/// Give blocks from a cache to the depot as one batch.
+/// \param sizeClass Size of the blocks.
+/// \param cache Cache of the calling thread.
+/// \param count Number of blocks to give, which the cache must hold.
+void msg::MessagePool::flush(size_t sizeClass, Cache& cache, size_t count)
+{
+    if (count == 0)
+        return;
+
+    Block* batch = cache.heads[sizeClass];
+    Block* last = batch;
+
+    for (size_t i = 1; i < count; i++)
+        last = last->next;
+
+    cache.heads[sizeClass] = last->next;
+    cache.counts[sizeClass] -= count;
+    last->next = 0;
+
+    Depot& depot = depots()[sizeClass];
+    AutoWriteLock<Block*> batches(depot.lock);
+
+    batch->nextBatch = *batches;
+    *batches = batch;
+}
+
+/// The depots are never destroyed, since messages may be freed by other
+/// static destructors.
+/// \return Depot for each size.
+msg::MessagePool::Depot* msg::MessagePool::depots()
+{
+    static Depot* depots = new Depot[CLASSES];
+    return depots;
+}
+
+
+////////// msg::MessagePool::Reaper //////////
+
+msg::MessagePool::Reaper::~Reaper()
+{
+    Cache& cache = _cache;
+
+    for (size_t i = 0; i < CLASSES; i++)
+        flush(i, cache, cache.counts[i]);
+
+    cache.dead = true;
+}
+
+
+////////// msg::MessagePool::Depot //////////
+
+msg::MessagePool::Depot::Depot()
+    : batches(0), lock(batches)
+{
+
+}
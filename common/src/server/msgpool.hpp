@@ -0,0 +1,63 @@
+/// \file msgpool.hpp
+/// \brief Pooled allocation for messages.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef MSGPOOL_HPP
+#define MSGPOOL_HPP
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+namespace msg {
+
+
+/// Allocates memory for messages from free lists.
+/// Messages are small, short lived and usually freed on a different thread
+/// from the one that allocated them, so the general purpose allocator does a
+/// lot of work for each one. Instead sizes up to MAX_SIZE are rounded up to a
+/// multiple of GRANULE and each size has its own free lists. Every thread
+/// keeps a cache of free blocks that it allocates from and frees to without
+/// locking. When a cache holds too many blocks of a size it gives a batch of
+/// them to a shared depot, and when it runs out it takes a batch back. So a
+/// thread that only frees messages hands its blocks over to a thread that only
+/// allocates them, and once the pool has grown to the peak number of messages
+/// in flight no more memory is asked for. Memory is only returned to the
+/// system when the process exits. Larger sizes go to the general allocator.
+class MessagePool {
+    public:
+        static void* allocate(size_t size);
+        static void release(void* p, size_t size);
+
+        static uint64_t systemAllocations();
+
+    private:
+        static const size_t GRANULE = 16;   ///< Sizes are rounded to this.
+        static const size_t MAX_SIZE = 256; ///< Largest pooled size.
+        static const size_t CLASSES = MAX_SIZE / GRANULE;
+        static const size_t BATCH = 64;     ///< Blocks moved to or from depot.
+
+        struct Block;
+        struct Cache;
+        struct Reaper;
+        struct Depot;
+
+        static void start(Cache& cache);
+        static void refill(size_t sizeClass, Cache& cache);
+        static void flush(size_t sizeClass, Cache& cache, size_t count);
+        static Depot* depots();
+
+        static thread_local Cache _cache;  ///< Free blocks of this thread.
+};
+
+
+}  // namespace msg
+
+
+#endif  // MSGPOOL_HPP
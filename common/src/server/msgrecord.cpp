@@ -0,0 +1,243 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sstream>
+#include <algorithm>
+#include <core/core.hpp>
+#include "msgtrace.hpp"
+#include "msgrecord.hpp"
+
+
+/// Start of every log, changed whenever the layout of records changes.
+static const char MAGIC[8] = {'M', 'S', 'G', 'L', 'O', 'G', '0', '1'};
+
+
+////////// MessageRecorder //////////
+
+/// Construct a MessageRecorder.
+/// \param po The post office whose messages are recorded.
+/// \param path Path of the log, which is replaced if it exists.
+MessageRecorder::MessageRecorder(PostOffice& po, const std::string& path) :
+    MessagableJob(po, msg::MSG_ALL), _start(msg::Tracer::now()), _recorded(0)
+{
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd == -1)
+        throw ErrNoException("open failed");
+
+    registerKey(msg::MSG_ALL, PostShard::ANY_KEY);
+
+    _buffer.append(MAGIC, sizeof(MAGIC));
+}
+
+MessageRecorder::~MessageRecorder()
+{
+    flush();
+
+    if (_fd != -1)
+        close(_fd);
+}
+
+Job::RetType MessageRecorder::main()
+{
+    // Write what has arrived so the log is current if the process dies.
+    flush();
+
+    return BLOCK;
+}
+
+/// \return Number of messages recorded.
+uint64_t MessageRecorder::recordedMessages() const
+{
+    return _recorded.load(std::memory_order_relaxed);
+}
+
+/// Add a record for a message to the log.
+/// \param message The message.
+void MessageRecorder::deliver(std::unique_ptr<msg::Message> message)
+{
+    if (_fd == -1)
+        return;
+
+    msg::Writer writer(_buffer);
+    writer.write(msg::Tracer::now() - _start);
+    writer.write(uint32_t(message->id()));
+
+    size_t start = _buffer.size();
+    writer.write(uint32_t(0));
+
+    message->encode(writer);
+
+    uint32_t size = _buffer.size() - start - sizeof(uint32_t);
+    memcpy(_buffer.data() + start, &size, sizeof(size));
+
+    _recorded.fetch_add(1, std::memory_order_relaxed);
+
+    if (_buffer.size() >= FLUSH)
+        flush();
+}
+
+/// Write the records kept so far to the log.
+/// If the log cannot be written recording stops, but the rest of the server
+/// carries on.
+void MessageRecorder::flush()
+{
+    size_t written = 0;
+
+    while ((_fd != -1) && (written < _buffer.size())) {
+        ssize_t size = write(_fd, _buffer.data() + written, _buffer.size() - written);
+
+        if (size >= 0) {
+            written += size;
+        } else if (errno != EINTR) {
+            Log::log->warn("MessageRecorder: write failed, recording stopped");
+            close(_fd);
+            _fd = -1;
+        }
+    }
+
+    _buffer.clear();
+}
+
+
+////////// MessageReplay //////////
+
+/// Construct a MessageReplay.
+/// \param path Path of a log written by a MessageRecorder.
+MessageReplay::MessageReplay(const std::string& path) :
+    _played(0), _elapsed(0), _behind(0)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw ErrNoException("open failed");
+
+    char chunk[64 * 1024];
+    ssize_t size;
+
+    while ((size = read(fd, chunk, sizeof(chunk))) != 0) {
+        if (size > 0) {
+            _log.append(chunk, size);
+        } else if (errno != EINTR) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            throw ErrNoException("read failed");
+        }
+    }
+
+    close(fd);
+
+    if ((_log.size() < sizeof(MAGIC)) || (memcmp(_log.data(), MAGIC, sizeof(MAGIC)) != 0))
+        throw InputException("MessageReplay: not a message log");
+}
+
+MessageReplay::~MessageReplay()
+{
+
+}
+
+/// Play the messages of the log to a handler.
+/// A log that cannot be decoded throws InputException, leaving the messages
+/// before the bad record played.
+/// \param handler The handler to dispatch the messages to.
+/// \param subscription Types of message to play, as the job of the handler
+/// would subscribe to. Others in the log are skipped.
+/// \param fast Whether to play the messages as fast as possible rather than
+/// with the gaps between them that were recorded.
+/// \param idle Called after each message and while waiting for the next, such
+/// as to let the job of the handler do its work for each tick.
+void MessageReplay::play(msg::MessageHandler& handler, int subscription, bool fast,
+    const IdleFunc& idle)
+{
+    msg::Reader reader(_log.data() + sizeof(MAGIC), _log.size() - sizeof(MAGIC));
+    uint64_t start = msg::Tracer::now();
+    uint64_t first = 0;
+    bool started = false;
+
+    while (!reader.done()) {
+        uint64_t time = reader.read<uint64_t>();
+        msg::MsgId id = msg::MsgId(reader.read<uint32_t>());
+        msg::Reader record = reader.record(reader.read<uint32_t>());
+        std::unique_ptr<msg::Message> message = msg::decode(id, record);
+
+        if (!record.done())
+            throw InputException("MessageReplay: record is too long");
+
+        if (!started) {
+            first = time;
+            started = true;
+        }
+
+        if (!message->matches(subscription))
+            continue;
+
+        if (!fast)
+            wait(start + (time - first), idle);
+
+        uint64_t before = msg::Tracer::now();
+        message->dispatch(handler);
+        uint64_t after = msg::Tracer::now();
+
+        if (id < IDS)
+            _handling[id].add(after - before);
+
+        _played++;
+        idle();
+    }
+
+    _elapsed = msg::Tracer::now() - start;
+}
+
+/// Produce a report on how long the handler took for each message id.
+/// \return The report with one line per message id.
+std::string MessageReplay::report() const
+{
+    std::ostringstream report;
+
+    report << "replayed " << _played << " messages in " << (_elapsed / 1000000) << "ms, "
+           << (_played != 0 ? _elapsed / _played : 0) << "ns/msg, at most "
+           << (_behind / 1000) << "us late";
+
+    for (int id = 0; id < IDS; id++) {
+        const Histogram& handling = _handling[id];
+
+        if (handling.count() == 0)
+            continue;
+
+        report << "\n  " << msg::idName(msg::MsgId(id)) << " count=" << handling.count()
+               << " handling(ns) mean=" << handling.mean()
+               << " p50=" << handling.percentile(0.5)
+               << " p99=" << handling.percentile(0.99)
+               << " max=" << handling.max();
+    }
+
+    return report.str();
+}
+
+/// Wait until a message is due, calling the idle function at least once a
+/// slice. How late the message is played is noted.
+/// \param due Time the message is due.
+/// \param idle Called while waiting.
+void MessageReplay::wait(uint64_t due, const IdleFunc& idle)
+{
+    uint64_t now = msg::Tracer::now();
+
+    while (now < due) {
+        idle();
+
+        now = msg::Tracer::now();
+        if (now >= due)
+            break;
+
+        uint64_t delay = due - now;
+        if (delay > SLICE)
+            delay = SLICE;
+
+        timespec ts = {time_t(delay / 1000000000), long(delay % 1000000000)};
+        nanosleep(&ts, 0);
+
+        now = msg::Tracer::now();
+    }
+
+    _behind = std::max(_behind, now - due);
+}
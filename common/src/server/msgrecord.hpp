@@ -0,0 +1,88 @@
+/// \file msgrecord.hpp
+/// \brief Records the messages through a post office and plays them back.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef MSGRECORD_HPP
+#define MSGRECORD_HPP
+
+
+#include <atomic>
+#include <string>
+#include <functional>
+#include "msgjob.hpp"
+#include "msgcodec.hpp"
+#include "histogram.hpp"
+
+
+/// Appends every message routed by a post office to a log file.
+/// The log starts with a header identifying it, followed by a record for
+/// each message. A record is the time the message reached the recorder, in
+/// nanoseconds since the recorder was made, then the id, size and encoded
+/// fields of the message as sent by a PostBridge. Fields are written as they
+/// are in memory, so a log can only be played back by a build for the same
+/// architecture and msg.spec. State messages are coalesced like they are
+/// for any other job, so if the recorder falls behind it only records the
+/// newest state of each object.
+class MessageRecorder : public MessagableJob {
+    public:
+        MessageRecorder(PostOffice& po, const std::string& path);
+        virtual ~MessageRecorder();
+
+        virtual RetType main();
+
+        uint64_t recordedMessages() const;
+
+    private:
+        static const size_t FLUSH = 64 * 1024;  ///< Bytes kept before writing.
+
+        virtual void deliver(std::unique_ptr<msg::Message> message);
+
+        void flush();
+
+        int _fd;                          ///< The log file or -1 once failed.
+        uint64_t _start;                  ///< Time the recording started.
+        msg::Buffer _buffer;              ///< Records not yet written.
+        std::atomic<uint64_t> _recorded;  ///< Messages recorded.
+};
+
+
+/// Plays back a log written by a MessageRecorder.
+/// Each message is decoded and dispatched straight to a handler, such as a
+/// Zone, LoginManager or ObjectCache, so the order of messages and what the
+/// handler sees are the same every time. Messages are played either as fast
+/// as possible or with the gaps between them that were recorded, and the
+/// time the handler takes for each is added to a histogram for its id.
+class MessageReplay {
+    public:
+        typedef std::function<void()> IdleFunc;
+
+        MessageReplay(const std::string& path);
+        ~MessageReplay();
+
+        void play(msg::MessageHandler& handler, int subscription, bool fast,
+            const IdleFunc& idle);
+        std::string report() const;
+
+    private:
+        static const int IDS = 64;              ///< Message ids with histograms.
+        static const uint64_t SLICE = 1000000;  ///< Most nanoseconds slept at once.
+
+        MessageReplay(const MessageReplay&);             ///< This method is undefined.
+        MessageReplay& operator=(const MessageReplay&);  ///< This method is undefined.
+
+        void wait(uint64_t due, const IdleFunc& idle);
+
+        msg::Buffer _log;          ///< The whole log.
+        Histogram _handling[IDS];  ///< Nanoseconds spent handling each id.
+        uint64_t _played;          ///< Messages played.
+        uint64_t _elapsed;         ///< Nanoseconds taken to play them.
+        uint64_t _behind;          ///< Most nanoseconds a message was late.
+};
+
+
+#endif  // MSGRECORD_HPP
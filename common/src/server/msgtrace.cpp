@@ -0,0 +1,189 @@
+#include <time.h>
+#include <sstream>
+#include "histogram.hpp"
+#include "msgtrace.hpp"
+
+
+/// Messages the current thread will send before it samples one.
+static thread_local unsigned int countdown = 0;
+
+
+/// Latencies of the messages with one id, in nanoseconds.
+struct msg::Tracer::Latency {
+    Histogram total;     ///< From sent to read.
+    Histogram outbox;    ///< From sent to collected.
+    Histogram inbox;     ///< From collected to read.
+    Histogram handling;  ///< From read to handled.
+};
+
+/// Points passed by one sampled message.
+struct msg::Tracer::Path {
+    MsgId id;     ///< Id of the message.
+    Trace trace;  ///< Times it passed each point.
+};
+
+
+////////// msg::Tracer //////////
+
+std::atomic<unsigned int> msg::Tracer::_period(0);
+
+/// Sample one in every so many messages sent by each thread.
+/// \param period Messages per sample, or zero to stop tracing.
+void msg::Tracer::setPeriod(unsigned int period)
+{
+    _period.store(period, std::memory_order_relaxed);
+}
+
+/// \return Messages per sample, or zero if tracing is off.
+unsigned int msg::Tracer::period()
+{
+    return _period.load(std::memory_order_relaxed);
+}
+
+/// Stamp a message read from an inbox.
+/// \param message A message with a Trace.
+/// \return A copy of the Trace of the message with the read time filled in.
+msg::Trace msg::Tracer::read(const Message& message)
+{
+    Trace trace = *message.trace();
+    trace.times[Trace::READ] = now();
+
+    return trace;
+}
+
+/// Record the latencies and path of a message once it has been handled.
+/// \param id Id of the message.
+/// \param trace Trace returned by read(). The handled time is filled in.
+void msg::Tracer::handled(MsgId id, Trace& trace)
+{
+    uint64_t* times = trace.times;
+    times[Trace::HANDLED] = now();
+
+    if (id < IDS) {
+        Latency& latency = latencies()[id];
+        latency.total.add(times[Trace::READ] - times[Trace::SENT]);
+        latency.handling.add(times[Trace::HANDLED] - times[Trace::READ]);
+
+        if (times[Trace::COLLECTED] != 0) {
+            latency.outbox.add(times[Trace::COLLECTED] - times[Trace::SENT]);
+            latency.inbox.add(times[Trace::READ] - times[Trace::COLLECTED]);
+        }
+    }
+
+    Path path = {id, trace};
+
+    PathDeque::LockForWrite paths(recent());
+    paths->push_back(path);
+
+    if (paths->size() > PATHS)
+        paths->pop_front();
+}
+
+/// Produce a report on the latency of each type of message sampled.
+/// \return The report with one line per message id.
+std::string msg::Tracer::report()
+{
+    std::ostringstream report;
+    unsigned int every = period();
+
+    report << "message latency: ";
+
+    if (every == 0) {
+        report << "tracing off";
+    } else {
+        report << "1 in " << every << " messages traced";
+    }
+
+    for (int id = 0; id < IDS; id++) {
+        const Latency& latency = latencies()[id];
+
+        if (latency.total.count() == 0)
+            continue;
+
+        report << "\n  " << idName(MsgId(id)) << " count=" << latency.total.count()
+               << " total(ns) mean=" << latency.total.mean()
+               << " p50=" << latency.total.percentile(0.5)
+               << " p99=" << latency.total.percentile(0.99)
+               << " max=" << latency.total.max()
+               << " outbox p99=" << latency.outbox.percentile(0.99)
+               << " inbox p99=" << latency.inbox.percentile(0.99)
+               << " handling p99=" << latency.handling.percentile(0.99);
+    }
+
+    return report.str();
+}
+
+/// Export the paths of the most recently handled sampled messages.
+/// Times are in nanoseconds from when each message was sent, and a time of
+/// -1 means the message did not pass that point.
+/// \return Comma separated values with a header line and one line per path.
+std::string msg::Tracer::paths()
+{
+    std::ostringstream csv;
+    csv << "message,sent,collected,read,handled\n";
+
+    PathDeque::LockForRead paths(recent());
+
+    for (const Path& path : *paths) {
+        const uint64_t* times = path.trace.times;
+        csv << idName(path.id);
+
+        for (int point = 0; point < Trace::POINTS; point++) {
+            if (times[point] == 0) {
+                csv << ",-1";
+            } else {
+                csv << "," << (times[point] - times[Trace::SENT]);
+            }
+        }
+
+        csv << "\n";
+    }
+
+    return csv.str();
+}
+
+/// Get the time from a monotonic clock.
+/// \return Time in nanoseconds.
+uint64_t msg::Tracer::now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/// Give a message a Trace if it is the one in every period to sample.
+/// \param message A message about to be sent.
+void msg::Tracer::sample(const Message& message)
+{
+    if (countdown != 0) {
+        countdown--;
+        return;
+    }
+
+    unsigned int every = period();
+    if ((every == 0) || (message.trace() != 0))
+        return;
+
+    countdown = every - 1;
+
+    Trace* trace = new Trace();
+    trace->times[Trace::SENT] = now();
+    message.setTrace(trace);
+}
+
+/// The latencies are made when first used so that they exist before any
+/// message is sent, however early.
+/// \return Latencies for each message id below IDS.
+msg::Tracer::Latency* msg::Tracer::latencies()
+{
+    static Latency latency[IDS];
+    return latency;
+}
+
+/// \return Paths of the most recently handled sampled messages, oldest first.
+msg::Tracer::PathDeque& msg::Tracer::recent()
+{
+    static PathDeque paths;
+    return paths;
+}
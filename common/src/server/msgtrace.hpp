@@ -0,0 +1,102 @@
+/// \file msgtrace.hpp
+/// \brief Samples how long messages take to reach the jobs they are sent to.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef MSGTRACE_HPP
+#define MSGTRACE_HPP
+
+
+#include <string>
+#include <atomic>
+#include <stdint.h>
+#include "autolock.hpp"
+#include "messages.hpp"
+
+
+namespace msg {
+
+
+/// Times at which a sampled message passed each point on its way to a job.
+/// Times are nanoseconds on the monotonic clock. A message only carries the
+/// times up to when the post office routes it, since after that it may be
+/// shared by several inboxes. Each reader fills in the rest in a copy.
+struct Trace {
+    enum Point {
+        SENT,       ///< Put in the outbox of the sender.
+        COLLECTED,  ///< Taken from the outbox by a post office shard.
+        READ,       ///< Taken from the inbox of the receiver.
+        HANDLED,    ///< Dispatched by the receiver.
+        POINTS
+    };
+
+    uint64_t times[POINTS];  ///< Time at each point or zero if not reached.
+};
+
+
+/// Records the latency of a sample of messages.
+/// One message in every period sent by each thread is given a Trace, which
+/// is stamped as the message is sent, routed, read and handled. Once it has
+/// been handled its latencies are added to histograms for its id and its
+/// path is kept with the most recent others. Tracing is off until a period
+/// is set, and while it is off sending a message costs one extra load, so a
+/// long period costs next to nothing in production.
+class Tracer {
+    public:
+        static void setPeriod(unsigned int period);
+        static unsigned int period();
+
+        static void sent(const Message& message);
+        static void collected(const Message& message);
+        static Trace read(const Message& message);
+        static void handled(MsgId id, Trace& trace);
+
+        static std::string report();
+        static std::string paths();
+
+        static uint64_t now();
+
+    private:
+        static const int IDS = 64;        ///< Message ids with histograms.
+        static const size_t PATHS = 256;  ///< Paths kept for export.
+
+        struct Path;
+        struct Latency;
+
+        typedef Lockable<Path>::Deque PathDeque;
+
+        static void sample(const Message& message);
+        static Latency* latencies();
+        static PathDeque& recent();
+
+        static std::atomic<unsigned int> _period;  ///< Messages per sample.
+};
+
+
+}  // namespace msg
+
+
+////////// msg::Tracer //////////
+
+/// Stamp a message as it is sent, if it is to be sampled.
+/// \param message The message, which must not have been put in an outbox.
+inline void msg::Tracer::sent(const Message& message)
+{
+    if (__builtin_expect(_period.load(std::memory_order_relaxed) != 0, 0))
+        sample(message);
+}
+
+/// Stamp a sampled message as it is taken from an outbox.
+/// \param message The message, which must not have been routed yet.
+inline void msg::Tracer::collected(const Message& message)
+{
+    if (__builtin_expect(message.trace() != 0, 0))
+        message.trace()->times[Trace::COLLECTED] = now();
+}
+
+
+#endif  // MSGTRACE_HPP
@@ -155,14 +155,17 @@ void RemoteClient::handleMsgInfo(const char* text)
 
 ////////// NetworkInterface //////////
 
-NetworkInterface::NetworkInterface(PostOffice& po) :
-    MessagableJob(po, MSG_ZONESAYS | MSG_PEER | MSG_CHAT), net::Interface(GAMEPORT)
+NetworkInterface::NetworkInterface(PostOffice& po, TickClock& clock) :
+    MessagableJob(po, MSG_ZONESAYS | MSG_PEER | MSG_CHAT), net::Interface(GAMEPORT),
+    _clock(clock)
 {
     Log::log->info("NetworkInterface: startup");
+    _clock.subscribe(this);
 }
 
 NetworkInterface::~NetworkInterface()
 {
+    _clock.unsubscribe(this);
     Log::log->info("NetworkInterface: shutdown");
 
     for (auto& client : _clients) 
@@ -171,9 +174,10 @@ NetworkInterface::~NetworkInterface()
 
 Job::RetType NetworkInterface::main()
 {
+    // Woken each tick to poll and flush, or when messages arrive.
     doNetworkTasks();
 
-    return YIELD;
+    return BLOCK;
 }
 
 void NetworkInterface::tellPlayerObjectPos(PlayerID player, const CachedObjectInfo& object)
@@ -15,6 +15,7 @@
 #include <tr1/unordered_map>
 #include "objcache.hpp"
 #include "msgjob.hpp"
+#include "tickclock.hpp"
 
 
 class NetworkInterface;
@@ -64,7 +65,7 @@ class NetworkInterface : public ObjectCache,
     public:
         friend class RemoteClient;
 
-        NetworkInterface(PostOffice& po);
+        NetworkInterface(PostOffice& po, TickClock& clock);
         virtual ~NetworkInterface();
 
         virtual RetType main();
@@ -90,6 +91,8 @@ class NetworkInterface : public ObjectCache,
 
         PlayerToPeer _players;
         Clients _clients;
+
+        TickClock& _clock;
 };
 
 
@@ -47,14 +47,9 @@ void ObjectCache::handleZoneSaysObjectLeave(ObjectID object)
     removeObjectInfo(object);
 }
 
-void ObjectCache::handleZoneSaysObjectClearClose(ObjectID object)
+void ObjectCache::handleZoneSaysObjectNeighbours(ObjectID object, const ObjectList& neighbours)
 {
-    getObjectInfo(object).clearCloseObjects();
-}
-
-void ObjectCache::handleZoneSaysObjectsClose(ObjectID a, ObjectID b)
-{
-    getObjectInfo(a).setCloseTo(b);
+    getObjectInfo(object).setCloseObjects(neighbours);
 }
 
 void ObjectCache::handleZoneSaysObjectAttach(ObjectID object, PlayerID player)
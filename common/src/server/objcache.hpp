@@ -35,8 +35,7 @@ class CachedObjectInfo {
         const Vector3& getVelocity() const;
         sim::ControlState getControlState() const;
 
-        void clearCloseObjects();
-        void setCloseTo(ObjectID object);
+        void setCloseObjects(const ObjectList& objects);
         const ObjectSet& getCloseObjects() const;
 
         void attachPlayer(PlayerID player);
@@ -77,8 +76,7 @@ class ObjectCache : public virtual msg::MessageHandler {
 
         virtual void handleZoneSaysObjectEnter(ObjectID object);
         virtual void handleZoneSaysObjectLeave(ObjectID object);
-        virtual void handleZoneSaysObjectClearClose(ObjectID object);
-        virtual void handleZoneSaysObjectsClose(ObjectID a, ObjectID b);
+        virtual void handleZoneSaysObjectNeighbours(ObjectID object, const ObjectList& neighbours);
         virtual void handleZoneSaysObjectAttach(ObjectID object, PlayerID player);
         virtual void handleZoneSaysObjectName(ObjectID object, const std::string& name);
         virtual void handleZoneSaysObjectPos(ObjectID object, Vector3 pos);
@@ -141,14 +139,10 @@ inline sim::ControlState CachedObjectInfo::getControlState() const
     return _state;
 }
 
-inline void CachedObjectInfo::clearCloseObjects()
+inline void CachedObjectInfo::setCloseObjects(const ObjectList& objects)
 {
     _closeObjects.clear();
-}
-
-inline void CachedObjectInfo::setCloseTo(ObjectID object)
-{
-    _closeObjects.insert(object);
+    _closeObjects.insert(objects.begin(), objects.end());
 }
 
 inline const ObjectSet& CachedObjectInfo::getCloseObjects() const
@@ -26,7 +26,12 @@ LoginManager::~LoginManager()
 
 LoginManager::RetType LoginManager::main()
 {
-    return YIELD;
+    return BLOCK;
+}
+
+Job::Priority LoginManager::priority()
+{
+    return BACKGROUND;
 }
 
 void LoginManager::handlePeerRequestLogin(PeerID peer, const std::string& username, const MD5Hash& password)
@@ -26,6 +26,8 @@ class LoginManager : public MessagableJob {
         virtual RetType main();
 
     private:
+        virtual Priority priority();
+
         virtual void handlePeerRequestLogin(PeerID peer, const std::string& username, const MD5Hash& password);
         virtual void handlePeerRequestLogout(PeerID peer, PlayerID player);
 
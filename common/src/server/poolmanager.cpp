@@ -0,0 +1,88 @@
+#include <sstream>
+#include <algorithm>
+#include <core/core.hpp>
+#include "poolmanager.hpp"
+
+
+const float PoolManager::BUSY_UTILISATION = 0.75f;
+const float PoolManager::QUIET_UTILISATION = 0.25f;
+
+
+////////// PoolManager //////////
+
+/// Construct a PoolManager.
+/// The pool starts with the minimum number of active workers.
+/// \param pool The pool whose workers are to be managed.
+/// \param minWorkers Least number of workers to keep active.
+/// \param maxWorkers Greatest number of workers to let run.
+PoolManager::PoolManager(JobPool& pool, int minWorkers, int maxWorkers)
+    : _pool(pool), _minWorkers(minWorkers), _maxWorkers(maxWorkers), 
+      _last(pool.load()), _lastTime(JobPool::now()), _quietSamples(0)
+{
+    resize(_minWorkers);
+}
+
+/// Destroy PoolManager.
+PoolManager::~PoolManager()
+{
+
+}
+
+/// Sample the load and adjust the worker limit.
+/// \return Always Job::BLOCK, having set a timer for the next sample.
+Job::RetType PoolManager::run()
+{
+    uint64_t time = JobPool::now();
+    JobPool::Load load = _pool.load();
+    int workers = _pool.workerLimit();
+
+    uint64_t elapsed = time - _lastTime;
+    uint64_t runs = load.runs - _last.runs;
+    unsigned int misses = load.deadlineMisses - _last.deadlineMisses;
+
+    float utilisation = (elapsed > 0 ? 
+        float(load.busy - _last.busy) / (float(elapsed) * workers) : 0.0f);
+    uint64_t meanWait = (runs > 0 ? (load.wait - _last.wait) / runs : 0);
+
+    _last = load;
+    _lastTime = time;
+
+    bool busy = ((misses > 0) || (utilisation > BUSY_UTILISATION) || 
+        (meanWait > WAIT_LIMIT));
+    bool quiet = ((misses == 0) && (utilisation < QUIET_UTILISATION) && 
+        (meanWait <= WAIT_LIMIT));
+
+    _quietSamples = (quiet ? _quietSamples + 1 : 0);
+
+    if (busy && (workers < _maxWorkers)) {
+        resize(workers + 1);
+    } else if ((_quietSamples >= QUIET_SAMPLES) && (workers > _minWorkers)) {
+        resize(workers - 1);
+        _quietSamples = 0;
+    }
+
+    wakeAfter(SAMPLE_PERIOD);
+
+    return BLOCK;
+}
+
+/// The manager can wait while the pool is busy, but not for long since it 
+/// is what adds workers when the pool is overloaded. Background jobs are 
+/// still given regular turns.
+/// \return Job::BACKGROUND.
+Job::Priority PoolManager::priority()
+{
+    return BACKGROUND;
+}
+
+/// Change the number of active workers.
+/// \param workers New number of active workers.
+void PoolManager::resize(int workers)
+{
+    workers = std::max(std::min(workers, _maxWorkers), _minWorkers);
+    _pool.setWorkerLimit(workers);
+
+    std::ostringstream message;
+    message << "PoolManager: " << workers << " active workers";
+    Log::log->info(message.str());
+}
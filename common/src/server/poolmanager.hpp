@@ -0,0 +1,54 @@
+/// \file poolmanager.hpp
+/// \brief Adjusts the number of active workers to the load.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef POOLMANAGER_HPP
+#define POOLMANAGER_HPP
+
+
+#include "concurrency.hpp"
+
+
+/// Job that grows and shrinks the set of active workers in a JobPool.
+/// Every SAMPLE_PERIOD the manager samples JobPool::load() and works out how
+/// busy the active workers were and how long jobs waited to be run. Another
+/// worker is let run straight away if realtime deadlines were missed, if the
+/// workers were busy or if jobs were kept waiting. A worker is only parked
+/// once the pool has been quiet for QUIET_SAMPLES samples in a row, so the
+/// count does not flap. The limit always stays between the minimum and 
+/// maximum given. The pool should have at least the maximum number of 
+/// Worker objects attached, since the manager only parks and unparks them.
+class PoolManager : public Job {
+    public:
+        PoolManager(JobPool& pool, int minWorkers, int maxWorkers);
+        virtual ~PoolManager();
+
+        virtual RetType run();
+
+    private:
+        static const uint64_t SAMPLE_PERIOD = 250000;  ///< Microseconds.
+        static const uint64_t WAIT_LIMIT = 1000;       ///< Mean wait to grow.
+        static const int QUIET_SAMPLES = 8;            ///< Samples to shrink.
+        static const float BUSY_UTILISATION;           ///< Fraction to grow.
+        static const float QUIET_UTILISATION;          ///< Fraction to shrink.
+
+        virtual Priority priority();
+
+        void resize(int workers);
+
+        JobPool& _pool;          ///< Pool whose workers are managed.
+        const int _minWorkers;   ///< Least number of active workers.
+        const int _maxWorkers;   ///< Greatest number of active workers.
+
+        JobPool::Load _last;     ///< Load at the previous sample.
+        uint64_t _lastTime;      ///< Time of the previous sample.
+        int _quietSamples;       ///< Consecutive quiet samples.
+};
+
+
+#endif  // POOLMANAGER_HPP
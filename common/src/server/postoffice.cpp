@@ -7,87 +7,830 @@
 ///
 
 
-#include <assert.h>
+#include <algorithm>
 #include <core/core.hpp>
+#include "msgtrace.hpp"
 #include "postoffice.hpp"
 
 
-////////// PostOffice //////////
+////////// PostShard //////////
 
-PostOffice::PostOffice() :
-    _srcsLock(_srcs[0]), _dstsLock(_dsts[0])
+PostShard::PostShard() :
+    _srcsLock(_srcs), _dstsLock(_dsts), _marker(0)
 {
-    Log::log->info("PostOffice: message routing: startup");
+
 }
 
-PostOffice::~PostOffice()
+PostShard::~PostShard()
 {
-    Log::log->info("PostOffice: message routing: shutdown");
+    for (size_t i = 0; i < _dsts.size(); i++) {
+        if (!_dsts[i]->outbox.closed())
+            _dsts[i]->inbox->removeWriter(this);
+    }
 }
 
-Job::RetType PostOffice::run()
+Job::RetType PostShard::run()
+{
+    AutoWriteLock<SrcVector> srcs(_srcsLock);
+    AutoWriteLock<DstVector> dsts(_dstsLock);
+
+    // Messages held back go in ahead of any routed now.
+    for (size_t i = 0; i < _dsts.size(); i++)
+        flush(*_dsts[i]);
+
+    // Closed inboxes are still read since their job may have sent messages
+    // just before it was destroyed.
+    for (size_t i = 0; i < _srcs.size(); i++)
+        collect(*_srcs[i], false);
+
+    for (size_t i = 0; i < _dsts.size(); i++)
+        _dsts[i]->outbox.transfer();
+
+    prune();
+
+    // Sources wake the shard when they have messages, and inboxes wake it
+    // when there is room for messages blocked or held back.
+    return BLOCK;
+}
+
+/// Route messages from an outbox to the inboxes of its subscribers.
+/// \param outbox The outbox to read messages from.
+void PostShard::addSource(Outbox& outbox)
+{
+    AutoWriteLock<SrcVector> srcs(_srcsLock);
+
+    std::unique_ptr<Src> src(new Src);
+    src->outbox = &outbox;
+    src->inbox.setReader(this);
+    src->inbox.connectTo(outbox);
+
+    _srcs.push_back(std::move(src));
+}
+
+/// Deliver messages of the subscribed types to an inbox.
+/// \param inbox The inbox to deliver messages to.
+/// \param subscription Bitwise OR of the types of message wanted.
+void PostShard::addDestination(Inbox& inbox, int subscription)
+{
+    AutoWriteLock<DstVector> dsts(_dstsLock);
+
+    std::unique_ptr<Dst> dst(new Dst);
+    dst->inbox = &inbox;
+    dst->subscription = subscription;
+    dst->mark = 0;
+    dst->sweepSize = SWEEP_SIZE;
+    inbox.connectTo(dst->outbox);
+    inbox.addWriter(this);
+
+    _dsts.push_back(std::move(dst));
+    rebuildRoutes();
+}
+
+/// Stop reading messages from an outbox once those already sent are routed.
+/// \param outbox The outbox.
+/// \return Whether the outbox was a source of this shard.
+bool PostShard::removeSource(Outbox& outbox)
+{
+    AutoWriteLock<SrcVector> srcs(_srcsLock);
+    AutoWriteLock<DstVector> dsts(_dstsLock);
+
+    for (size_t i = 0; i < _srcs.size(); i++) {
+        if (_srcs[i]->outbox == &outbox) {
+            collect(*_srcs[i], true);
+            _srcs.erase(_srcs.begin() + i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// Stop delivering messages to an inbox.
+/// \param inbox The inbox.
+/// \return Whether the inbox was a destination of this shard.
+bool PostShard::removeDestination(Inbox& inbox)
+{
+    AutoWriteLock<DstVector> dsts(_dstsLock);
+
+    for (size_t i = 0; i < _dsts.size(); i++) {
+        if (_dsts[i]->inbox == &inbox) {
+            inbox.removeWriter(this);
+            _dsts.erase(_dsts.begin() + i);
+            rebuildRoutes();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/// Deliver messages of a type that have a key to an inbox.
+/// Keyed messages are only delivered to the inboxes registered for their key,
+/// not to every inbox subscribed to their type.
+/// \param inbox An inbox already added as a destination.
+/// \param type Bitwise OR of the types the key is for.
+/// \param key The key, or ANY_KEY for every key.
+void PostShard::addKey(Inbox& inbox, int type, uint64_t key)
 {
-    typedef std::unique_ptr<msg::Message> MsgPtr;
+    AutoWriteLock<DstVector> dsts(_dstsLock);
+
+    Dst* dst = findDestination(inbox);
+    if (dst == 0)
+        return;
+
+    dst->keys.push_back(Key(type, key));
+
+    for (int i = 0; i < ROUTES; i++) {
+        if (!(type & (1u << i)))
+            continue;
+
+        if (key == ANY_KEY) {
+            _anyKey[i].push_back(dst);
+        } else {
+            _keyed[i][key].push_back(dst);
+        }
+    }
+}
+
+/// Stop delivering keyed messages to an inbox.
+/// \param inbox An inbox already added as a destination.
+/// \param type Types passed to addKey().
+/// \param key Key passed to addKey().
+void PostShard::removeKey(Inbox& inbox, int type, uint64_t key)
+{
+    AutoWriteLock<DstVector> dsts(_dstsLock);
+
+    Dst* dst = findDestination(inbox);
+    if (dst == 0)
+        return;
 
-    AutoWriteLock<Src> srcLock(_srcsLock);
-    AutoWriteLock<Dst> dstLock(_dstsLock);
+    std::vector<Key>::iterator iter = std::find(dst->keys.begin(), dst->keys.end(), Key(type, key));
+    if (iter == dst->keys.end())
+        return;
 
-    for (int i = 0; i < NUMBOX; i++) {
-        if (_srcs[i].inbox.closed()) 
+    dst->keys.erase(iter);
+
+    for (int i = 0; i < ROUTES; i++) {
+        if (!(type & (1u << i)))
+            continue;
+
+        if (key == ANY_KEY) {
+            Route& route = _anyKey[i];
+            route.erase(std::find(route.begin(), route.end(), dst));
             continue;
+        }
+
+        KeyedRoutes::iterator keyed = _keyed[i].find(key);
+        Route& route = keyed->second;
+        route.erase(std::find(route.begin(), route.end(), dst));
 
-        _srcs[i].inbox.transfer();
+        if (route.empty())
+            _keyed[i].erase(keyed);
+    }
+}
+
+/// Route all the messages waiting in the outbox of a source.
+/// A message that would go to an inbox with a blocking limit that has been
+/// reached is kept by the source, and no more of its messages are routed
+/// until there is room for it. Both locks must be held.
+/// \param src The source to read messages from.
+/// \param force Whether to route messages even to full inboxes.
+void PostShard::collect(Src& src, bool force)
+{
+    src.inbox.transfer();
 
-        while (!_srcs[i].inbox.empty()) {
-            MsgPtr message(_srcs[i].inbox.get());
+    while (src.stalled || !src.inbox.empty()) {
+        bool retry = (src.stalled != 0);
 
-            for (int j = 0; j < NUMBOX; j++) {
-                if (message->matches(_dsts[j].subscription)) 
-                    _dsts[j].outbox.put(*message);
+        if (!retry) {
+            src.stalled = src.inbox.get();
+            msg::Tracer::collected(*src.stalled);
+        }
+
+        target(*src.stalled);
+
+        if (!force) {
+            if (Dst* full = blocking(*src.stalled)) {
+                if (!retry)
+                    full->inbox->_deferred++;
+
+                return;
             }
         }
+
+        route(std::move(src.stalled));
     }
+}
+
+/// Find the subscribers to the types of a message.
+/// A batch may hold several types, so a subscriber can be in more than one of
+/// the routes looked at. Each is marked with the number of the message when
+/// it is first found so that it is only found once. A keyed message uses the
+/// route for its key and the route for every key in place of the route for
+/// each bit, so its cost does not depend on how many inboxes subscribe to its
+/// type.
+/// \param message The message to find the subscribers to.
+void PostShard::target(const msg::Message& message)
+{
+    uint64_t marker = ++_marker;
+    unsigned int types = message.type();
+    bool keyed = message.keyed();
+    uint64_t key = (keyed ? message.key() : 0);
 
-    for (int i = 0; i < NUMBOX; i++) {
-        if (_dsts[i].outbox.closed()) 
+    _targets.clear();
+
+    while (types != 0) {
+        int bit = __builtin_ctz(types);
+        types &= types - 1;
+
+        if (!keyed) {
+            addTargets(_routes[bit], marker);
             continue;
+        }
 
-        _dsts[i].outbox.transfer();
+        KeyedRoutes::const_iterator iter = _keyed[bit].find(key);
+        if (iter != _keyed[bit].end())
+            addTargets(iter->second, marker);
+
+        addTargets(_anyKey[bit], marker);
     }
+}
 
-    return YIELD;
+/// Add the subscribers on a route to the targets of a message.
+/// \param route The route.
+/// \param marker Number of the message, which subscribers already added have.
+void PostShard::addTargets(const Route& route, uint64_t marker)
+{
+    for (size_t i = 0; i < route.size(); i++) {
+        Dst* dst = route[i];
+
+        if ((dst->mark != marker) && !dst->outbox.closed()) {
+            dst->mark = marker;
+            _targets.push_back(dst);
+        }
+    }
 }
 
-void PostOffice::registerOutbox(Outbox& outbox)
+/// Find a subscriber that a message must wait for.
+/// \param message The message passed to target().
+/// \return A subscriber whose inbox has no room for the message or null.
+PostShard::Dst* PostShard::blocking(const msg::Message& message)
+{
+    for (size_t i = 0; i < _targets.size(); i++) {
+        int limit = overloaded(*_targets[i], message);
+        if (limit < 0)
+            continue;
+
+        Overload policy = _targets[i]->inbox->_limits[limit].policy;
+
+        if ((policy == OVERLOAD_BLOCK) || !message.coalesces())
+            return _targets[i];
+    }
+
+    return 0;
+}
+
+/// Put a message in the outbox of every subscriber found by target().
+/// Subscribers are not sent copies. Instead every one of them is made an
+/// owner of the message, which is freed when the last of them deletes it.
+/// \param message The message to route.
+void PostShard::route(std::unique_ptr<msg::Message> message)
 {
-    AutoWriteLock<Src> srcLock(_srcsLock);
+    if (_targets.empty())
+        return;
+
+    msg::Message* shared = message.release();
+    shared->share(_targets.size() - 1);
+
+    for (size_t i = 0; i < _targets.size(); i++)
+        deliver(*_targets[i], std::unique_ptr<msg::Message>(shared));
+}
+
+/// Put a message in the outbox for an inbox, or hold it back.
+/// A message is held back if it comes under a limit of the inbox that drops
+/// the oldest messages and that limit has been reached or already has
+/// messages held back, so that the messages of the limit stay in order.
+/// Otherwise it is put in the outbox, even if a limit has been reached, since
+/// blocking limits have already been checked by blocking(). Only state
+/// messages are dropped. Others only get here when they are forced through,
+/// and are held back with the rest but kept.
+/// \param dst Destination for the inbox.
+/// \param message The message.
+void PostShard::deliver(Dst& dst, std::unique_ptr<msg::Message> message)
+{
+    int limit = overloaded(dst, *message);
+
+    if ((limit >= 0) && (dst.inbox->_limits[limit].policy == OVERLOAD_DROP_OLDEST)) {
+        HeldQueue& held = dst.held[limit];
+        held.push_back(std::move(message));
+
+        if (held.size() > dst.inbox->_limits[limit].capacity) {
+            HeldQueue::iterator oldest = held.begin();
+            while ((oldest != held.end()) && !(*oldest)->coalesces())
+                ++oldest;
+
+            if (oldest != held.end()) {
+                held.erase(oldest);
+                dst.inbox->_dropped++;
+            }
+        }
+
+        return;
+    }
+
+    size_t replaced = put(dst, std::move(message));
+
+    if (limit >= 0)
+        dst.inbox->_dropped += replaced;
+}
+
+/// Put a message in the outbox for an inbox.
+/// A state message is swapped into the Latest for its id and key if that is
+/// still waiting in the inbox. Otherwise it is put in a new Latest, which
+/// both the inbox and this shard own a share of.
+/// \param dst Destination for the inbox.
+/// \param message The message.
+/// \return The number of messages swapped out rather than queued.
+size_t PostShard::put(Dst& dst, std::unique_ptr<msg::Message> message)
+{
+    if (!message->coalesces()) {
+        dst.inbox->queued(*message);
+        dst.outbox.put(std::move(message));
+        return 0;
+    }
+
+    if (message->id() == msg::ID_BATCH)
+        return putBatch(dst, std::move(message));
+
+    std::unique_ptr<msg::Latest>& latest = dst.latest[Key(message->id(), message->stateKey())];
+
+    if (latest && latest->replace(message))
+        return 1;
+
+    latest.reset(new msg::Latest(std::move(message)));
+    latest->share(1);
+    dst.inbox->queued(*latest);
+    dst.outbox.put(std::unique_ptr<msg::Message>(latest.get()));
+
+    if (dst.latest.size() >= dst.sweepSize)
+        sweep(dst);
+
+    return 0;
+}
+
+/// Put a batch of state records in the outbox for an inbox.
+/// While the last batch queued is still waiting in the inbox the reader is
+/// behind, so the batch is split and each record coalesced on its own.
+/// Otherwise the batch is queued whole in a new Latest, and the Latests
+/// queued before it are forgotten so that no newer record is swapped in
+/// ahead of the batch.
+/// \param dst Destination for the inbox.
+/// \param message The batch.
+/// \return The number of records swapped out rather than queued.
+size_t PostShard::putBatch(Dst& dst, std::unique_ptr<msg::Message> message)
+{
+    LatestMap::iterator last = dst.latest.find(Key(msg::ID_BATCH, 0));
+
+    if ((last != dst.latest.end()) && !last->second->taken()) {
+        std::vector<std::unique_ptr<msg::Message> > records;
+        static_cast<const msg::Batch&>(*message).split(records);
+
+        size_t replaced = 0;
+        for (size_t i = 0; i < records.size(); i++)
+            replaced += put(dst, std::move(records[i]));
+
+        return replaced;
+    }
+
+    dst.latest.clear();
+    dst.sweepSize = SWEEP_SIZE;
+
+    msg::Latest* latest = new msg::Latest(std::move(message));
+    dst.latest[Key(msg::ID_BATCH, 0)].reset(latest);
+    latest->share(1);
+    dst.inbox->queued(*latest);
+    dst.outbox.put(std::unique_ptr<msg::Message>(latest));
+
+    return 0;
+}
+
+/// Find the limit of an inbox that a message comes under, if that limit has
+/// been reached or has messages held back.
+/// \param dst Destination for the inbox.
+/// \param message The message.
+/// \return Index of the limit or -1 if there is none.
+int PostShard::overloaded(Dst& dst, const msg::Message& message)
+{
+    Inbox& inbox = *dst.inbox;
+    int limits = inbox.limits();
+
+    for (int i = 0; i < limits; i++) {
+        if (inbox.matches(i, message))
+            return ((!dst.held[i].empty() || inbox.full(i)) ? i : -1);
+    }
+
+    return -1;
+}
+
+/// Put messages held back for an inbox in its outbox while there is room.
+/// \param dst Destination for the inbox.
+void PostShard::flush(Dst& dst)
+{
+    if (dst.outbox.closed())
+        return;
+
+    Inbox& inbox = *dst.inbox;
+    int limits = inbox.limits();
+
+    for (int i = 0; i < limits; i++) {
+        HeldQueue& held = dst.held[i];
+
+        while (!held.empty() && !inbox.full(i)) {
+            put(dst, std::move(held.front()));
+            held.pop_front();
+        }
+    }
+}
 
-    for (int i = 0; i < NUMBOX; i++) {
-        if (_srcs[i].inbox.closed()) {
-            _srcs[i].inbox.connectTo(outbox);
+/// Forget Latests that have been read.
+/// Objects come and go, so without this a destination would remember a
+/// Latest for every key ever sent to it. The next sweep is put off until
+/// the number remembered has doubled, so sweeping costs O(1) per message.
+/// \param dst The destination.
+void PostShard::sweep(Dst& dst)
+{
+    for (LatestMap::iterator iter = dst.latest.begin(); iter != dst.latest.end(); ) {
+        if (iter->second->taken()) {
+            iter = dst.latest.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+
+    dst.sweepSize = std::max(2 * dst.latest.size(), size_t(SWEEP_SIZE));
+}
+
+/// Remove sources and destinations whose job has been destroyed.
+/// Both locks must be held and closed sources must already have been read.
+void PostShard::prune()
+{
+    for (size_t i = 0; i < _srcs.size(); ) {
+        if (_srcs[i]->inbox.closed() && _srcs[i]->inbox.empty() && !_srcs[i]->stalled) {
+            _srcs[i] = std::move(_srcs.back());
+            _srcs.pop_back();
+        } else {
+            i++;
+        }
+    }
+
+    size_t count = _dsts.size();
+
+    for (size_t i = 0; i < _dsts.size(); ) {
+        if (_dsts[i]->outbox.closed()) {
+            _dsts.erase(_dsts.begin() + i);
+        } else {
+            i++;
+        }
+    }
+
+    if (_dsts.size() != count)
+        rebuildRoutes();
+}
+
+/// Recompute the subscribers to each type and key from the destinations.
+/// The destination lock must be held.
+void PostShard::rebuildRoutes()
+{
+    for (int i = 0; i < ROUTES; i++) {
+        _routes[i].clear();
+        _keyed[i].clear();
+        _anyKey[i].clear();
+    }
+
+    for (size_t i = 0; i < _dsts.size(); i++) {
+        Dst* dst = _dsts[i].get();
+
+        for (int j = 0; j < ROUTES; j++) {
+            if (dst->subscription & (1u << j))
+                _routes[j].push_back(dst);
+
+            for (size_t k = 0; k < dst->keys.size(); k++) {
+                if (!(dst->keys[k].first & (1u << j)))
+                    continue;
+
+                if (dst->keys[k].second == ANY_KEY) {
+                    _anyKey[j].push_back(dst);
+                } else {
+                    _keyed[j][dst->keys[k].second].push_back(dst);
+                }
+            }
+        }
+    }
+}
+
+/// The destination lock must be held.
+/// \param inbox An inbox.
+/// \return The destination for the inbox or null if it has none.
+PostShard::Dst* PostShard::findDestination(Inbox& inbox)
+{
+    for (size_t i = 0; i < _dsts.size(); i++) {
+        if (_dsts[i]->inbox == &inbox)
+            return _dsts[i].get();
+    }
+
+    return 0;
+}
+
+
+////////// Inbox //////////
+
+Inbox::Inbox() :
+    _limitCount(0), _waiting(false), _dropped(0), _deferred(0)
+{
+
+}
+
+/// Stop every shard delivering to the inbox. Each waits for the shard to
+/// finish routing, since it reads the limits of the inbox as it does so.
+Inbox::~Inbox()
+{
+    std::vector<PostShard*> shards(*WriterVector::LockForRead(_writers));
+
+    for (size_t i = 0; i < shards.size(); i++)
+        shards[i]->removeDestination(*this);
+}
+
+/// Limit how many messages of some types may wait in the inbox.
+/// A message comes under the first limit whose types it has any of. Limits
+/// cannot be changed once set, but may be added while the inbox is in use.
+/// Only the reader may add them.
+/// \param types Bitwise OR of the types of message to limit.
+/// \param capacity Most messages of the types that may wait.
+/// \param policy What to do with messages once there are that many.
+void Inbox::setLimit(int types, size_t capacity, Overload policy)
+{
+    int count = _limitCount.load(std::memory_order_relaxed);
+
+    if (count == LIMITS)
+        throw InputException("Inbox: too many limits");
+
+    if (capacity == 0)
+        throw InputException("Inbox: limit capacity must be at least one");
+
+    _limits[count].types = types;
+    _limits[count].capacity = capacity;
+    _limits[count].policy = policy;
+    _limits[count].queued = 0;
+
+    _limitCount.store(count + 1, std::memory_order_release);
+}
+
+/// Gets a message from one of the pipes.
+/// The message no longer counts towards the limits of the inbox, and if the
+/// post office was waiting for room it is woken.
+/// \return The message.
+/// \pre !empty()
+std::unique_ptr<msg::Message> Inbox::get()
+{
+    std::unique_ptr<msg::Message> message = ring::Merge<msg::Message>::get();
+    int count = limits();
+
+    if (count == 0)
+        return message;
+
+    for (int i = 0; i < count; i++) {
+        if (matches(i, *message)) {
+            _limits[i].queued--;
+            break;
+        }
+    }
+
+    if (_waiting.load() && _waiting.exchange(false)) {
+        WriterVector::LockForRead writers(_writers);
+
+        for (size_t i = 0; i < writers->size(); i++)
+            (*writers)[i]->wake();
+    }
+
+    return message;
+}
+
+/// Delete all messages waiting to be read.
+/// This must not be called while the post office may be putting messages.
+void Inbox::clear()
+{
+    while (!empty())
+        get();
+}
+
+/// \return Number of messages dropped because a limit was reached.
+uint64_t Inbox::dropped() const
+{
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+/// \return Number of messages left with their sender because a limit was
+/// reached.
+uint64_t Inbox::deferred() const
+{
+    return _deferred.load(std::memory_order_relaxed);
+}
+
+/// Wake a shard when room is made for messages.
+/// \param shard The shard.
+void Inbox::addWriter(PostShard* shard)
+{
+    WriterVector::LockForWrite writers(_writers);
+    writers->push_back(shard);
+}
+
+/// Stop waking a shard.
+/// \param shard A shard passed to addWriter().
+void Inbox::removeWriter(PostShard* shard)
+{
+    WriterVector::LockForWrite writers(_writers);
+    writers->erase(std::remove(writers->begin(), writers->end(), shard), writers->end());
+}
+
+/// \return Number of limits set.
+int Inbox::limits() const
+{
+    return _limitCount.load(std::memory_order_acquire);
+}
+
+/// A message only comes under the first limit it matches.
+/// \param limit Index of a limit.
+/// \param message A message.
+/// \return Whether the message has any of the types of the limit.
+bool Inbox::matches(int limit, const msg::Message& message) const
+{
+    return ((message.type() & _limits[limit].types) != 0);
+}
+
+/// Check whether a limit has been reached.
+/// If it has the writers are woken once the reader makes room. The count is
+/// checked again after saying so, in case the reader made room just before.
+/// \param limit Index of a limit.
+/// \return Whether the limit has been reached.
+bool Inbox::full(int limit)
+{
+    const Limit& l = _limits[limit];
+
+    if (l.queued.load() < int64_t(l.capacity))
+        return false;
+
+    _waiting = true;
+
+    return (l.queued.load() >= int64_t(l.capacity));
+}
+
+/// Count a message towards the limit it comes under.
+/// \param message A message about to be put in the inbox.
+void Inbox::queued(const msg::Message& message)
+{
+    int count = limits();
+
+    for (int i = 0; i < count; i++) {
+        if (matches(i, message)) {
+            _limits[i].queued++;
             return;
         }
     }
+}
+
 
-    Log::log->warn("PostOffice: registered outbox limit exceeded.");
+////////// PostShard::KeyHash //////////
 
-    assert(false);
+size_t PostShard::KeyHash::operator()(const Key& key) const
+{
+    return std::hash<uint64_t>()(key.second ^ (uint64_t(key.first) << 56));
 }
 
+
+////////// PostOffice //////////
+
+/// Construct a PostOffice.
+/// \param shards Number of shards to route messages with.
+PostOffice::PostOffice(int shards) :
+    _nextShard(0), _delayedOutbox(std::make_shared<Outbox>())
+{
+    _shards.push_back(this);
+
+    for (int i = 1; i < shards; i++) {
+        _pending.push_back(std::unique_ptr<PostShard>(new PostShard));
+        _shards.push_back(_pending.back().get());
+    }
+
+    addSource(*_delayedOutbox);
+
+    Log::log->info("PostOffice: message routing: startup");
+}
+
+PostOffice::~PostOffice()
+{
+    Log::log->info("PostOffice: message routing: shutdown");
+}
+
+Job::RetType PostOffice::run()
+{
+    // The other shards can only be added once the post office is in a pool.
+    while (!_pending.empty() && (pool() != 0)) {
+        pool()->add(std::move(_pending.back()));
+        _pending.pop_back();
+    }
+
+    return PostShard::run();
+}
+
+/// Route messages from an outbox to the inboxes of its subscribers.
+/// Messages sent after this is called will also be routed, which allows
+/// deregistration to finish routing messages sent before it.
+/// \param outbox The outbox to read messages from.
+void PostOffice::registerOutbox(Outbox& outbox)
+{
+    _shards[_nextShard++ % _shards.size()]->addSource(outbox);
+}
+
+/// Deliver messages of the subscribed types to an inbox.
+/// Every shard is given a pipe to the inbox.
+/// \param inbox The inbox to deliver messages to.
+/// \param subscription Bitwise OR of the types of message wanted.
 void PostOffice::registerInbox(Inbox& inbox, int subscription)
 {
-    AutoWriteLock<Dst> dstLock(_dstsLock);
+    for (size_t i = 0; i < _shards.size(); i++)
+        _shards[i]->addDestination(inbox, subscription);
+}
 
-    for (int i = 0; i < NUMBOX; i++) {
-        if (_dsts[i].outbox.closed()) {
-            _dsts[i].outbox.connectTo(inbox);
-            _dsts[i].subscription = subscription;
+/// Stop reading messages from an outbox.
+/// Messages already sent are routed first. The outbox must not be written to
+/// while this is called. There is no need to call this before destroying an
+/// outbox, since closed outboxes are removed automatically.
+/// \param outbox An outbox passed to registerOutbox().
+void PostOffice::deregisterOutbox(Outbox& outbox)
+{
+    for (size_t i = 0; i < _shards.size(); i++) {
+        if (_shards[i]->removeSource(outbox))
             return;
-        }
     }
 
-    Log::log->warn("PostOffice: registered inbox limit exceeded.");
+    Log::log->warn("PostOffice: deregistered outbox not registered.");
+}
+
+/// Stop delivering messages to an inbox.
+/// Messages already delivered are left in the inbox. There is no need to call
+/// this before destroying an inbox, since it deregisters itself.
+/// \param inbox An inbox passed to registerInbox().
+void PostOffice::deregisterInbox(Inbox& inbox)
+{
+    bool found = false;
+
+    for (size_t i = 0; i < _shards.size(); i++)
+        found |= _shards[i]->removeDestination(inbox);
+
+    if (!found)
+        Log::log->warn("PostOffice: deregistered inbox not registered.");
+}
+
+/// Deliver messages of a type that have a key to an inbox.
+/// Keyed messages only go to the inboxes registered for their key, whatever
+/// the subscriptions of other inboxes. The inbox must have been registered.
+/// An inbox registered for ANY_KEY gets keyed messages of the type whatever
+/// their key, such as a bridge to the jobs in another process.
+/// \param inbox The inbox to deliver messages to.
+/// \param type Bitwise OR of the types of message the key is for.
+/// \param key The key, such as a ZoneID or PlayerID, or ANY_KEY.
+void PostOffice::registerKey(Inbox& inbox, int type, uint64_t key)
+{
+    for (size_t i = 0; i < _shards.size(); i++)
+        _shards[i]->addKey(inbox, type, key);
+}
 
-    assert(false);
+/// Stop delivering keyed messages to an inbox.
+/// \param inbox An inbox passed to registerKey().
+/// \param type Types passed to registerKey().
+/// \param key Key passed to registerKey().
+void PostOffice::deregisterKey(Inbox& inbox, int type, uint64_t key)
+{
+    for (size_t i = 0; i < _shards.size(); i++)
+        _shards[i]->removeKey(inbox, type, key);
 }
 
+/// Route a message once a delay has passed.
+/// The message is put by a pool timer into a pipe read by the first shard.
+/// Pool timers never run at the same time as each other, so that pipe has a
+/// single writer however many jobs send delayed messages. If the post office
+/// has been destroyed by then the message is dropped. This may only be called
+/// once the post office has been added to a JobPool.
+/// \param msg The message to send.
+/// \param usec Delay in microseconds.
+void PostOffice::sendAfter(const msg::Message& msg, uint64_t usec)
+{
+    std::weak_ptr<Outbox> outbox = _delayedOutbox;
+    std::shared_ptr<msg::Message> message(msg.clone());
+
+    pool()->schedule(usec, [outbox, message]() {
+        if (std::shared_ptr<Outbox> target = outbox.lock())
+            target->put(*message);
+    });
+}
@@ -11,43 +11,218 @@
 #define POSTOFFICE_HPP
 
 
-#include "fifo.hpp"
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <stdint.h>
+#include "ringfifo.hpp"
 #include "autolock.hpp"
 #include "messages.hpp"
+#include "msglatest.hpp"
 #include "concurrency.hpp"
 
 
-typedef fifo::Get<msg::Message> Inbox;
-typedef fifo::Put<msg::Message> Outbox;
+typedef ring::Put<msg::Message> Outbox;
 
+class PostShard;
 
-class PostOffice : public Job {
+
+/// What to do with a message for an inbox that has reached a limit.
+enum Overload {
+    OVERLOAD_BLOCK,        ///< Leave it in the sender's outbox until there is room.
+    OVERLOAD_DROP_OLDEST,  ///< Hold back state messages, dropping the oldest, block the rest.
+    OVERLOAD_COALESCE      ///< Coalesce state messages, block the rest.
+};
+
+
+/// Readable end of the pipes from the shards of a post office to a job.
+/// An inbox may limit how many messages of some types wait in it. Each limit
+/// counts the messages of its types that have been put in the inbox and not
+/// yet read, and once the count reaches the capacity of the limit the post
+/// office applies its policy to further messages of those types. Blocked
+/// messages are left with their sender, along with everything the sender
+/// sends after them, and are counted as deferred. State messages held back
+/// are kept by the post office, up to the capacity of the limit, and the
+/// oldest of them are dropped. Coalesced state messages replace the one with
+/// the same id and key that is waiting, and only use room if there is none.
+/// Only state messages are ever dropped or coalesced, so under either policy
+/// any other message is blocked. The post office is woken to carry on once
+/// the reader makes room. An inbox deregisters itself from the post office
+/// when it is destroyed.
+class Inbox : public ring::Merge<msg::Message> {
     public:
-        PostOffice();
-        virtual ~PostOffice();
+        friend class PostShard;
+
+        static const int LIMITS = 8;  ///< Most limits an inbox can have.
+
+        Inbox();
+        ~Inbox();
+
+        void setLimit(int types, size_t capacity, Overload policy);
+        std::unique_ptr<msg::Message> get();
+        void clear();
+
+        uint64_t dropped() const;
+        uint64_t deferred() const;
+
+    private:
+        typedef Lockable<PostShard*>::Vector WriterVector;
+
+        struct Limit {
+            int types;                     ///< Types of message limited.
+            size_t capacity;               ///< Most messages of the types.
+            Overload policy;               ///< What to do once it is reached.
+            std::atomic<int64_t> queued;   ///< Messages of the types unread.
+        };
+
+        void addWriter(PostShard* shard);
+        void removeWriter(PostShard* shard);
+        int limits() const;
+        bool matches(int limit, const msg::Message& message) const;
+        bool full(int limit);
+        void queued(const msg::Message& message);
+
+        Limit _limits[LIMITS];
+        std::atomic<int> _limitCount;     ///< Limits in use.
+        std::atomic<bool> _waiting;       ///< Whether writers wait for room.
+        std::atomic<uint64_t> _dropped;   ///< Messages dropped.
+        std::atomic<uint64_t> _deferred;  ///< Messages left with the sender.
+        WriterVector _writers;            ///< Shards to wake when there is room.
+};
+
+
+/// Routes the messages from some of the outboxes registered with a PostOffice.
+/// Each shard reads its own outboxes and has its own pipe to every registered
+/// inbox, so shards share no pipes or locks and can run on different workers
+/// at once. For each bit of a subscription a shard keeps a table of the
+/// inboxes subscribed to it, so routing a message costs one put per
+/// subscriber rather than a test of every inbox. Keyed messages only go to
+/// the inboxes registered for their key, found by looking the key up in a
+/// table for each bit, and to any inbox registered for every key of the
+/// type. State messages are coalesced, so that each inbox holds
+/// at most one of them for each id and key, and batches of state records
+/// are split into their records once a reader falls behind so that those
+/// are coalesced as well. Limits set on an inbox are
+/// applied as messages are delivered to it. Outboxes whose job has been
+/// destroyed are removed on the next pass, after any messages the job sent
+/// have been routed. Inboxes are removed as they are destroyed, since the
+/// shard reads their limits as it routes.
+class PostShard : public Job {
+    public:
+        static const uint64_t ANY_KEY = ~uint64_t(0);  ///< Stands for every key.
+
+        PostShard();
+        virtual ~PostShard();
 
         virtual RetType run();
 
-        virtual void registerOutbox(Outbox& outbox);
-        virtual void registerInbox(Inbox& inbox, int subscription);
+        void addSource(Outbox& outbox);
+        void addDestination(Inbox& inbox, int subscription);
+        bool removeSource(Outbox& outbox);
+        bool removeDestination(Inbox& inbox);
+        void addKey(Inbox& inbox, int type, uint64_t key);
+        void removeKey(Inbox& inbox, int type, uint64_t key);
 
     private:
+        typedef ring::Get<msg::Message> Reader;
+
         struct Src {
-            Inbox inbox;
+            Reader inbox;                          ///< Reads from the registered outbox.
+            Outbox* outbox;                        ///< The registered outbox.
+            std::unique_ptr<msg::Message> stalled; ///< Blocked by a full inbox.
+        };
+
+        typedef std::pair<int, uint64_t> Key;
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const;
         };
 
+        typedef std::unordered_map<Key, std::unique_ptr<msg::Latest>, KeyHash> LatestMap;
+        typedef std::deque<std::unique_ptr<msg::Message> > HeldQueue;
+
         struct Dst {
-            Outbox outbox;
-            int subscription;
+            Outbox outbox;                  ///< Writes to the registered inbox.
+            Inbox* inbox;                   ///< The registered inbox.
+            int subscription;               ///< Types of message wanted.
+            std::vector<Key> keys;          ///< Types and keys of keyed messages wanted.
+            uint64_t mark;                  ///< Last message routed here.
+            LatestMap latest;               ///< State messages by id and key.
+            size_t sweepSize;               ///< Size of latest at which to sweep it.
+            HeldQueue held[Inbox::LIMITS];  ///< Held back by each limit.
         };
 
-        static const int NUMBOX = 3;
+        typedef std::vector<std::unique_ptr<Src> > SrcVector;
+        typedef std::vector<std::unique_ptr<Dst> > DstVector;
+        typedef std::vector<Dst*> Route;
+        typedef std::unordered_map<uint64_t, Route> KeyedRoutes;
+
+        static const int ROUTES = 8 * sizeof(int);  ///< One per subscription bit.
+        static const size_t SWEEP_SIZE = 64;        ///< Least size of latest to sweep.
+
+        void collect(Src& src, bool force);
+        void target(const msg::Message& message);
+        void addTargets(const Route& route, uint64_t marker);
+        Dst* blocking(const msg::Message& message);
+        void route(std::unique_ptr<msg::Message> message);
+        void deliver(Dst& dst, std::unique_ptr<msg::Message> message);
+        size_t put(Dst& dst, std::unique_ptr<msg::Message> message);
+        size_t putBatch(Dst& dst, std::unique_ptr<msg::Message> message);
+        int overloaded(Dst& dst, const msg::Message& message);
+        void flush(Dst& dst);
+        void sweep(Dst& dst);
+        void prune();
+        void rebuildRoutes();
+        Dst* findDestination(Inbox& inbox);
+
+        SrcVector _srcs;
+        DstVector _dsts;
+
+        Lock<SrcVector> _srcsLock;
+        Lock<DstVector> _dstsLock;
+
+        Route _routes[ROUTES];       ///< Subscribers to each bit.
+        KeyedRoutes _keyed[ROUTES];  ///< Key holders for each bit.
+        Route _anyKey[ROUTES];       ///< Holders of every key for each bit.
+        Route _targets;              ///< Subscribers to the message being routed.
+        uint64_t _marker;            ///< Number of messages routed.
+};
 
-        Src _srcs[NUMBOX];
-        Dst _dsts[NUMBOX];
 
-        Lock<Src> _srcsLock;
-        Lock<Dst> _dstsLock;
+/// Routes messages from the outboxes of jobs to the inboxes of jobs.
+/// Any number of outboxes and inboxes may be registered, and they may be
+/// registered and deregistered while the post office is running. Outboxes
+/// are shared out between shards in turn, the post office itself being the
+/// first. The other shards are added to the pool when the post office first
+/// runs. All the messages from one outbox go through the same shard, so they
+/// arrive in the order they were sent.
+class PostOffice : public PostShard {
+    public:
+        PostOffice(int shards = 1);
+        virtual ~PostOffice();
+
+        virtual RetType run();
+
+        virtual void registerOutbox(Outbox& outbox);
+        virtual void registerInbox(Inbox& inbox, int subscription);
+        virtual void deregisterOutbox(Outbox& outbox);
+        virtual void deregisterInbox(Inbox& inbox);
+        virtual void registerKey(Inbox& inbox, int type, uint64_t key);
+        virtual void deregisterKey(Inbox& inbox, int type, uint64_t key);
+
+        void sendAfter(const msg::Message& msg, uint64_t usec);
+
+    private:
+        typedef std::vector<PostShard*> ShardVector;
+        typedef std::vector<std::unique_ptr<PostShard> > PendingVector;
+
+        ShardVector _shards;                    ///< All shards including this.
+        PendingVector _pending;                 ///< Shards not yet in the pool.
+        std::atomic<unsigned int> _nextShard;   ///< Shard for next outbox.
+        std::shared_ptr<Outbox> _delayedOutbox; ///< Written by pool timers.
 };
 
 
@@ -0,0 +1,598 @@
+/// \file ringfifo.hpp
+/// \brief FIFO queue backed by a single producer, single consumer ring.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef RINGFIFO_HPP
+#define RINGFIFO_HPP
+
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <assert.h>
+#include <core/core.hpp>
+#include "autolock.hpp"
+#include "concurrency.hpp"
+
+
+namespace ring {
+
+
+template<typename T> class Put;
+template<typename T> class Get;
+template<typename T> class Merge;
+
+
+static const size_t RINGSIZE = 256;  ///< Slots in each ring, a power of two.
+static const size_t CACHELINE = 64;  ///< Bytes in a cache line.
+
+
+/// Writable end of a ring FIFO pipe.
+/// This has the same interface as fifo::Put but objects are written straight
+/// into a ring held by the fifo::Get end rather than into a vector that is
+/// later swapped across, so they can be read as soon as they are put and the
+/// writer never waits for the reader. Only one thread may put objects into a
+/// pipe at a time. The writer takes a shared lock on its own end while it
+/// puts so that the pipe cannot be disconnected under it. No other thread
+/// takes that lock except to connect or disconnect, so it costs little. If
+/// the ring is full objects go to a locked overflow list until the reader
+/// has emptied the ring, so nothing is lost and the order is kept.
+template<typename T>
+class Put {
+    public:
+        friend class Get<T>;
+
+        Put();
+        virtual ~Put();
+
+        void clear();
+        void transfer();
+        void put(const T& object);
+        void put(std::unique_ptr<T> object);
+        void connectTo(Get<T>& get);
+        bool closed() const;
+        bool empty() const;
+
+    private:
+        void disconnect();
+
+        typedef AutoWriteLock<Put> HalfLockFIFO;
+
+        mutable Lock<Put> _lock;  ///< Lock for this half of pipe.
+        Get<T>* _get;             ///< Pointer to other end of pipe.
+};
+
+
+/// Readable end of a ring FIFO pipe.
+/// This has the same interface as fifo::Get. The ring lives here and its
+/// read and write positions are kept on separate cache lines, each with a
+/// cached copy of the other, so that the reader and writer only share a
+/// cache line when one of them finds the ring empty or full. Only one thread
+/// may read from a pipe at a time.
+template<typename T>
+class Get {
+    public:
+        friend class Put<T>;
+
+        Get();
+        virtual ~Get();
+
+        void clear();
+        void transfer();
+        std::unique_ptr<T> get();
+        void connectTo(Put<T>& put);
+        void setReader(Job* job);
+        bool closed() const;
+        bool empty() const;
+
+    private:
+        typedef std::vector<T*> Vector;
+        typedef typename Lockable<T*>::Vector Overflow;
+        typedef typename Overflow::LockForWrite WriteLock;
+
+        bool push(T* object);
+        void spill(T* object);
+        void disconnect(bool referred);
+
+        typedef AutoWriteLock<Get> HalfLockFIFO;
+
+        alignas(CACHELINE) std::atomic<size_t> _head;  ///< Next slot to read.
+        size_t _cachedTail;                            ///< Reader's copy of tail.
+        Vector _local;                                 ///< Overflow being read.
+        size_t _index;                                 ///< Next overflow to read.
+
+        alignas(CACHELINE) std::atomic<size_t> _tail;  ///< Next slot to write.
+        size_t _cachedHead;                            ///< Writer's copy of head.
+
+        alignas(CACHELINE) T* _slots[RINGSIZE];  ///< Objects in the ring.
+
+        std::atomic<bool> _spilled;  ///< Whether objects are in overflow.
+        Overflow _overflow;          ///< Objects put while the ring was full.
+
+        Lock<Get> _lock;  ///< Lock for this half of pipe.
+        Put<T>* _put;     ///< Pointer to other end of pipe.
+        Job* _reader;     ///< Job to wake when objects arrive.
+
+        class LockFIFO {
+            public:
+                LockFIFO(Get* get, bool bothEnds);
+                ~LockFIFO();
+
+                bool halfLocked() const;
+
+            private:
+                bool _bothEnds;
+                Get<T>* _get;
+                Put<T>* _put;
+        };
+};
+
+
+/// Readable end of several ring FIFO pipes.
+/// This has the same interface as Get, but connecting it to a Put end adds a
+/// pipe rather than replacing the one it has, so it can be read from objects
+/// written by several threads. Objects are read from each pipe in the order
+/// they were put. Objects from different pipes are interleaved. Only one
+/// thread may read at a time, and pipes must not be connected while it is
+/// reading.
+template<typename T>
+class Merge {
+    public:
+        Merge();
+
+        void clear();
+        void transfer();
+        std::unique_ptr<T> get();
+        void connectTo(Put<T>& put);
+        void setReader(Job* job);
+        bool closed() const;
+        bool empty() const;
+
+    private:
+        typedef std::vector<std::unique_ptr<Get<T> > > GetVector;
+
+        GetVector _gets;  ///< One per connected pipe.
+        size_t _next;     ///< Pipe to read from first.
+        Job* _reader;     ///< Job to wake when objects arrive.
+};
+
+
+}  // namespace ring
+
+
+////////// ring::Put //////////
+
+/// Create the writable end of a FIFO pipe.
+template<typename T>
+ring::Put<T>::Put() :
+    _lock(*this), _get(0)
+{
+
+}
+
+/// Destroy the writable end of a FIFO pipe.
+template<typename T>
+ring::Put<T>::~Put()
+{
+    disconnect();
+}
+
+/// Objects are written straight to the other end so there is nothing to
+/// delete. This is provided for compatibility with fifo::Put.
+template<typename T>
+void ring::Put<T>::clear()
+{
+
+}
+
+/// Objects can be read as soon as they are put so there is nothing to
+/// transfer. This is provided for compatibility with fifo::Put.
+template<typename T>
+void ring::Put<T>::transfer()
+{
+
+}
+
+/// Puts a copy of an object into the FIFO pipe and wakes the reader.
+/// The object can be read straight away.
+/// \param object The object to put into the pipe.
+template<typename T>
+void ring::Put<T>::put(const T& object)
+{
+    if (closed())
+        return;
+
+    put(object.clone());
+}
+
+/// Puts an object into the FIFO pipe and wakes the reader.
+/// The pipe takes ownership of the object, so nothing is copied. If the pipe
+/// is not connected the object is deleted.
+/// \param object The object to put into the pipe.
+template<typename T>
+void ring::Put<T>::put(std::unique_ptr<T> object)
+{
+    if (closed())
+        return;
+
+    const Put<T>& self = _lock.roWaitLock();
+
+    if (self._get != 0) {
+        T* p = object.release();
+
+        if (!_get->push(p))
+            _get->spill(p);
+
+        if (_get->_reader != 0)
+            _get->_reader->wake();
+    }
+
+    _lock.roUnlock();
+}
+
+/// Form a FIFO pipe between two ends.
+/// If either end is part of an existing pipe that pipe will be broken and any
+/// objects it has in transit will be deleted.
+/// \param get The readable end of the pipe.
+template<typename T>
+void ring::Put<T>::connectTo(Get<T>& get)
+{
+    get.connectTo(*this);
+}
+
+/// \return Whether this end is part of a FIFO pipe.
+template<typename T>
+inline bool ring::Put<T>::closed() const
+{
+    return (_get == 0);
+}
+
+/// \return Whether all objects written have been read.
+template<typename T>
+inline bool ring::Put<T>::empty() const
+{
+    const Put<T>& self = _lock.roWaitLock();
+    bool result = ((self._get == 0) || self._get->empty());
+    _lock.roUnlock();
+
+    return result;
+}
+
+/// Disconnect FIFO pipe and free any objects that are in transit.
+/// This function simply locks this end of the pipe and invokes the disconnect
+/// function on the get side.
+template<typename T>
+void ring::Put<T>::disconnect()
+{
+    HalfLockFIFO lock(_lock);
+    if (_get != 0)
+        _get->disconnect(true);
+}
+
+
+////////// ring::Get //////////
+
+/// Create the readable end of a FIFO pipe.
+template<typename T>
+ring::Get<T>::Get() :
+    _head(0), _cachedTail(0), _index(0), _tail(0), _cachedHead(0), _spilled(false),
+    _lock(*this), _put(0), _reader(0)
+{
+
+}
+
+/// Destroy the readable end of a FIFO pipe.
+template<typename T>
+ring::Get<T>::~Get()
+{
+    disconnect(false);
+}
+
+/// Delete all objects waiting to be read from FIFO pipe.
+/// This must not be called while the other end may be putting objects.
+template<typename T>
+void ring::Get<T>::clear()
+{
+    while (!empty())
+        get();
+
+    _local.clear();
+    _index = 0;
+}
+
+/// Objects can be read as soon as they are put so there is nothing to
+/// transfer. This is provided for compatibility with fifo::Get.
+template<typename T>
+void ring::Get<T>::transfer()
+{
+
+}
+
+/// Gets an object from the FIFO pipe.
+/// Objects in the ring are read first. Objects that overflowed are only read
+/// once the ring is empty, since the writer stops using the ring while there
+/// is overflow, and the writer starts using it again once the reader has
+/// taken the overflow.
+/// \return The object got from the pipe.
+/// \pre !empty()
+template<typename T>
+std::unique_ptr<T> ring::Get<T>::get()
+{
+    assert(!empty());
+
+    if (_index == _local.size()) {
+        size_t head = _head.load(std::memory_order_relaxed);
+
+        if (head == _cachedTail)
+            _cachedTail = _tail.load(std::memory_order_acquire);
+
+        if (head != _cachedTail) {
+            T* object = _slots[head & (RINGSIZE - 1)];
+            _head.store(head + 1, std::memory_order_release);
+            return std::unique_ptr<T>(object);
+        }
+
+        WriteLock overflow(_overflow);
+
+        _local.clear();
+        _local.swap(*overflow);
+        _index = 0;
+        _spilled = false;
+    }
+
+    return std::unique_ptr<T>(_local[_index++]);
+}
+
+/// Form a FIFO pipe between two ends.
+/// If either end is part of an existing pipe that pipe will be broken and any
+/// objects it has in transit will be deleted.
+/// \param put The writable end of the pipe.
+template<typename T>
+void ring::Get<T>::connectTo(Put<T>& put)
+{
+    disconnect(false);
+    put.disconnect();
+
+    typename Get<T>::HalfLockFIFO getLock(_lock);
+    typename Put<T>::HalfLockFIFO putLock(put._lock);
+
+    if (!closed() || !put.closed())
+        return;
+
+    _put = &put;
+    put._get = this;
+}
+
+/// Set the job that reads from this end of the FIFO pipe.
+/// The job is woken whenever objects are put into the pipe, so it may block
+/// while the pipe is empty. This should be called before the pipe is
+/// connected.
+/// \param job The reading job.
+template<typename T>
+void ring::Get<T>::setReader(Job* job)
+{
+    _reader = job;
+}
+
+/// \return Whether this end is part of a FIFO pipe.
+template<typename T>
+inline bool ring::Get<T>::closed() const
+{
+    return (_put == 0);
+}
+
+/// \return Whether any objects are waiting to be read.
+template<typename T>
+inline bool ring::Get<T>::empty() const
+{
+    return ((_index == _local.size()) &&
+            (_head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire)) &&
+            !_spilled.load(std::memory_order_acquire));
+}
+
+/// Write an object into the ring.
+/// This is called by the writer. Objects are not written to the ring while
+/// there is overflow, so that they are not read ahead of it.
+/// \param object The object to write.
+/// \return Whether there was room for the object.
+template<typename T>
+bool ring::Get<T>::push(T* object)
+{
+    if (_spilled.load(std::memory_order_acquire))
+        return false;
+
+    size_t tail = _tail.load(std::memory_order_relaxed);
+
+    if (tail - _cachedHead >= RINGSIZE) {
+        _cachedHead = _head.load(std::memory_order_acquire);
+
+        if (tail - _cachedHead >= RINGSIZE)
+            return false;
+    }
+
+    _slots[tail & (RINGSIZE - 1)] = object;
+    _tail.store(tail + 1, std::memory_order_release);
+
+    return true;
+}
+
+/// Add an object to the overflow list.
+/// This is called by the writer when push() fails. The reader may have taken
+/// the overflow since then, in which case the ring is empty and the object
+/// goes there instead.
+/// \param object The object to add.
+template<typename T>
+void ring::Get<T>::spill(T* object)
+{
+    WriteLock overflow(_overflow);
+
+    if (!_spilled && push(object))
+        return;
+
+    overflow->push_back(object);
+    _spilled = true;
+}
+
+/// Disconnect FIFO pipe.
+/// This function needs to lock both ends of the pipe in order to perform the
+/// disconnect. However, if it is invoked from an already locked Put end it
+/// should not attempt to lock that end again. The referred parameter is
+/// provided for this purpose. Objects in transit are only freed when this end
+/// disconnects, since the reader may be reading them. When the Put end
+/// disconnects they are left for the reader, which can still get them once
+/// the pipe is closed.
+/// \param referred Whether the Put end should be locked.
+template<typename T>
+void ring::Get<T>::disconnect(bool referred)
+{
+    LockFIFO lock(this, !referred);
+
+    if (!lock.halfLocked())
+        _put->_get = 0;
+
+    _put = 0;
+
+    if (!referred)
+        clear();
+}
+
+
+////////// ring::Get::LockFIFO //////////
+
+template<typename T>
+ring::Get<T>::LockFIFO::LockFIFO(Get* get, bool bothEnds) :
+    _bothEnds(bothEnds), _get(get), _put(0)
+{
+    assert(_get != 0);
+
+    while (true) {
+        _get->_lock.rwWaitLock();
+
+        _put = _get->_put;
+
+        assert((_get->_put == 0) || (_get->_put->_get == _get));
+
+        if (!_bothEnds || (_put == 0) || _put->_lock.rwTryLock())
+            return;
+
+        _get->_lock.rwUnlock();
+    }
+}
+
+template<typename T>
+ring::Get<T>::LockFIFO::~LockFIFO()
+{
+    if (_bothEnds && (_put != 0))
+        _put->_lock.rwUnlock();
+
+    _get->_lock.rwUnlock();
+}
+
+template<typename T>
+bool ring::Get<T>::LockFIFO::halfLocked() const
+{
+    return (_put == 0);
+}
+
+
+////////// ring::Merge //////////
+
+/// Create an end with no pipes.
+template<typename T>
+ring::Merge<T>::Merge() :
+    _next(0), _reader(0)
+{
+
+}
+
+/// Delete all objects waiting to be read from the pipes.
+/// This must not be called while the other ends may be putting objects.
+template<typename T>
+void ring::Merge<T>::clear()
+{
+    for (size_t i = 0; i < _gets.size(); i++)
+        _gets[i]->clear();
+}
+
+/// Objects can be read as soon as they are put so there is nothing to
+/// transfer. This is provided for compatibility with Get.
+template<typename T>
+void ring::Merge<T>::transfer()
+{
+
+}
+
+/// Gets an object from one of the pipes.
+/// The pipes take turns, so a busy pipe cannot hold up the others.
+/// \return The object got from a pipe.
+/// \pre !empty()
+template<typename T>
+std::unique_ptr<T> ring::Merge<T>::get()
+{
+    assert(!empty());
+
+    while (true) {
+        if (_next >= _gets.size())
+            _next = 0;
+
+        Get<T>& get = *_gets[_next++];
+
+        if (!get.empty())
+            return get.get();
+    }
+}
+
+/// Add a pipe from a Put end.
+/// If the Put end is part of an existing pipe that pipe will be broken and
+/// any objects it has in transit will be deleted.
+/// \param put The writable end of the new pipe.
+template<typename T>
+void ring::Merge<T>::connectTo(Put<T>& put)
+{
+    std::unique_ptr<Get<T> > get(new Get<T>);
+    get->setReader(_reader);
+    get->connectTo(put);
+
+    _gets.push_back(std::move(get));
+}
+
+/// Set the job that reads from this end of the pipes.
+/// This should be called before any pipes are connected.
+/// \param job The reading job.
+template<typename T>
+void ring::Merge<T>::setReader(Job* job)
+{
+    _reader = job;
+}
+
+/// \return Whether none of the pipes are connected.
+template<typename T>
+bool ring::Merge<T>::closed() const
+{
+    for (size_t i = 0; i < _gets.size(); i++) {
+        if (!_gets[i]->closed())
+            return false;
+    }
+
+    return true;
+}
+
+/// \return Whether no objects are waiting to be read.
+template<typename T>
+bool ring::Merge<T>::empty() const
+{
+    for (size_t i = 0; i < _gets.size(); i++) {
+        if (!_gets[i]->empty())
+            return false;
+    }
+
+    return true;
+}
+
+
+#endif  // RINGFIFO_HPP
@@ -80,6 +80,11 @@ Job::RetType VirtualMachine::run()
     return YIELD;
 }
 
+Job::Priority VirtualMachine::priority()
+{
+    return BACKGROUND;
+}
+
 void VirtualMachine::removeInstance(Instance::ID id)
 {
     AutoWriteLock<InstanceToVM>(_instanceToVMLock)->erase(id);
@@ -584,6 +589,11 @@ Job::RetType ScriptModule::run()
     return YIELD;
 }
 
+Job::Priority ScriptModule::priority()
+{
+    return BACKGROUND;
+}
+
 Lock<CallQueue>& ScriptModule::callQueue()
 {
     return _lock;
@@ -66,6 +66,8 @@ class VirtualMachine : public Job {
         void swapRPC();
 
     private:
+        virtual Priority priority();
+
         void addToSet();
         void loadLibraries();
         void storeFunctions();
@@ -253,6 +255,8 @@ class ScriptModule : public Job {
         Lock<CallQueue>& callQueue();
         
     private:
+        virtual Priority priority();
+
         void scriptMain();
         void handleMessages();
         void annotateWithModule(Exception& e);
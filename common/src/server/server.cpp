@@ -3,6 +3,8 @@
 #include <unistd.h>
 #include <signal.h>
 #include <assert.h>
+#include <sstream>
+#include <fstream>
 #include <iostream>
 #include <vector>
 #include <boost/shared_ptr.hpp>
@@ -13,13 +15,19 @@
 #include "postoffice.hpp"
 #include "network.hpp"
 #include "player.hpp"
-#include "idle.hpp"
+#include "tickclock.hpp"
+#include "topology.hpp"
+#include "poolmanager.hpp"
 #include "zone.hpp"
+#include "bridge.hpp"
+#include "msgrecord.hpp"
 #include <math/prim.hpp>
 #include "canvas.hpp"
 #include <physics/kdtree.hpp>
 #include "daemon.hpp"
 #include "logging.hpp"
+#include "lockprofile.hpp"
+#include "msgtrace.hpp"
 
 // temp testing of headers
 #include <math/volumes.hpp>
@@ -27,8 +35,44 @@
 
 using namespace std;
 
-static const int CYCLE_PERIOD = 100000;
+typedef std::vector<std::pair<int, Topology::CpuList> > CpuGroups;
 
+/// Group the CPUs workers may use by the node they will be treated as on.
+/// Without NUMA placement every CPU is put in one group for node zero.
+/// \param topology Layout of the machine.
+/// \return Groups of CPUs paired with their node, none of them empty.
+static CpuGroups groupCpus(const Topology& topology)
+{
+    Topology::CpuList cpus = (getSettings().cpus().empty() ? topology.allCpus() :
+        Topology::parseCpuList(getSettings().cpus()));
+
+    if (cpus.empty())
+        throw InputException("cpu list is empty");
+
+    if (!getSettings().numa())
+        return CpuGroups(1, std::make_pair(0, cpus));
+
+    std::vector<Topology::CpuList> nodes(topology.nodes());
+    for (int cpu : cpus)
+        nodes[topology.nodeOf(cpu)].push_back(cpu);
+
+    CpuGroups groups;
+    for (size_t node = 0; node < nodes.size(); node++) {
+        if (!nodes[node].empty())
+            groups.push_back(std::make_pair(node, nodes[node]));
+    }
+
+    return groups;
+}
+
+/// Object cache that plays messages back without telling any players.
+class ReplayCache : public ObjectCache {
+    private:
+        virtual void tellPlayerObjectPos(PlayerID player, const CachedObjectInfo& object) {}
+        virtual void tellPlayerObjectAll(PlayerID player, const CachedObjectInfo& object) {}
+        virtual void tellPlayerObjectAttach(PlayerID player, ObjectID object) {}
+        virtual void tellPlayerObjectLeave(PlayerID player, ObjectID object) {}
+};
 
 class Server : public Daemon, public SignalHandler {
     public:
@@ -38,16 +82,20 @@ class Server : public Daemon, public SignalHandler {
 
     private:
         int safeMain();
+        int replay();
+        void dumpStats(JobPool& pool, TickClock& clock);
 
         virtual void handle_SIGINT();
         virtual void handle_SIGTERM();
+        virtual void handle_SIGUSR1();
 
         bool _running;
+        bool _dumpStats;
 
 };
 
 Server::Server() :
-    Daemon("/var/run/mmoserv.pid"), _running(true)
+    Daemon("/var/run/mmoserv.pid"), _running(true), _dumpStats(false)
 {
 
 }
@@ -66,6 +114,7 @@ int Server::main()
 
     installSignalHandler(SIGINT);
     installSignalHandler(SIGTERM);
+    installSignalHandler(SIGUSR1);
     
     try {
         safeMain();
@@ -80,35 +129,193 @@ int Server::main()
 
 int Server::safeMain()
 {
-    // Create standard jobs.
-    auto jobIdle = std::make_unique<Idle>(CYCLE_PERIOD);
-    auto jobPostOffice = std::make_unique<PostOffice>();
-    auto jobNetwork = std::make_unique<NetworkInterface>(*jobPostOffice);
-    auto jobLogin = std::make_unique<LoginManager>(*jobPostOffice);
-    auto testZone = std::make_unique<Zone>(*jobPostOffice);
+    if (!getSettings().replay().empty())
+        return replay();
+
+    // Start the clock that drives simulation ticks.
+    TickClock clock(getSettings().tickRate());
+
+    // Time a sample of messages from sender to handler.
+    msg::Tracer::setPeriod(getSettings().tracePeriod());
+
+    // Work out where workers run and which node the zone lives on.
+    Topology topology;
+    CpuGroups groups = groupCpus(topology);
+    int zoneNode = (getSettings().numa() ? groups[0].first : -1);
+
+    // Create standard jobs. The post office has a shard for each worker that
+    // is always awake. A process that only runs the zone leaves the rest to
+    // the server it is linked to.
+    bool zoneOnly = getSettings().zoneOnly();
+    const std::string& zoneLink = getSettings().zoneLink();
+
+    auto jobPostOffice = std::make_unique<PostOffice>(getSettings().threadMin());
+    std::unique_ptr<NetworkInterface> jobNetwork;
+    std::unique_ptr<LoginManager> jobLogin;
+
+    if (!zoneOnly) {
+        jobNetwork = std::make_unique<NetworkInterface>(*jobPostOffice, clock);
+        jobLogin = std::make_unique<LoginManager>(*jobPostOffice);
+    }
+
+    // A zone in another process is reached through a bridge, so that if it
+    // crashes or stalls the players in other zones carry on. The server side
+    // passes on what the zone is told and the zone side what it says.
+    std::unique_ptr<PostBridge> jobBridge;
+    if (!zoneLink.empty()) {
+        int forward = (zoneOnly ? msg::MSG_ZONESAYS : msg::MSG_ZONETELL | msg::MSG_PLAYER);
+
+        Log::log->info("Server: linking to zone process at " + zoneLink);
+        jobBridge = std::make_unique<PostBridge>(*jobPostOffice, clock, 
+            openLink(zoneLink, !zoneOnly), forward);
+    }
+
+    // Keep a log of every message to replay offline.
+    std::unique_ptr<MessageRecorder> jobRecorder;
+    if (!getSettings().record().empty())
+        jobRecorder = std::make_unique<MessageRecorder>(*jobPostOffice, getSettings().record());
+
+    // Allocate the zone from the node it will run on.
+    std::unique_ptr<Zone> testZone;
+    if (zoneOnly || zoneLink.empty()) {
+        PreferNode prefer(zoneNode);
+        testZone = std::make_unique<Zone>(*jobPostOffice, clock, zoneNode);
+    }
+
+    // Bound what can pile up for a job that falls behind. Object state only
+    // needs the newest of each, while chat and logins must all be handled so
+    // their senders are held up instead.
+    if (getSettings().inboxCapacity() > 0) {
+        size_t capacity = getSettings().inboxCapacity();
+
+        if (jobNetwork) {
+            jobNetwork->setInboxLimit(msg::MSG_ZONESAYS, capacity, OVERLOAD_COALESCE);
+            jobNetwork->setInboxLimit(msg::MSG_CHAT, capacity, OVERLOAD_BLOCK);
+            jobLogin->setInboxLimit(msg::MSG_PEER | msg::MSG_CHAT, capacity, OVERLOAD_BLOCK);
+        }
+
+        if (testZone)
+            testZone->setInboxLimit(msg::MSG_ZONETELL, capacity, OVERLOAD_COALESCE);
+    }
 
     // Add to pool.
     JobPool pool;
-    pool.add(std::move(jobIdle));
     pool.add(std::move(jobPostOffice));
-    pool.add(std::move(jobNetwork));
-    pool.add(std::move(jobLogin));
-    pool.add(std::move(testZone));
 
-    // Create worker threads.
+    if (jobNetwork) {
+        jobNetwork->setDrainBudget(getSettings().drainBudget());
+        jobLogin->setDrainBudget(getSettings().drainBudget());
+        pool.add(std::move(jobNetwork));
+        pool.add(std::move(jobLogin));
+    }
+
+    if (jobBridge)
+        pool.add(std::move(jobBridge));
+
+    if (jobRecorder)
+        pool.add(std::move(jobRecorder));
+
+    if (testZone) {
+        testZone->setDrainBudget(getSettings().drainBudget());
+        pool.add(std::move(testZone));
+    }
+
+    // The manager parks workers beyond those needed for the load.
+    pool.add(std::make_unique<PoolManager>(pool, getSettings().threadMin(), 
+        getSettings().threadMax()));
+
+    // Create worker threads, spread evenly over the CPU groups. With NUMA 
+    // placement each worker may run on any CPU of its node, otherwise workers
+    // are only pinned if given a CPU list and then get a CPU each.
+    bool pin = (getSettings().numa() || !getSettings().cpus().empty());
     std::vector<boost::shared_ptr<Worker> > workers;
     for (int i = 0; i < getSettings().threadMax(); i++) {
-        workers.push_back(boost::shared_ptr<Worker>(new Worker(pool)));
+        const CpuGroups::value_type& group = groups[i % groups.size()];
+        Worker* worker = new Worker(pool, group.first);
+        workers.push_back(boost::shared_ptr<Worker>(worker));
+
+        if (pin && getSettings().numa()) {
+            worker->pin(group.second);
+        } else if (pin) {
+            worker->pin(Topology::CpuList(1, group.second[i % group.second.size()]));
+        }
+
         logInfo(LOGMSG_CREATE_THREAD);
     }
 
     do {
         pause();
+
+        if (_dumpStats) {
+            _dumpStats = false;
+            dumpStats(pool, clock);
+        }
     } while (_running);
 
+    dumpStats(pool, clock);
+
     return 0;
 }
 
+/// Play a recorded log of messages to one job, in place of running the
+/// server, and log how long each kind of message took to handle. The job is
+/// run by this thread between messages, so it still does its work for each
+/// tick, and what it sends is routed and thrown away.
+/// \return Exit code.
+int Server::replay()
+{
+    TickClock clock(getSettings().tickRate());
+    PostOffice po;
+
+    // The cache is played what the network interface would be.
+    std::unique_ptr<MessagableJob> job;
+    ReplayCache cache;
+    msg::MessageHandler* handler = &cache;
+    int subscription = msg::MSG_ZONESAYS;
+
+    if (getSettings().replayInto() == "zone") {
+        auto zone = std::make_unique<Zone>(po, clock, -1);
+        handler = zone.get();
+        job = std::move(zone);
+        subscription = msg::MSG_ZONETELL | msg::MSG_PLAYER;
+    } else if (getSettings().replayInto() == "login") {
+        auto login = std::make_unique<LoginManager>(po);
+        handler = login.get();
+        job = std::move(login);
+        subscription = msg::MSG_PEER | msg::MSG_CHAT;
+    }
+
+    MessageReplay replay(getSettings().replay());
+    replay.play(*handler, subscription, getSettings().replayFast(), [&]() {
+        po.run();
+
+        if (job)
+            job->run();
+    });
+
+    Log::log->info(replay.report());
+
+    return 0;
+}
+
+void Server::dumpStats(JobPool& pool, TickClock& clock)
+{
+    std::ostringstream ticks;
+    ticks << "tick jitter: mean " << clock.meanJitter() << "us, max " 
+          << clock.maxJitter() << "us, " << clock.overruns() << " overruns";
+    Log::log->info(ticks.str());
+
+    Log::log->info(pool.report());
+    Log::log->info(LockProfile::report());
+    Log::log->info(msg::Tracer::report());
+
+    // Paths are too long for the log so they go to a file of their own.
+    if (msg::Tracer::period() != 0) {
+        std::ofstream paths("msgpaths.csv");
+        paths << msg::Tracer::paths();
+    }
+}
+
 void Server::handle_SIGINT()
 {
     logInfo(LOGMSG_SERVER_STOP);
@@ -123,6 +330,12 @@ void Server::handle_SIGTERM()
     _running = false;
 }
 
+void Server::handle_SIGUSR1()
+{
+    // Only set a flag since the report takes locks.
+    _dumpStats = true;
+}
+
 int main(int argc, char* argv[])
 {
     std::cout << "main()" << std::endl;
@@ -2,6 +2,7 @@
 #include <argtable3.h>
 #include <core/core.hpp>
 #include "settings.hpp"
+#include "concurrency.hpp"
 
 
 Settings* settings = 0;
@@ -22,15 +23,31 @@ Settings& getSettings()
 
 Settings::Settings(int argc, char* argv[])
 {
+    arg_int* argThreadMin = arg_int0("m", "thread-min", "NUM", "keep at least NUM worker threads active");
     arg_int* argThreadMax = arg_int0("t", "thread-max", "NUM", "use up to NUM worker threads");
     arg_int* argGamePort = arg_int0("p", "game-port", "PORT", "game clients connect on PORT");
     arg_int* argClients = arg_int0("c", "clients", "NUM", "allow NUM clients to connect");
     arg_int* argDownstream = arg_int0("d", "downstream", "BYTES", "incoming bandwidth in BYTES per second");
     arg_int* argUpstream = arg_int0("u", "upstream", "BYTES", "outgoing bandwidth in BYTES per second");
+    arg_int* argTickRate = arg_int0("r", "tick-rate", "HZ", "run simulation ticks HZ times per second");
+    arg_str* argCpus = arg_str0(NULL, "cpus", "LIST", "pin worker threads to the CPUs in LIST, such as 0-3,8-11");
+    arg_lit* argNuma = arg_lit0(NULL, "numa", "keep each zone and its memory on one NUMA node");
     arg_str* argDirectory = arg_str0("w", "working-dir", "DIR", "make DIR the working directory");
+    arg_int* argInboxCapacity = arg_int0(NULL, "inbox-capacity", "NUM", "let NUM messages of a kind wait for a job, or any if 0");
+    arg_int* argDrainBudget = arg_int0(NULL, "drain-budget", "NUM", "handle up to NUM messages each time a job runs, or all if 0");
+    arg_int* argTracePeriod = arg_int0(NULL, "trace-period", "NUM", "time 1 in NUM messages end to end, or none if 0");
+    arg_str* argZoneLink = arg_str0(NULL, "zone-link", "ADDR", "run the zone in another process linked by the socket path or shm:NAME at ADDR");
+    arg_lit* argZoneOnly = arg_lit0(NULL, "zone-only", "be the process that runs the zone for the server at --zone-link");
+    arg_str* argRecord = arg_str0(NULL, "record", "FILE", "record every message sent to FILE");
+    arg_str* argReplay = arg_str0(NULL, "replay", "FILE", "play the messages recorded in FILE and report how long they took");
+    arg_str* argReplayInto = arg_str0(NULL, "replay-into", "JOB", "play messages to JOB, which is zone, login or cache");
+    arg_lit* argReplayFast = arg_lit0(NULL, "replay-fast", "play messages as fast as possible rather than as recorded");
     
-    void* argtable[] = {argThreadMax, argGamePort, argClients, argUpstream, 
-                        argDownstream, argDirectory, arg_end(20)};
+    void* argtable[] = {argThreadMin, argThreadMax, argGamePort, argClients, argUpstream, 
+                        argDownstream, argTickRate, argCpus, argNuma, argDirectory, 
+                        argInboxCapacity, argDrainBudget, argTracePeriod, argZoneLink, 
+                        argZoneOnly, argRecord, argReplay, argReplayInto, argReplayFast, 
+                        arg_end(20)};
     
     if (arg_nullcheck(argtable) != 0)
         throw InputException("failed to read arguments");
@@ -39,13 +56,55 @@ Settings::Settings(int argc, char* argv[])
         throw InputException("error while parsing arguments");
     
     _threadMax = (argThreadMax->count > 0 ? argThreadMax->ival[0] : 2);
+    _threadMin = (argThreadMin->count > 0 ? argThreadMin->ival[0] : 1);
     _gamePort = (argGamePort->count > 0 ? argGamePort->ival[0] : 18572);
     _clients = (argClients->count > 0 ? argClients->ival[0] : 10);
     _downstream = (argDownstream->count > 0 ? argDownstream->ival[0] : 2048);
     _upstream = (argUpstream->count > 0 ? argUpstream->ival[0] : 2048);
+    _tickRate = (argTickRate->count > 0 ? argTickRate->ival[0] : 60);
+    _cpus = (argCpus->count > 0 ? argCpus->sval[0] : "");
+    _numa = (argNuma->count > 0);
     _directory = (argDirectory->count > 0 ? argDirectory->sval[0] : ".");
+    _inboxCapacity = (argInboxCapacity->count > 0 ? argInboxCapacity->ival[0] : 0);
+    _drainBudget = (argDrainBudget->count > 0 ? argDrainBudget->ival[0] : 0);
+    _tracePeriod = (argTracePeriod->count > 0 ? argTracePeriod->ival[0] : 0);
+    _zoneLink = (argZoneLink->count > 0 ? argZoneLink->sval[0] : "");
+    _zoneOnly = (argZoneOnly->count > 0);
+    _record = (argRecord->count > 0 ? argRecord->sval[0] : "");
+    _replay = (argReplay->count > 0 ? argReplay->sval[0] : "");
+    _replayInto = (argReplayInto->count > 0 ? argReplayInto->sval[0] : "zone");
+    _replayFast = (argReplayFast->count > 0);
     
     arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    
+    if ((_threadMin < 1) || (_threadMin > _threadMax))
+        throw InputException("thread min must be between 1 and thread max");
+    
+    if (_threadMax > JobPool::MAX_WORKERS)
+        throw InputException("thread max must not exceed " + std::to_string(JobPool::MAX_WORKERS));
+    
+    if ((_tickRate < 1) || (_tickRate > 1000))
+        throw InputException("tick rate must be between 1 and 1000");
+
+    if (_inboxCapacity < 0)
+        throw InputException("inbox capacity must not be negative");
+
+    if (_drainBudget < 0)
+        throw InputException("drain budget must not be negative");
+
+    if (_tracePeriod < 0)
+        throw InputException("trace period must not be negative");
+
+    if (_zoneOnly && _zoneLink.empty())
+        throw InputException("zone only needs a zone link");
+
+    if ((_replayInto != "zone") && (_replayInto != "login") && (_replayInto != "cache"))
+        throw InputException("replay into must be zone, login or cache");
+}
+
+int Settings::threadMin() const
+{
+    return _threadMin;
 }
 
 int Settings::threadMax() const
@@ -73,7 +132,67 @@ int Settings::upstream() const
     return _upstream;
 }
 
+int Settings::tickRate() const
+{
+    return _tickRate;
+}
+
+const std::string& Settings::cpus() const
+{
+    return _cpus;
+}
+
+bool Settings::numa() const
+{
+    return _numa;
+}
+
 const std::string& Settings::directory() const
 {
     return _directory;
 }
+
+int Settings::inboxCapacity() const
+{
+    return _inboxCapacity;
+}
+
+int Settings::drainBudget() const
+{
+    return _drainBudget;
+}
+
+int Settings::tracePeriod() const
+{
+    return _tracePeriod;
+}
+
+const std::string& Settings::zoneLink() const
+{
+    return _zoneLink;
+}
+
+bool Settings::zoneOnly() const
+{
+    return _zoneOnly;
+}
+
+const std::string& Settings::record() const
+{
+    return _record;
+}
+
+const std::string& Settings::replay() const
+{
+    return _replay;
+}
+
+const std::string& Settings::replayInto() const
+{
+    return _replayInto;
+}
+
+bool Settings::replayFast() const
+{
+    return _replayFast;
+}
@@ -6,20 +6,46 @@ class Settings {
     public:
         Settings(int argc, char* argv[]);
         
+        int threadMin() const;
         int threadMax() const;
         int gamePort() const;
         int clients() const;
         int downstream() const;
         int upstream() const;
+        int tickRate() const;
+        const std::string& cpus() const;
+        bool numa() const;
         const std::string& directory() const;
+        int inboxCapacity() const;
+        int drainBudget() const;
+        int tracePeriod() const;
+        const std::string& zoneLink() const;
+        bool zoneOnly() const;
+        const std::string& record() const;
+        const std::string& replay() const;
+        const std::string& replayInto() const;
+        bool replayFast() const;
         
     private:
+        int _threadMin;
         int _threadMax;
         int _gamePort;
         int _clients;
         int _downstream;
         int _upstream;
+        int _tickRate;
+        std::string _cpus;
+        bool _numa;
         std::string _directory;
+        int _inboxCapacity;
+        int _drainBudget;
+        int _tracePeriod;
+        std::string _zoneLink;
+        bool _zoneOnly;
+        std::string _record;
+        std::string _replay;
+        std::string _replayInto;
+        bool _replayFast;
 };
 
 
@@ -1,19 +1,37 @@
+#include <time.h>
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
 #include <assert.h>
+#include <sstream>
 #include <iostream>
 #include <vector>
+#include <atomic>
+#include <algorithm>
+#include <set>
+#include <queue>
+#include <random>
+#include <functional>
+#include <sched.h>
+#include <pthread.h>
 #include <boost/shared_ptr.hpp>
 #include "concurrency.hpp"
+#include "timerwheel.hpp"
 #include <core/core.hpp>
 #include "settings.hpp"
 #include "scriptmodule.hpp"
+#include "fifo.hpp"
+#include "ringfifo.hpp"
 #include "postoffice.hpp"
+#include "cojob.hpp"
+#include "msgpool.hpp"
+#include "msglatest.hpp"
+#include "msgtrace.hpp"
+#include "bridge.hpp"
+#include "msgrecord.hpp"
 #include "network.hpp"
 #include "player.hpp"
-#include "idle.hpp"
 #include "zone.hpp"
 #include <math/prim.hpp>
 #include "canvas.hpp"
@@ -204,3 +222,1309 @@ void displayKDTree()
     checkIntersection(tree, bounds);
 }
 
+
+////////// Lock Contention Test Code //////////
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/// Copy of the original x86 byte lock, kept for comparison with Lock.
+class ByteLock {
+    public:
+        ByteLock() : _rw(0), _ro(0) {}
+
+        void rwWaitLock() {
+            asm volatile (
+                "rwwait_spin%=: xorb %%al, %%al;       "
+                "               lock cmpxchgb %%dl, %0;"
+                "               cmpb $0, %%al;         "
+                "               jne rwwait_wait%=;     "
+                "               orb %1, %%al;          "
+                "               cmpb $0, %%al;         "
+                "               je rwwait_done%=;      "
+                "               lock andb $0, %0;      "
+                "rwwait_wait%=: pause;                 "
+                "               jmp rwwait_spin%=;     "
+                "rwwait_done%=:                        "
+                : : "m"(_rw), "m"(_ro), "a"(0), "d"(1)
+            );
+        }
+
+        void rwUnlock() {
+            asm volatile ("lock andb $0, %0" : : "m"(_rw));
+        }
+
+        void roWaitLock() {
+            asm volatile (
+                "rowait_spin%=: xorb %%al, %%al;       "
+                "               lock cmpxchgb %%dl, %0;"
+                "               cmpb $0, %%al;         "
+                "               je rowait_done%=;      "
+                "               pause;                 "
+                "               jmp rowait_spin%=;     "
+                "rowait_done%=: lock incb %1;          "
+                "               lock andb $0, %0;      "
+                : : "m"(_rw), "m"(_ro), "a"(0), "d"(1)
+            );
+        }
+
+        void roUnlock() {
+            asm volatile ("lock decb %0;" : : "m"(_ro));
+        }
+
+    private:
+        unsigned char _rw;
+        unsigned char _ro;
+};
+
+#endif
+
+/// Adapts Lock to the interface used by the contention test.
+class AtomicLock {
+    public:
+        AtomicLock() : _value(0), _lock(_value) {}
+
+        void rwWaitLock() { _lock.rwWaitLock(); }
+        void rwUnlock() { _lock.rwUnlock(); }
+        void roWaitLock() { _lock.roWaitLock(); }
+        void roUnlock() { _lock.roUnlock(); }
+
+    private:
+        int _value;
+        Lock<int> _lock;
+};
+
+template<typename L>
+struct LockContention {
+    static const int ITERATIONS = 200000;
+    static const int WRITE_EVERY = 10;
+
+    L lock;
+    volatile uint64_t value;
+
+    static void* threadMain(void* args) {
+        LockContention* test = reinterpret_cast<LockContention*>(args);
+
+        for (int i = 0; i < ITERATIONS; i++) {
+            if (i % WRITE_EVERY == 0) {
+                test->lock.rwWaitLock();
+                test->value = test->value + 1;
+                test->lock.rwUnlock();
+            } else {
+                test->lock.roWaitLock();
+                uint64_t value = test->value;
+                (void)value;
+                test->lock.roUnlock();
+            }
+        }
+
+        return 0;
+    }
+
+    void run(const char* name, int threadCount) {
+        std::vector<pthread_t> threads(threadCount);
+        value = 0;
+
+        Timer timer;
+        for (auto& thread : threads)
+            pthread_create(&thread, 0, &threadMain, this);
+        for (auto& thread : threads)
+            pthread_join(thread, 0);
+        uint64_t elapsed = timer.elapsed();
+
+        uint64_t expected = uint64_t(threadCount) * (ITERATIONS / WRITE_EVERY);
+        cout << name << " threads = " << threadCount 
+             << " ops/ms = " << (uint64_t(threadCount) * ITERATIONS * 1000 / (elapsed + 1))
+             << (value == expected ? "" : " (lost writes)") << endl;
+    }
+};
+
+/// Compare Lock against the original byte lock under contention.
+/// Each thread does one write for every nine reads.
+void lockContention()
+{
+    for (int threadCount = 1; threadCount <= 16; threadCount *= 2) {
+        LockContention<AtomicLock>().run("atomic", threadCount);
+#if defined(__x86_64__) || defined(__i386__)
+        LockContention<ByteLock>().run("byte  ", threadCount);
+#endif
+    }
+}
+
+
+////////// Coroutine Job Test Code //////////
+
+/// What a CoroutineCheck saw. It is kept apart from the job since the pool
+/// destroys the job once its coroutine throws.
+struct CoroutineResults {
+    CoroutineResults() : filtered(0), unwanted(0), timedOut(false), waited(0), ticks(0),
+        ordered(true), frames(0), destroyed(false) {}
+
+    ObjectID filtered;
+    int unwanted;
+    bool timedOut;
+    uint64_t waited;
+    int ticks;
+    bool ordered;
+    std::atomic<int> frames;
+    std::atomic<bool> destroyed;
+};
+
+/// Counts the coroutine frames that are alive.
+struct FrameGuard {
+    FrameGuard(std::atomic<int>& frames) : frames(frames) { frames++; }
+    ~FrameGuard() { frames--; }
+
+    std::atomic<int>& frames;
+};
+
+/// Job whose coroutine receives with a filter and a timeout, waits for ticks,
+/// spawns a coroutine that never finishes and then throws.
+struct CoroutineCheck : public CoroutineJob {
+    static const uint64_t TIMEOUT = 20000;
+    static const int TICKS = 20;
+
+    CoroutineCheck(PostOffice& po, TickClock& clock, CoroutineResults& results) :
+        CoroutineJob(po, msg::MSG_ZONESAYS, &clock), clock(clock), results(results) {
+        spawn(script());
+    }
+
+    virtual ~CoroutineCheck() {
+        results.destroyed = true;
+    }
+
+    virtual void handleZoneSaysObjectEnter(ObjectID object) {
+        results.unwanted++;
+    }
+
+    Task script() {
+        FrameGuard guard(results.frames);
+
+        std::unique_ptr<const msg::ZoneSaysObjectEnter> enter =
+            co_await receive<msg::ZoneSaysObjectEnter>(
+                [](const msg::ZoneSaysObjectEnter& message) { return (message.object() == 2); });
+        results.filtered = enter->object();
+
+        uint64_t before = JobPool::now();
+        std::unique_ptr<const msg::ZoneSaysObjectLeave> leave =
+            co_await receive<msg::ZoneSaysObjectLeave>(TIMEOUT);
+        results.waited = JobPool::now() - before;
+        results.timedOut = (leave == 0);
+
+        // Sleeping between ticks unsubscribes the job from the clock, so each
+        // wait for a tick subscribes again and may find the tick has started.
+        TickClock::Tick last = clock.tick();
+        for (int i = 0; i < TICKS; i++) {
+            TickClock::Tick tick = co_await nextTick();
+            results.ordered = results.ordered && (tick > last);
+            results.ticks++;
+            last = tick;
+
+            co_await sleepFor((i * 7919) % clock.period());
+        }
+
+        spawn(hang());
+
+        co_await sleepFor(1000);
+        throw InputException("CoroutineCheck: thrown on purpose");
+    }
+
+    Task hang() {
+        FrameGuard guard(results.frames);
+        co_await receive<msg::ZoneSaysObjectLeave>();
+    }
+
+    TickClock& clock;
+    CoroutineResults& results;
+};
+
+/// Drive a CoroutineJob on a worker. Three objects enter, one alone and two
+/// in a batch as a zone sends them, of which only the last is wanted. Nothing
+/// leaves so the receive with a timeout gives null. Once the coroutine throws the pool destroys the job, which must
+/// destroy the coroutine still suspended with it.
+void coroutineJob()
+{
+    static const uint64_t DEADLINE = 5000000;
+
+    TickClock clock(100);
+    CoroutineResults results;
+    JobPool pool;
+    std::unique_ptr<PostOffice> po(new PostOffice);
+    Outbox outbox;
+
+    po->registerOutbox(outbox);
+    pool.add(Job::Ptr(new CoroutineCheck(*po, clock, results)));
+    pool.add(std::move(po));
+
+    {
+        Worker worker(pool);
+
+        std::unique_ptr<msg::Batch> batch(new msg::Batch);
+        batch->addZoneSaysObjectEnter(3);
+        batch->addZoneSaysObjectEnter(2);
+
+        outbox.put(std::unique_ptr<msg::Message>(new msg::ZoneSaysObjectEnter(1)));
+        outbox.put(std::move(batch));
+
+        uint64_t start = JobPool::now();
+        while (!(results.destroyed && (results.frames == 0)) && (JobPool::now() - start < DEADLINE))
+            usleep(1000);
+    }
+
+    cout << "coroutine job: filtered = " << results.filtered
+         << " unwanted = " << results.unwanted
+         << " timed out after " << results.waited << "us"
+         << " ticks = " << results.ticks << (results.ordered ? "" : " (out of order)")
+         << " frames left = " << results.frames << endl;
+
+    assert((results.filtered == 2) && (results.unwanted == 2));
+    assert(results.timedOut && (results.waited >= CoroutineCheck::TIMEOUT));
+    assert((results.ticks == CoroutineCheck::TICKS) && results.ordered);
+    assert(results.destroyed && (results.frames == 0));
+}
+
+
+////////// Timer Wheel Test Code //////////
+
+/// Schedules timers spread over every wheel, and beyond the top one, then
+/// advances the wheel in irregular steps checking that each timer fires
+/// exactly once, never early and no later than the first step it is due by.
+struct TimerWheelCheck {
+    static const int COUNT = 500000;
+    static const uint64_t RESOLUTION = 1000;
+    static const uint64_t START = 1000000;
+
+    typedef std::pair<uint64_t, int> Due;
+    typedef std::priority_queue<Due, std::vector<Due>, std::greater<Due> > DueQueue;
+
+    TimerWheelCheck() : random(12345), due(COUNT), ids(COUNT), fired(COUNT, 0),
+        cancelled(COUNT, false), previous(START), now(START), early(false), late(false) {}
+
+    /// Pick a delay of at least a tick, mostly short but some further than
+    /// the wheels span.
+    uint64_t delay() {
+        int pick = random() % 100;
+        int bits = (pick < 50 ? 16 : (pick < 90 ? 24 : (pick < 99 ? 32 : 34)));
+        return (1 + (random() & ((uint64_t(1) << bits) - 1))) * RESOLUTION + random() % RESOLUTION;
+    }
+
+    /// Pick a step, mostly a few ticks but sometimes far enough to skip.
+    uint64_t step() {
+        int pick = random() % 100;
+        int bits = (pick < 70 ? 3 : (pick < 95 ? 12 : (pick < 99 ? 20 : 28)));
+        return (random() & ((uint64_t(1) << bits) - 1)) * RESOLUTION + random() % RESOLUTION + 1;
+    }
+
+    uint64_t expiry(int i) const {
+        return (due[i] + RESOLUTION - 1) / RESOLUTION;
+    }
+
+    void fire(int i) {
+        early |= (now / RESOLUTION < expiry(i));
+        late |= (previous / RESOLUTION >= expiry(i));
+        fired[i]++;
+    }
+
+    void run() {
+        TimerWheel wheel(START, RESOLUTION);
+
+        for (int i = 0; i < COUNT; i++)
+            due[i] = START + delay();
+
+        Timer timer;
+        for (int i = 0; i < COUNT; i++)
+            ids[i] = wheel.schedule(due[i], [this, i]() { fire(i); });
+        uint64_t scheduling = timer.elapsed();
+
+        timer.reset();
+        for (int i = 0; i < COUNT; i += 4)
+            cancelled[i] = wheel.cancel(ids[i]);
+        uint64_t cancelling = timer.elapsed();
+
+        DueQueue pending;
+        for (int i = 0; i < COUNT; i++) {
+            assert(cancelled[i] == (i % 4 == 0));
+            if (!cancelled[i])
+                pending.push(Due(expiry(i), i));
+        }
+
+        assert(wheel.size() == pending.size());
+
+        bool midway = false;
+        bool wrongCancel = false;
+        bool wrongExpiry = false;
+        int steps = 0;
+
+        while (wheel.size() > 0) {
+            previous = now;
+            now += step();
+            wheel.advance(now);
+            steps++;
+
+            // Cancel some of the rest once the nearest timers have fired.
+            if (!midway && (now >= START + (RESOLUTION << 16))) {
+                midway = true;
+
+                for (int i = 1; i < COUNT; i += 8) {
+                    bool cancel = wheel.cancel(ids[i]);
+                    wrongCancel |= (cancel != (fired[i] == 0));
+                    cancelled[i] = cancel;
+                }
+            }
+
+            while (!pending.empty() &&
+                   ((fired[pending.top().second] != 0) || cancelled[pending.top().second]))
+                pending.pop();
+
+            uint64_t next = wheel.nextExpiry();
+            if (pending.empty()) {
+                wrongExpiry |= (next != TimerWheel::NEVER);
+            } else {
+                wrongExpiry |= ((next <= now) || (next > pending.top().first * RESOLUTION));
+            }
+        }
+
+        int once = 0;
+        for (int i = 0; i < COUNT; i++) {
+            assert(fired[i] == (cancelled[i] ? 0 : 1));
+            once += fired[i];
+        }
+
+        // Ids of fired and cancelled timers stay stale once their nodes are
+        // reused.
+        std::vector<TimerWheel::Id> reused(COUNT / 10);
+        for (size_t i = 0; i < reused.size(); i++)
+            reused[i] = wheel.schedule(now + RESOLUTION, []() {});
+
+        bool stale = false;
+        for (int i = 0; i < COUNT; i++)
+            stale |= wheel.cancel(ids[i]);
+
+        assert(wheel.size() == reused.size());
+        for (size_t i = 0; i < reused.size(); i++)
+            assert(wheel.cancel(reused[i]));
+
+        cout << "timer wheel: " << COUNT << " timers, " << once << " fired over "
+             << steps << " steps, schedule ns/timer = " << (scheduling * 1000 / COUNT)
+             << " cancel ns/timer = " << (cancelling * 1000 / ((COUNT + 3) / 4))
+             << (early ? " (early)" : "") << (late ? " (late)" : "")
+             << (wrongCancel ? " (wrong cancel)" : "") << (wrongExpiry ? " (wrong expiry)" : "")
+             << (stale ? " (stale id cancelled)" : "") << endl;
+
+        assert(!early && !late && !wrongCancel && !wrongExpiry && !stale);
+    }
+
+    std::mt19937_64 random;
+    std::vector<uint64_t> due;
+    std::vector<TimerWheel::Id> ids;
+    std::vector<int> fired;
+    std::vector<bool> cancelled;
+    uint64_t previous;
+    uint64_t now;
+    bool early;
+    bool late;
+};
+
+/// Check a TimerWheel with many pending timers and measure the cost of
+/// scheduling and cancelling them.
+void timerWheel()
+{
+    TimerWheelCheck().run();
+}
+
+
+////////// FIFO Throughput Test Code //////////
+
+/// Object sent through the pipes by the FIFO test.
+struct Stamped {
+    Stamped(uint64_t sent = 0) : sent(sent) {}
+
+    std::unique_ptr<Stamped> clone() const {
+        return std::unique_ptr<Stamped>(new Stamped(*this));
+    }
+
+    uint64_t sent;  ///< Time put in nanoseconds.
+};
+
+static uint64_t nanoTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+template<template<typename> class P, template<typename> class G>
+struct FifoThroughput {
+    static const int COUNT = 1000000;
+    static const int PACED_COUNT = 100000;
+
+    P<Stamped> put;
+    G<Stamped> get;
+    bool paced;
+    int count;
+    std::atomic<int> received;
+
+    static void* producerMain(void* args) {
+        FifoThroughput* test = reinterpret_cast<FifoThroughput*>(args);
+
+        for (int i = 0; i < test->count; i++) {
+            while (test->paced && (test->received.load() < i))
+                sched_yield();
+
+            test->put.put(Stamped(nanoTime()));
+        }
+
+        return 0;
+    }
+
+    void run(const char* name, bool pace) {
+        get.connectTo(put);
+        paced = pace;
+        count = (paced ? PACED_COUNT : COUNT);
+        received = 0;
+
+        pthread_t producer;
+        uint64_t total = 0, worst = 0;
+
+        Timer timer;
+        pthread_create(&producer, 0, &producerMain, this);
+
+        while (received.load() < count) {
+            get.transfer();
+
+            if (get.empty())
+                sched_yield();
+
+            while (!get.empty()) {
+                uint64_t latency = nanoTime() - get.get()->sent;
+                total += latency;
+                worst = std::max(worst, latency);
+                received++;
+            }
+        }
+
+        pthread_join(producer, 0);
+        uint64_t elapsed = timer.elapsed();
+
+        cout << name << (paced ? " paced " : " flood ")
+             << " msgs/ms = " << (uint64_t(count) * 1000 / (elapsed + 1))
+             << " mean latency ns = " << (total / count)
+             << " max latency ns = " << worst << endl;
+    }
+};
+
+/// Compare the vector swapping FIFO against the ring FIFO.
+/// One thread puts objects while another reads them, polling the way
+/// MessagableJob does when it is not blocked. Flooding measures throughput.
+/// Pacing, where each object is only put once the last has been read,
+/// measures the latency of handing a single object across.
+void fifoThroughput()
+{
+    for (int paced = 0; paced < 2; paced++) {
+        FifoThroughput<fifo::Put, fifo::Get>().run("vector", paced);
+        FifoThroughput<ring::Put, ring::Get>().run("ring  ", paced);
+    }
+}
+
+
+////////// Message Allocation Test Code //////////
+
+struct MessageAllocation {
+    static const int WARMUP = 100000;
+    static const int COUNT = 1000000;
+
+    Outbox outbox;
+    Inbox inbox;
+    bool copy;
+    std::atomic<int> sent;
+
+    static void* producerMain(void* args) {
+        MessageAllocation* test = reinterpret_cast<MessageAllocation*>(args);
+
+        for (int i = 0; i < WARMUP + COUNT; i++) {
+            // Keep the pipe short so the pool only grows to a fixed size.
+            while (i - test->sent.load() > 1000)
+                sched_yield();
+
+            if (test->copy) {
+                test->outbox.put(msg::ZoneTellObjectPos(0, i, Vector3(0.0f, 0.0f, 0.0f)));
+            } else {
+                test->outbox.put(std::unique_ptr<msg::Message>(
+                    new msg::ZoneTellObjectPos(0, i, Vector3(0.0f, 0.0f, 0.0f))));
+            }
+        }
+
+        return 0;
+    }
+
+    void run(bool copying) {
+        inbox.connectTo(outbox);
+        copy = copying;
+        sent = 0;
+
+        pthread_t producer;
+        pthread_create(&producer, 0, &producerMain, this);
+
+        uint64_t before = 0;
+        Timer timer;
+
+        for (int received = 0; received < WARMUP + COUNT; ) {
+            if (inbox.empty()) {
+                sched_yield();
+                continue;
+            }
+
+            inbox.get();
+            sent = ++received;
+
+            if (received == WARMUP) {
+                before = msg::MessagePool::systemAllocations();
+                timer.reset();
+            }
+        }
+
+        pthread_join(producer, 0);
+        uint64_t elapsed = timer.elapsed();
+        uint64_t allocations = msg::MessagePool::systemAllocations() - before;
+
+        cout << (copy ? "copy" : "move")
+             << " msgs/ms = " << (uint64_t(COUNT) * 1000 / (elapsed + 1))
+             << " system allocations = " << allocations
+             << " per message = " << (double(allocations) / COUNT) << endl;
+    }
+};
+
+/// Check that messaging does not call the system allocator once warmed up.
+/// One thread sends messages either by copying them or by moving them into
+/// the outbox while another thread reads and frees them.
+void messageAllocation()
+{
+    MessageAllocation().run(true);
+    MessageAllocation().run(false);
+}
+
+
+////////// Message Batching Test Code //////////
+
+/// Handler that sums what it is sent, so dispatch cannot be optimised away.
+struct BatchingHandler : public msg::MessageHandler {
+    BatchingHandler() : sum(0) {}
+
+    virtual void handleZoneSaysObjectAll(ObjectID object, Vector3 pos, Vector3 vel,
+        float rot, ControlState state) {
+        sum += object + uint64_t(pos.x) + state;
+    }
+
+    virtual void handleZoneSaysObjectAttach(ObjectID object, PlayerID player) {
+        sum += object + player;
+    }
+
+    uint64_t sum;
+};
+
+/// Compare sending separate messages against sending one batch.
+/// Each round builds the mix of messages a zone sends every tick, sends them
+/// through a pipe and dispatches them at the other end.
+void messageBatching()
+{
+    static const int COUNT = 10000;
+    static const int ROUNDS = 100;
+
+    Outbox outbox;
+    Inbox inbox;
+    inbox.connectTo(outbox);
+
+    BatchingHandler separate, batched;
+
+    Timer timer;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < COUNT; i++) {
+            Vector3 pos(float(i), 0.0f, 0.0f);
+
+            if (i % 2 == 0) {
+                outbox.put(std::unique_ptr<msg::Message>(
+                    new msg::ZoneSaysObjectAll(i, pos, pos, 0.0f, i)));
+            } else {
+                outbox.put(std::unique_ptr<msg::Message>(
+                    new msg::ZoneSaysObjectAttach(i, i + 1)));
+            }
+        }
+
+        while (!inbox.empty())
+            inbox.get()->dispatch(separate);
+    }
+    uint64_t separateTime = timer.elapsed();
+
+    timer.reset();
+    for (int round = 0; round < ROUNDS; round++) {
+        std::unique_ptr<msg::Batch> batch(new msg::Batch);
+
+        for (int i = 0; i < COUNT; i++) {
+            Vector3 pos(float(i), 0.0f, 0.0f);
+
+            if (i % 2 == 0) {
+                batch->addZoneSaysObjectAll(i, pos, pos, 0.0f, i);
+            } else {
+                batch->addZoneSaysObjectAttach(i, i + 1);
+            }
+        }
+
+        outbox.put(std::move(batch));
+
+        while (!inbox.empty())
+            inbox.get()->dispatch(batched);
+    }
+    uint64_t batchedTime = timer.elapsed();
+
+    cout << "separate msgs/ms = " << (uint64_t(COUNT) * ROUNDS * 1000 / (separateTime + 1))
+         << " batched msgs/ms = " << (uint64_t(COUNT) * ROUNDS * 1000 / (batchedTime + 1))
+         << (separate.sum == batched.sum ? "" : " (mismatch)") << endl;
+}
+
+
+////////// Message Fan-out Test Code //////////
+
+/// Measure routing a broadcast to many subscribers.
+/// The post office is run directly rather than by a pool. Every subscriber
+/// should be given the message that was sent rather than a copy of it.
+void messageFanout()
+{
+    static const int READERS = 16;
+    static const int COUNT = 100000;
+
+    PostOffice po;
+    Outbox outbox;
+    Inbox inboxes[READERS];
+
+    po.registerOutbox(outbox);
+    for (int i = 0; i < READERS; i++)
+        po.registerInbox(inboxes[i], msg::MSG_CHAT);
+
+    std::string text(200, 'x');
+    uint64_t copies = 0;
+
+    Timer timer;
+    for (int i = 0; i < COUNT; i++) {
+        msg::Message* sent = new msg::ChatBroadcast(text);
+        outbox.put(std::unique_ptr<msg::Message>(sent));
+        po.run();
+
+        for (int j = 0; j < READERS; j++) {
+            while (!inboxes[j].empty()) {
+                if (inboxes[j].get().get() != sent)
+                    copies++;
+            }
+        }
+    }
+    uint64_t elapsed = timer.elapsed();
+
+    cout << "fan-out to " << READERS << " msgs/ms = " << (uint64_t(COUNT) * 1000 / (elapsed + 1))
+         << " copies per message = " << (double(copies) / COUNT) << endl;
+}
+
+
+////////// Post Office Scaling Test Code //////////
+
+struct PostOfficeScaling {
+    static const int SOURCES = 16;
+    static const int DESTS = 4;
+    static const int COUNT = 50000;
+
+    Outbox outboxes[SOURCES];
+    Inbox inboxes[DESTS];
+    std::atomic<int> nextDest;
+
+    static void* consumerMain(void* args) {
+        PostOfficeScaling* test = reinterpret_cast<PostOfficeScaling*>(args);
+        Inbox& inbox = test->inboxes[test->nextDest++];
+
+        for (int count = 0; count < SOURCES * COUNT; ) {
+            if (inbox.empty()) {
+                sched_yield();
+                continue;
+            }
+
+            inbox.get();
+            count++;
+        }
+
+        return 0;
+    }
+
+    void run(int shards) {
+        std::unique_ptr<PostOffice> po(new PostOffice(shards));
+
+        for (int i = 0; i < SOURCES; i++)
+            po->registerOutbox(outboxes[i]);
+        // Position updates are keyed by player, so take them for every player.
+        for (int i = 0; i < DESTS; i++) {
+            po->registerInbox(inboxes[i], 0);
+            po->registerKey(inboxes[i], msg::MSG_ZONETELL, PostShard::ANY_KEY);
+        }
+
+        // Queue everything first so that only routing is timed.
+        for (int i = 0; i < COUNT; i++) {
+            for (int j = 0; j < SOURCES; j++) {
+                outboxes[j].put(std::unique_ptr<msg::Message>(
+                    new msg::ZoneTellObjectPos(j, i, Vector3(0.0f, 0.0f, 0.0f))));
+            }
+        }
+
+        nextDest = 0;
+        pthread_t consumers[DESTS];
+        for (int i = 0; i < DESTS; i++)
+            pthread_create(&consumers[i], 0, &consumerMain, this);
+
+        JobPool pool;
+        pool.add(std::move(po));
+
+        Timer timer;
+        {
+            std::vector<std::unique_ptr<Worker> > workers;
+            for (int i = 0; i < shards; i++)
+                workers.push_back(std::unique_ptr<Worker>(new Worker(pool)));
+
+            for (int i = 0; i < DESTS; i++)
+                pthread_join(consumers[i], 0);
+        }
+        uint64_t elapsed = timer.elapsed();
+
+        cout << shards << " shards msgs/ms = "
+             << (uint64_t(SOURCES) * COUNT * 1000 / (elapsed + 1)) << endl;
+    }
+};
+
+/// Measure how routing throughput grows with the number of shards.
+/// Sources are queued up with messages before the pool starts, then each
+/// shard is given its own worker and the time taken for every destination
+/// to receive every message is measured.
+void postOfficeScaling()
+{
+    for (int shards = 1; shards <= 8; shards *= 2)
+        PostOfficeScaling().run(shards);
+}
+
+
+////////// Keyed Routing Test Code //////////
+
+/// Measure routing a message to one zone out of many.
+/// Each zone either takes player messages for every zone and would filter out
+/// those for other zones itself, or registers a key for its own zone. The
+/// same messages are sent either way. Only the post office is timed, not the
+/// zones reading their messages.
+void keyedRouting()
+{
+    static const int COUNT = 100000;
+
+    for (int zones = 1; zones <= 256; zones *= 16) {
+        for (int keyed = 0; keyed < 2; keyed++) {
+            PostOffice po;
+            Outbox outbox;
+            std::vector<Inbox> inboxes(zones);
+
+            po.registerOutbox(outbox);
+            for (int i = 0; i < zones; i++) {
+                po.registerInbox(inboxes[i], 0);
+                po.registerKey(inboxes[i], msg::MSG_PLAYER, (keyed ? i : PostShard::ANY_KEY));
+            }
+
+            for (int i = 0; i < COUNT; i++)
+                outbox.put(std::unique_ptr<msg::Message>(new msg::PlayerEnterZone(i, i % zones)));
+
+            Timer timer;
+            po.run();
+            uint64_t elapsed = timer.elapsed();
+
+            uint64_t delivered = 0;
+            for (int i = 0; i < zones; i++) {
+                while (!inboxes[i].empty()) {
+                    inboxes[i].get();
+                    delivered++;
+                }
+            }
+
+            cout << zones << " zones " << (keyed ? "keyed  " : "by type")
+                 << " msgs/ms = " << (uint64_t(COUNT) * 1000 / (elapsed + 1))
+                 << " deliveries per message = " << (double(delivered) / COUNT) << endl;
+        }
+    }
+}
+
+
+////////// State Coalescing Test Code //////////
+
+/// Handler that records the newest position it is sent for each object.
+struct CoalescingHandler : public msg::MessageHandler {
+    CoalescingHandler(int objects) : positions(objects, -1.0f), count(0) {}
+
+    virtual void handleZoneSaysObjectAll(ObjectID object, Vector3 pos, Vector3 vel,
+        float rot, ControlState state) {
+        positions[object] = pos.x;
+        count++;
+    }
+
+    std::vector<float> positions;
+    int count;
+};
+
+/// Check that a reader that falls behind only gets the newest state.
+/// A zone sends the neighbours and state of every object in one batch each
+/// tick, as Zone::main() does, while the network interface reads nothing.
+/// Its inbox should hold no more than three records per object, and the
+/// last one read for each object should be from the last round.
+void stateCoalescing()
+{
+    static const int OBJECTS = 1000;
+    static const int ROUNDS = 100;
+
+    PostOffice po;
+    Outbox outbox;
+    Inbox inbox;
+
+    po.registerOutbox(outbox);
+    po.registerInbox(inbox, msg::MSG_ZONESAYS);
+
+    ObjectList neighbours;
+    Timer timer;
+    for (int round = 0; round < ROUNDS; round++) {
+        std::unique_ptr<msg::Batch> batch(new msg::Batch);
+
+        for (int i = 0; i < OBJECTS; i++) {
+            Vector3 pos(float(round), 0.0f, 0.0f);
+            batch->addZoneSaysObjectNeighbours(i, neighbours);
+            batch->addZoneSaysObjectAll(i, pos, pos, 0.0f, 0);
+        }
+
+        outbox.put(std::move(batch));
+        po.run();
+    }
+    uint64_t elapsed = timer.elapsed();
+
+    CoalescingHandler handler(OBJECTS);
+    while (!inbox.empty())
+        msg::Latest::open(inbox.get())->dispatch(handler);
+
+    int stale = 0;
+    for (int i = 0; i < OBJECTS; i++) {
+        if (handler.positions[i] != float(ROUNDS - 1))
+            stale++;
+    }
+
+    cout << "sent = " << (OBJECTS * ROUNDS) << " queued = " << handler.count
+         << " stale = " << stale
+         << " msgs/ms = " << (uint64_t(OBJECTS) * ROUNDS * 1000 / (elapsed + 1)) << endl;
+
+    assert((handler.count <= 3 * OBJECTS) && (stale == 0));
+}
+
+
+////////// Proximity Batching Test Code //////////
+
+/// Handler that rebuilds neighbour sets the way the object cache does.
+struct ProximityHandler : public msg::MessageHandler {
+    ProximityHandler(int objects) : neighbours(objects), records(0) {}
+
+    virtual void handleZoneSaysObjectNeighbours(ObjectID object, const ObjectList& list) {
+        neighbours[object].clear();
+        neighbours[object].insert(list.begin(), list.end());
+        records++;
+    }
+
+    virtual void handleZoneSaysObjectLeave(ObjectID object) {
+        neighbours[object].clear();
+        records++;
+    }
+
+    virtual void handleZoneSaysObjectAttach(ObjectID object, PlayerID player) {
+        neighbours[object].insert(ObjectID(player));
+        records++;
+    }
+
+    std::vector<std::set<ObjectID> > neighbours;
+    uint64_t records;
+};
+
+/// Compare sending one record per pair of close objects against sending one
+/// neighbour list per object, for a few hundred ships all close together.
+/// ObjectLeave and ObjectAttach stand in for the clear and per pair messages
+/// the zone used to send.
+void proximityBatching()
+{
+    static const int OBJECTS = 300;
+    static const int ROUNDS = 20;
+
+    std::vector<ObjectList> close(OBJECTS);
+    for (int i = 0; i < OBJECTS; i++) {
+        for (int j = 0; j < OBJECTS; j++) {
+            if (j != i)
+                close[i].push_back(j);
+        }
+    }
+
+    Outbox outbox;
+    Inbox inbox;
+    inbox.connectTo(outbox);
+
+    ProximityHandler pairs(OBJECTS), lists(OBJECTS);
+    size_t pairBytes = 0, listBytes = 0;
+
+    Timer timer;
+    for (int round = 0; round < ROUNDS; round++) {
+        std::unique_ptr<msg::Batch> batch(new msg::Batch);
+
+        for (int i = 0; i < OBJECTS; i++) {
+            batch->addZoneSaysObjectLeave(i);
+
+            for (auto id : close[i])
+                batch->addZoneSaysObjectAttach(i, id);
+        }
+
+        msg::Buffer bytes;
+        msg::Writer writer(bytes);
+        batch->encode(writer);
+        pairBytes = bytes.size();
+
+        outbox.put(std::move(batch));
+
+        while (!inbox.empty())
+            inbox.get()->dispatch(pairs);
+    }
+    uint64_t pairTime = timer.elapsed();
+
+    timer.reset();
+    for (int round = 0; round < ROUNDS; round++) {
+        std::unique_ptr<msg::Batch> batch(new msg::Batch);
+
+        for (int i = 0; i < OBJECTS; i++)
+            batch->addZoneSaysObjectNeighbours(i, close[i]);
+
+        msg::Buffer bytes;
+        msg::Writer writer(bytes);
+        batch->encode(writer);
+        listBytes = bytes.size();
+
+        outbox.put(std::move(batch));
+
+        while (!inbox.empty())
+            inbox.get()->dispatch(lists);
+    }
+    uint64_t listTime = timer.elapsed();
+
+    cout << "per pair records/tick = " << (pairs.records / ROUNDS)
+         << " bytes/tick = " << pairBytes
+         << " us/tick = " << (pairTime / ROUNDS) << endl;
+    cout << "per object records/tick = " << (lists.records / ROUNDS)
+         << " bytes/tick = " << listBytes
+         << " us/tick = " << (listTime / ROUNDS)
+         << (pairs.neighbours == lists.neighbours ? "" : " (mismatch)") << endl;
+}
+
+
+////////// Inbox Limit Test Code //////////
+
+/// Handler that counts what it is sent and checks it arrives in order.
+struct LimitHandler : public msg::MessageHandler {
+    LimitHandler() : enters(0), states(0), last(0), ordered(true) {}
+
+    virtual void handleZoneSaysObjectEnter(ObjectID object) {
+        ordered &= (object >= last);
+        last = object;
+        enters++;
+    }
+
+    virtual void handleZoneSaysObjectAll(ObjectID object, Vector3 pos, Vector3 vel,
+        float rot, ControlState state) {
+        states++;
+    }
+
+    int enters;
+    int states;
+    ObjectID last;
+    bool ordered;
+};
+
+/// Send messages to an inbox whose reader has stalled and report how much
+/// piles up under a limit with a policy. Each round a zone sends the
+/// neighbours and state of every object in one batch, as Zone::main() does,
+/// and tells of an object entering. Once it is done the reader catches up,
+/// and blocked messages follow as it makes room. Whatever the policy every
+/// enter must arrive, in order, since only state may be lost. Coalesced
+/// batches must not be blocked, so no more than three states per object may
+/// be waiting.
+/// \param policy The policy of the limit.
+/// \param name Name of the policy.
+void inboxLimit(Overload policy, const char* name)
+{
+    static const int OBJECTS = 1000;
+    static const int ROUNDS = 100;
+    static const size_t CAPACITY = 100;
+
+    PostOffice po;
+    Outbox outbox;
+    Inbox inbox;
+
+    inbox.setLimit(msg::MSG_ZONESAYS, CAPACITY, policy);
+    po.registerOutbox(outbox);
+    po.registerInbox(inbox, msg::MSG_ZONESAYS);
+
+    ObjectList neighbours;
+    for (int round = 0; round < ROUNDS; round++) {
+        Vector3 pos(float(round), 0.0f, 0.0f);
+        std::unique_ptr<msg::Batch> batch(new msg::Batch);
+
+        for (int i = 0; i < OBJECTS; i++) {
+            batch->addZoneSaysObjectNeighbours(i, neighbours);
+            batch->addZoneSaysObjectAll(i, pos, pos, 0.0f, 0);
+        }
+
+        outbox.put(std::move(batch));
+        outbox.put(std::unique_ptr<msg::Message>(new msg::ZoneSaysObjectEnter(round)));
+        po.run();
+    }
+
+    LimitHandler stalled;
+    while (!inbox.empty())
+        msg::Latest::open(inbox.get())->dispatch(stalled);
+
+    LimitHandler caughtUp;
+    bool delivered = true;
+
+    while (delivered) {
+        po.run();
+        delivered = !inbox.empty();
+
+        while (!inbox.empty())
+            msg::Latest::open(inbox.get())->dispatch(caughtUp);
+    }
+
+    cout << name << ": waiting = " << (stalled.enters + stalled.states)
+         << " dropped = " << inbox.dropped()
+         << " deferred = " << inbox.deferred()
+         << " enters = " << (stalled.enters + caughtUp.enters) << "/" << ROUNDS
+         << ((stalled.ordered && caughtUp.ordered) ? "" : " (out of order)") << endl;
+
+    assert(stalled.enters + caughtUp.enters == ROUNDS);
+    assert(stalled.ordered && caughtUp.ordered);
+    assert((policy != OVERLOAD_COALESCE) || (stalled.states <= 3 * OBJECTS));
+}
+
+/// Compare the policies for a full inbox.
+void inboxLimits()
+{
+    inboxLimit(OVERLOAD_BLOCK, "block");
+    inboxLimit(OVERLOAD_DROP_OLDEST, "drop oldest");
+    inboxLimit(OVERLOAD_COALESCE, "coalesce");
+}
+
+
+////////// Message Tracing Test Code //////////
+
+/// Job that tells a zone about objects, or plays the zone and counts what it
+/// is told. Only the zone, which has a subscription, takes the messages for
+/// the player they are sent to.
+struct TracingJob : public MessagableJob {
+    TracingJob(PostOffice& po, int subscription) : MessagableJob(po, subscription), handled(0) {
+        if (subscription != 0)
+            registerKey(msg::MSG_ZONETELL, 1);
+    }
+
+    virtual RetType main() {
+        return BLOCK;
+    }
+
+    virtual void handleZoneTellObjectAll(PlayerID player, ObjectID object, Vector3 pos,
+        Vector3 vel, float rot, ControlState state) {
+        handled++;
+    }
+
+    void tell(ObjectID object) {
+        Vector3 pos(float(object), 0.0f, 0.0f);
+        sendMessage(std::unique_ptr<msg::Message>(
+            new msg::ZoneTellObjectAll(1, object, pos, pos, 0.0f, 0)));
+    }
+
+    int handled;
+};
+
+/// Measure what tracing costs a message going from one job to another, with
+/// tracing off, sampling and tracing every message. The report and the first
+/// few paths are shown for the last.
+void messageTracing()
+{
+    static const int COUNT = 100;
+    static const int ROUNDS = 2000;
+    static const unsigned int PERIODS[] = {0, 1000, 1};
+
+    for (unsigned int period : PERIODS) {
+        msg::Tracer::setPeriod(period);
+
+        PostOffice po;
+        TracingJob client(po, 0);
+        TracingJob zone(po, msg::MSG_ZONETELL);
+
+        Timer timer;
+        for (int round = 0; round < ROUNDS; round++) {
+            for (int i = 0; i < COUNT; i++)
+                client.tell(i);
+
+            po.run();
+            zone.run();
+        }
+        uint64_t elapsed = timer.elapsed();
+
+        cout << "trace period " << period << ": ns/msg = "
+             << (elapsed * 1000 / (uint64_t(COUNT) * ROUNDS))
+             << (zone.handled == COUNT * ROUNDS ? "" : " (lost messages)") << endl;
+    }
+
+    cout << msg::Tracer::report() << endl;
+
+    std::istringstream paths(msg::Tracer::paths());
+    std::string line;
+    for (int i = 0; i < 4 && std::getline(paths, line); i++)
+        cout << line << endl;
+
+    msg::Tracer::setPeriod(0);
+}
+
+
+////////// Post Bridge Test Code //////////
+
+/// Time messages sent in rounds from a client to a zone. With no links the
+/// zone shares the post office of the client, otherwise it has a post office
+/// of its own joined to that of the client by a bridge at each end of the
+/// links. Each round is run until the zone has handled all of it, so with
+/// one message a round this is the latency of a message and with many it is
+/// the cost of each in a stream.
+/// \param near Link for the bridge at the client or null.
+/// \param far Link for the bridge at the zone or null.
+/// \param count Messages sent each round.
+/// \return Nanoseconds per message.
+uint64_t bridgeRounds(std::unique_ptr<BridgeLink> near, std::unique_ptr<BridgeLink> far, int count)
+{
+    static const int MESSAGES = 200000;
+
+    TickClock clock(1);
+    PostOffice nearPo;
+    PostOffice farPo;
+    bool bridged = (near != 0);
+
+    TracingJob client(nearPo, 0);
+    TracingJob zone(bridged ? farPo : nearPo, msg::MSG_ZONETELL);
+    std::unique_ptr<PostBridge> nearBridge;
+    std::unique_ptr<PostBridge> farBridge;
+
+    if (bridged) {
+        nearBridge = std::make_unique<PostBridge>(nearPo, clock, std::move(near), msg::MSG_ZONETELL);
+        farBridge = std::make_unique<PostBridge>(farPo, clock, std::move(far), 0);
+    }
+
+    int rounds = MESSAGES / count;
+
+    Timer timer;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count; i++)
+            client.tell(i);
+
+        nearPo.run();
+
+        if (bridged) {
+            uint64_t expected = uint64_t(round + 1) * count;
+
+            while (farBridge->receivedMessages() < expected) {
+                nearBridge->run();
+                farBridge->run();
+            }
+
+            farPo.run();
+        }
+
+        zone.run();
+    }
+    uint64_t elapsed = timer.elapsed();
+
+    if (zone.handled != rounds * count)
+        cout << "  lost " << (rounds * count - zone.handled) << " messages" << endl;
+
+    return elapsed * 1000 / (uint64_t(rounds) * count);
+}
+
+/// Compare delivering messages within a post office against delivering them
+/// through bridges over a Unix domain socket and over shared memory. Both
+/// post offices are in this process, so this measures what the bridges add
+/// on top of the tick a message may wait for at the far end.
+void postBridge()
+{
+    static const int COUNTS[] = {1, 100};
+
+    for (int count : COUNTS) {
+        cout << count << " message" << (count == 1 ? "" : "s") << " a round:" << endl;
+        cout << "  in process: ns/msg = " << bridgeRounds(0, 0, count) << endl;
+
+        std::unique_ptr<SocketLink> near;
+        std::unique_ptr<SocketLink> far;
+        SocketLink::pair(near, far);
+        cout << "  unix socket: ns/msg = " << bridgeRounds(std::move(near), std::move(far), count) << endl;
+
+        std::string name = "/bridge-test-" + std::to_string(getpid());
+        std::unique_ptr<BridgeLink> created = std::make_unique<ShmLink>(name, true);
+        std::unique_ptr<BridgeLink> opened = std::make_unique<ShmLink>(name, false);
+        cout << "  shared memory: ns/msg = " << bridgeRounds(std::move(created), std::move(opened), count) << endl;
+    }
+}
+
+
+////////// Message Recording Test Code //////////
+
+/// Handler that checks messages are played back in the order they were sent.
+struct ReplayCheck : public virtual msg::MessageHandler {
+    ReplayCheck() : next(0), outOfOrder(0) {}
+
+    virtual void handleZoneTellObjectAll(PlayerID player, ObjectID object, Vector3 pos,
+        Vector3 vel, float rot, ControlState state) {
+        outOfOrder += (object != next);
+        next = object + 1;
+    }
+
+    ObjectID next;
+    int outOfOrder;
+};
+
+/// Record messages sent over a few ticks, then play them back as fast as
+/// possible and as recorded.
+void messageRecording()
+{
+    static const int COUNT = 1000;
+    static const int TICKS = 20;
+
+    std::string path = "/tmp/msgrecord-test-" + std::to_string(getpid());
+
+    {
+        PostOffice po;
+        TracingJob client(po, 0);
+        MessageRecorder recorder(po, path);
+
+        for (int tick = 0; tick < TICKS; tick++) {
+            for (int i = 0; i < COUNT; i++)
+                client.tell(tick * COUNT + i);
+
+            po.run();
+            recorder.run();
+            usleep(10000);
+        }
+
+        cout << "recorded " << recorder.recordedMessages() << " messages" << endl;
+    }
+
+    static const bool FAST[] = {true, false};
+
+    for (bool fast : FAST) {
+        ReplayCheck check;
+        MessageReplay replay(path);
+        replay.play(check, msg::MSG_ZONETELL, fast, []() {});
+
+        cout << (fast ? "fast: " : "as recorded: ") << replay.report() << endl;
+        cout << "  played " << check.next << ", " << check.outOfOrder << " out of order" << endl;
+    }
+
+    unlink(path.c_str());
+}
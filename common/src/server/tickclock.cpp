@@ -0,0 +1,196 @@
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sstream>
+#include <sys/timerfd.h>
+#include <core/core.hpp>
+#include "tickclock.hpp"
+
+
+////////// TickClock //////////
+
+/// Start a clock ticking at a fixed rate.
+/// Tick zero starts when the clock is created and the first tick after that
+/// is one period later.
+/// \param rate Number of ticks per second.
+TickClock::TickClock(unsigned int rate)
+    : _timer(-1), _start(JobPool::now()), _period(1000000 / rate), _tick(0),
+      _terminate(false), _subscribersLock(_subscribers), _totalJitter(0),
+      _maxJitter(0), _measured(0), _overruns(0), _warnings(0)
+{
+    _timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+    if (_timer < 0)
+        throw ErrNoException("timerfd_create failed");
+
+    uint64_t first = startOf(1);
+
+    itimerspec spec;
+    spec.it_value.tv_sec = first / 1000000;
+    spec.it_value.tv_nsec = (first % 1000000) * 1000;
+    spec.it_interval.tv_sec = _period / 1000000;
+    spec.it_interval.tv_nsec = (_period % 1000000) * 1000;
+
+    if (timerfd_settime(_timer, TFD_TIMER_ABSTIME, &spec, 0) != 0) {
+        close(_timer);
+        throw ErrNoException("timerfd_settime failed");
+    }
+
+    pthread_create(&_thread, 0, &threadMain, this);
+}
+
+/// Stop the clock.
+/// This waits for the clock thread to notice, which takes at most one period.
+TickClock::~TickClock()
+{
+    _terminate = true;
+    pthread_join(_thread, 0);
+
+    close(_timer);
+}
+
+/// Wake a job at the start of every tick.
+/// The job must be unsubscribed before it is destroyed.
+/// \param job The job to wake.
+void TickClock::subscribe(Job* job)
+{
+    AutoWriteLock<JobVector>(_subscribersLock)->push_back(job);
+}
+
+/// Stop waking a job every tick.
+/// \param job The job to stop waking.
+void TickClock::unsubscribe(Job* job)
+{
+    AutoWriteLock<JobVector> jobs(_subscribersLock);
+
+    for (JobVector::iterator iter = jobs->begin(); iter != jobs->end(); ++iter) {
+        if (*iter == job) {
+            jobs->erase(iter);
+            break;
+        }
+    }
+}
+
+/// Used to find out the most recent tick.
+/// \return Number of the tick that most recently started.
+TickClock::Tick TickClock::tick() const
+{
+    return _tick.load();
+}
+
+/// Used to find out when a tick starts.
+/// \param tick The tick number.
+/// \return Start time in microseconds on the JobPool::now() clock.
+uint64_t TickClock::startOf(Tick tick) const
+{
+    return _start + tick * _period;
+}
+
+/// Used to find out the time between ticks.
+/// \return Tick period in microseconds.
+uint64_t TickClock::period() const
+{
+    return _period;
+}
+
+/// Used to find out how late ticks start on average.
+/// \return Mean jitter in microseconds.
+uint64_t TickClock::meanJitter() const
+{
+    uint64_t measured = _measured.load();
+
+    return (measured > 0 ? _totalJitter.load() / measured : 0);
+}
+
+/// Used to find out the latest any tick has started.
+/// \return Maximum jitter in microseconds.
+uint64_t TickClock::maxJitter() const
+{
+    return _maxJitter.load();
+}
+
+/// Used to find out how many ticks were skipped because the clock fell behind.
+/// \return Number of skipped ticks.
+unsigned int TickClock::overruns() const
+{
+    return _overruns.load();
+}
+
+/// Main function executed by the clock thread.
+/// The thread asks for realtime scheduling so that it is not held up by busy
+/// workers. This needs privileges the server may not have, in which case the
+/// thread carries on with normal scheduling. Signals are blocked so that 
+/// they are delivered to the main thread.
+/// \param args Pointer to %TickClock object.
+/// \return Always zero.
+void* TickClock::threadMain(void* args)
+{
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+    sched_param param;
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    reinterpret_cast<TickClock*>(args)->runTicks();
+
+    return 0;
+}
+
+/// Wait on the timer and publish each tick until terminated.
+void TickClock::runTicks()
+{
+    while (!_terminate) {
+        uint64_t expirations = 0;
+
+        if (read(_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+
+        publishTick(expirations);
+    }
+}
+
+/// Advance the tick number and wake subscribers.
+/// \param expirations Number of times the timer expired since the last read.
+void TickClock::publishTick(uint64_t expirations)
+{
+    Tick tick = _tick.load() + expirations;
+    _tick = tick;
+
+    if (expirations > 1)
+        _overruns += expirations - 1;
+
+    recordJitter(JobPool::now() - startOf(tick));
+
+    AutoReadLock<JobVector> jobs(_subscribersLock);
+
+    for (auto job : *jobs)
+        job->wake();
+}
+
+/// Record how late a tick started.
+/// A warning is logged when jitter exceeds JITTER_WARNING, but only each time
+/// the number of such ticks doubles so that the log is not flooded.
+/// \param jitter Microseconds between the scheduled and actual tick start.
+void TickClock::recordJitter(uint64_t jitter)
+{
+    _totalJitter += jitter;
+    _measured++;
+
+    if (jitter > _maxJitter.load())
+        _maxJitter = jitter;
+
+    if (jitter <= JITTER_WARNING)
+        return;
+
+    unsigned int warnings = ++_warnings;
+
+    if ((warnings & (warnings - 1)) == 0) {
+        std::ostringstream message;
+        message << "TickClock: tick started " << jitter << "us late ("
+                << warnings << " late ticks so far)";
+        Log::log->warn(message.str());
+    }
+}
@@ -0,0 +1,83 @@
+/// \file tickclock.hpp
+/// \brief Fixed rate clock which drives simulation ticks.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef TICKCLOCK_HPP
+#define TICKCLOCK_HPP
+
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include "lock.hpp"
+#include "concurrency.hpp"
+
+
+/// Source of fixed rate ticks for the whole server.
+/// A %TickClock runs a thread of its own which sleeps on a timerfd set to
+/// expire at the start of every tick. Each time it expires the tick number is
+/// advanced and every subscribed Job is woken, so jobs that do per tick work
+/// can simply return Job::BLOCK until the next tick rather than sleeping on a
+/// worker thread. Tick start times are measured on the same monotonic clock
+/// as JobPool::now() and are fixed multiples of the period, so the tick rate
+/// does not drift with load. If the clock thread falls behind then ticks are
+/// skipped rather than run late. The delay between the scheduled start of a
+/// tick and the clock waking is recorded as jitter.
+class TickClock {
+    public:
+        typedef uint64_t Tick;
+
+        TickClock(unsigned int rate);
+        ~TickClock();
+
+        void subscribe(Job* job);
+        void unsubscribe(Job* job);
+
+        Tick tick() const;
+        uint64_t startOf(Tick tick) const;
+        uint64_t period() const;
+
+        uint64_t meanJitter() const;
+        uint64_t maxJitter() const;
+        unsigned int overruns() const;
+
+    private:
+        TickClock(const TickClock&);             ///< This method is undefined.
+        TickClock& operator=(const TickClock&);  ///< This method is undefined.
+
+        static const uint64_t JITTER_WARNING = 1000;  ///< Microseconds.
+
+        typedef std::vector<Job*> JobVector;
+
+        static void* threadMain(void* args);
+        void runTicks();
+        void publishTick(uint64_t expirations);
+        void recordJitter(uint64_t jitter);
+
+        pthread_t _thread;  ///< Thread waiting on the timer.
+        int _timer;         ///< Timer file descriptor.
+
+        uint64_t _start;   ///< Start time of tick zero.
+        uint64_t _period;  ///< Microseconds between ticks.
+
+        std::atomic<Tick> _tick;         ///< Most recent tick.
+        std::atomic<bool> _terminate;    ///< Indicates whether to stop thread.
+
+        JobVector _subscribers;            ///< Jobs woken every tick.
+        Lock<JobVector> _subscribersLock;  ///< Lock for subscribers.
+
+        std::atomic<uint64_t> _totalJitter;   ///< Sum of jitter over all ticks.
+        std::atomic<uint64_t> _maxJitter;     ///< Largest jitter seen.
+        std::atomic<uint64_t> _measured;      ///< Ticks jitter was recorded for.
+        std::atomic<unsigned int> _overruns;  ///< Ticks that were skipped.
+        unsigned int _warnings;               ///< Jitter warnings counted.
+};
+
+
+#endif  // TICKCLOCK_HPP
@@ -0,0 +1,284 @@
+#include <limits.h>
+#include "timerwheel.hpp"
+
+
+////////// TimerWheel //////////
+
+/// Construct an empty TimerWheel.
+/// \param time The current time in microseconds.
+/// \param resolution Microseconds per tick.
+TimerWheel::TimerWheel(uint64_t time, uint64_t resolution)
+    : _resolution(resolution), _now(time / resolution)
+{
+    for (int i = 0; i < LEVELS; i++) {
+        for (int j = 0; j < SLOTS; j++)
+            _heads[i][j] = -1;
+
+        for (int j = 0; j < WORDS; j++)
+            _occupied[i][j] = 0;
+
+        _counts[i] = 0;
+    }
+}
+
+/// Add a timer.
+/// A timer whose time has already passed fires on the next advance().
+/// \param time Time at which to fire in microseconds.
+/// \param callback Function to call when the timer fires.
+/// \return Id that can be used to cancel the timer.
+TimerWheel::Id TimerWheel::schedule(uint64_t time, Callback callback)
+{
+    int32_t index = 0;
+
+    if (_free.empty()) {
+        index = _nodes.size();
+        _nodes.push_back(Node());
+    } else {
+        index = _free.back();
+        _free.pop_back();
+    }
+
+    Node& node = _nodes[index];
+    node.expiry = time / _resolution + (time % _resolution != 0 ? 1 : 0);
+    node.callback = std::move(callback);
+
+    if (node.expiry <= _now)
+        node.expiry = _now + 1;
+
+    place(index);
+
+    return (uint64_t(node.generation) << 32) | uint64_t(index + 1);
+}
+
+/// Remove a timer before it fires.
+/// \param id Id of the timer.
+/// \return Whether the timer was pending. If not it has already fired.
+bool TimerWheel::cancel(Id id)
+{
+    int64_t index = int64_t(id & 0xffffffff) - 1;
+
+    if ((index < 0) || (index >= int64_t(_nodes.size())))
+        return false;
+
+    Node& node = _nodes[index];
+
+    if (!node.linked || (node.generation != (id >> 32)))
+        return false;
+
+    unlink(index);
+    release(index);
+
+    return true;
+}
+
+/// Fire every timer due by the given time.
+/// Stretches of time in which the lower wheels are empty are skipped rather
+/// than stepped through tick by tick, so advancing after a long idle period
+/// is cheap. Each callback is removed before it is called, so callbacks may
+/// schedule and cancel timers.
+/// \param time The current time in microseconds.
+void TimerWheel::advance(uint64_t time)
+{
+    uint64_t target = time / _resolution;
+
+    while (_now < target) {
+        int empty = 0;
+        while ((empty < LEVELS) && (_counts[empty] == 0))
+            empty++;
+
+        if (empty == LEVELS) {
+            _now = target;
+            break;
+        }
+
+        if (empty > 0) {
+            // Nothing can fire before the next slot of the lowest occupied
+            // wheel begins.
+            uint64_t boundary = _now | ((uint64_t(1) << (SLOT_BITS * empty)) - 1);
+
+            if (boundary >= target) {
+                _now = target;
+                break;
+            }
+
+            _now = boundary;
+        }
+
+        _now++;
+
+        int levels = 1;
+        while ((levels < LEVELS) &&
+               (((_now >> (SLOT_BITS * (levels - 1))) & (SLOTS - 1)) == 0))
+            levels++;
+
+        for (int level = levels - 1; level > 0; level--)
+            cascade(level);
+
+        fire(_now & (SLOTS - 1));
+    }
+}
+
+/// Used to find out when the next timer may fire.
+/// This is exact when the timer is in the lowest wheel. Otherwise it is the
+/// time its slot is next moved down, which is no later than its expiry.
+/// \return Time in microseconds or NEVER if there are no timers.
+uint64_t TimerWheel::nextExpiry() const
+{
+    for (int level = 0; level < LEVELS; level++) {
+        if (_counts[level] == 0)
+            continue;
+
+        int shift = SLOT_BITS * level;
+        uint64_t tick = ((_now >> shift) + distance(level)) << shift;
+
+        return tick * _resolution;
+    }
+
+    return NEVER;
+}
+
+/// Used to find out how many timers are pending.
+/// \return Number of timers.
+size_t TimerWheel::size() const
+{
+    return _nodes.size() - _free.size();
+}
+
+/// Put a node in the slot for its expiry.
+/// \param index Index of the node.
+void TimerWheel::place(int32_t index)
+{
+    uint64_t expiry = _nodes[index].expiry;
+    uint64_t delta = expiry - _now;
+    int level = 0;
+
+    while ((level < LEVELS - 1) && (delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))))
+        level++;
+
+    uint64_t span = uint64_t(1) << (SLOT_BITS * LEVELS);
+    if (delta >= span)
+        expiry = _now + span - 1;
+
+    link(index, level, (expiry >> (SLOT_BITS * level)) & (SLOTS - 1));
+}
+
+/// Add a node to the front of a slot.
+/// \param index Index of the node.
+/// \param level The wheel.
+/// \param slot The slot in the wheel.
+void TimerWheel::link(int32_t index, int level, int slot)
+{
+    Node& node = _nodes[index];
+    int32_t& head = _heads[level][slot];
+
+    node.prev = -1;
+    node.next = head;
+    node.level = level;
+    node.slot = slot;
+    node.linked = true;
+
+    if (head >= 0)
+        _nodes[head].prev = index;
+
+    head = index;
+    _occupied[level][slot / 64] |= uint64_t(1) << (slot % 64);
+    _counts[level]++;
+}
+
+/// Remove a node from its slot.
+/// \param index Index of the node.
+void TimerWheel::unlink(int32_t index)
+{
+    Node& node = _nodes[index];
+
+    if (node.prev >= 0) {
+        _nodes[node.prev].next = node.next;
+    } else {
+        _heads[node.level][node.slot] = node.next;
+    }
+
+    if (node.next >= 0)
+        _nodes[node.next].prev = node.prev;
+
+    if (_heads[node.level][node.slot] < 0)
+        _occupied[node.level][node.slot / 64] &= ~(uint64_t(1) << (node.slot % 64));
+
+    node.linked = false;
+    _counts[node.level]--;
+}
+
+/// Return an unlinked node to the pool.
+/// \param index Index of the node.
+void TimerWheel::release(int32_t index)
+{
+    Node& node = _nodes[index];
+
+    node.callback = Callback();
+    node.generation++;
+
+    _free.push_back(index);
+}
+
+/// Move the nodes in the current slot of a wheel down to lower wheels.
+/// \param level The wheel.
+void TimerWheel::cascade(int level)
+{
+    int slot = (_now >> (SLOT_BITS * level)) & (SLOTS - 1);
+    int32_t index = -1;
+
+    while ((index = _heads[level][slot]) >= 0) {
+        unlink(index);
+        place(index);
+    }
+}
+
+/// Fire every node in a slot of the lowest wheel.
+/// \param slot The slot.
+void TimerWheel::fire(int slot)
+{
+    int32_t index = -1;
+
+    while ((index = _heads[0][slot]) >= 0) {
+        unlink(index);
+
+        Callback callback = std::move(_nodes[index].callback);
+        release(index);
+
+        callback();
+    }
+}
+
+/// Find how far ahead the next occupied slot of a wheel is.
+/// The current slot is counted as a full turn away, since any nodes in it
+/// are not reached until the wheel comes round again.
+/// \param level The wheel, which must hold at least one node.
+/// \return Number of slots from the current slot, between 1 and SLOTS.
+int TimerWheel::distance(int level) const
+{
+    int current = (_now >> (SLOT_BITS * level)) & (SLOTS - 1);
+
+    for (int i = 1; i <= SLOTS; i++) {
+        int slot = (current + i) & (SLOTS - 1);
+        uint64_t word = _occupied[level][slot / 64] >> (slot % 64);
+
+        if (word == 0) {
+            // Skip the rest of this word.
+            i += 63 - (slot % 64);
+            continue;
+        }
+
+        return i + __builtin_ctzll(word);
+    }
+
+    return SLOTS;
+}
+
+
+////////// TimerWheel::Node //////////
+
+/// Construct a free Node.
+TimerWheel::Node::Node()
+    : expiry(0), generation(1), prev(-1), next(-1), level(0), slot(0), linked(false)
+{
+
+}
@@ -0,0 +1,91 @@
+/// \file timerwheel.hpp
+/// \brief Hierarchical timer wheel.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+
+#include <vector>
+#include <stdint.h>
+#include <functional>
+
+
+/// Holds timers that run a callback once they expire.
+/// Time is divided into ticks of a fixed resolution and timers are kept in
+/// LEVELS wheels of SLOTS slots each. The lowest wheel has a slot per tick,
+/// and each wheel above it has slots SLOTS times as long as the wheel below.
+/// A timer is put in the lowest wheel whose span covers its expiry. As time
+/// advances past the start of a slot in a higher wheel the timers in that
+/// slot are moved down, so every timer is moved at most LEVELS times. This
+/// makes scheduling and cancelling O(1) however many timers are pending.
+/// Timers are stored in a pool of nodes linked by index, and ids carry a
+/// generation so that a stale id cannot cancel a reused node.
+///
+/// Expiry times are rounded up to a whole tick, so a timer never fires early
+/// but may fire up to one tick late. With the default resolution of a
+/// millisecond the wheels span about 49 days. Timers further away than that
+/// are held at the far end of the top wheel until they come into range. A
+/// %TimerWheel is not thread safe so its owner must lock it.
+class TimerWheel {
+    public:
+        typedef uint64_t Id;                     ///< Zero is never used.
+        typedef std::function<void()> Callback;
+
+        static const uint64_t NEVER = UINT64_MAX;  ///< No timer is pending.
+
+        TimerWheel(uint64_t time, uint64_t resolution = 1000);
+
+        Id schedule(uint64_t time, Callback callback);
+        bool cancel(Id id);
+        void advance(uint64_t time);
+
+        uint64_t nextExpiry() const;
+        size_t size() const;
+
+    private:
+        static const int LEVELS = 4;           ///< Number of wheels.
+        static const int SLOT_BITS = 8;        ///< Log2 of slots per wheel.
+        static const int SLOTS = 1 << SLOT_BITS;
+        static const int WORDS = SLOTS / 64;   ///< Words in each occupancy map.
+
+        /// A pending timer, or a free node if not linked.
+        struct Node {
+            Node();
+
+            uint64_t expiry;      ///< Tick at which to fire.
+            Callback callback;    ///< Function to call when fired.
+            uint32_t generation;  ///< Changed each time the node is freed.
+            int32_t prev;         ///< Previous node in slot or -1.
+            int32_t next;         ///< Next node in slot or -1.
+            uint8_t level;        ///< Wheel holding the node.
+            uint8_t slot;         ///< Slot holding the node.
+            bool linked;          ///< Whether the node is in a slot.
+        };
+
+        void place(int32_t index);
+        void link(int32_t index, int level, int slot);
+        void unlink(int32_t index);
+        void release(int32_t index);
+        void cascade(int level);
+        void fire(int slot);
+        int distance(int level) const;
+
+        uint64_t _resolution;  ///< Microseconds per tick.
+        uint64_t _now;         ///< Last tick processed.
+
+        std::vector<Node> _nodes;     ///< Timer storage.
+        std::vector<int32_t> _free;   ///< Unused nodes.
+
+        int32_t _heads[LEVELS][SLOTS];       ///< First node in each slot.
+        uint64_t _occupied[LEVELS][WORDS];   ///< Which slots hold nodes.
+        size_t _counts[LEVELS];              ///< Nodes held by each wheel.
+};
+
+
+#endif  // TIMERWHEEL_HPP
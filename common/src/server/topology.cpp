@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <core/core.hpp>
+#include "topology.hpp"
+
+
+////////// Topology //////////
+
+/// Read the layout of the machine.
+Topology::Topology()
+{
+    std::string online;
+
+    if (readFile("/sys/devices/system/node/online", online)) {
+        for (int node : parseCpuList(online)) {
+            std::ostringstream path;
+            path << "/sys/devices/system/node/node" << node << "/cpulist";
+
+            std::string list;
+            if (!readFile(path.str(), list))
+                continue;
+
+            if (int(_nodes.size()) <= node)
+                _nodes.resize(node + 1);
+
+            _nodes[node] = parseCpuList(list);
+        }
+    }
+
+    if (!_nodes.empty())
+        return;
+
+    _nodes.resize(1);
+
+    if (readFile("/sys/devices/system/cpu/online", online)) {
+        _nodes[0] = parseCpuList(online);
+    } else {
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN); cpu++)
+            _nodes[0].push_back(cpu);
+    }
+}
+
+/// Used to find out how many nodes there are.
+/// Node numbers may have gaps, in which case the missing nodes have no CPUs.
+/// \return One more than the highest node number.
+int Topology::nodes() const
+{
+    return _nodes.size();
+}
+
+/// Used to find out which CPUs belong to a node.
+/// \param node The node number.
+/// \return The CPUs of the node.
+const Topology::CpuList& Topology::cpus(int node) const
+{
+    return _nodes.at(node);
+}
+
+/// Used to find out every CPU of the machine.
+/// \return The CPUs of all nodes in node order.
+Topology::CpuList Topology::allCpus() const
+{
+    CpuList all;
+
+    for (auto& node : _nodes)
+        all.insert(all.end(), node.begin(), node.end());
+
+    return all;
+}
+
+/// Used to find out which node a CPU belongs to.
+/// \param cpu The CPU number.
+/// \return The node number or zero if the CPU is unknown.
+int Topology::nodeOf(int cpu) const
+{
+    for (size_t node = 0; node < _nodes.size(); node++) {
+        for (int member : _nodes[node]) {
+            if (member == cpu)
+                return node;
+        }
+    }
+
+    return 0;
+}
+
+/// Parse a list of CPUs in the kernel format, such as "0-3,8-11".
+/// \param list The list to parse.
+/// \return The CPUs in the order given.
+Topology::CpuList Topology::parseCpuList(const std::string& list)
+{
+    CpuList cpus;
+    std::istringstream stream(list);
+    std::string item;
+
+    while (std::getline(stream, item, ',')) {
+        if (item.find_first_not_of(" \t\n") == std::string::npos)
+            continue;
+
+        char* end = 0;
+        long first = strtol(item.c_str(), &end, 10);
+        long last = first;
+
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+
+        if ((*end != '\0' && *end != '\n') || (first < 0) || (last < first) ||
+            (last >= CPU_SETSIZE))
+            throw InputException("invalid cpu list: " + list);
+
+        for (long cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+/// Restrict a thread to run only on the given CPUs.
+/// \param thread The thread to pin.
+/// \param cpus The CPUs it may run on.
+void Topology::pinThread(pthread_t thread, const CpuList& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    int error = pthread_setaffinity_np(thread, sizeof(set), &set);
+
+    if (error != 0) {
+        errno = error;
+        throw ErrNoException("pthread_setaffinity_np failed");
+    }
+}
+
+/// Read the whole of a small file.
+/// \param path Path of the file.
+/// \param contents String to hold the contents.
+/// \return Whether the file could be read.
+bool Topology::readFile(const std::string& path, std::string& contents)
+{
+    std::ifstream file(path.c_str());
+
+    if (!file)
+        return false;
+
+    std::getline(file, contents);
+
+    return !file.bad();
+}
+
+
+////////// PreferNode //////////
+
+/// Prefer memory from a node for allocations by the calling thread.
+/// Failure is not an error, since the memory is still usable wherever it is.
+/// \param node The node number or -1 to leave the policy alone.
+PreferNode::PreferNode(int node)
+    : _set(false)
+{
+    const int bits = sizeof(unsigned long) * CHAR_BIT;
+
+    if ((node < 0) || (node >= bits))
+        return;
+
+    unsigned long mask = 1ul << node;
+
+    // The kernel ignores the last bit of the mask so one more is given.
+    _set = (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, bits + 1) == 0);
+}
+
+/// Restore the default memory policy.
+PreferNode::~PreferNode()
+{
+    if (_set)
+        syscall(SYS_set_mempolicy, MPOL_DEFAULT, 0, 0);
+}
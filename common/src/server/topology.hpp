@@ -0,0 +1,64 @@
+/// \file topology.hpp
+/// \brief Processor and memory layout of the machine.
+/// \author Ben Radford
+/// \date 17th October 2026
+///
+/// Copyright (c) 2026 Ben Radford.
+///
+
+
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+/// Describes which CPUs belong to which NUMA node.
+/// The layout is read from /sys when the %Topology is constructed. A machine
+/// without NUMA support, or one where /sys cannot be read, is treated as a
+/// single node holding every online CPU. CPU lists use the kernel format of
+/// comma separated numbers and ranges, for example "0-3,8-11".
+class Topology {
+    public:
+        typedef std::vector<int> CpuList;
+
+        Topology();
+
+        int nodes() const;
+        const CpuList& cpus(int node) const;
+        CpuList allCpus() const;
+        int nodeOf(int cpu) const;
+
+        static CpuList parseCpuList(const std::string& list);
+        static void pinThread(pthread_t thread, const CpuList& cpus);
+
+    private:
+        static bool readFile(const std::string& path, std::string& contents);
+
+        std::vector<CpuList> _nodes;  ///< CPUs of each node.
+};
+
+
+/// Makes the calling thread prefer memory on one NUMA node while in scope.
+/// Pages first touched by the thread are taken from the node while it has
+/// free memory, and from any other node after that. Data allocated in the
+/// scope therefore lives beside the CPUs that will use it. The previous
+/// policy is the system default, which is restored on destruction. A
+/// negative node leaves the policy alone.
+class PreferNode {
+    public:
+        PreferNode(int node);
+        ~PreferNode();
+
+    private:
+        PreferNode(const PreferNode&);             ///< This method is undefined.
+        PreferNode& operator=(const PreferNode&);  ///< This method is undefined.
+
+        bool _set;  ///< Whether the policy was changed.
+};
+
+
+#endif  // TOPOLOGY_HPP
@@ -3,6 +3,7 @@
 
 
 #include <string>
+#include <vector>
 #include <stdint.h>
 #include <net/net.hpp>
 #include <math/vecmath.hpp>
@@ -14,6 +15,7 @@ using sim::ObjectID;
 using sim::ControlState;
 typedef uint32_t ZoneID;
 typedef uint64_t PlayerID;
+typedef std::vector<ObjectID> ObjectList;
 
 
 typedef char MD5Hash;
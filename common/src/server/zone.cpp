@@ -15,66 +15,123 @@ using namespace msg;
 using namespace sim;
 
 
-Zone::Zone(PostOffice& po) :
+Zone::Zone(PostOffice& po, TickClock& clock, int node) :
     MessagableJob(po, MSG_ZONETELL | MSG_PLAYER),
     _quadTree(vol::AABB(Vector3(-500.0f, -500.0f, -10.0f), Vector3(500.0f, 500.0f, 10.0f))),
     _physicsSystem(vol::AABB(Vector3(-500.0f, -500.0f, -10.0f), Vector3(500.0f, 500.0f, 10.0f)), "common/data/maps/base03.dat"),
     _nextObjectID(1),
-    _thisZone(1)
+    _thisZone(1),
+    _node(node),
+    _clock(clock),
+    _lastTick(clock.tick()),
+    _nextUpdate(0)
 {
     Log::log->info("creating zone");
+    registerKey(MSG_PLAYER, _thisZone);
+    _physicsSystem.setParallelRunner(this);
+    _clock.subscribe(this);
 }
 
 Zone::~Zone()
 {
+    _clock.unsubscribe(this);
     Log::log->info("freeing zone");
 }
 
-struct SendCloseMsg {
-    SendCloseMsg(ObjectID id, MessageSender sender) :
-        sendMessage(sender), objectID(id) {}
+struct CollectCloseObjects {
+    CollectCloseObjects(ObjectID id, std::vector<ObjectID>& list) :
+        closeObjects(list), objectID(id) {}
     void visit(const sim::MovableObject* object) {
         if (objectID != object->getID())
-            sendMessage(msg::ZoneSaysObjectsClose(objectID, object->getID()));
+            closeObjects.push_back(object->getID());
     }
-    MessageSender sendMessage;
+    std::vector<ObjectID>& closeObjects;
     ObjectID objectID;
 };
 
 Zone::RetType Zone::main()
 {
-    bool sendUpdates = (_timer.elapsed() > 500000);
+    // Messages may wake the zone between ticks.
+    TickClock::Tick tick = _clock.tick();
+    if (tick == _lastTick)
+        return BLOCK;
+
+    uint64_t elapsed = _clock.startOf(tick) - _clock.startOf(_lastTick);
+    _lastTick = tick;
+
+    // Nothing to simulate until a player enters.
+    if (_objectIdMap.empty()) 
+        return BLOCK;
+
+    // Full updates are sent every UPDATE_PERIOD, measured in tick start times
+    // so that no clock needs to be read.
+    bool sendUpdates = (_clock.startOf(tick) >= _nextUpdate);
     if (sendUpdates)
-        _timer.reset();
+        _nextUpdate = _clock.startOf(tick) + UPDATE_PERIOD;
 
-    for (auto& pair : _objectIdMap) {
-        ObjectID objectID = pair.first;
-        //MovableObject* object = pair.second;
+    _objects.clear();
+    for (auto& pair : _objectIdMap)
+        _objects.push_back(pair.second);
 
-        sendMessage(msg::ZoneSaysObjectClearClose(objectID));
+    _closeObjects.resize(_objects.size());
 
-        Vector3 offset(150.0f, 150.0f, 0.0f);
-        //const Vector3& pos = object->getPosition();
-        SendCloseMsg visitor(objectID, newMessageSender());
-        _quadTree.process(visitor/*, vol::AABB(pos - offset, pos + offset)*/);
-    }
+    // Find close objects and apply controls for each object in parallel.
+    // Neither moves any object so the quad tree can be shared.
+    parallelFor(0, _objects.size(), OBJECT_GRAIN, [this](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            MovableObject* object = _objects[i];
+
+            _closeObjects[i].clear();
+            CollectCloseObjects visitor(object->getID(), _closeObjects[i]);
+            _quadTree.process(visitor);
 
-    for (auto& pair : _objectIdMap) {
-        ObjectID objectID = pair.first;
-        MovableObject* object = pair.second;
+            object->update();
+        }
+    });
 
-        object->update();
+    // The outbox has a single writer so messages are sent afterwards, all in
+    // one batch.
+    std::unique_ptr<msg::Batch> batch(new msg::Batch);
+
+    for (size_t i = 0; i < _objects.size(); i++) {
+        MovableObject* object = _objects[i];
+        ObjectID objectID = object->getID();
+
+        batch->addZoneSaysObjectNeighbours(objectID, _closeObjects[i]);
 
         if (sendUpdates) {
-            sendMessage(msg::ZoneSaysObjectAll(objectID, 
+            batch->addZoneSaysObjectAll(objectID, 
                 object->getPosition(), object->getVelocity(), 
-                object->getRotation(), object->getControlState()));
+                object->getRotation(), object->getControlState());
         }
     }
 
-    _physicsSystem.accumulateAndIntegrate();
+    sendMessage(std::move(batch));
+
+    _physicsSystem.accumulateAndIntegrate(elapsed);
+
+    return BLOCK;
+}
 
-    return YIELD;
+Job::Priority Zone::priority()
+{
+    return REALTIME;
+}
+
+uint64_t Zone::deadline()
+{
+    return TICK_DEADLINE;
+}
+
+int Zone::node()
+{
+    return _node;
+}
+
+void Zone::parallelFor(size_t begin, size_t end, size_t grain, 
+    const ParallelRunner::RangeFunc& func)
+{
+    MessagableJob::parallelFor(begin, end, grain, func);
 }
 
 void Zone::handlePlayerEnterZone(PlayerID player, ZoneID zone)
@@ -92,6 +149,7 @@ void Zone::handlePlayerEnterZone(PlayerID player, ZoneID zone)
 
     _playerIdMap.insert(std::make_pair(player, objectID));
     _quadTree.insert(object);
+    registerKey(MSG_ZONETELL, player);
 
     sendMessage(msg::ZoneSaysObjectAttach(objectID, player));
 
@@ -123,6 +181,7 @@ void Zone::handlePlayerLeaveZone(PlayerID player, ZoneID zone)
     }
 
     _playerIdMap.erase(playerIter);
+    deregisterKey(MSG_ZONETELL, player);
 
     Log::log->debug("player leaves zone");
 }
@@ -12,11 +12,12 @@
 
 
 #include <physics/sim.hpp>
-#include <core/timer.hpp>
 #include "msgjob.hpp"
+#include "tickclock.hpp"
 #include <physics/quadtree.hpp>
 #include "typedefs.hpp"
 #include <tr1/unordered_map>
+#include <vector>
 #include <physics/object.hpp>
 
 
@@ -36,9 +37,9 @@ class ZoneLoader : public MessagableJob {
 
 };
 
-class Zone : public MessagableJob {
+class Zone : public MessagableJob, private ParallelRunner {
     public:
-        Zone(PostOffice& po);
+        Zone(PostOffice& po, TickClock& clock, int node = -1);
         virtual ~Zone();
 
         virtual RetType main();
@@ -46,6 +47,18 @@ class Zone : public MessagableJob {
     private:
         typedef std::tr1::unordered_map<ObjectID, sim::MovableObject*> ObjectMap;
         typedef std::tr1::unordered_map<PlayerID, ObjectID> PlayerMap;
+        typedef std::vector<sim::MovableObject*> ObjectVector;
+
+        static const uint64_t TICK_DEADLINE = 5000;  ///< Microseconds.
+        static const uint64_t UPDATE_PERIOD = 500000;  ///< Microseconds.
+        static const int OBJECT_GRAIN = 32;
+
+        virtual Priority priority();
+        virtual uint64_t deadline();
+        virtual int node();
+
+        virtual void parallelFor(size_t begin, size_t end, size_t grain, 
+            const ParallelRunner::RangeFunc& func);
 
         virtual void handlePlayerEnterZone(PlayerID player, ZoneID zone);
         virtual void handlePlayerLeaveZone(PlayerID player, ZoneID zone);
@@ -62,10 +75,16 @@ class Zone : public MessagableJob {
         ObjectMap _objectIdMap;
         PlayerMap _playerIdMap;
 
+        ObjectVector _objects;
+        std::vector<ObjectList> _closeObjects;
+
         ObjectID _nextObjectID;
         ZoneID _thisZone;
+        int _node;
 
-        Timer _timer;
+        TickClock& _clock;
+        TickClock::Tick _lastTick;
+        uint64_t _nextUpdate;
 };
 
 
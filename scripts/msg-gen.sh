@@ -10,9 +10,11 @@ HANDLERHDR="msghandler.hpp"
 HANDLERSRC="msghandler.cpp"
 MSGDESC="Auto-generated message definitions."
 HANDLERDESC="Auto-generated message handler."
-SEDMSGTYPE="s/^\(.*\)(.*)$/\1/;s/^\([[:alnum:]]*\)_.*$/\1/"
-SEDMSGNAME="s/^\(.*\)(.*)$/\1/;s/_//g"
-SEDARGLIST="s/^.*(\(.*\))$/\1/"
+SEDMSGTYPE="s/^\([^(]*\)(.*$/\1/;s/^\([[:alnum:]]*\)_.*$/\1/"
+SEDMSGNAME="s/^\([^(]*\)(.*$/\1/;s/_//g"
+SEDARGLIST="s/^[^(]*(\(.*\)).*$/\1/"
+SEDROUTE="s/^.*\[route=\([[:alnum:]]*\)\].*$/\1/p"
+SEDSTATE="s/^.*\[state=\([[:alnum:]]*\)\].*$/\1/p"
 . scripts/code-gen.inc
 
 # Write message types.
@@ -32,10 +34,35 @@ function write-message-types() {
     while read MSG <&3; do
         MSGNAME=`echo $MSG | sed "$SEDMSGNAME"`
         echo $MSG | sed "$SEDMSGTYPE" | tr [a-z] [A-Z]
-    done | sort -u |
-    while read MSGTYPE; do
-        printf "    MSG_%-${MAXWIDTH}s = 0x%04x,\n" $MSGTYPE $FLAGVALUE
-        FLAGVALUE=$(($FLAGVALUE * 2))
+    done | sort -u | {
+        while read MSGTYPE; do
+            printf "    MSG_%-${MAXWIDTH}s = 0x%04x,\n" $MSGTYPE $FLAGVALUE
+            FLAGVALUE=$(($FLAGVALUE * 2))
+        done
+        printf "    MSG_%-${MAXWIDTH}s = 0x%04x,\n" ALL $(($FLAGVALUE - 1))
+    }
+    echo "};"
+}
+
+# Write message ids.
+function write-message-ids() {
+    exec 1>&4 3<&- 3<>$SPEC
+    echo "enum MsgId {"
+    MAXWIDTH="5"
+    while read MSG <&3; do
+        MSGNAME=`echo $MSG | sed "$SEDMSGNAME"`
+        if [ ${#MSGNAME} -gt $MAXWIDTH ]; then
+            MAXWIDTH=${#MSGNAME}
+        fi
+    done
+    printf "    ID_%-${MAXWIDTH}s = %d,\n" BATCH 0
+    printf "    ID_%-${MAXWIDTH}s = %d,\n" LATEST 1
+    IDVALUE="2"
+    exec 3<&- 3<>$SPEC
+    while read MSG <&3; do
+        MSGID=`echo $MSG | sed "$SEDMSGNAME" | tr [a-z] [A-Z]`
+        printf "    ID_%-${MAXWIDTH}s = %d,\n" $MSGID $IDVALUE
+        IDVALUE=$(($IDVALUE + 1))
     done
     echo "};"
 }
@@ -50,8 +77,11 @@ rm $MSGHDR $MSGSRC $HANDLERHDR $HANDLERSRC
 exec 4<>$MSGHDR 1>&4
 file-comments "$MSGHDR" "$MSGDESC"
 open-header-guard "$MSGHDR"
+echo "#include <new>"
+echo "#include <atomic>"
 echo "#include <memory>"
 echo "#include \"typedefs.hpp\""
+echo "#include \"msgcodec.hpp\""
 echo
 echo
 echo "namespace msg {"
@@ -63,15 +93,42 @@ echo
 write-message-types
 echo
 echo
+write-message-ids
+echo
+echo
+echo "struct Trace;"
+echo
+echo "const char* idName(MsgId id);"
+echo
+echo
 echo "class Message {"
 echo "    public:"
+echo "        static void* operator new(size_t size);"
+echo "        static void operator delete(void* p, size_t size);"
+echo "        static void operator delete(Message* p, std::destroying_delete_t, size_t size);"
+echo
+echo "        Message();"
+echo "        Message(const Message& other);"
+echo "        Message& operator=(const Message& other);"
 echo "        virtual ~Message();"
 echo "        virtual std::unique_ptr<Message> clone() const = 0;"
-echo "        virtual void dispatch(MessageHandler& handler) = 0;"
-echo "        virtual bool matches(int subscription) = 0;"
+echo "        virtual void dispatch(MessageHandler& handler) const = 0;"
+echo "        virtual bool matches(int subscription) const = 0;"
+echo "        virtual int type() const = 0;"
+echo "        virtual MsgId id() const = 0;"
+echo "        virtual void encode(Writer& writer) const = 0;"
+echo "        virtual bool keyed() const = 0;"
+echo "        virtual uint64_t key() const = 0;"
+echo "        virtual bool coalesces() const = 0;"
+echo "        virtual uint64_t stateKey() const = 0;"
+echo
+echo "        void share(unsigned int readers) const;"
+echo "        Trace* trace() const;"
+echo "        void setTrace(Trace* trace) const;"
 echo
 echo "    private:"
-echo
+echo "        mutable std::atomic<unsigned int> _owners;"
+echo "        mutable Trace* _trace;"
 echo "};"
 echo
 echo
@@ -81,13 +138,66 @@ exec 5<>$MSGSRC 1>&5
 file-comments "$MSGSRC" "$MSGDESC"
 echo "#include \"$MSGHDR\""
 echo "#include \"$HANDLERHDR\""
+echo "#include \"msgpool.hpp\""
+echo "#include \"msgtrace.hpp\""
 echo
 echo
 echo "////////// msg::Message //////////"
 echo
+echo "void* msg::Message::operator new(size_t size)"
+echo "{"
+echo "    return MessagePool::allocate(size);"
+echo "}"
+echo
+echo "void msg::Message::operator delete(void* p, size_t size)"
+echo "{"
+echo "    MessagePool::release(p, size);"
+echo "}"
+echo
+echo "void msg::Message::operator delete(Message* p, std::destroying_delete_t, size_t size)"
+echo "{"
+echo "    if (p->_owners.fetch_sub(1, std::memory_order_acq_rel) != 1)"
+echo "        return;"
+echo
+echo "    p->~Message();"
+echo "    MessagePool::release(p, size);"
+echo "}"
+echo
+echo "msg::Message::Message()"
+echo "    : _owners(1), _trace(0)"
+echo "{"
+echo
+echo "}"
+echo
+echo "msg::Message::Message(const Message& other)"
+echo "    : _owners(1), _trace(0)"
+echo "{"
+echo
+echo "}"
+echo
+echo "msg::Message& msg::Message::operator=(const Message& other)"
+echo "{"
+echo "    return *this;"
+echo "}"
+echo
 echo "msg::Message::~Message()"
 echo "{"
+echo "    delete _trace;"
+echo "}"
 echo
+echo "void msg::Message::share(unsigned int readers) const"
+echo "{"
+echo "    _owners.fetch_add(readers, std::memory_order_relaxed);"
+echo "}"
+echo
+echo "msg::Trace* msg::Message::trace() const"
+echo "{"
+echo "    return _trace;"
+echo "}"
+echo
+echo "void msg::Message::setTrace(Trace* trace) const"
+echo "{"
+echo "    _trace = trace;"
 echo "}"
 echo
 echo
@@ -127,8 +237,54 @@ while read MSG <&3; do
     ARGLIST=`echo $MSG | sed "$SEDARGLIST"`
     ARGS=`echo $ARGLIST | sed 's/, /\n/g;s/&//g'`
     MSGTYPE=`echo $MSG | sed "$SEDMSGTYPE" | tr [a-z] [A-Z]`
+    MSGID=`echo $MSGNAME | tr [a-z] [A-Z]`
+    ROUTE=`echo $MSG | sed -n "$SEDROUTE"`
+    STATE=`echo $MSG | sed -n "$SEDSTATE"`
     MSG="$MSGNAME($ARGLIST)"
 
+    # Batch methods, written once all messages are done.
+    ISSTATE=`[ -n "$STATE" ] && echo true || echo false`
+    BATCHDECLS="$BATCHDECLS        void add$MSG;\n"
+    BATCHTYPES="$BATCHTYPES        case ID_$MSGID:\n            return MSG_$MSGTYPE;\n"
+    IDNAMES="$IDNAMES        case ID_$MSGID:\n            return \"$MSGNAME\";\n"
+    BATCHADDS="$BATCHADDS`
+        echo "void msg::Batch::add$MSG"
+        echo "{"
+        echo "    size_t start = begin(ID_$MSGID, MSG_$MSGTYPE, $ISSTATE);"
+        echo "    Writer writer(_buffer);"
+        echo -e "$ARGS" | while read ARG; do
+            echo $ARG | sed 's/^\(.*\) \(.*\)$/    writer.write(\2);/'
+        done
+        echo "    end(start);"
+        echo "}"
+    `\n\n"
+    BATCHCASES="$BATCHCASES`
+        echo "            case ID_$MSGID: {"
+        echo -e "$ARGS" | while read ARG; do
+            echo $ARG | sed 's/^\(const \)\{0,1\}\(.*\) \(.*\)$/                \2 \3 = reader.read<\2>();/'
+        done
+        echo -n "                handler.handle$MSGNAME("
+        echo -e "$ARGS" | while read ARG; do
+            echo -n $ARG | sed 's/^\(.*\) \(.*\)$/\2, /'
+        done | sed 's/\(.*\), $/\1/'
+        echo ");"
+        echo "                break;"
+        echo "            }"
+    `\n"
+
+    DECODECASES="$DECODECASES`
+        echo "        case ID_$MSGID: {"
+        echo -e "$ARGS" | while read ARG; do
+            echo $ARG | sed 's/^\(const \)\{0,1\}\(.*\) \(.*\)$/            \2 \3 = reader.read<\2>();/'
+        done
+        echo -n "            return std::unique_ptr<Message>(new $MSGNAME("
+        echo -e "$ARGS" | while read ARG; do
+            echo -n $ARG | sed 's/^\(.*\) \(.*\)$/\2, /'
+        done | sed 's/\(.*\), $/\1/'
+        echo "));"
+        echo "        }"
+    `\n"
+
     # Message header.
     exec 1>&4
     echo "class $MSGNAME : public Message {"
@@ -136,8 +292,21 @@ while read MSG <&3; do
     echo "        $MSG;"
     echo "        virtual ~$MSGNAME();"
     echo "        virtual std::unique_ptr<Message> clone() const;"
-    echo "        virtual void dispatch(MessageHandler& handler);"
-    echo "        virtual bool matches(int subscription);"
+    echo "        virtual void dispatch(MessageHandler& handler) const;"
+    echo "        virtual bool matches(int subscription) const;"
+    echo "        virtual int type() const;"
+    echo "        virtual MsgId id() const;"
+    echo "        virtual void encode(Writer& writer) const;"
+    echo "        virtual bool keyed() const;"
+    echo "        virtual uint64_t key() const;"
+    echo "        virtual bool coalesces() const;"
+    echo "        virtual uint64_t stateKey() const;"
+    echo
+    echo -e "$ARGS" |
+    while read ARG; do
+        echo $ARG |
+        sed 's/^\(const \)\{0,1\}\(.*\) \(.*\)$/        const \2\& \3() const;/'
+    done
     echo
     echo "    private:"
     echo -e "$ARGS" |
@@ -173,7 +342,7 @@ while read MSG <&3; do
     echo "    return std::unique_ptr<Message>(new $MSGNAME(*this));"
     echo "}"
     echo
-    echo "void msg::$MSGNAME::dispatch(MessageHandler& handler)"
+    echo "void msg::$MSGNAME::dispatch(MessageHandler& handler) const"
     echo "{"
     echo -n "    handler.handle$MSGNAME("
     echo -e "$ARGS" | while read ARG; do
@@ -182,11 +351,69 @@ while read MSG <&3; do
     echo ");"
     echo "}"
     echo
-    echo "bool msg::$MSGNAME::matches(int subscription)"
+    echo "bool msg::$MSGNAME::matches(int subscription) const"
     echo "{"
     echo "    return ((subscription & MSG_$MSGTYPE) != 0);"
     echo "}"
     echo
+    echo "int msg::$MSGNAME::type() const"
+    echo "{"
+    echo "    return MSG_$MSGTYPE;"
+    echo "}"
+    echo
+    echo "msg::MsgId msg::$MSGNAME::id() const"
+    echo "{"
+    echo "    return ID_$MSGID;"
+    echo "}"
+    echo
+    echo "void msg::$MSGNAME::encode(Writer& writer) const"
+    echo "{"
+    echo -e "$ARGS" | while read ARG; do
+        echo $ARG | sed 's/^\(.*\) \(.*\)$/    writer.write(_\2);/'
+    done
+    echo "}"
+    echo
+    echo "bool msg::$MSGNAME::keyed() const"
+    echo "{"
+    if [ -n "$ROUTE" ]; then
+        echo "    return true;"
+    else
+        echo "    return false;"
+    fi
+    echo "}"
+    echo
+    echo "uint64_t msg::$MSGNAME::key() const"
+    echo "{"
+    if [ -n "$ROUTE" ]; then
+        echo "    return _$ROUTE;"
+    else
+        echo "    return 0;"
+    fi
+    echo "}"
+    echo
+    echo "bool msg::$MSGNAME::coalesces() const"
+    echo "{"
+    if [ -n "$STATE" ]; then
+        echo "    return true;"
+    else
+        echo "    return false;"
+    fi
+    echo "}"
+    echo
+    echo "uint64_t msg::$MSGNAME::stateKey() const"
+    echo "{"
+    if [ -n "$STATE" ]; then
+        echo "    return _$STATE;"
+    else
+        echo "    return 0;"
+    fi
+    echo "}"
+    echo
+    echo -e "$ARGS" |
+    while read ARG; do
+        echo $ARG |
+        sed 's/^\(const \)\{0,1\}\(.*\) \(.*\)$/const \2\& msg::'$MSGNAME'::\3() const\n{\n    return _\3;\n}\n/'
+    done
     echo
 
     # Handler header.
@@ -202,6 +429,263 @@ while read MSG <&3; do
     echo
 done
 
+# Batch header.
+exec 1>&4
+echo "class Batch : public Message {"
+echo "    public:"
+echo "        Batch();"
+echo "        virtual ~Batch();"
+echo "        virtual std::unique_ptr<Message> clone() const;"
+echo "        virtual void dispatch(MessageHandler& handler) const;"
+echo "        virtual bool matches(int subscription) const;"
+echo "        virtual int type() const;"
+echo "        virtual MsgId id() const;"
+echo "        virtual void encode(Writer& writer) const;"
+echo "        virtual bool keyed() const;"
+echo "        virtual uint64_t key() const;"
+echo "        virtual bool coalesces() const;"
+echo "        virtual uint64_t stateKey() const;"
+echo
+echo "        static std::unique_ptr<Batch> decode(Reader& reader);"
+echo
+echo "        void add(const Message& msg);"
+echo -ne "$BATCHDECLS"
+echo
+echo "        void clear();"
+echo "        bool empty() const;"
+echo "        size_t count() const;"
+echo "        void split(std::vector<std::unique_ptr<Message> >& records) const;"
+echo
+echo "    private:"
+echo "        static int typeOf(MsgId id);"
+echo
+echo "        size_t begin(MsgId id, int type, bool state);"
+echo "        void end(size_t start);"
+echo
+echo "        Buffer _buffer;"
+echo "        int _types;"
+echo "        size_t _count;"
+echo "        size_t _states;"
+echo "};"
+echo
+echo
+echo "std::unique_ptr<Message> decode(MsgId id, Reader& reader);"
+echo
+echo
+
+# Batch source.
+exec 1>&5
+echo "////////// msg::Batch //////////"
+echo
+echo "msg::Batch::Batch() :"
+echo "    _types(0), _count(0), _states(0)"
+echo "{"
+echo
+echo "}"
+echo
+echo "msg::Batch::~Batch()"
+echo "{"
+echo
+echo "}"
+echo
+echo "std::unique_ptr<msg::Message> msg::Batch::clone() const"
+echo "{"
+echo "    return std::unique_ptr<Message>(new Batch(*this));"
+echo "}"
+echo
+echo "void msg::Batch::dispatch(MessageHandler& handler) const"
+echo "{"
+echo "    // The buffer is only written by this class so it need not be checked."
+echo "    Reader reader(_buffer.data(), _buffer.size(), true);"
+echo
+echo "    while (!reader.done()) {"
+echo "        uint32_t id = reader.read<uint32_t>();"
+echo "        uint32_t size = reader.read<uint32_t>();"
+echo
+echo "        switch (id) {"
+echo -ne "$BATCHCASES"
+echo "            default:"
+echo "                reader.skip(size);"
+echo "                break;"
+echo "        }"
+echo "    }"
+echo "}"
+echo
+echo "bool msg::Batch::matches(int subscription) const"
+echo "{"
+echo "    return ((subscription & _types) != 0);"
+echo "}"
+echo
+echo "int msg::Batch::type() const"
+echo "{"
+echo "    return _types;"
+echo "}"
+echo
+echo "msg::MsgId msg::Batch::id() const"
+echo "{"
+echo "    return ID_BATCH;"
+echo "}"
+echo
+echo "void msg::Batch::encode(Writer& writer) const"
+echo "{"
+echo "    writer.write(_buffer);"
+echo "}"
+echo
+echo "bool msg::Batch::keyed() const"
+echo "{"
+echo "    return false;"
+echo "}"
+echo
+echo "uint64_t msg::Batch::key() const"
+echo "{"
+echo "    return 0;"
+echo "}"
+echo
+echo "bool msg::Batch::coalesces() const"
+echo "{"
+echo "    return ((_count != 0) && (_states == _count));"
+echo "}"
+echo
+echo "uint64_t msg::Batch::stateKey() const"
+echo "{"
+echo "    return 0;"
+echo "}"
+echo
+echo "std::unique_ptr<msg::Batch> msg::Batch::decode(Reader& reader)"
+echo "{"
+echo "    std::unique_ptr<Batch> batch(new Batch());"
+echo "    batch->_buffer = reader.read<Buffer>();"
+echo
+echo "    // The buffer came from outside so each record is decoded to check it."
+echo "    Reader records(batch->_buffer.data(), batch->_buffer.size());"
+echo
+echo "    while (!records.done()) {"
+echo "        MsgId id = MsgId(records.read<uint32_t>());"
+echo "        uint32_t size = records.read<uint32_t>();"
+echo "        int type = typeOf(id);"
+echo
+echo "        if (type == 0)"
+echo "            throw InputException(\"msg::Batch: record has no type\");"
+echo
+echo "        Reader record = records.record(size);"
+echo "        bool state = msg::decode(id, record)->coalesces();"
+echo
+echo "        if (!record.done())"
+echo "            throw InputException(\"msg::Batch: record is too long\");"
+echo
+echo "        batch->_types |= type;"
+echo "        batch->_count++;"
+echo "        batch->_states += (state ? 1 : 0);"
+echo "    }"
+echo
+echo "    return batch;"
+echo "}"
+echo
+echo "void msg::Batch::add(const Message& msg)"
+echo "{"
+echo "    if (msg.id() == ID_BATCH) {"
+echo "        const Batch& batch = static_cast<const Batch&>(msg);"
+echo "        _buffer.append(batch._buffer.data(), batch._buffer.size());"
+echo "        _types |= batch._types;"
+echo "        _count += batch._count;"
+echo "        _states += batch._states;"
+echo "        return;"
+echo "    }"
+echo
+echo "    size_t start = begin(msg.id(), typeOf(msg.id()), msg.coalesces());"
+echo "    Writer writer(_buffer);"
+echo "    msg.encode(writer);"
+echo "    end(start);"
+echo "}"
+echo
+echo -ne "$BATCHADDS"
+echo "void msg::Batch::clear()"
+echo "{"
+echo "    _buffer.clear();"
+echo "    _types = 0;"
+echo "    _count = 0;"
+echo "    _states = 0;"
+echo "}"
+echo
+echo "bool msg::Batch::empty() const"
+echo "{"
+echo "    return (_count == 0);"
+echo "}"
+echo
+echo "size_t msg::Batch::count() const"
+echo "{"
+echo "    return _count;"
+echo "}"
+echo
+echo "void msg::Batch::split(std::vector<std::unique_ptr<Message> >& records) const"
+echo "{"
+echo "    // The buffer is only written by this class so it need not be checked."
+echo "    Reader reader(_buffer.data(), _buffer.size(), true);"
+echo
+echo "    while (!reader.done()) {"
+echo "        MsgId id = MsgId(reader.read<uint32_t>());"
+echo "        Reader record = reader.record(reader.read<uint32_t>());"
+echo "        records.push_back(msg::decode(id, record));"
+echo "    }"
+echo "}"
+echo
+echo "int msg::Batch::typeOf(MsgId id)"
+echo "{"
+echo "    switch (id) {"
+echo -ne "$BATCHTYPES"
+echo "        default:"
+echo "            return 0;"
+echo "    }"
+echo "}"
+echo
+echo "size_t msg::Batch::begin(MsgId id, int type, bool state)"
+echo "{"
+echo "    size_t start = _buffer.size();"
+echo "    Writer writer(_buffer);"
+echo "    writer.write(uint32_t(id));"
+echo "    writer.write(uint32_t(0));"
+echo
+echo "    _types |= type;"
+echo "    _count++;"
+echo "    _states += (state ? 1 : 0);"
+echo
+echo "    return start;"
+echo "}"
+echo
+echo "void msg::Batch::end(size_t start)"
+echo "{"
+echo "    uint32_t size = _buffer.size() - start - 2 * sizeof(uint32_t);"
+echo "    memcpy(_buffer.data() + start + sizeof(uint32_t), &size, sizeof(size));"
+echo "}"
+echo
+
+echo "////////// msg //////////"
+echo
+echo "const char* msg::idName(MsgId id)"
+echo "{"
+echo "    switch (id) {"
+echo "        case ID_BATCH:"
+echo "            return \"Batch\";"
+echo "        case ID_LATEST:"
+echo "            return \"Latest\";"
+echo -ne "$IDNAMES"
+echo "        default:"
+echo "            return \"Unknown\";"
+echo "    }"
+echo "}"
+echo
+echo "std::unique_ptr<msg::Message> msg::decode(MsgId id, Reader& reader)"
+echo "{"
+echo "    switch (id) {"
+echo "        case ID_BATCH:"
+echo "            return Batch::decode(reader);"
+echo -ne "$DECODECASES"
+echo "        default:"
+echo "            throw InputException(\"msg::decode: unknown message id\");"
+echo "    }"
+echo "}"
+echo
+
 # Close message header.
 exec 1>&4 4>&-
 echo "}  // namespace msg"